@@ -8,6 +8,8 @@
 #include "cpu.h"
 #include "kernel/loader.h"
 #include "kernel/svc_types.h"
+#include "perfmap.h"
+#include "profiler.h"
 
 bool e3ds_init(E3DS* s, char* romfile) {
     memset(s, 0, sizeof *s);
@@ -22,8 +24,9 @@ bool e3ds_init(E3DS* s, char* romfile) {
 
     u32 entrypoint = 0;
 
-    char* ext = strrchr(romfile, '.');
-    if (!ext) {
+    char ext[8];
+    romfile_ext(romfile, ext);
+    if (!*ext) {
         lerror("unsupported file format");
         e3ds_destroy(s);
         return false;
@@ -79,7 +82,12 @@ bool e3ds_init(E3DS* s, char* romfile) {
 }
 
 void e3ds_destroy(E3DS* s) {
+    savestate_destroy(s);
+    rewind_reset(s);
+    profiler_stop(s);
+    profiler_clear();
     cpu_free(s);
+    perfmap_clear_modules();
 
     gpu_destroy(&s->gpu);
 
@@ -92,7 +100,7 @@ void e3ds_destroy(E3DS* s) {
 
     fs_close_all_files(s);
 
-    if (s->romimage.fp) fclose(s->romimage.fp);
+    romfile_close(&s->romimage.file);
 
     memory_destroy(s);
 }
@@ -121,6 +129,7 @@ void e3ds_run_frame(E3DS* s) {
     while (!s->frame_complete) {
         e3ds_restore_context(s);
         if (!s->cpu.halt) {
+            g_profiler.where = PROF_CPU;
             while (true) {
                 s64 cycles =
                     FIFO_peek(s->sched.event_queue).time - s->sched.now;
@@ -129,6 +138,7 @@ void e3ds_run_frame(E3DS* s) {
                 if (s->cpu.halt) break;
             }
         }
+        g_profiler.where = PROF_HLE;
         e3ds_save_context(s);
         run_next_event(&s->sched);
         run_to_present(&s->sched);
@@ -138,5 +148,8 @@ void e3ds_run_frame(E3DS* s) {
         e3ds_update_datetime(s);
     }
     s->frame_complete = false;
+    g_profiler.where = PROF_NONE;
+
+    rewind_frame(s);
 }
 
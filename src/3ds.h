@@ -9,6 +9,8 @@
 #include "kernel/memory.h"
 #include "kernel/process.h"
 #include "kernel/thread.h"
+#include "rewind.h"
+#include "savestate.h"
 #include "scheduler.h"
 #include "services/services.h"
 #include "services/srv.h"
@@ -35,16 +37,20 @@ typedef struct _3DS {
     DSP dsp;
 
     E3DSMemory* mem;
+    MemDirty dirty;
 
 #ifdef FASTMEM
     int mem_fd;
     u8* physmem;
     u8* virtmem;
+#else
+    SWTLBEntry tlb[SWTLB_SIZE];
 #endif
 
     FreeListNode freelist;
+    NodePool freelistpool;
 
-    KThread readylist;
+    ReadyQueue ready;
 
     KProcess process;
 
@@ -56,6 +62,9 @@ typedef struct _3DS {
     bool frame_complete;
 
     Scheduler sched;
+
+    SaveStates states;
+    Rewind rewind;
 } E3DS;
 
 bool e3ds_init(E3DS* s, char* romfile);
@@ -65,4 +74,12 @@ void e3ds_update_datetime(E3DS* s);
 
 void e3ds_run_frame(E3DS* s);
 
+#ifndef FASTMEM
+static inline void* sw_vptr(E3DS* s, u32 addr) {
+    auto e = &s->tlb[(addr >> 12) % SWTLB_SIZE];
+    if (e->tag == addr >> 12) return (void*) (e->base + addr);
+    return sw_vptr_slow(s, addr);
+}
+#endif
+
 #endif
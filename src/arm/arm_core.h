@@ -28,6 +28,17 @@ typedef enum {
 } CpuException;
 
 typedef struct _ArmCore ArmCore;
+
+// direct mapped software tlb for when fastmem is not available
+// an entry maps the virtual page in tag to base, so base + addr is the host
+// address of addr
+#define SWTLB_BITS 12
+#define SWTLB_SIZE BIT(SWTLB_BITS)
+
+typedef struct {
+    u32 tag;
+    uintptr_t base;
+} SWTLBEntry;
 typedef struct _JITBlock JITBlock;
 
 typedef struct _ArmCore {
@@ -104,6 +115,7 @@ typedef struct _ArmCore {
     void (*cp15_write)(ArmCore* cpu, ArmInstr instr, u32 data);
 
     void* fastmem;
+    SWTLBEntry* tlb;
 
     JITBlock*** jit_cache[64];
 
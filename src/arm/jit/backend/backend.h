@@ -1,11 +1,23 @@
 #ifndef BACKEND_H
 #define BACKEND_H
 
-#ifdef __x86_64__
+#ifdef NOJIT
+#include "backend_interp.h"
+#define backend_generate_code(ir, regalloc, cpu)                               \
+    backend_interp_generate_code(ir, regalloc, cpu)
+#define backend_get_code(backend) ((JITFunc) nullptr)
+#define backend_get_code_size(backend) backend_interp_get_code_size(backend)
+#define backend_exec(block) backend_interp_exec((block)->backend)
+#define backend_patch_links(block) backend_interp_patch_links(block)
+#define backend_free(backend) backend_interp_free(backend)
+#define backend_disassemble(backend) backend_interp_disassemble(backend)
+#elifdef __x86_64__
 #include "backend_x86.h"
 #define backend_generate_code(ir, regalloc, cpu)                               \
     backend_x86_generate_code(ir, regalloc, cpu)
 #define backend_get_code(backend) backend_x86_get_code(backend)
+#define backend_get_code_size(backend) backend_x86_get_code_size(backend)
+#define backend_exec(block) (block)->code()
 #define backend_patch_links(block) backend_x86_patch_links(block)
 #define backend_free(backend) backend_x86_free(backend)
 #define backend_disassemble(backend) backend_x86_disassemble(backend)
@@ -14,6 +26,8 @@
 #define backend_generate_code(ir, regalloc, cpu)                               \
     backend_arm_generate_code(ir, regalloc, cpu)
 #define backend_get_code(backend) backend_arm_get_code(backend)
+#define backend_get_code_size(backend) backend_arm_get_code_size(backend)
+#define backend_exec(block) (block)->code()
 #define backend_patch_links(block) backend_arm_patch_links(block)
 #define backend_free(backend) backend_arm_free(backend)
 #define backend_disassemble(backend) backend_arm_disassemble(backend)
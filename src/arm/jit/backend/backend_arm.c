@@ -1,4 +1,4 @@
-#ifdef __aarch64__
+#if defined(__aarch64__) && !defined(NOJIT)
 
 #include "backend_arm.h"
 
@@ -6,8 +6,6 @@
 #include <capstone/capstone.h>
 #endif
 
-#include "arm/media.h"
-
 #define RAS_DEFAULT_SUFFIX W
 #define RAS_CTX_VAR backend->code
 #include <ras/ras_a64.h>
@@ -16,10 +14,14 @@
 #define TEMPREGS_COUNT 13
 #define SAVEDREGS_BASE 19
 #define SAVEDREGS_COUNT 10
+// v0-v2 are scratch, v8-v15 are callee saved
+#define FLOATREGS_BASE 16
+#define FLOATREGS_COUNT 16
 
 // returns:
 // 0-31 : reg index
 // 32+n : stack index
+// 64+n : simd reg index
 static int getOpForReg(HostRegAllocation* hralloc, int i) {
     HostRegInfo hr = hralloc->hostreg_info[i];
     switch (hr.type) {
@@ -29,6 +31,8 @@ static int getOpForReg(HostRegAllocation* hralloc, int i) {
             return SAVEDREGS_BASE + hr.index;
         case REG_STACK:
             return 32 + hr.index;
+        case REG_FLOAT:
+            return 64 + FLOATREGS_BASE + hr.index;
         default:
             unreachable();
     }
@@ -40,7 +44,9 @@ static void print_hostregs(HostRegAllocation* hralloc) {
     for (u32 i = 0; i < hralloc->nregs; i++) {
         printf(" $%d:", i);
         int operand = getOpForReg(hralloc, i);
-        if (operand >= 32) {
+        if (operand >= 64) {
+            printf("s%d", operand - 64);
+        } else if (operand >= 32) {
             operand -= 32;
             printf("[sp, #0x%x]", 4 * operand);
         } else {
@@ -110,12 +116,70 @@ static void compileVFPWrite64(ArmCodeBackend* backend, ArmInstr instr,
 #define STOREDST()                                                             \
     ({                                                                         \
         int op = GETOP(i);                                                     \
-        if (op >= 32) {                                                        \
+        if (op >= 32 && op < 64) {                                             \
             op -= 32;                                                          \
             STR(IP0, (SP, 4 * op));                                            \
         }                                                                      \
     })
 
+// float values are kept in simd registers unless they had to go to the stack
+#define LOADFOP(i, flbk)                                                       \
+    ({                                                                         \
+        auto dst = flbk;                                                       \
+        if (inst.imm##i) {                                                     \
+            MOV(IP0, inst.op##i);                                              \
+            FMOVW(dst, IP0);                                                   \
+        } else {                                                               \
+            int op = GETOP(inst.op##i);                                        \
+            if (op >= 64) {                                                    \
+                dst = V(op - 64);                                              \
+            } else if (op >= 32) {                                             \
+                op -= 32;                                                      \
+                LDRS(dst, (SP, 4 * op));                                       \
+            } else {                                                           \
+                FMOVW(dst, R(op));                                             \
+            }                                                                  \
+        }                                                                      \
+        dst;                                                                   \
+    })
+#define LOADFOP1() LOADFOP(1, V0)
+#define LOADFOP2() LOADFOP(2, V1)
+
+// the register the result is computed in, v0 if it goes elsewhere
+#define DSTFREG()                                                              \
+    ({                                                                         \
+        int op = GETOP(i);                                                     \
+        (op >= 64) ? V(op - 64) : V0;                                          \
+    })
+#define STOREFDST()                                                            \
+    ({                                                                         \
+        if (GETOP(i) < 64) FMOVW(DSTREG(), V0);                                \
+    })
+
+// the inline lookup has never been run on an arm64 host, so it stays off
+// until it has and every access takes the callback, which still checks the
+// tlb in sw_vptr, build with ARM_INLINE_TLB to try it
+#ifdef ARM_INLINE_TLB
+#define INLINE_TLB(cpu) ((cpu)->tlb != nullptr)
+#else
+#define INLINE_TLB(cpu) false
+#endif
+
+// looks up the address in R1 in the software tlb, on a hit R0 + R1 is the
+// host address, otherwise it jumps to miss
+// the memory ops are callbacks so the scratch registers are free to use
+static void compileTLBLookup(ArmCodeBackend* backend, rasLabel miss) {
+    static_assert(sizeof(SWTLBEntry) == 16);
+    LSR(IP0, R1, 12);
+    UBFX(IP1, R1, 12, SWTLB_BITS);
+    LDRX(R0, CPU(tlb));
+    ADDX(R0, R0, IP1, LSL(4));
+    LDR(IP1, (R0, offsetof(SWTLBEntry, tag)));
+    CMP(IP1, IP0);
+    BNE(miss);
+    LDRX(R0, (R0, offsetof(SWTLBEntry, base)));
+}
+
 ArmCodeBackend* backend_arm_generate_code(IRBlock* ir, RegAllocation* regalloc,
                                           ArmCore* cpu) {
     ArmCodeBackend* backend = calloc(1, sizeof *backend);
@@ -124,7 +188,8 @@ ArmCodeBackend* backend_arm_generate_code(IRBlock* ir, RegAllocation* regalloc,
     backend->regalloc = regalloc;
 
     backend->hralloc =
-        allocate_host_registers(regalloc, TEMPREGS_COUNT, SAVEDREGS_COUNT);
+        allocate_host_registers(regalloc, TEMPREGS_COUNT, SAVEDREGS_COUNT,
+                                FLOATREGS_COUNT);
 
     u32 flags_mask = 0; // mask for which flags to store
     u32 lastflags = 0;  // last var for which flags were set
@@ -255,6 +320,39 @@ ArmCodeBackend* backend_arm_generate_code(IRBlock* ir, RegAllocation* regalloc,
                 STR(R0, CPU(cpsr));
                 break;
             }
+            case IR_LOAD_GE: {
+                auto dst = DSTREG();
+                LDR(dst, CPU(cpsr));
+                UBFX(dst, dst, 16, 4);
+                break;
+            }
+            case IR_STORE_GE: {
+                auto src = LOADOP2();
+                LDR(R0, CPU(cpsr));
+                BFI(R0, src, 16, 4);
+                STR(R0, CPU(cpsr));
+                break;
+            }
+            case IR_LOAD_VFP: {
+                if (GETOP(i) >= 64) {
+                    auto dst = DSTFREG();
+                    LDRS(dst, CPU(s[inst.op1]));
+                } else {
+                    auto dst = DSTREG();
+                    LDR(dst, CPU(s[inst.op1]));
+                }
+                break;
+            }
+            case IR_STORE_VFP: {
+                if (!inst.imm2 && GETOP(inst.op2) >= 64) {
+                    auto src = LOADFOP2();
+                    STRS(src, CPU(s[inst.op1]));
+                } else {
+                    auto src = LOADOP2();
+                    STR(src, CPU(s[inst.op1]));
+                }
+                break;
+            }
             case IR_VFP_DATA_PROC: {
                 lastflags = 0;
                 compileVFPDataProc(backend, (ArmInstr) {inst.op1});
@@ -322,75 +420,147 @@ ArmCodeBackend* backend_arm_generate_code(IRBlock* ir, RegAllocation* regalloc,
             }
             case IR_LOAD_MEM8: {
                 auto dst = DSTREG();
-                MOVX(R0, R29);
                 MOVOP1(R1);
+                LABEL(miss);
+                LABEL(done);
+                if (INLINE_TLB(cpu)) {
+                    compileTLBLookup(backend, miss);
+                    LDRB(dst, (R0, R1, UXTW()));
+                    B(done);
+                }
+                L(miss);
+                MOVX(R0, R29);
                 MOV(R2, 0);
                 LDRLX(IP0, lld8);
                 BLR(IP0);
                 MOV(dst, R0);
+                L(done);
                 break;
             }
             case IR_LOAD_MEMS8: {
                 auto dst = DSTREG();
-                MOVX(R0, R29);
                 MOVOP1(R1);
+                LABEL(miss);
+                LABEL(done);
+                if (INLINE_TLB(cpu)) {
+                    compileTLBLookup(backend, miss);
+                    LDRSBW(dst, (R0, R1, UXTW()));
+                    B(done);
+                }
+                L(miss);
+                MOVX(R0, R29);
                 MOV(R2, 1);
                 LDRLX(IP0, lld8);
                 BLR(IP0);
                 MOV(dst, R0);
+                L(done);
                 break;
             }
             case IR_LOAD_MEM16: {
                 auto dst = DSTREG();
-                MOVX(R0, R29);
                 MOVOP1(R1);
+                LABEL(miss);
+                LABEL(done);
+                if (INLINE_TLB(cpu)) {
+                    compileTLBLookup(backend, miss);
+                    LDRH(dst, (R0, R1, UXTW()));
+                    B(done);
+                }
+                L(miss);
+                MOVX(R0, R29);
                 MOV(R2, 0);
                 LDRLX(IP0, lld16);
                 BLR(IP0);
                 MOV(dst, R0);
+                L(done);
                 break;
             }
             case IR_LOAD_MEMS16: {
                 auto dst = DSTREG();
-                MOVX(R0, R29);
                 MOVOP1(R1);
+                LABEL(miss);
+                LABEL(done);
+                if (INLINE_TLB(cpu)) {
+                    compileTLBLookup(backend, miss);
+                    LDRSHW(dst, (R0, R1, UXTW()));
+                    B(done);
+                }
+                L(miss);
+                MOVX(R0, R29);
                 MOV(R2, 1);
                 LDRLX(IP0, lld16);
                 BLR(IP0);
                 MOV(dst, R0);
+                L(done);
                 break;
             }
             case IR_LOAD_MEM32: {
                 auto dst = DSTREG();
-                MOVX(R0, R29);
                 MOVOP1(R1);
+                LABEL(miss);
+                LABEL(done);
+                if (INLINE_TLB(cpu)) {
+                    compileTLBLookup(backend, miss);
+                    LDR(dst, (R0, R1, UXTW()));
+                    B(done);
+                }
+                L(miss);
+                MOVX(R0, R29);
                 LDRLX(IP0, lld32);
                 BLR(IP0);
                 MOV(dst, R0);
+                L(done);
                 break;
             }
             case IR_STORE_MEM8: {
-                MOVX(R0, R29);
                 MOVOP1(R1);
                 MOVOP2(R2);
+                LABEL(miss);
+                LABEL(done);
+                if (INLINE_TLB(cpu)) {
+                    compileTLBLookup(backend, miss);
+                    STRB(R2, (R0, R1, UXTW()));
+                    B(done);
+                }
+                L(miss);
+                MOVX(R0, R29);
                 LDRLX(IP0, lst8);
                 BLR(IP0);
+                L(done);
                 break;
             }
             case IR_STORE_MEM16: {
-                MOVX(R0, R29);
                 MOVOP1(R1);
                 MOVOP2(R2);
+                LABEL(miss);
+                LABEL(done);
+                if (INLINE_TLB(cpu)) {
+                    compileTLBLookup(backend, miss);
+                    STRH(R2, (R0, R1, UXTW()));
+                    B(done);
+                }
+                L(miss);
+                MOVX(R0, R29);
                 LDRLX(IP0, lst16);
                 BLR(IP0);
+                L(done);
                 break;
             }
             case IR_STORE_MEM32: {
-                MOVX(R0, R29);
                 MOVOP1(R1);
                 MOVOP2(R2);
+                LABEL(miss);
+                LABEL(done);
+                if (INLINE_TLB(cpu)) {
+                    compileTLBLookup(backend, miss);
+                    STR(R2, (R0, R1, UXTW()));
+                    B(done);
+                }
+                L(miss);
+                MOVX(R0, R29);
                 LDRLX(IP0, lst32);
                 BLR(IP0);
+                L(done);
                 break;
             }
             case IR_MOV: {
@@ -603,6 +773,49 @@ ArmCodeBackend* backend_arm_generate_code(IRBlock* ir, RegAllocation* regalloc,
                 }
                 break;
             }
+            case IR_FADD:
+            case IR_FSUB:
+            case IR_FMUL:
+            case IR_FDIV: {
+                auto src1 = LOADFOP1();
+                auto src2 = LOADFOP2();
+                auto dst = DSTFREG();
+                switch (inst.opcode) {
+                    case IR_FADD:
+                        FADDS(dst, src1, src2);
+                        break;
+                    case IR_FSUB:
+                        FSUBS(dst, src1, src2);
+                        break;
+                    case IR_FMUL:
+                        FMULS(dst, src1, src2);
+                        break;
+                    default:
+                        FDIVS(dst, src1, src2);
+                        break;
+                }
+                STOREFDST();
+                break;
+            }
+            case IR_FSQRT:
+            case IR_FNEG:
+            case IR_FABS: {
+                auto src = LOADFOP2();
+                auto dst = DSTFREG();
+                switch (inst.opcode) {
+                    case IR_FSQRT:
+                        FSQRTS(dst, src);
+                        break;
+                    case IR_FNEG:
+                        FNEGS(dst, src);
+                        break;
+                    default:
+                        FABSS(dst, src);
+                        break;
+                }
+                STOREFDST();
+                break;
+            }
             case IR_SMULH: {
                 auto src1 = LOADOP1();
                 auto src2 = LOADOP2();
@@ -667,23 +880,23 @@ ArmCodeBackend* backend_arm_generate_code(IRBlock* ir, RegAllocation* regalloc,
                 break;
             }
             case IR_MEDIA_UADD8: {
+                auto src1 = LOADOP1();
+                auto src2 = LOADOP2();
                 auto dst = DSTREG();
-                MOVX(R0, R29);
-                MOVOP1(R1);
-                MOVOP2(R2);
-                MOVX(IP0, (uintptr_t) media_uadd8);
-                BLR(IP0);
-                MOV(dst, R0);
+                MOVS(V0, 0, src1);
+                MOVS(V1, 0, src2);
+                ADD8B(V0, V0, V1);
+                MOVS(dst, V0, 0);
                 break;
             }
             case IR_MEDIA_USUB8: {
+                auto src1 = LOADOP1();
+                auto src2 = LOADOP2();
                 auto dst = DSTREG();
-                MOVX(R0, R29);
-                MOVOP1(R1);
-                MOVOP2(R2);
-                MOVX(IP0, (uintptr_t) media_usub8);
-                BLR(IP0);
-                MOV(dst, R0);
+                MOVS(V0, 0, src1);
+                MOVS(V1, 0, src2);
+                SUB8B(V0, V0, V1);
+                MOVS(dst, V0, 0);
                 break;
             }
             case IR_MEDIA_UQADD8: {
@@ -716,16 +929,6 @@ ArmCodeBackend* backend_arm_generate_code(IRBlock* ir, RegAllocation* regalloc,
                 MOVS(dst, V0, 0);
                 break;
             }
-            case IR_MEDIA_SSUB8: {
-                auto dst = DSTREG();
-                MOVX(R0, R29);
-                MOVOP1(R1);
-                MOVOP2(R2);
-                MOVX(IP0, (uintptr_t) media_ssub8);
-                BLR(IP0);
-                MOV(dst, R0);
-                break;
-            }
             case IR_MEDIA_QSUB8: {
                 auto src1 = LOADOP1();
                 auto src2 = LOADOP2();
@@ -736,14 +939,29 @@ ArmCodeBackend* backend_arm_generate_code(IRBlock* ir, RegAllocation* regalloc,
                 MOVS(dst, V0, 0);
                 break;
             }
-            case IR_MEDIA_SEL: {
+            case IR_MEDIA_GE_UADD8:
+            case IR_MEDIA_GE_USUB8:
+            case IR_MEDIA_GE_SSUB8: {
+                auto src1 = LOADOP1();
+                auto src2 = LOADOP2();
                 auto dst = DSTREG();
-                MOVX(R0, R29);
-                MOVOP1(R1);
-                MOVOP2(R2);
-                MOVX(IP0, (uintptr_t) media_sel);
-                BLR(IP0);
-                MOV(dst, R0);
+                MOVS(V0, 0, src1);
+                MOVS(V1, 0, src2);
+                if (inst.opcode == IR_MEDIA_GE_UADD8) {
+                    // there was a carry if the sum is less than an operand
+                    ADD8B(V2, V0, V1);
+                    CMHI8B(V2, V0, V2);
+                } else if (inst.opcode == IR_MEDIA_GE_USUB8) {
+                    CMHS8B(V2, V0, V1);
+                } else {
+                    CMGE8B(V2, V0, V1);
+                }
+                // gather the top bit of each byte of the mask
+                MOVS(R0, V2, 0);
+                AND(R0, R0, 0x08040201, R1);
+                MOV(R1, 0x01010101);
+                MUL(R0, R0, R1);
+                LSR(dst, R0, 24);
                 break;
             }
             case IR_GETN: {
@@ -852,9 +1070,8 @@ ArmCodeBackend* backend_arm_generate_code(IRBlock* ir, RegAllocation* regalloc,
                 }
                 break;
             }
-            case IR_HALT: {
-                MOV(R0, 1);
-                STRB(R0, CPU(halt));
+            case IR_IDLE: {
+                STRX(ZR, CPU(cycles));
                 break;
             }
             case IR_BEGIN: {
@@ -869,6 +1086,13 @@ ArmCodeBackend* backend_arm_generate_code(IRBlock* ir, RegAllocation* regalloc,
                 MOVX(R29, (uintptr_t) cpu);
                 L(looplabel);
 
+                if (ir->counters) {
+                    MOVX(R0, (uintptr_t) ir->counters);
+                    LDRX(R1, (R0, offsetof(IRBlockCounters, execs)));
+                    ADDX(R1, R1, 1);
+                    STRX(R1, (R0, offsetof(IRBlockCounters, execs)));
+                }
+
                 break;
             }
             case IR_END_RET:
@@ -876,6 +1100,13 @@ ArmCodeBackend* backend_arm_generate_code(IRBlock* ir, RegAllocation* regalloc,
             case IR_END_LOOP: {
                 lastflags = 0;
 
+                if (ir->counters) {
+                    MOVX(R0, (uintptr_t) ir->counters);
+                    LDRX(R1, (R0, offsetof(IRBlockCounters, cycles)));
+                    ADDX(R1, R1, inst.cycles);
+                    STRX(R1, (R0, offsetof(IRBlockCounters, cycles)));
+                }
+
                 LDRX(R0, CPU(cycles));
                 SUBX(R0, R0, inst.cycles);
                 STRX(R0, CPU(cycles));
@@ -1249,6 +1480,10 @@ JITFunc backend_arm_get_code(ArmCodeBackend* backend) {
     return rasGetCode(backend->code);
 }
 
+size_t backend_arm_get_code_size(ArmCodeBackend* backend) {
+    return rasGetSize(backend->code);
+}
+
 void backend_arm_patch_links(JITBlock* block) {
     ArmCodeBackend* backend = block->backend;
     for (int i = 0; i < backend->links.size; i++) {
@@ -1259,6 +1494,7 @@ void backend_arm_patch_links(JITBlock* block) {
         Vec_push(linkblock->linkingblocks,
                  ((BlockLocation) {block->attrs, block->start_addr}));
     }
+    g_jit_stats.links_patched += backend->links.size;
     rasReady(backend->code);
     Vec_free(backend->links);
 }
@@ -25,6 +25,7 @@ typedef struct {
 ArmCodeBackend* backend_arm_generate_code(IRBlock* ir, RegAllocation* regalloc,
                                           ArmCore* cpu);
 JITFunc backend_arm_get_code(ArmCodeBackend* backend);
+size_t backend_arm_get_code_size(ArmCodeBackend* backend);
 void backend_arm_patch_links(JITBlock* block);
 void backend_arm_free(ArmCodeBackend* backend);
 void backend_arm_disassemble(ArmCodeBackend* backend);
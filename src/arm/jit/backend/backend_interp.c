@@ -0,0 +1,726 @@
+#ifdef NOJIT
+
+#include "backend_interp.h"
+
+#include <math.h>
+#include <string.h>
+
+#include "arm/media.h"
+#include "arm/vfp.h"
+
+// ops which don't exist in the ir
+enum {
+    // add/sub which also compute the carry and overflow, chosen when decoding
+    // instead of checking the following instructions every time
+    INTERP_ADD_CV = IR_PCMASK + 1,
+    INTERP_SUB_CV,
+    INTERP_ADC_CV,
+    INTERP_SBC_CV,
+
+    // superinstructions for the most common pairs
+    INTERP_JFLAGZ,  // LOAD_FLAG + JZ, these are most conditional instructions
+    INTERP_JFLAGNZ, // LOAD_FLAG + JNZ
+    INTERP_STORE_N, // GETN + STORE_FLAG, after every flag setting instruction
+    INTERP_STORE_Z, // GETZ + STORE_FLAG
+    INTERP_STORE_C, // GETC + STORE_FLAG
+    INTERP_STORE_V, // GETV + STORE_FLAG
+
+    INTERP_MAX
+};
+
+#define S(n) s[op->n]
+#define NEXT goto* (++op)->handler
+#define DISPATCH() goto* op->handler
+#define JUMP(target) goto* (op = &code->ops.d[target])->handler
+
+#ifdef JIT_FASTMEM
+#define VMEM(T, addr) (*(T*) ((u8*) cpu->fastmem + (addr)))
+#else
+// software tlb lookup, misses go through the callbacks
+#define TLBENT(addr) (&cpu->tlb[((addr) >> 12) % SWTLB_SIZE])
+#define TLBHIT(addr) (cpu->tlb && TLBENT(addr)->tag == (addr) >> 12)
+#define TLBPTR(addr) ((void*) (TLBENT(addr)->base + (addr)))
+#endif
+
+#define ADDCV(x, y, c)                                                         \
+    ({                                                                         \
+        u32 op1 = x, op2 = y;                                                  \
+        u32 res = op1 + op2;                                                   \
+        u32 tmpc = res < op1;                                                  \
+        res += c;                                                              \
+        cf = tmpc || res < op1 + op2;                                          \
+        vf = ((op1 ^ res) & ~(op1 ^ op2)) >> 31;                               \
+        res;                                                                   \
+    })
+
+#define H(name) [IR_##name] = &&h_##name
+#define HX(name) [INTERP_##name] = &&h_##name
+
+// runs the block and the blocks it links to until the cycles run out
+// with a null backend it only returns the handler table so the decoder can
+// fill in the handler addresses
+static void* const* interp_run(InterpCodeBackend* code) {
+    static void* const handlers[INTERP_MAX] = {
+        H(LOAD_REG),       H(STORE_REG),      H(LOAD_FLAG),
+        H(STORE_FLAG),     H(LOAD_REG_USR),   H(STORE_REG_USR),
+        H(LOAD_CPSR),      H(STORE_CPSR),     H(LOAD_SPSR),
+        H(STORE_SPSR),     H(LOAD_THUMB),     H(STORE_THUMB),
+        H(LOAD_VFP),       H(STORE_VFP),      H(LOAD_GE),
+        H(STORE_GE),       H(LOAD_MEM8),      H(LOAD_MEMS8),
+        H(LOAD_MEM16),     H(LOAD_MEMS16),    H(LOAD_MEM32),
+        H(STORE_MEM8),     H(STORE_MEM16),    H(STORE_MEM32),
+        H(VFP_DATA_PROC),  H(VFP_LOAD_MEM),   H(VFP_STORE_MEM),
+        H(VFP_READ),       H(VFP_WRITE),      H(VFP_READ64L),
+        H(VFP_WRITE64L),   H(CP15_READ),      H(CP15_WRITE),
+        H(SETC),           H(JZ),             H(JNZ),
+        H(JELSE),          H(MODESWITCH),     H(EXCEPTION),
+        H(IDLE),           H(BEGIN),          H(END_RET),
+        H(END_LINK),       H(END_LOOP),       H(MOV),
+        H(AND),            H(OR),             H(XOR),
+        H(NOT),            H(LSL),            H(LSR),
+        H(ASR),            H(ROR),            H(RRC),
+        H(ADD),            H(SUB),            H(ADC),
+        H(SBC),            H(MUL),            H(SMULH),
+        H(UMULH),          H(SMULW),          H(CLZ),
+        H(REV),            H(REV16),          H(USAT),
+        H(SSAT),           H(FADD),           H(FSUB),
+        H(FMUL),           H(FDIV),           H(FSQRT),
+        H(FNEG),           H(FABS),           H(MEDIA_UADD8),
+        H(MEDIA_USUB8),    H(MEDIA_UQADD8),   H(MEDIA_UQSUB8),
+        H(MEDIA_UHADD8),   H(MEDIA_QSUB8),    H(MEDIA_GE_UADD8),
+        H(MEDIA_GE_USUB8), H(MEDIA_GE_SSUB8), H(GETN),
+        H(GETZ),           H(GETC),           H(GETV),
+        H(GETCIFZ),        H(PCMASK),         HX(ADD_CV),
+        HX(SUB_CV),        HX(ADC_CV),        HX(SBC_CV),
+        HX(JFLAGZ),        HX(JFLAGNZ),       HX(STORE_N),
+        HX(STORE_Z),       HX(STORE_C),       HX(STORE_V),
+    };
+    if (!code) return handlers;
+
+    ArmCore* cpu = code->cpu;
+    u32* s = code->slots.d;
+    InterpOp* op = code->ops.d;
+    bool cf = false, vf = false;
+    bool jmptaken = false;
+
+    DISPATCH();
+
+h_LOAD_REG:
+    S(d) = cpu->r[op->imm];
+    NEXT;
+h_STORE_REG:
+    cpu->r[op->imm] = S(b);
+    NEXT;
+h_LOAD_FLAG:
+    S(d) = (cpu->cpsr.w >> op->imm) & 1;
+    NEXT;
+h_STORE_FLAG:
+    cpu->cpsr.w = (cpu->cpsr.w & ~BIT(op->imm)) | (S(b) ? BIT(op->imm) : 0);
+    NEXT;
+h_LOAD_REG_USR:
+    if (op->imm < 13) S(d) = cpu->banked_r8_12[0][op->imm - 8];
+    else if (op->imm == 13) S(d) = cpu->banked_sp[0];
+    else S(d) = cpu->banked_lr[0];
+    NEXT;
+h_STORE_REG_USR:
+    if (op->imm < 13) cpu->banked_r8_12[0][op->imm - 8] = S(b);
+    else if (op->imm == 13) cpu->banked_sp[0] = S(b);
+    else cpu->banked_lr[0] = S(b);
+    NEXT;
+h_LOAD_CPSR:
+    S(d) = cpu->cpsr.w;
+    NEXT;
+h_STORE_CPSR:
+    cpu->cpsr.w = S(b);
+    NEXT;
+h_LOAD_SPSR:
+    S(d) = cpu->spsr;
+    NEXT;
+h_STORE_SPSR:
+    cpu->spsr = S(b);
+    NEXT;
+h_LOAD_THUMB:
+    S(d) = cpu->cpsr.t;
+    NEXT;
+h_STORE_THUMB:
+    cpu->cpsr.t = S(b);
+    NEXT;
+h_LOAD_VFP:
+    S(d) = F2I(cpu->s[op->imm]);
+    NEXT;
+h_STORE_VFP:
+    cpu->s[op->imm] = I2F(S(b));
+    NEXT;
+h_LOAD_GE:
+    S(d) = cpu->cpsr.ge;
+    NEXT;
+h_STORE_GE:
+    cpu->cpsr.ge = S(b);
+    NEXT;
+
+#ifdef JIT_FASTMEM
+h_LOAD_MEM8:
+    S(d) = VMEM(u8, S(a));
+    NEXT;
+h_LOAD_MEMS8:
+    S(d) = VMEM(s8, S(a));
+    NEXT;
+h_LOAD_MEM16:
+    S(d) = VMEM(u16, S(a));
+    NEXT;
+h_LOAD_MEMS16:
+    S(d) = VMEM(s16, S(a));
+    NEXT;
+h_LOAD_MEM32:
+    S(d) = VMEM(u32, S(a));
+    NEXT;
+h_STORE_MEM8:
+    VMEM(u8, S(a)) = S(b);
+    NEXT;
+h_STORE_MEM16:
+    VMEM(u16, S(a)) = S(b);
+    NEXT;
+h_STORE_MEM32:
+    VMEM(u32, S(a)) = S(b);
+    NEXT;
+#else
+h_LOAD_MEM8:
+    S(d) = TLBHIT(S(a)) ? *(u8*) TLBPTR(S(a)) : cpu->read8(cpu, S(a), false);
+    NEXT;
+h_LOAD_MEMS8:
+    S(d) = TLBHIT(S(a)) ? *(s8*) TLBPTR(S(a)) : cpu->read8(cpu, S(a), true);
+    NEXT;
+h_LOAD_MEM16:
+    S(d) = TLBHIT(S(a)) ? *(u16*) TLBPTR(S(a)) : cpu->read16(cpu, S(a), false);
+    NEXT;
+h_LOAD_MEMS16:
+    S(d) = TLBHIT(S(a)) ? *(s16*) TLBPTR(S(a)) : cpu->read16(cpu, S(a), true);
+    NEXT;
+h_LOAD_MEM32:
+    S(d) = TLBHIT(S(a)) ? *(u32*) TLBPTR(S(a)) : cpu->read32(cpu, S(a));
+    NEXT;
+h_STORE_MEM8:
+    if (TLBHIT(S(a))) *(u8*) TLBPTR(S(a)) = S(b);
+    else cpu->write8(cpu, S(a), S(b));
+    NEXT;
+h_STORE_MEM16:
+    if (TLBHIT(S(a))) *(u16*) TLBPTR(S(a)) = S(b);
+    else cpu->write16(cpu, S(a), S(b));
+    NEXT;
+h_STORE_MEM32:
+    if (TLBHIT(S(a))) *(u32*) TLBPTR(S(a)) = S(b);
+    else cpu->write32(cpu, S(a), S(b));
+    NEXT;
+#endif
+
+h_VFP_DATA_PROC:
+    exec_vfp_data_proc(cpu, (ArmInstr) {op->imm});
+    NEXT;
+h_VFP_LOAD_MEM:
+    exec_vfp_load_mem(cpu, (ArmInstr) {op->imm}, S(b));
+    NEXT;
+h_VFP_STORE_MEM:
+    exec_vfp_store_mem(cpu, (ArmInstr) {op->imm}, S(b));
+    NEXT;
+h_VFP_READ:
+    S(d) = exec_vfp_read(cpu, (ArmInstr) {op->imm});
+    NEXT;
+h_VFP_WRITE:
+    exec_vfp_write(cpu, (ArmInstr) {op->imm}, S(b));
+    NEXT;
+h_VFP_READ64L: {
+    // also writes the slot of the READ64H after it
+    u64 d = exec_vfp_read64(cpu, (ArmInstr) {op->imm});
+    s[op->d] = d;
+    s[op->d + 1] = d >> 32;
+    NEXT;
+}
+h_VFP_WRITE64L:
+    // a and b are the operands of the WRITE64L/H pair
+    exec_vfp_write64(cpu, (ArmInstr) {op->imm}, S(a) | (u64) S(b) << 32);
+    NEXT;
+h_CP15_READ:
+    S(d) = cpu->cp15_read(cpu, (ArmInstr) {op->imm});
+    NEXT;
+h_CP15_WRITE:
+    cpu->cp15_write(cpu, (ArmInstr) {op->imm}, S(b));
+    NEXT;
+
+h_SETC:
+    cf = S(b);
+    NEXT;
+h_JZ:
+    if (S(a) == 0) {
+        jmptaken = true;
+        JUMP(op->imm);
+    }
+    jmptaken = false;
+    NEXT;
+h_JNZ:
+    if (S(a) != 0) {
+        jmptaken = true;
+        JUMP(op->imm);
+    }
+    jmptaken = false;
+    NEXT;
+h_JELSE:
+    if (!jmptaken) {
+        jmptaken = true;
+        JUMP(op->imm);
+    }
+    jmptaken = false;
+    NEXT;
+h_JFLAGZ:
+    if ((S(d) = (cpu->cpsr.w >> op->a) & 1) == 0) {
+        jmptaken = true;
+        JUMP(op->imm);
+    }
+    jmptaken = false;
+    NEXT;
+h_JFLAGNZ:
+    if ((S(d) = (cpu->cpsr.w >> op->a) & 1) != 0) {
+        jmptaken = true;
+        JUMP(op->imm);
+    }
+    jmptaken = false;
+    NEXT;
+
+h_MODESWITCH:
+    cpu_update_mode(cpu, op->imm);
+    NEXT;
+h_EXCEPTION:
+    switch (op->imm) {
+        case E_SWI:
+            cpu->handle_svc(cpu, (ArmInstr) {S(b)}.sw_intr.arg);
+            break;
+        case E_UND:
+            cpu_undefined_fail(cpu, S(b));
+            break;
+    }
+    NEXT;
+h_IDLE:
+    cpu->cycles = 0;
+    NEXT;
+
+h_BEGIN:
+    // only there when profiling
+    code->counters->execs++;
+    NEXT;
+h_END_RET:
+    if (code->counters) code->counters->cycles += op->imm;
+    cpu->cycles -= op->imm;
+    return nullptr;
+h_END_LINK:
+    if (code->counters) code->counters->cycles += op->imm;
+    cpu->cycles -= op->imm;
+    if (cpu->cycles <= 0) return nullptr;
+    code = op->link;
+    s = code->slots.d;
+    JUMP(0);
+h_END_LOOP:
+    if (code->counters) code->counters->cycles += op->imm;
+    cpu->cycles -= op->imm;
+    if (cpu->cycles <= 0) return nullptr;
+    JUMP(0);
+
+h_MOV:
+    S(d) = S(b);
+    NEXT;
+h_AND:
+    S(d) = S(a) & S(b);
+    NEXT;
+h_OR:
+    S(d) = S(a) | S(b);
+    NEXT;
+h_XOR:
+    S(d) = S(a) ^ S(b);
+    NEXT;
+h_NOT:
+    S(d) = ~S(b);
+    NEXT;
+h_LSL:
+    S(d) = S(b) >= 32 ? 0 : S(a) << S(b);
+    NEXT;
+h_LSR:
+    S(d) = S(b) >= 32 ? 0 : S(a) >> S(b);
+    NEXT;
+h_ASR:
+    S(d) = (s32) S(a) >> (S(b) >= 32 ? 31 : S(b));
+    NEXT;
+h_ROR: {
+    u32 shamt = S(b) & 31;
+    S(d) = S(a) >> shamt | S(a) << (-shamt & 31);
+    NEXT;
+}
+h_RRC:
+    S(d) = S(a) >> 1 | cf << 31;
+    NEXT;
+h_ADD:
+    S(d) = S(a) + S(b);
+    NEXT;
+h_SUB:
+    S(d) = S(a) - S(b);
+    NEXT;
+h_ADC:
+    S(d) = S(a) + S(b) + cf;
+    NEXT;
+h_SBC:
+    S(d) = S(a) + ~S(b) + cf;
+    NEXT;
+h_ADD_CV:
+    S(d) = ADDCV(S(a), S(b), 0);
+    NEXT;
+h_SUB_CV:
+    S(d) = ADDCV(S(a), ~S(b), 1);
+    NEXT;
+h_ADC_CV:
+    S(d) = ADDCV(S(a), S(b), cf);
+    NEXT;
+h_SBC_CV:
+    S(d) = ADDCV(S(a), ~S(b), cf);
+    NEXT;
+h_MUL:
+    S(d) = S(a) * S(b);
+    NEXT;
+h_SMULH:
+    S(d) = ((s64) (s32) S(a) * (s64) (s32) S(b)) >> 32;
+    NEXT;
+h_UMULH:
+    S(d) = ((u64) S(a) * (u64) S(b)) >> 32;
+    NEXT;
+h_SMULW:
+    S(d) = ((s64) (s32) S(a) * (s64) (s32) S(b)) >> 16;
+    NEXT;
+h_CLZ:
+    S(d) = S(b) ? __builtin_clz(S(b)) : 32;
+    NEXT;
+h_REV:
+    S(d) = __builtin_bswap32(S(b));
+    NEXT;
+h_REV16: {
+    u32 x = S(b);
+    S(d) = (x & 0xff00ff00) >> 8 | (x & 0x00ff00ff) << 8;
+    NEXT;
+}
+h_USAT: {
+    s32 x = S(b);
+    if (x < 0) x = 0;
+    if (x > MASK(op->imm)) x = MASK(op->imm);
+    S(d) = x;
+    NEXT;
+}
+h_SSAT: {
+    s32 x = S(b);
+    if (x < ~MASK(op->imm)) x = ~MASK(op->imm);
+    if (x > MASK(op->imm)) x = MASK(op->imm);
+    S(d) = x;
+    NEXT;
+}
+
+h_FADD:
+    S(d) = F2I(I2F(S(a)) + I2F(S(b)));
+    NEXT;
+h_FSUB:
+    S(d) = F2I(I2F(S(a)) - I2F(S(b)));
+    NEXT;
+h_FMUL:
+    S(d) = F2I(I2F(S(a)) * I2F(S(b)));
+    NEXT;
+h_FDIV:
+    S(d) = F2I(I2F(S(a)) / I2F(S(b)));
+    NEXT;
+h_FSQRT:
+    S(d) = F2I(sqrtf(I2F(S(b))));
+    NEXT;
+h_FNEG:
+    S(d) = S(b) ^ BIT(31);
+    NEXT;
+h_FABS:
+    S(d) = S(b) & MASK(31);
+    NEXT;
+
+h_MEDIA_UADD8:
+    S(d) = media_uadd8(S(a), S(b));
+    NEXT;
+h_MEDIA_USUB8:
+    S(d) = media_usub8(S(a), S(b));
+    NEXT;
+h_MEDIA_UQADD8:
+    S(d) = media_uqadd8(S(a), S(b));
+    NEXT;
+h_MEDIA_UQSUB8:
+    S(d) = media_uqsub8(S(a), S(b));
+    NEXT;
+h_MEDIA_UHADD8:
+    S(d) = media_uhadd8(S(a), S(b));
+    NEXT;
+h_MEDIA_QSUB8:
+    S(d) = media_qsub8(S(a), S(b));
+    NEXT;
+h_MEDIA_GE_UADD8:
+    S(d) = media_ge_uadd8(S(a), S(b));
+    NEXT;
+h_MEDIA_GE_USUB8:
+    S(d) = media_ge_usub8(S(a), S(b));
+    NEXT;
+h_MEDIA_GE_SSUB8:
+    S(d) = media_ge_ssub8(S(a), S(b));
+    NEXT;
+
+h_GETN:
+    S(d) = S(b) >> 31;
+    NEXT;
+h_GETZ:
+    S(d) = S(b) == 0;
+    NEXT;
+h_GETC:
+    S(d) = cf;
+    NEXT;
+h_GETV:
+    S(d) = vf;
+    NEXT;
+h_STORE_N:
+    cpu->cpsr.n = S(d) = S(b) >> 31;
+    NEXT;
+h_STORE_Z:
+    cpu->cpsr.z = S(d) = S(b) == 0;
+    NEXT;
+h_STORE_C:
+    cpu->cpsr.c = S(d) = cf;
+    NEXT;
+h_STORE_V:
+    cpu->cpsr.v = S(d) = vf;
+    NEXT;
+h_GETCIFZ:
+    S(d) = S(a) ? S(b) : cf;
+    NEXT;
+h_PCMASK:
+    S(d) = S(a) ? ~1 : ~3;
+    NEXT;
+}
+
+#undef H
+#undef HX
+
+// immediates get their own slots after the ir values, equal immediates share
+// a slot
+static u32 getslot(InterpCodeBackend* this, u32 nvals, bool imm, u32 op) {
+    if (!imm) return op;
+    for (u32 i = nvals; i < this->slots.size; i++) {
+        if (this->slots.d[i] == op) return i;
+    }
+    return Vec_push(this->slots, op);
+}
+
+// the same check the ir interpreter does to see if the flags of an add/sub
+// are used
+static bool needs_cv(IRBlock* ir, u32 i) {
+    IROpcode next = i + 1 < ir->code.size ? ir->code.d[i + 1].opcode : IR_NOP;
+    return next == IR_GETC ||
+           (i + 3 < ir->code.size && ir->code.d[i + 3].opcode == IR_GETV) ||
+           (ir->code.d[i].opcode == IR_ADD && next == IR_ADC);
+}
+
+static bool fuse_setflag(IRBlock* ir, u32 i, int flag, bool* jmptarget) {
+    if (i + 1 >= ir->code.size || jmptarget[i + 1]) return false;
+    IRInstr next = ir->code.d[i + 1];
+    return next.opcode == IR_STORE_FLAG && next.op1 == flag && !next.imm2 &&
+           next.op2 == i;
+}
+
+InterpCodeBackend* backend_interp_generate_code(IRBlock* ir,
+                                                RegAllocation* regalloc,
+                                                ArmCore* cpu) {
+    void* const* handlers = interp_run(nullptr);
+
+    InterpCodeBackend* this = calloc(1, sizeof *this);
+    this->cpu = cpu;
+    this->counters = ir->counters;
+
+    u32 nvals = this->nvals = ir->code.size;
+    Vec_resize(this->slots, nvals + 16);
+    memset(this->slots.d, 0, nvals * sizeof(u32));
+    this->slots.size = nvals;
+
+    bool jmptarget[nvals + 1];
+    memset(jmptarget, 0, sizeof jmptarget);
+    for (u32 i = 0; i < nvals; i++) {
+        IRInstr inst = ir->code.d[i];
+        if (inst.opcode == IR_JZ || inst.opcode == IR_JNZ ||
+            inst.opcode == IR_JELSE)
+            jmptarget[inst.op2] = true;
+    }
+
+    // op index of each ir instruction, for resolving jumps
+    u32 opidx[nvals + 1];
+
+#define SLOT(n) getslot(this, nvals, inst.imm##n, inst.op##n)
+#define EMIT(opc, ...)                                                         \
+    Vec_push(this->ops,                                                        \
+             ((InterpOp) {.handler = handlers[opc], .d = i, __VA_ARGS__}))
+
+    for (u32 i = 0; i < nvals; i++) {
+        opidx[i] = this->ops.size;
+        IRInstr inst = ir->code.d[i];
+        switch (inst.opcode) {
+            case IR_NOP:
+            case IR_VFP_READ64H:
+            case IR_VFP_WRITE64H:
+                break;
+            case IR_BEGIN:
+                if (ir->counters) EMIT(IR_BEGIN);
+                break;
+            case IR_LOAD_FLAG: {
+                IRInstr next = i + 1 < nvals ? ir->code.d[i + 1] : inst;
+                if ((next.opcode == IR_JZ || next.opcode == IR_JNZ) &&
+                    !next.imm1 && next.op1 == i && !jmptarget[i + 1]) {
+                    EMIT(next.opcode == IR_JZ ? INTERP_JFLAGZ : INTERP_JFLAGNZ,
+                         .a = 31 - inst.op1, .imm = next.op2);
+                    opidx[++i] = this->ops.size - 1;
+                } else {
+                    EMIT(IR_LOAD_FLAG, .imm = 31 - inst.op1);
+                }
+                break;
+            }
+            case IR_STORE_FLAG:
+                EMIT(IR_STORE_FLAG, .b = SLOT(2), .imm = 31 - inst.op1);
+                break;
+            case IR_GETN:
+            case IR_GETZ:
+            case IR_GETC:
+            case IR_GETV: {
+                static const struct {
+                    int flag, fused;
+                } getflags[] = {
+                    [IR_GETN - IR_GETN] = {NF, INTERP_STORE_N},
+                    [IR_GETZ - IR_GETN] = {ZF, INTERP_STORE_Z},
+                    [IR_GETC - IR_GETN] = {CF, INTERP_STORE_C},
+                    [IR_GETV - IR_GETN] = {VF, INTERP_STORE_V},
+                };
+                auto g = getflags[inst.opcode - IR_GETN];
+                if (fuse_setflag(ir, i, g.flag, jmptarget)) {
+                    EMIT(g.fused, .b = SLOT(2));
+                    opidx[++i] = this->ops.size - 1;
+                } else {
+                    EMIT(inst.opcode, .b = SLOT(2));
+                }
+                break;
+            }
+            case IR_ADD:
+            case IR_SUB:
+            case IR_ADC:
+            case IR_SBC: {
+                int opc = inst.opcode;
+                if (needs_cv(ir, i)) opc += INTERP_ADD_CV - IR_ADD;
+                EMIT(opc, .a = SLOT(1), .b = SLOT(2));
+                break;
+            }
+            // these have an immediate first operand
+            case IR_LOAD_REG:
+            case IR_STORE_REG:
+            case IR_LOAD_REG_USR:
+            case IR_STORE_REG_USR:
+            case IR_LOAD_VFP:
+            case IR_STORE_VFP:
+            case IR_VFP_DATA_PROC:
+            case IR_VFP_LOAD_MEM:
+            case IR_VFP_STORE_MEM:
+            case IR_VFP_READ:
+            case IR_VFP_WRITE:
+            case IR_VFP_READ64L:
+            case IR_CP15_READ:
+            case IR_CP15_WRITE:
+            case IR_MODESWITCH:
+            case IR_EXCEPTION:
+            case IR_USAT:
+            case IR_SSAT:
+                EMIT(inst.opcode, .b = SLOT(2), .imm = inst.op1);
+                break;
+            case IR_VFP_WRITE64L: {
+                IRInstr hi = ir->code.d[i + 1];
+                EMIT(IR_VFP_WRITE64L, .a = SLOT(2),
+                     .b = getslot(this, nvals, hi.imm2, hi.op2),
+                     .imm = inst.op1);
+                break;
+            }
+            case IR_JZ:
+            case IR_JNZ:
+                EMIT(inst.opcode, .a = SLOT(1), .imm = inst.op2);
+                break;
+            case IR_JELSE:
+                EMIT(IR_JELSE, .imm = inst.op2);
+                break;
+            case IR_END_RET:
+            case IR_END_LOOP:
+                EMIT(inst.opcode, .imm = inst.cycles);
+                break;
+            case IR_END_LINK: {
+                u32 idx = EMIT(IR_END_LINK, .imm = inst.cycles);
+                Vec_push(this->links,
+                         ((InterpLinkPatch) {idx, inst.op1, inst.op2}));
+                break;
+            }
+            default:
+                EMIT(inst.opcode, .a = SLOT(1), .b = SLOT(2));
+                break;
+        }
+    }
+    opidx[nvals] = this->ops.size;
+
+#undef SLOT
+#undef EMIT
+
+    Vec_foreach(op, this->ops) {
+        if (op->handler == handlers[IR_JZ] || op->handler == handlers[IR_JNZ] ||
+            op->handler == handlers[IR_JELSE] ||
+            op->handler == handlers[INTERP_JFLAGZ] ||
+            op->handler == handlers[INTERP_JFLAGNZ])
+            op->imm = opidx[op->imm];
+    }
+
+    return this;
+}
+
+size_t backend_interp_get_code_size(InterpCodeBackend* backend) {
+    return backend->ops.size * sizeof(InterpOp) +
+           backend->slots.size * sizeof(u32);
+}
+
+void backend_interp_exec(InterpCodeBackend* backend) {
+    interp_run(backend);
+}
+
+void backend_interp_patch_links(JITBlock* block) {
+    auto* code = (InterpCodeBackend*) block->backend;
+    Vec_foreach(p, code->links) {
+        JITBlock* linkblock = get_jitblock(code->cpu, p->attrs, p->addr);
+        code->ops.d[p->op].link = linkblock->backend;
+        Vec_push(linkblock->linkingblocks,
+                 ((BlockLocation) {block->attrs, block->start_addr}));
+    }
+    g_jit_stats.links_patched += code->links.size;
+}
+
+void backend_interp_free(InterpCodeBackend* backend) {
+    Vec_free(backend->ops);
+    Vec_free(backend->slots);
+    Vec_free(backend->links);
+    free(backend);
+}
+
+void backend_interp_disassemble(InterpCodeBackend* backend) {
+    void* const* handlers = interp_run(nullptr);
+    printf("--------- Interpreter ops ------------\n");
+    for (u32 i = 0; i < backend->ops.size; i++) {
+        InterpOp* op = &backend->ops.d[i];
+        int opc = 0;
+        while (opc < INTERP_MAX && handlers[opc] != op->handler) opc++;
+        printf("%04x: op %d d=s%d a=s%d b=s%d imm=0x%x\n", i, opc, op->d, op->a,
+               op->b, op->imm);
+    }
+    for (u32 i = backend->nvals; i < backend->slots.size; i++) {
+        printf("s%d = 0x%x\n", i, backend->slots.d[i]);
+    }
+}
+
+#endif
@@ -0,0 +1,54 @@
+#ifndef BACKEND_INTERP_H
+#define BACKEND_INTERP_H
+
+#include "arm/jit/jit.h"
+#include "arm/jit/register_allocator.h"
+#include "common.h"
+
+// cached interpreter for hosts that can't generate code at runtime
+// the optimized ir is decoded once into an array of ops which each hold the
+// address of their handler, so executing a block is just jumping from handler
+// to handler
+// every ir value and immediate gets a slot in the block's slot array, ops
+// refer to their operands by slot so they never check for immediates
+
+typedef struct _InterpCodeBackend InterpCodeBackend;
+
+typedef struct {
+    void* handler;
+    union {
+        struct {
+            u32 a, b; // operand slots
+        };
+        InterpCodeBackend* link; // END_LINK target once patched
+    };
+    u32 d;   // result slot (same as the ir index)
+    u32 imm; // register/flag, instruction, jump target or cycles
+} InterpOp;
+
+typedef struct {
+    u32 op;
+    u32 attrs, addr;
+} InterpLinkPatch;
+
+typedef struct _InterpCodeBackend {
+    Vec(InterpOp) ops;
+    Vec(u32) slots;
+    u32 nvals; // slots after these are immediates
+
+    ArmCore* cpu;
+    IRBlockCounters* counters;
+
+    Vec(InterpLinkPatch) links;
+} InterpCodeBackend;
+
+InterpCodeBackend* backend_interp_generate_code(IRBlock* ir,
+                                                RegAllocation* regalloc,
+                                                ArmCore* cpu);
+size_t backend_interp_get_code_size(InterpCodeBackend* backend);
+void backend_interp_exec(InterpCodeBackend* backend);
+void backend_interp_patch_links(JITBlock* block);
+void backend_interp_free(InterpCodeBackend* backend);
+void backend_interp_disassemble(InterpCodeBackend* backend);
+
+#endif
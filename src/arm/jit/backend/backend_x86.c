@@ -1,4 +1,4 @@
-#ifdef __x86_64__
+#if defined(__x86_64__) && !defined(NOJIT)
 
 #include "backend_x86.h"
 
@@ -6,8 +6,6 @@
 #include <capstone/capstone.h>
 #endif
 
-#include "arm/media.h"
-
 #define RAS_CTX_VAR this->code
 #include <ras/ras_x64.h>
 
@@ -35,6 +33,14 @@ static const rasX64Reg savedregs[] =
 #else
     {RBP, R12, R13, R14, R15};
 #endif
+// xmm0-2 are scratch, windows saves xmm6 and up
+static const rasX64Xmm floatregs[] =
+#ifdef _WIN32
+    {XMM3, XMM4, XMM5};
+#else
+    {XMM3,  XMM4,  XMM5,  XMM6,  XMM7,  XMM8,  XMM9,
+     XMM10, XMM11, XMM12, XMM13, XMM14, XMM15};
+#endif
 
 static rasX64Op getOpForReg(X86CodeBackend* this, int i) {
     HostRegInfo hr = this->hralloc.hostreg_info[i];
@@ -45,6 +51,8 @@ static rasX64Op getOpForReg(X86CodeBackend* this, int i) {
             return MKOP(savedregs[hr.index]);
         case REG_STACK:
             return MKOP(PTR(4 * hr.index, RSP));
+        case REG_FLOAT:
+            return MKOPV(floatregs[hr.index]);
         default:
             unreachable();
     }
@@ -58,6 +66,8 @@ static void print_hostregs(X86CodeBackend* this) {
         auto operand = getOpForReg(this, i);
         if (operand.isMem)
             printf("[rsp+%d]", 4 * this->hralloc.hostreg_info[i].index);
+        else if (this->hralloc.hostreg_info[i].type == REG_FLOAT)
+            printf("xmm%d", operand.r.idx);
         else printf("r%d", operand.r.idx);
     }
     printf("\n");
@@ -142,6 +152,99 @@ static void compileVFPWrite64(X86CodeBackend* this, ArmInstr instr,
         }                                                                      \
     })
 
+// media values are kept in general purpose registers and moved to xmm
+// registers for the operation
+#define XMMLOADOP(n, xmm)                                                      \
+    ({                                                                         \
+        if (inst.imm##n) {                                                     \
+            MOVD(RDX, inst.op##n);                                             \
+            MOVD(xmm, RDX);                                                    \
+        } else {                                                               \
+            MOVD(xmm, GETOP(inst.op##n));                                      \
+        }                                                                      \
+    })
+
+#define XMMBINARY(op)                                                          \
+    ({                                                                         \
+        XMMLOADOP(1, XMM0);                                                    \
+        XMMLOADOP(2, XMM1);                                                    \
+        op(XMM0, XMM1);                                                        \
+        MOVD(GETOP(i), XMM0);                                                  \
+    })
+
+// float values are kept in xmm registers unless they had to go to the stack
+#define ISFLOAT(v)                                                             \
+    (this->hralloc.hostreg_info[regalloc->reg_assn[v]].type == REG_FLOAT)
+#define GETXMM(v)                                                              \
+    floatregs[this->hralloc.hostreg_info[regalloc->reg_assn[v]].index]
+
+// gives the xmm register with operand n, loading it into xmm if it isn't in
+// one already
+#define FLOADOP(n, xmm)                                                        \
+    ({                                                                         \
+        rasX64Xmm r = xmm;                                                     \
+        if (inst.imm##n) {                                                     \
+            MOVD(RDX, inst.op##n);                                             \
+            MOVD(r, RDX);                                                      \
+        } else if (ISFLOAT(inst.op##n)) {                                      \
+            r = GETXMM(inst.op##n);                                            \
+        } else {                                                               \
+            MOVD(r, GETOP(inst.op##n));                                        \
+        }                                                                      \
+        r;                                                                     \
+    })
+
+// the register the result is computed in, xmm0 if it goes elsewhere
+#define FDSTREG() (ISFLOAT(i) ? GETXMM(i) : XMM0)
+#define FSTOREDST()                                                            \
+    ({                                                                         \
+        if (!ISFLOAT(i)) MOVD(GETOP(i), XMM0);                                 \
+    })
+
+#define FBINARY(op)                                                            \
+    ({                                                                         \
+        auto src1 = FLOADOP(1, XMM0);                                          \
+        auto src2 = FLOADOP(2, XMM1);                                          \
+        auto dst = FDSTREG();                                                  \
+        if (dst.idx == src2.idx && dst.idx != src1.idx) {                      \
+            MOVAPS(XMM1, src2);                                                \
+            src2 = XMM1;                                                       \
+        }                                                                      \
+        if (dst.idx != src1.idx) MOVAPS(dst, src1);                            \
+        op(dst, src2);                                                         \
+        FSTOREDST();                                                           \
+    })
+
+// negation and absolute value only touch the sign bit
+#define FSIGNOP(op, mask)                                                      \
+    ({                                                                         \
+        auto src = FLOADOP(2, XMM0);                                           \
+        auto dst = FDSTREG();                                                  \
+        if (dst.idx != src.idx) MOVAPS(dst, src);                              \
+        MOVD(RDX, mask);                                                       \
+        MOVD(XMM1, RDX);                                                       \
+        op(dst, XMM1);                                                         \
+        FSTOREDST();                                                           \
+    })
+
+#ifndef JIT_FASTMEM
+// looks up the address in ARG2 in the software tlb, on a hit RAX + ARG2 is
+// the host address, otherwise it jumps to miss
+// the memory ops are callbacks so the scratch registers are free to use
+static void compileTLBLookup(X86CodeBackend* this, rasLabel miss) {
+    static_assert(sizeof(SWTLBEntry) == 16);
+    MOVD(R10, ARG2);
+    SHRD(R10, 12);
+    MOVD(R11, R10);
+    ANDD(R11, SWTLB_SIZE - 1);
+    SHLD(R11, 4);
+    MOVQ(RAX, CPU(tlb));
+    CMPD(PTR(RAX, R11), R10);
+    JNE(miss);
+    MOVQ(RAX, PTR(offsetof(SWTLBEntry, base), RAX, R11));
+}
+#endif
+
 X86CodeBackend* backend_x86_generate_code(IRBlock* ir, RegAllocation* regalloc,
                                           ArmCore* cpu) {
     X86CodeBackend* this = calloc(1, sizeof *this);
@@ -149,8 +252,9 @@ X86CodeBackend* backend_x86_generate_code(IRBlock* ir, RegAllocation* regalloc,
     this->cpu = cpu;
     this->regalloc = regalloc;
 
-    this->hralloc = allocate_host_registers(regalloc, countof(tempregs),
-                                            countof(savedregs));
+    this->hralloc =
+        allocate_host_registers(regalloc, countof(tempregs),
+                                countof(savedregs), countof(floatregs));
 
     u32 flags_mask = 0;
     u32 lastflags = 0;
@@ -260,6 +364,38 @@ X86CodeBackend* backend_x86_generate_code(IRBlock* ir, RegAllocation* regalloc,
                 }
                 break;
             }
+            case IR_LOAD_GE: {
+                LOAD(CPU(cpsr));
+                auto dest = GETOP(i);
+                SHRD(dest, 16);
+                ANDD(dest, 0xf);
+                break;
+            }
+            case IR_STORE_GE: {
+                ANDD(CPU(cpsr), ~(0xf << 16));
+                if (inst.imm2) {
+                    if (inst.op2 & 0xf) ORD(CPU(cpsr), (inst.op2 & 0xf) << 16);
+                } else {
+                    MOVD(RDX, GETOP(inst.op2));
+                    SHLD(RDX, 16);
+                    ORD(CPU(cpsr), RDX);
+                }
+                break;
+            }
+            case IR_LOAD_VFP:
+                if (ISFLOAT(i)) {
+                    MOVSS(GETXMM(i), CPU(s[inst.op1]));
+                } else {
+                    LOAD(CPU(s[inst.op1]));
+                }
+                break;
+            case IR_STORE_VFP:
+                if (!inst.imm2 && ISFLOAT(inst.op2)) {
+                    MOVSS(CPU(s[inst.op1]), GETXMM(inst.op2));
+                } else {
+                    STORE(CPU(s[inst.op1]));
+                }
+                break;
             case IR_VFP_DATA_PROC: {
                 compileVFPDataProc(this, (ArmInstr) {inst.op1});
                 break;
@@ -449,62 +585,10 @@ X86CodeBackend* backend_x86_generate_code(IRBlock* ir, RegAllocation* regalloc,
                 break;
             }
 #else
-            case IR_LOAD_MEM8: {
-                XORD(ARG3, ARG3);
-                if (inst.imm1) {
-                    MOVD(ARG2, inst.op1);
-                } else {
-                    auto src = GETOP(inst.op1);
-                    if (src.isMem || src.r.idx != ARG2.idx) MOVD(ARG2, src);
-                }
-                MOVQ(ARG1, RBX);
-                MOVQ(RAX, (uintptr_t) cpu->read8);
-                CALL(RAX);
-                MOVD(GETOP(i), RAX);
-                break;
-            }
-            case IR_LOAD_MEMS8: {
-                MOVD(ARG3, 1);
-                if (inst.imm1) {
-                    MOVD(ARG2, inst.op1);
-                } else {
-                    auto src = GETOP(inst.op1);
-                    if (src.isMem || src.r.idx != ARG2.idx) MOVD(ARG2, src);
-                }
-                MOVQ(ARG1, RBX);
-                MOVQ(RAX, (u64) cpu->read8);
-                CALL(RAX);
-                MOVD(GETOP(i), RAX);
-                break;
-            }
-            case IR_LOAD_MEM16: {
-                XORD(ARG3, ARG3);
-                if (inst.imm1) {
-                    MOVD(ARG2, inst.op1);
-                } else {
-                    auto src = GETOP(inst.op1);
-                    if (src.isMem || src.r.idx != ARG2.idx) MOVD(ARG2, src);
-                }
-                MOVQ(ARG1, RBX);
-                MOVQ(RAX, (u64) cpu->read16);
-                CALL(RAX);
-                MOVD(GETOP(i), RAX);
-                break;
-            }
-            case IR_LOAD_MEMS16: {
-                MOVD(ARG3, 1);
-                if (inst.imm1) {
-                    MOVD(ARG2, inst.op1);
-                } else {
-                    auto src = GETOP(inst.op1);
-                    if (src.isMem || src.r.idx != ARG2.idx) MOVD(ARG2, src);
-                }
-                MOVQ(ARG1, RBX);
-                MOVQ(RAX, (u64) cpu->read16);
-                CALL(RAX);
-                MOVD(GETOP(i), RAX);
-                break;
-            }
+            case IR_LOAD_MEM8:
+            case IR_LOAD_MEMS8:
+            case IR_LOAD_MEM16:
+            case IR_LOAD_MEMS16:
             case IR_LOAD_MEM32: {
                 if (inst.imm1) {
                     MOVD(ARG2, inst.op1);
@@ -512,30 +596,54 @@ X86CodeBackend* backend_x86_generate_code(IRBlock* ir, RegAllocation* regalloc,
                     auto src = GETOP(inst.op1);
                     if (src.isMem || src.r.idx != ARG2.idx) MOVD(ARG2, src);
                 }
-                MOVQ(ARG1, RBX);
-                MOVQ(RAX, (u64) cpu->read32);
-                CALL(RAX);
-                MOVD(GETOP(i), RAX);
-                break;
-            }
-            case IR_STORE_MEM8: {
-                if (inst.imm2) {
-                    MOVD(ARG3, inst.op2);
-                } else {
-                    MOVD(ARG3, GETOP(inst.op2));
-                }
-                if (inst.imm1) {
-                    MOVD(ARG2, inst.op1);
-                } else {
-                    auto src = GETOP(inst.op1);
-                    if (src.isMem || src.r.idx != ARG2.idx) MOVD(ARG2, src);
+                LABEL(miss);
+                LABEL(done);
+                if (cpu->tlb) {
+                    compileTLBLookup(this, miss);
+                    switch (inst.opcode) {
+                        case IR_LOAD_MEM8:
+                            MOVZXBD(RAX, PTR(RAX, ARG2));
+                            break;
+                        case IR_LOAD_MEMS8:
+                            MOVSXBD(RAX, PTR(RAX, ARG2));
+                            break;
+                        case IR_LOAD_MEM16:
+                            MOVZXWD(RAX, PTR(RAX, ARG2));
+                            break;
+                        case IR_LOAD_MEMS16:
+                            MOVSXWD(RAX, PTR(RAX, ARG2));
+                            break;
+                        default:
+                            MOVD(RAX, PTR(RAX, ARG2));
+                            break;
+                    }
+                    JMP(done);
+                }
+                L(miss);
+                switch (inst.opcode) {
+                    case IR_LOAD_MEM8:
+                    case IR_LOAD_MEMS8:
+                        MOVD(ARG3, inst.opcode == IR_LOAD_MEMS8);
+                        MOVQ(RAX, (u64) cpu->read8);
+                        break;
+                    case IR_LOAD_MEM16:
+                    case IR_LOAD_MEMS16:
+                        MOVD(ARG3, inst.opcode == IR_LOAD_MEMS16);
+                        MOVQ(RAX, (u64) cpu->read16);
+                        break;
+                    default:
+                        MOVQ(RAX, (u64) cpu->read32);
+                        break;
                 }
                 MOVQ(ARG1, RBX);
-                MOVQ(RAX, (u64) cpu->write8);
                 CALL(RAX);
+                L(done);
+                MOVD(GETOP(i), RAX);
                 break;
             }
-            case IR_STORE_MEM16: {
+            case IR_STORE_MEM8:
+            case IR_STORE_MEM16:
+            case IR_STORE_MEM32: {
                 if (inst.imm2) {
                     MOVD(ARG3, inst.op2);
                 } else {
@@ -547,26 +655,38 @@ X86CodeBackend* backend_x86_generate_code(IRBlock* ir, RegAllocation* regalloc,
                     auto src = GETOP(inst.op1);
                     if (src.isMem || src.r.idx != ARG2.idx) MOVD(ARG2, src);
                 }
-                MOVQ(ARG1, RBX);
-                MOVQ(RAX, (u64) cpu->write16);
-                CALL(RAX);
-                break;
-            }
-            case IR_STORE_MEM32: {
-                if (inst.imm2) {
-                    MOVD(ARG3, inst.op2);
-                } else {
-                    MOVD(ARG3, GETOP(inst.op2));
+                LABEL(miss);
+                LABEL(done);
+                if (cpu->tlb) {
+                    compileTLBLookup(this, miss);
+                    switch (inst.opcode) {
+                        case IR_STORE_MEM8:
+                            MOVB(PTR(RAX, ARG2), ARG3);
+                            break;
+                        case IR_STORE_MEM16:
+                            MOVW(PTR(RAX, ARG2), ARG3);
+                            break;
+                        default:
+                            MOVD(PTR(RAX, ARG2), ARG3);
+                            break;
+                    }
+                    JMP(done);
                 }
-                if (inst.imm1) {
-                    MOVD(ARG2, inst.op1);
-                } else {
-                    auto src = GETOP(inst.op1);
-                    if (src.isMem || src.r.idx != ARG2.idx) MOVD(ARG2, src);
+                L(miss);
+                switch (inst.opcode) {
+                    case IR_STORE_MEM8:
+                        MOVQ(RAX, (u64) cpu->write8);
+                        break;
+                    case IR_STORE_MEM16:
+                        MOVQ(RAX, (u64) cpu->write16);
+                        break;
+                    default:
+                        MOVQ(RAX, (u64) cpu->write32);
+                        break;
                 }
                 MOVQ(ARG1, RBX);
-                MOVQ(RAX, (u64) cpu->write32);
                 CALL(RAX);
+                L(done);
                 break;
             }
 #endif
@@ -805,6 +925,30 @@ X86CodeBackend* backend_x86_generate_code(IRBlock* ir, RegAllocation* regalloc,
                 }
                 break;
             }
+            case IR_FADD:
+                FBINARY(ADDSS);
+                break;
+            case IR_FSUB:
+                FBINARY(SUBSS);
+                break;
+            case IR_FMUL:
+                FBINARY(MULSS);
+                break;
+            case IR_FDIV:
+                FBINARY(DIVSS);
+                break;
+            case IR_FSQRT: {
+                auto src = FLOADOP(2, XMM0);
+                SQRTSS(FDSTREG(), src);
+                FSTOREDST();
+                break;
+            }
+            case IR_FNEG:
+                FSIGNOP(XORPS, BIT(31));
+                break;
+            case IR_FABS:
+                FSIGNOP(ANDPS, MASK(31));
+                break;
             case IR_SMULH:
             case IR_UMULH: {
                 if (inst.imm1) {
@@ -907,145 +1051,66 @@ X86CodeBackend* backend_x86_generate_code(IRBlock* ir, RegAllocation* regalloc,
                 MOVD(GETOP(i), RDX);
                 break;
             }
-            case IR_MEDIA_UADD8: {
-                if (inst.imm2) {
-                    MOVD(ARG3, inst.op2);
-                } else {
-                    MOVD(ARG3, GETOP(inst.op2));
-                }
-                if (inst.imm1) {
-                    MOVD(ARG2, inst.op1);
-                } else {
-                    MOVD(ARG2, GETOP(inst.op1));
-                }
-                MOVQ(ARG1, RBX);
-                MOVQ(RAX, (u64) media_uadd8);
-                CALL(RAX);
-                MOVD(GETOP(i), RAX);
+            case IR_MEDIA_UADD8:
+                XMMBINARY(PADDB);
                 break;
-            }
-            case IR_MEDIA_USUB8: {
-                if (inst.imm2) {
-                    MOVD(ARG3, inst.op2);
-                } else {
-                    MOVD(ARG3, GETOP(inst.op2));
-                }
-                if (inst.imm1) {
-                    MOVD(ARG2, inst.op1);
-                } else {
-                    MOVD(ARG2, GETOP(inst.op1));
-                }
-                MOVQ(ARG1, RBX);
-                MOVQ(RAX, (u64) media_usub8);
-                CALL(RAX);
-                MOVD(GETOP(i), RAX);
-                break;
-            }
-            case IR_MEDIA_UQADD8: {
-                if (inst.imm1) {
-                    MOVD(RDX, inst.op1);
-                } else {
-                    MOVD(RDX, GETOP(inst.op1));
-                }
-                MOVD(XMM0, RDX);
-                if (inst.imm2) {
-                    MOVD(RDX, inst.op2);
-                } else {
-                    MOVD(RDX, GETOP(inst.op2));
-                }
-                MOVD(XMM1, RDX);
-                PADDUSB(XMM0, XMM1);
-                MOVD(RAX, XMM0);
-                MOVD(GETOP(i), RAX);
-                break;
-            }
-            case IR_MEDIA_UQSUB8: {
-                if (inst.imm1) {
-                    MOVD(RDX, inst.op1);
-                } else {
-                    MOVD(RDX, GETOP(inst.op1));
-                }
-                MOVD(XMM0, RDX);
-                if (inst.imm2) {
-                    MOVD(RDX, inst.op2);
-                } else {
-                    MOVD(RDX, GETOP(inst.op2));
-                }
-                MOVD(XMM1, RDX);
-                PSUBUSB(XMM0, XMM1);
-                MOVD(RAX, XMM0);
-                MOVD(GETOP(i), RAX);
+            case IR_MEDIA_USUB8:
+                XMMBINARY(PSUBB);
                 break;
-            }
-            case IR_MEDIA_UHADD8: {
-                if (inst.imm2) {
-                    MOVD(ARG3, inst.op2);
-                } else {
-                    MOVD(ARG3, GETOP(inst.op2));
-                }
-                if (inst.imm1) {
-                    MOVD(ARG2, inst.op1);
-                } else {
-                    MOVD(ARG2, GETOP(inst.op1));
-                }
-                MOVQ(ARG1, RBX);
-                MOVQ(RAX, (u64) media_uhadd8);
-                CALL(RAX);
-                MOVD(GETOP(i), RAX);
+            case IR_MEDIA_UQADD8:
+                XMMBINARY(PADDUSB);
                 break;
-            }
-            case IR_MEDIA_SSUB8: {
-                if (inst.imm2) {
-                    MOVD(ARG3, inst.op2);
-                } else {
-                    MOVD(ARG3, GETOP(inst.op2));
-                }
-                if (inst.imm1) {
-                    MOVD(ARG2, inst.op1);
-                } else {
-                    MOVD(ARG2, GETOP(inst.op1));
-                }
-                MOVQ(ARG1, RBX);
-                MOVQ(RAX, (u64) media_ssub8);
-                CALL(RAX);
-                MOVD(GETOP(i), RAX);
+            case IR_MEDIA_UQSUB8:
+                XMMBINARY(PSUBUSB);
                 break;
-            }
-            case IR_MEDIA_QSUB8: {
-                if (inst.imm1) {
-                    MOVD(RDX, inst.op1);
-                } else {
-                    MOVD(RDX, GETOP(inst.op1));
-                }
-                MOVD(XMM0, RDX);
-                if (inst.imm2) {
-                    MOVD(RDX, inst.op2);
-                } else {
-                    MOVD(RDX, GETOP(inst.op2));
-                }
+            case IR_MEDIA_UHADD8:
+                // pavgb rounds up so subtract the rounding bit
+                XMMLOADOP(1, XMM0);
+                XMMLOADOP(2, XMM1);
+                MOVAPS(XMM2, XMM0);
+                PXOR(XMM2, XMM1);
+                PAVGB(XMM0, XMM1);
+                MOVD(RDX, 0x01010101);
                 MOVD(XMM1, RDX);
-                PSUBSB(XMM0, XMM1);
-                MOVD(RAX, XMM0);
-                MOVD(GETOP(i), RAX);
+                PAND(XMM2, XMM1);
+                PSUBB(XMM0, XMM2);
+                MOVD(GETOP(i), XMM0);
+                break;
+            case IR_MEDIA_QSUB8:
+                XMMBINARY(PSUBSB);
+                break;
+            case IR_MEDIA_GE_UADD8:
+                // the saturated sum differs from the sum if there was a carry
+                XMMLOADOP(1, XMM0);
+                XMMLOADOP(2, XMM1);
+                MOVAPS(XMM2, XMM0);
+                PADDUSB(XMM2, XMM1);
+                PADDB(XMM0, XMM1);
+                PCMPEQB(XMM0, XMM2);
+                PMOVMSKB(RDX, XMM0);
+                ANDD(RDX, 0xf);
+                XORD(RDX, 0xf);
+                MOVD(GETOP(i), RDX);
                 break;
-            }
-            case IR_MEDIA_SEL: {
-                if (inst.imm2) {
-                    MOVD(ARG3, inst.op2);
-                } else {
-                    MOVD(ARG3, GETOP(inst.op2));
-                }
-                if (inst.imm1) {
-                    MOVD(ARG2, inst.op1);
-                } else {
-                    MOVD(ARG2, GETOP(inst.op1));
-                }
-                MOVQ(ARG1, RBX);
-                MOVQ(RAX, (u64) media_sel);
-                CALL(RAX);
-                MOVD(GETOP(i), RAX);
+            case IR_MEDIA_GE_USUB8:
+                XMMLOADOP(1, XMM0);
+                XMMLOADOP(2, XMM1);
+                MOVAPS(XMM2, XMM0);
+                PMAXUB(XMM2, XMM1);
+                PCMPEQB(XMM2, XMM0);
+                PMOVMSKB(RDX, XMM2);
+                ANDD(RDX, 0xf);
+                MOVD(GETOP(i), RDX);
+                break;
+            case IR_MEDIA_GE_SSUB8:
+                XMMLOADOP(1, XMM0);
+                XMMLOADOP(2, XMM1);
+                PCMPGTB(XMM1, XMM0);
+                PMOVMSKB(RDX, XMM1);
+                ANDD(RDX, 0xf);
+                XORD(RDX, 0xf);
+                MOVD(GETOP(i), RDX);
                 break;
-            }
             case IR_GETN: {
                 auto dest = GETOP(i);
                 if (inst.imm2) {
@@ -1253,8 +1318,8 @@ X86CodeBackend* backend_x86_generate_code(IRBlock* ir, RegAllocation* regalloc,
                 }
                 break;
             }
-            case IR_HALT: {
-                MOVB(CPU(halt), 1);
+            case IR_IDLE: {
+                MOVQ(CPU(cycles), 0);
                 break;
             }
             case IR_BEGIN: {
@@ -1267,12 +1332,23 @@ X86CodeBackend* backend_x86_generate_code(IRBlock* ir, RegAllocation* regalloc,
                 MOVQ(RBX, (u64) cpu);
                 L(looplabel);
 
+                if (ir->counters) {
+                    MOVQ(RAX, (u64) ir->counters);
+                    ADDQ(PTR(offsetof(IRBlockCounters, execs), RAX), 1);
+                }
+
                 break;
             }
             case IR_END_RET:
             case IR_END_LINK:
             case IR_END_LOOP: {
 
+                if (ir->counters) {
+                    MOVQ(RAX, (u64) ir->counters);
+                    ADDQ(PTR(offsetof(IRBlockCounters, cycles), RAX),
+                         inst.cycles);
+                }
+
                 MOVQ(RAX, CPU(cycles));
                 SUBQ(RAX, inst.cycles);
                 MOVQ(CPU(cycles), RAX);
@@ -1819,6 +1895,10 @@ JITFunc backend_x86_get_code(X86CodeBackend* backend) {
     return rasGetCode(backend->code);
 }
 
+size_t backend_x86_get_code_size(X86CodeBackend* backend) {
+    return rasGetSize(backend->code);
+}
+
 void backend_x86_patch_links(JITBlock* block) {
     auto* code = (X86CodeBackend*) block->backend;
     Vec_foreach(p, code->links) {
@@ -1827,6 +1907,7 @@ void backend_x86_patch_links(JITBlock* block) {
         Vec_push(linkblock->linkingblocks,
                  ((BlockLocation) {block->attrs, block->start_addr}));
     }
+    g_jit_stats.links_patched += code->links.size;
 
     rasReady(code->code);
 }
@@ -25,6 +25,7 @@ typedef struct {
 X86CodeBackend* backend_x86_generate_code(IRBlock* ir, RegAllocation* regalloc,
                                 ArmCore* cpu);
 JITFunc backend_x86_get_code(X86CodeBackend* backend);
+size_t backend_x86_get_code_size(X86CodeBackend* backend);
 void backend_x86_patch_links(JITBlock* block);
 void backend_x86_free(X86CodeBackend* backend);
 void backend_x86_disassemble(X86CodeBackend* backend);
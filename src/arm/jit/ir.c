@@ -1,5 +1,7 @@
 #include "ir.h"
 
+#include <math.h>
+
 #include "arm/media.h"
 #include "arm/vfp.h"
 
@@ -14,6 +16,8 @@ bool iropc_hasresult(IROpcode opc) {
         case IR_LOAD_CPSR:
         case IR_LOAD_SPSR:
         case IR_LOAD_THUMB:
+        case IR_LOAD_VFP:
+        case IR_LOAD_GE:
         case IR_LOAD_MEM8:
         case IR_LOAD_MEMS8:
         case IR_LOAD_MEM16:
@@ -47,12 +51,6 @@ bool iropc_iscallback(IROpcode opc) {
         case IR_EXCEPTION:
         case IR_CP15_READ:
         case IR_CP15_WRITE:
-        case IR_MEDIA_UADD8:
-        case IR_MEDIA_USUB8:
-        case IR_MEDIA_UQSUB8:
-        case IR_MEDIA_UHADD8:
-        case IR_MEDIA_SSUB8:
-        case IR_MEDIA_SEL:
             return true;
         default:
             return false;
@@ -66,10 +64,6 @@ bool iropc_ispure(IROpcode opc) {
         case IR_ADC:
         case IR_SBC:
         case IR_GETCIFZ:
-        case IR_MEDIA_UADD8:
-        case IR_MEDIA_USUB8:
-        case IR_MEDIA_SSUB8:
-        case IR_MEDIA_SEL:
             return false;
         default:
             return true;
@@ -158,6 +152,18 @@ void ir_interpret(IRBlock* block, ArmCore* cpu) {
             case IR_STORE_THUMB:
                 cpu->cpsr.t = OP(2);
                 break;
+            case IR_LOAD_GE:
+                v[i] = cpu->cpsr.ge;
+                break;
+            case IR_STORE_GE:
+                cpu->cpsr.ge = OP(2);
+                break;
+            case IR_LOAD_VFP:
+                v[i] = F2I(cpu->s[OP(1)]);
+                break;
+            case IR_STORE_VFP:
+                cpu->s[OP(1)] = I2F(OP(2));
+                break;
             case IR_VFP_DATA_PROC: {
                 ArmInstr vfpinst = {OP(1)};
                 exec_vfp_data_proc(cpu, vfpinst);
@@ -327,6 +333,27 @@ void ir_interpret(IRBlock* block, ArmCore* cpu) {
             case IR_MUL:
                 v[i] = OP(1) * OP(2);
                 break;
+            case IR_FADD:
+                v[i] = F2I(I2F(OP(1)) + I2F(OP(2)));
+                break;
+            case IR_FSUB:
+                v[i] = F2I(I2F(OP(1)) - I2F(OP(2)));
+                break;
+            case IR_FMUL:
+                v[i] = F2I(I2F(OP(1)) * I2F(OP(2)));
+                break;
+            case IR_FDIV:
+                v[i] = F2I(I2F(OP(1)) / I2F(OP(2)));
+                break;
+            case IR_FSQRT:
+                v[i] = F2I(sqrtf(I2F(OP(2))));
+                break;
+            case IR_FNEG:
+                v[i] = OP(2) ^ BIT(31);
+                break;
+            case IR_FABS:
+                v[i] = OP(2) & MASK(31);
+                break;
             case IR_UMULH:
                 v[i] = ((u64) OP(1) * (u64) OP(2)) >> 32;
                 break;
@@ -375,38 +402,33 @@ void ir_interpret(IRBlock* block, ArmCore* cpu) {
                 v[i] = x;
                 break;
             }
-            case IR_MEDIA_UADD8: {
-                v[i] = media_uadd8(cpu, OP(1), OP(2));
+            case IR_MEDIA_UADD8:
+                v[i] = media_uadd8(OP(1), OP(2));
                 break;
-            }
-            case IR_MEDIA_USUB8: {
-                v[i] = media_usub8(cpu, OP(1), OP(2));
+            case IR_MEDIA_USUB8:
+                v[i] = media_usub8(OP(1), OP(2));
                 break;
-            }
-            case IR_MEDIA_UQADD8: {
-                v[i] = media_uqadd8(cpu, OP(1), OP(2));
+            case IR_MEDIA_UQADD8:
+                v[i] = media_uqadd8(OP(1), OP(2));
                 break;
-            }
-            case IR_MEDIA_UQSUB8: {
-                v[i] = media_uqsub8(cpu, OP(1), OP(2));
+            case IR_MEDIA_UQSUB8:
+                v[i] = media_uqsub8(OP(1), OP(2));
                 break;
-            }
-            case IR_MEDIA_UHADD8: {
-                v[i] = media_uhadd8(cpu, OP(1), OP(2));
+            case IR_MEDIA_UHADD8:
+                v[i] = media_uhadd8(OP(1), OP(2));
                 break;
-            }
-            case IR_MEDIA_SSUB8: {
-                v[i] = media_ssub8(cpu, OP(1), OP(2));
+            case IR_MEDIA_QSUB8:
+                v[i] = media_qsub8(OP(1), OP(2));
                 break;
-            }
-            case IR_MEDIA_QSUB8: {
-                v[i] = media_qsub8(cpu, OP(1), OP(2));
+            case IR_MEDIA_GE_UADD8:
+                v[i] = media_ge_uadd8(OP(1), OP(2));
                 break;
-            }
-            case IR_MEDIA_SEL: {
-                v[i] = media_sel(cpu, OP(1), OP(2));
+            case IR_MEDIA_GE_USUB8:
+                v[i] = media_ge_usub8(OP(1), OP(2));
+                break;
+            case IR_MEDIA_GE_SSUB8:
+                v[i] = media_ge_ssub8(OP(1), OP(2));
                 break;
-            }
             case IR_GETN:
                 v[i] = OP(2) >> 31;
                 break;
@@ -459,14 +481,18 @@ void ir_interpret(IRBlock* block, ArmCore* cpu) {
                         break;
                 }
                 break;
-            case IR_HALT:
-                cpu->halt = true;
+            case IR_IDLE:
+                cpu->cycles = 0;
                 break;
             case IR_BEGIN:
+                if (block->counters) block->counters->execs++;
                 break;
             case IR_END_LINK:
             case IR_END_LOOP:
             case IR_END_RET:
+                if (block->counters) {
+                    block->counters->cycles += block->code.d[i].cycles;
+                }
                 cpu->cycles -= block->code.d[i].cycles;
                 return;
         }
@@ -514,6 +540,13 @@ void ir_interpret(IRBlock* block, ArmCore* cpu) {
     if (op2) DISASM_OP(2);                                                     \
     return
 
+#define DISASM_VFP(name, r, op2)                                               \
+    if (r) printf("v%d = ", i);                                                \
+    printf(#name);                                                             \
+    printf(" s%d ", inst.op1);                                                 \
+    if (op2) DISASM_OP(2);                                                     \
+    return
+
 #define DISASM_MEM(name, r, op2)                                               \
     if (r) printf("v%d = ", i);                                                \
     printf(#name " ");                                                         \
@@ -558,6 +591,14 @@ void ir_disasm_instr(IRInstr inst, int i) {
             DISASM(load_thumb, 1, 0, 0);
         case IR_STORE_THUMB:
             DISASM(store_thumb, 0, 0, 1);
+        case IR_LOAD_GE:
+            DISASM(load_ge, 1, 0, 0);
+        case IR_STORE_GE:
+            DISASM(store_ge, 0, 0, 1);
+        case IR_LOAD_VFP:
+            DISASM_VFP(load_vfp, 1, 0);
+        case IR_STORE_VFP:
+            DISASM_VFP(store_vfp, 0, 1);
         case IR_LOAD_MEM8:
             DISASM_MEM(load_mem8, 1, 0);
         case IR_LOAD_MEMS8:
@@ -628,6 +669,20 @@ void ir_disasm_instr(IRInstr inst, int i) {
             DISASM(sbc, 1, 1, 1);
         case IR_MUL:
             DISASM(mul, 1, 1, 1);
+        case IR_FADD:
+            DISASM(fadd, 1, 1, 1);
+        case IR_FSUB:
+            DISASM(fsub, 1, 1, 1);
+        case IR_FMUL:
+            DISASM(fmul, 1, 1, 1);
+        case IR_FDIV:
+            DISASM(fdiv, 1, 1, 1);
+        case IR_FSQRT:
+            DISASM(fsqrt, 1, 0, 1);
+        case IR_FNEG:
+            DISASM(fneg, 1, 0, 1);
+        case IR_FABS:
+            DISASM(fabs, 1, 0, 1);
         case IR_UMULH:
             DISASM(umulh, 1, 1, 1);
         case IR_SMULH:
@@ -644,12 +699,22 @@ void ir_disasm_instr(IRInstr inst, int i) {
             DISASM(usat, 1, 1, 1);
         case IR_MEDIA_UADD8:
             DISASM(uadd8, 1, 1, 1);
+        case IR_MEDIA_USUB8:
+            DISASM(usub8, 1, 1, 1);
+        case IR_MEDIA_UQADD8:
+            DISASM(uqadd8, 1, 1, 1);
         case IR_MEDIA_UQSUB8:
             DISASM(uqsub8, 1, 1, 1);
+        case IR_MEDIA_UHADD8:
+            DISASM(uhadd8, 1, 1, 1);
         case IR_MEDIA_QSUB8:
             DISASM(qsub8, 1, 1, 1);
-        case IR_MEDIA_SEL:
-            DISASM(sel, 1, 1, 1);
+        case IR_MEDIA_GE_UADD8:
+            DISASM(ge_uadd8, 1, 1, 1);
+        case IR_MEDIA_GE_USUB8:
+            DISASM(ge_usub8, 1, 1, 1);
+        case IR_MEDIA_GE_SSUB8:
+            DISASM(ge_ssub8, 1, 1, 1);
         case IR_GETN:
             DISASM(getn, 1, 0, 1);
         case IR_GETZ:
@@ -676,8 +741,8 @@ void ir_disasm_instr(IRInstr inst, int i) {
         case IR_EXCEPTION:
             DISASM(exception, 0, 1, 1);
             break;
-        case IR_HALT:
-            DISASM(halt, 0, 0, 0);
+        case IR_IDLE:
+            DISASM(idle, 0, 0, 0);
             break;
         case IR_BEGIN:
             DISASM(begin, 0, 0, 0);
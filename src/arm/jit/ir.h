@@ -31,6 +31,10 @@ typedef enum {
     IR_STORE_SPSR,    // --v
     IR_LOAD_THUMB,    // r--
     IR_STORE_THUMB,   // --v
+    IR_LOAD_VFP,      // ri-, raw bits of a single precision register
+    IR_STORE_VFP,     // -iv
+    IR_LOAD_GE,       // r--
+    IR_STORE_GE,      // --v
 
     // memory access instructions
     IR_LOAD_MEM8,   // rv-
@@ -43,7 +47,8 @@ typedef enum {
     IR_STORE_MEM32, // -vv
 
     // vfp instructions
-    // TODO: integrate this into the jit properly
+    // single precision arithmetic is lowered to the float instructions below,
+    // everything else still goes through these
     IR_VFP_DATA_PROC, // -i-
     IR_VFP_LOAD_MEM,  // -iv
     IR_VFP_STORE_MEM, // -iv
@@ -69,7 +74,7 @@ typedef enum {
     // special instructions
     IR_MODESWITCH, // -i-
     IR_EXCEPTION,  // -ii
-    IR_HALT,       // ---
+    IR_IDLE,       // ---, ends the time slice, used for idle loops
 
     // special control instructions
     IR_BEGIN,    // ---, always the first instruction
@@ -112,15 +117,26 @@ typedef enum {
     IR_USAT,  // riv
     IR_SSAT,  // riv
 
+    // single precision float instructions, values are the raw float bits
+    IR_FADD,  // rvv
+    IR_FSUB,  // rvv
+    IR_FMUL,  // rvv
+    IR_FDIV,  // rvv
+    IR_FSQRT, // r-v
+    IR_FNEG,  // r-v, flips the sign bit
+    IR_FABS,  // r-v, clears the sign bit
+
     // media instructions (all rvv)
     IR_MEDIA_UADD8,
-    IR_MEDIA_USUB8,
+    IR_MEDIA_USUB8, // also the result of ssub8
     IR_MEDIA_UQADD8,
     IR_MEDIA_UQSUB8,
     IR_MEDIA_UHADD8,
-    IR_MEDIA_SSUB8,
     IR_MEDIA_QSUB8,
-    IR_MEDIA_SEL,
+    // these give the GE flags of the operation, sel is done with and/or
+    IR_MEDIA_GE_UADD8,
+    IR_MEDIA_GE_USUB8,
+    IR_MEDIA_GE_SSUB8,
 
     // flag instructions, these always appear in groups of alternating get flag
     // + store flag
@@ -148,12 +164,19 @@ typedef struct {
     u32 cycles; // cycle count up to this instruction
 } IRInstr;
 
+// written by the block itself when profiling
+typedef struct {
+    u64 execs;
+    u64 cycles;
+} IRBlockCounters;
+
 typedef struct {
     Vec(IRInstr) code;
     u32 start_addr;
     u32 end_addr;
     u32 numinstr;
     bool loop;
+    IRBlockCounters* counters;
 } IRBlock;
 
 static inline void irblock_init(IRBlock* block) {
@@ -161,6 +184,7 @@ static inline void irblock_init(IRBlock* block) {
     block->start_addr = block->end_addr = 0;
     block->numinstr = 0;
     block->loop = false;
+    block->counters = nullptr;
 }
 static inline void irblock_free(IRBlock* block) {
     Vec_free(block->code);
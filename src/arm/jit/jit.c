@@ -2,6 +2,8 @@
 
 #include "backend/backend.h"
 #include "optimizer.h"
+#include "perfmap.h"
+#include "profiler.h"
 #include "register_allocator.h"
 #include "translator.h"
 
@@ -14,8 +16,37 @@
 #endif
 
 JITConfig g_jit_config;
+JITStats g_jit_stats;
+
+const char* jit_phase_names[JIT_PHASE_MAX] = {
+    [JIT_PHASE_TRANSLATE] = "translate",
+    [JIT_PHASE_OPT_LOADSTORE] = "optimize_loadstore",
+    [JIT_PHASE_OPT_CONSTPROP] = "optimize_constprop",
+    [JIT_PHASE_OPT_LITERALS] = "optimize_literals",
+    [JIT_PHASE_OPT_CHAINJUMPS] = "optimize_chainjumps",
+    [JIT_PHASE_OPT_DEADCODE] = "optimize_deadcode",
+    [JIT_PHASE_OPT_WAITLOOP] = "optimize_waitloop",
+    [JIT_PHASE_OPT_BLOCKLINKING] = "optimize_blocklinking",
+    [JIT_PHASE_REGALLOC] = "allocate_registers",
+    [JIT_PHASE_BACKEND] = "backend_generate_code",
+    [JIT_PHASE_LINK] = "backend_patch_links",
+};
+
+#define PHASE(p, ...)                                                          \
+    ({                                                                         \
+        u64 phase_start = time_now_ns();                                       \
+        __VA_ARGS__;                                                           \
+        g_jit_stats.phase_ns[p] += time_now_ns() - phase_start;                \
+    })
+
+static int hist_bucket(u64 n, int buckets) {
+    int b = n > 1 ? 64 - __builtin_clzll(n - 1) : 0;
+    return b < buckets ? b : buckets - 1;
+}
 
 JITBlock* create_jit_block(ArmCore* cpu, u32 addr) {
+    u64 start_time = time_now_ns();
+
     JITBlock* block = malloc(sizeof *block);
     block->attrs = cpu->cpsr.w & 0x3f;
     block->start_addr = addr;
@@ -24,34 +55,56 @@ JITBlock* create_jit_block(ArmCore* cpu, u32 addr) {
 
     Vec_init(block->linkingblocks);
 
+    block->counters = (IRBlockCounters) {};
+
     IRBlock ir;
     irblock_init(&ir);
+    if (g_jit_config.profile) ir.counters = &block->counters;
 
-    compile_block(cpu, &ir, addr);
+    PHASE(JIT_PHASE_TRANSLATE, compile_block(cpu, &ir, addr));
 
     block->numinstr = ir.numinstr;
 
     if (g_jit_config.optimize) {
-        optimize_loadstore(&ir);
-        optimize_constprop(&ir);
-        if (g_jit_config.optimize_literals) optimize_literals(&ir, cpu);
-        optimize_chainjumps(&ir);
-        optimize_loadstore(&ir);
-        optimize_constprop(&ir);
-        optimize_chainjumps(&ir);
-        optimize_deadcode(&ir);
-        if (g_jit_config.linking) optimize_blocklinking(&ir, cpu);
+        PHASE(JIT_PHASE_OPT_LOADSTORE, optimize_loadstore(&ir));
+        PHASE(JIT_PHASE_OPT_CONSTPROP, optimize_constprop(&ir));
+        if (g_jit_config.optimize_literals)
+            PHASE(JIT_PHASE_OPT_LITERALS, optimize_literals(&ir, cpu));
+        PHASE(JIT_PHASE_OPT_CHAINJUMPS, optimize_chainjumps(&ir));
+        PHASE(JIT_PHASE_OPT_LOADSTORE, optimize_loadstore(&ir));
+        PHASE(JIT_PHASE_OPT_CONSTPROP, optimize_constprop(&ir));
+        PHASE(JIT_PHASE_OPT_CHAINJUMPS, optimize_chainjumps(&ir));
+        PHASE(JIT_PHASE_OPT_DEADCODE, optimize_deadcode(&ir));
+        if (ir.loop && g_jit_config.idle_loops)
+            PHASE(JIT_PHASE_OPT_WAITLOOP, optimize_waitloop(&ir));
+        if (g_jit_config.linking)
+            PHASE(JIT_PHASE_OPT_BLOCKLINKING, optimize_blocklinking(&ir, cpu));
     }
 
     block->end_addr = ir.end_addr;
 
-    RegAllocation regalloc = allocate_registers(&ir);
+    RegAllocation regalloc;
+    PHASE(JIT_PHASE_REGALLOC, regalloc = allocate_registers(&ir));
 
-    block->backend = backend_generate_code(&ir, &regalloc, cpu);
+    PHASE(JIT_PHASE_BACKEND,
+          block->backend = backend_generate_code(&ir, &regalloc, cpu));
     block->code = backend_get_code(block->backend);
+    size_t code_size = backend_get_code_size(block->backend);
+    if (g_perfmap && block->code) {
+        perfmap_add_arm_block(block->code, code_size, addr, block->end_addr,
+                              block->attrs & BIT(5));
+    }
 
     cpu->jit_cache[block->attrs][addr >> 16][(addr & 0xffff) >> 1] = block;
+
+    // linking can compile the blocks being linked to, that time is counted
+    // for those blocks instead
+    u64 link_start = time_now_ns();
+    u64 nested_ns = g_jit_stats.compile_ns;
     backend_patch_links(block);
+    nested_ns = g_jit_stats.compile_ns - nested_ns;
+    g_jit_stats.phase_ns[JIT_PHASE_LINK] +=
+        time_now_ns() - link_start - nested_ns;
 
 #ifdef IR_DISASM
     ir_disassemble(&ir);
@@ -69,10 +122,21 @@ JITBlock* create_jit_block(ArmCore* cpu, u32 addr) {
         irblock_free(&ir);
     }
 
+    g_jit_stats.blocks_compiled++;
+    g_jit_stats.compile_ns += time_now_ns() - start_time - nested_ns;
+    g_jit_stats.guest_instrs += block->numinstr;
+    g_jit_stats.code_bytes += code_size;
+    g_jit_stats.live_blocks++;
+    g_jit_stats.live_code_bytes += code_size;
+    g_jit_stats.instrs_hist[hist_bucket(block->numinstr, JIT_HIST_INSTRS)]++;
+    g_jit_stats.code_hist[hist_bucket(code_size, JIT_HIST_CODE)]++;
+
     return block;
 }
 
 void destroy_jit_block(JITBlock* block) {
+    if (block->counters.execs) profiler_retire_block(block);
+
     if (g_jit_config.ir_interpret) {
         irblock_free(block->ir);
         free(block->ir);
@@ -80,6 +144,9 @@ void destroy_jit_block(JITBlock* block) {
 
     block->cpu->jit_cache[block->attrs][block->start_addr >> 16]
                          [(block->start_addr & 0xffff) >> 1] = nullptr;
+    g_jit_stats.blocks_destroyed++;
+    g_jit_stats.live_blocks--;
+    g_jit_stats.live_code_bytes -= backend_get_code_size(block->backend);
     backend_free(block->backend);
     Vec_foreach(l, block->linkingblocks) {
         if (!(block->cpu->jit_cache[l->attrs] &&
@@ -88,7 +155,10 @@ void destroy_jit_block(JITBlock* block) {
         JITBlock* linkingblock =
             block->cpu
                 ->jit_cache[l->attrs][l->addr >> 16][(l->addr & 0xffff) >> 1];
-        if (linkingblock) destroy_jit_block(linkingblock);
+        if (linkingblock) {
+            g_jit_stats.unlinked_blocks++;
+            destroy_jit_block(linkingblock);
+        }
     }
     Vec_free(block->linkingblocks);
     free(block);
@@ -101,7 +171,7 @@ void jit_exec(JITBlock* block) {
     if (g_jit_config.ir_interpret) {
         ir_interpret(block->ir, block->cpu);
     } else {
-        block->code();
+        backend_exec(block);
     }
 }
 
@@ -138,6 +208,9 @@ JITBlock* get_jitblock(ArmCore* cpu, u32 attrs, u32 addr) {
 
 // start is page aligned
 void jit_invalidate_range(ArmCore* cpu, u32 start_addr, u32 len) {
+    g_jit_stats.invalidations++;
+    u64 destroyed = g_jit_stats.blocks_destroyed;
+
     u32 end_addr = start_addr + len;
     u32 startpg = start_addr >> 16;
     u32 endpg = end_addr >> 16;
@@ -160,6 +233,9 @@ void jit_invalidate_range(ArmCore* cpu, u32 start_addr, u32 len) {
             }
         }
     }
+
+    // this includes the blocks linking to the invalidated ones
+    g_jit_stats.invalidated_blocks += g_jit_stats.blocks_destroyed - destroyed;
 }
 
 void jit_free_all(ArmCore* cpu) {
@@ -185,3 +261,59 @@ void arm_exec_jit(ArmCore* cpu) {
     JITBlock* block = get_jitblock(cpu, cpu->cpsr.jitattrs, cpu->pc);
     jit_exec(block);
 }
+
+// the live block counts describe the current jit cache so they are kept
+void jit_stats_reset() {
+    u64 live_blocks = g_jit_stats.live_blocks;
+    u64 live_code_bytes = g_jit_stats.live_code_bytes;
+    g_jit_stats = (JITStats) {};
+    g_jit_stats.live_blocks = live_blocks;
+    g_jit_stats.live_code_bytes = live_code_bytes;
+}
+
+static void write_hist(FILE* fp, u64* hist, int n) {
+    fprintf(fp, "[");
+    for (int i = 0; i < n; i++) {
+        fprintf(fp, "%lu%s", (unsigned long) hist[i], i < n - 1 ? ", " : "");
+    }
+    fprintf(fp, "]");
+}
+
+// indent is the indentation of the line the object starts on
+void jit_stats_write_json(FILE* fp, char* indent) {
+#define FIELD(name)                                                            \
+    fprintf(fp, "%s  \"" #name "\": %lu,\n", indent,                           \
+            (unsigned long) g_jit_stats.name)
+
+    fprintf(fp, "{\n");
+    FIELD(blocks_compiled);
+    FIELD(compile_ns);
+    FIELD(guest_instrs);
+    FIELD(code_bytes);
+    FIELD(live_blocks);
+    FIELD(live_code_bytes);
+    FIELD(blocks_destroyed);
+    FIELD(invalidations);
+    FIELD(invalidated_blocks);
+    FIELD(unlinked_blocks);
+    FIELD(links_patched);
+    FIELD(idle_loops);
+
+#undef FIELD
+
+    fprintf(fp, "%s  \"phase_ns\": {\n", indent);
+    for (int i = 0; i < JIT_PHASE_MAX; i++) {
+        fprintf(fp, "%s    \"%s\": %lu%s\n", indent, jit_phase_names[i],
+                (unsigned long) g_jit_stats.phase_ns[i],
+                i < JIT_PHASE_MAX - 1 ? "," : "");
+    }
+    fprintf(fp, "%s  },\n", indent);
+
+    // bucket i is sizes in (2^(i-1), 2^i], the last bucket is everything
+    // larger
+    fprintf(fp, "%s  \"guest_instrs_hist\": ", indent);
+    write_hist(fp, g_jit_stats.instrs_hist, JIT_HIST_INSTRS);
+    fprintf(fp, ",\n%s  \"code_bytes_hist\": ", indent);
+    write_hist(fp, g_jit_stats.code_hist, JIT_HIST_CODE);
+    fprintf(fp, "\n%s}", indent);
+}
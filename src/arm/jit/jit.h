@@ -26,6 +26,8 @@ typedef struct _JITBlock {
 
     Vec(BlockLocation) linkingblocks;
 
+    IRBlockCounters counters;
+
 } JITBlock;
 
 typedef struct {
@@ -35,10 +37,57 @@ typedef struct {
     bool optimize;
     bool optimize_literals;
     bool linking;
+    // loops that only poll memory end the time slice
+    bool idle_loops;
+    // new blocks count their executions and cycles
+    bool profile;
 } JITConfig;
 
 extern JITConfig g_jit_config;
 
+typedef enum {
+    JIT_PHASE_TRANSLATE,
+    JIT_PHASE_OPT_LOADSTORE,
+    JIT_PHASE_OPT_CONSTPROP,
+    JIT_PHASE_OPT_LITERALS,
+    JIT_PHASE_OPT_CHAINJUMPS,
+    JIT_PHASE_OPT_DEADCODE,
+    JIT_PHASE_OPT_WAITLOOP,
+    JIT_PHASE_OPT_BLOCKLINKING,
+    JIT_PHASE_REGALLOC,
+    JIT_PHASE_BACKEND,
+    JIT_PHASE_LINK,
+    JIT_PHASE_MAX
+} JITPhase;
+
+// bucket i of the histograms counts sizes in (2^(i-1), 2^i]
+#define JIT_HIST_INSTRS 9
+#define JIT_HIST_CODE 17
+
+typedef struct {
+    u64 blocks_compiled;
+    u64 compile_ns;
+    u64 phase_ns[JIT_PHASE_MAX];
+
+    u64 guest_instrs;
+    u64 code_bytes;
+    u64 live_blocks;
+    u64 live_code_bytes;
+    u64 instrs_hist[JIT_HIST_INSTRS];
+    u64 code_hist[JIT_HIST_CODE];
+
+    u64 blocks_destroyed;
+    u64 invalidations;
+    u64 invalidated_blocks;
+    // destroyed because a block they were linked to was destroyed
+    u64 unlinked_blocks;
+    u64 links_patched;
+    u64 idle_loops;
+} JITStats;
+
+extern JITStats g_jit_stats;
+extern const char* jit_phase_names[JIT_PHASE_MAX];
+
 JITBlock* create_jit_block(ArmCore* cpu, u32 addr);
 void destroy_jit_block(JITBlock* block);
 
@@ -50,4 +99,7 @@ void jit_free_all(ArmCore* cpu);
 
 void arm_exec_jit(ArmCore* cpu);
 
+void jit_stats_reset();
+void jit_stats_write_json(FILE* fp, char* indent);
+
 #endif
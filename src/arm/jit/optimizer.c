@@ -18,6 +18,12 @@ void optimize_loadstore(IRBlock* block) {
     u32 vflag[5] = {};
     bool immflag[5] = {};
     u32 laststoreflag[5] = {};
+    u32 vvfp[32] = {};
+    bool immvfp[32] = {};
+    u32 laststorevfp[32] = {};
+    u32 vge = 0;
+    bool immge = false;
+    u32 laststorege = 0;
 
     u32 jmpsource = 0;
     u32 jmptarget = -1;
@@ -40,6 +46,19 @@ void optimize_loadstore(IRBlock* block) {
                     immflag[f] = false;
                 }
             }
+            for (int s = 0; s < 32; s++) {
+                if (laststorevfp[s] > jmpsource ||
+                    (vvfp[s] > jmpsource && !immvfp[s])) {
+                    laststorevfp[s] = 0;
+                    vvfp[s] = 0;
+                    immvfp[s] = false;
+                }
+            }
+            if (laststorege > jmpsource || (vge > jmpsource && !immge)) {
+                laststorege = 0;
+                vge = 0;
+                immge = false;
+            }
             jmpsource = 0;
         }
         switch (inst.opcode) {
@@ -83,10 +102,63 @@ void optimize_loadstore(IRBlock* block) {
                 immflag[f] = inst.imm2;
                 break;
             }
+            case IR_LOAD_VFP: {
+                u32 sd = inst.op1;
+                if (vvfp[sd] || immvfp[sd]) {
+                    block->code.d[i] = MOVX(vvfp[sd], immvfp[sd]);
+                } else {
+                    vvfp[sd] = i;
+                    immvfp[sd] = false;
+                }
+                break;
+            }
+            case IR_STORE_VFP: {
+                u32 sd = inst.op1;
+                if (laststorevfp[sd] > jmpsource) {
+                    block->code.d[laststorevfp[sd]] = NOP;
+                }
+                laststorevfp[sd] = i;
+                vvfp[sd] = inst.op2;
+                immvfp[sd] = inst.imm2;
+                break;
+            }
+            // these access the vfp registers directly
+            case IR_VFP_DATA_PROC:
+            case IR_VFP_LOAD_MEM:
+            case IR_VFP_STORE_MEM:
+            case IR_VFP_READ:
+            case IR_VFP_WRITE:
+            case IR_VFP_READ64L:
+            case IR_VFP_READ64H:
+            case IR_VFP_WRITE64L:
+            case IR_VFP_WRITE64H:
+                for (int s = 0; s < 32; s++) {
+                    laststorevfp[s] = 0;
+                    vvfp[s] = 0;
+                    immvfp[s] = false;
+                }
+                break;
+            case IR_LOAD_GE:
+                if (vge || immge) {
+                    block->code.d[i] = MOVX(vge, immge);
+                } else {
+                    vge = i;
+                    immge = false;
+                }
+                break;
+            case IR_STORE_GE:
+                if (laststorege > jmpsource) {
+                    block->code.d[laststorege] = NOP;
+                }
+                laststorege = i;
+                vge = inst.op2;
+                immge = inst.imm2;
+                break;
             case IR_LOAD_CPSR:
                 for (int f = 0; f < 5; f++) {
                     laststoreflag[f] = 0;
                 }
+                laststorege = 0;
                 break;
             case IR_STORE_CPSR:
                 for (int f = 0; f < 5; f++) {
@@ -97,6 +169,12 @@ void optimize_loadstore(IRBlock* block) {
                     vflag[f] = 0;
                     immflag[f] = false;
                 }
+                if (laststorege > jmpsource) {
+                    block->code.d[laststorege] = NOP;
+                }
+                laststorege = 0;
+                vge = 0;
+                immge = false;
                 break;
             case IR_JZ:
             case IR_JNZ:
@@ -123,6 +201,19 @@ void optimize_loadstore(IRBlock* block) {
                     }
                     laststoreflag[f] = 0;
                 }
+                for (int s = 0; s < 32; s++) {
+                    if (laststorevfp[s] > jmpsource ||
+                        (vvfp[s] > jmpsource && !immvfp[s])) {
+                        vvfp[s] = 0;
+                        immvfp[s] = false;
+                    }
+                    laststorevfp[s] = 0;
+                }
+                if (laststorege > jmpsource || (vge > jmpsource && !immge)) {
+                    vge = 0;
+                    immge = false;
+                }
+                laststorege = 0;
                 break;
             }
             default:
@@ -595,11 +686,15 @@ void optimize_deadcode(IRBlock* block) {
     }
 }
 
+// detects loops that only read memory and registers and then branch back
+// without changing any of the state they read, like polling a flag that is set
+// by an interrupt or another thread
+// nothing else can run until the next scheduler event, so such loops end the
+// time slice instead of spinning through it
 void optimize_waitloop(IRBlock* block) {
 #define R(n) BIT(n)
 #define CPSR BIT(16)
 #define SPSR BIT(17)
-#define MEM BIT(18)
 #define LOAD(v) (loaded |= v);
 #define STORE(v) (loaded & (v) ? modified |= v : 0)
 
@@ -616,7 +711,8 @@ void optimize_waitloop(IRBlock* block) {
                 if (inst.op1 == 15 && inst.imm2 &&
                     inst.op2 == block->start_addr &&
                     block->code.d[i + 1].opcode == IR_NOP && !modified) {
-                    block->code.d[i + 1].opcode = IR_HALT;
+                    block->code.d[i + 1].opcode = IR_IDLE;
+                    g_jit_stats.idle_loops++;
                     return;
                 } else {
                     STORE(R(inst.op1));
@@ -631,7 +727,10 @@ void optimize_waitloop(IRBlock* block) {
             case IR_LOAD_CPSR:
                 LOAD(CPSR);
                 break;
-            case IR_STORE_CPSR:
+            case IR_LOAD_GE:
+                LOAD(CPSR);
+                break;
+            case IR_STORE_GE:
                 STORE(CPSR);
                 break;
             case IR_LOAD_SPSR:
@@ -640,35 +739,28 @@ void optimize_waitloop(IRBlock* block) {
             case IR_STORE_SPSR:
                 STORE(SPSR);
                 break;
-            case IR_LOAD_MEM8:
-                LOAD(MEM);
-                break;
-            case IR_LOAD_MEMS8:
-                LOAD(MEM);
-                break;
-            case IR_LOAD_MEM16:
-                LOAD(MEM);
-                break;
-            case IR_LOAD_MEMS16:
-                LOAD(MEM);
-                break;
-            case IR_LOAD_MEM32:
-                LOAD(MEM);
-                break;
+            // memory writes could be seen by the hardware or change what the
+            // loop reads, so any store means the loop is doing real work
             case IR_STORE_MEM8:
-                STORE(MEM);
-                break;
             case IR_STORE_MEM16:
-                STORE(MEM);
-                break;
             case IR_STORE_MEM32:
-                STORE(MEM);
-                break;
+            case IR_LOAD_REG_USR:
+            case IR_STORE_REG_USR:
+            case IR_STORE_CPSR:
+            case IR_STORE_THUMB:
+            case IR_MODESWITCH:
+            case IR_EXCEPTION:
+            case IR_LOAD_VFP:
+            case IR_STORE_VFP:
             case IR_VFP_DATA_PROC:
             case IR_VFP_LOAD_MEM:
             case IR_VFP_STORE_MEM:
             case IR_VFP_READ:
             case IR_VFP_WRITE:
+            case IR_VFP_READ64L:
+            case IR_VFP_READ64H:
+            case IR_VFP_WRITE64L:
+            case IR_VFP_WRITE64H:
             case IR_CP15_READ:
             case IR_CP15_WRITE:
                 return;
@@ -680,7 +772,6 @@ void optimize_waitloop(IRBlock* block) {
 #undef R
 #undef CPSR
 #undef SPSR
-#undef MEM
 #undef LOAD
 #undef STORE
 }
@@ -710,7 +801,7 @@ void optimize_blocklinking(IRBlock* block, ArmCore* cpu) {
                 break;
             case IR_MODESWITCH:
             case IR_EXCEPTION:
-            case IR_HALT:
+            case IR_IDLE:
             case IR_CP15_WRITE:
                 can_link = false;
                 break;
@@ -12,9 +12,29 @@ void find_uses(IRBlock* block, u32* vuses) {
     }
 }
 
+static bool is_float_op(IROpcode opc) {
+    return opc >= IR_FADD && opc <= IR_FABS;
+}
+
+// a value is a float if it comes from a vfp register or a float op and
+// nothing but float ops and vfp stores look at it
+void find_floats(IRBlock* block, bool* vfloat) {
+    for (int i = 0; i < block->code.size; i++) {
+        IRInstr inst = block->code.d[i];
+        vfloat[i] = inst.opcode == IR_LOAD_VFP || is_float_op(inst.opcode);
+        if (is_float_op(inst.opcode)) continue;
+        if (!inst.imm1) vfloat[inst.op1] = false;
+        if (!inst.imm2 && inst.opcode != IR_STORE_VFP) {
+            vfloat[inst.op2] = false;
+        }
+    }
+}
+
 RegAllocation allocate_registers(IRBlock* block) {
     u32 vuses[block->code.size];
     find_uses(block, vuses);
+    bool vfloat[block->code.size];
+    find_floats(block, vfloat);
 
     RegAllocation ret;
     Vec_init(ret.reg_info);
@@ -45,14 +65,14 @@ RegAllocation allocate_registers(IRBlock* block) {
         if (iropc_hasresult(inst.opcode)) {
             u32 assignment = -1;
             for (int r = 0; r < reg_active.size; r++) {
-                if (!reg_active.d[r]) {
+                if (!reg_active.d[r] && ret.reg_info.d[r].fp == vfloat[i]) {
                     assignment = r;
                     break;
                 }
             }
             if (assignment == -1) {
                 assignment = reg_active.size;
-                Vec_push(ret.reg_info, ((RegInfo) {0, REG_TEMP}));
+                Vec_push(ret.reg_info, ((RegInfo) {0, REG_TEMP, vfloat[i]}));
                 Vec_push(reg_active, true);
             }
             ret.reg_info.d[assignment].uses += 1 + vuses[i];
@@ -80,8 +100,11 @@ int compare(const void* i, const void* j) {
            regalloc_cmp->reg_info.d[*(int*) i].uses;
 }
 
+// floats go to simd registers, except ones that are live across a callback
+// since no simd registers are saved, those and any that don't fit go to the
+// stack
 HostRegAllocation allocate_host_registers(RegAllocation* regalloc, u32 ntemp,
-                                          u32 nsaved) {
+                                          u32 nsaved, u32 nfloat) {
     int nregs = regalloc->reg_info.size;
 
     HostRegAllocation ret = {};
@@ -94,9 +117,18 @@ HostRegAllocation allocate_host_registers(RegAllocation* regalloc, u32 ntemp,
     regalloc_cmp = regalloc;
     qsort(sorted, nregs, sizeof(int), compare);
 
+    for (int _i = 0; _i < nregs && ret.count[REG_FLOAT] < nfloat; _i++) {
+        int i = sorted[_i];
+        if (regalloc->reg_info.d[i].fp &&
+            regalloc->reg_info.d[i].type == REG_TEMP) {
+            ret.hostreg_info[i].type = REG_FLOAT;
+            ret.hostreg_info[i].index = ret.count[REG_FLOAT]++;
+        }
+    }
     for (int _i = 0; _i < nregs; _i++) {
         int i = sorted[_i];
         if (ret.hostreg_info[i].type == REG_NONE &&
+            !regalloc->reg_info.d[i].fp &&
             regalloc->reg_info.d[i].type == REG_TEMP) {
             ret.hostreg_info[i].type = REG_TEMP;
             ret.hostreg_info[i].index = ret.count[REG_TEMP]++;
@@ -105,7 +137,8 @@ HostRegAllocation allocate_host_registers(RegAllocation* regalloc, u32 ntemp,
     }
     for (int _i = 0; _i < nregs; _i++) {
         int i = sorted[_i];
-        if (ret.hostreg_info[i].type == REG_NONE) {
+        if (ret.hostreg_info[i].type == REG_NONE &&
+            !regalloc->reg_info.d[i].fp) {
             ret.hostreg_info[i].type = REG_SAVED;
             ret.hostreg_info[i].index = ret.count[REG_SAVED]++;
             if (ret.count[REG_SAVED] == nsaved) break;
@@ -130,7 +163,8 @@ void regalloc_print(RegAllocation* regalloc) {
 
     printf("Registers:");
     for (int i = 0; i < regalloc->reg_info.size; i++) {
-        printf(" $%d(%s,%d)", i, typenames[regalloc->reg_info.d[i].type],
+        printf(" $%d(%s%s,%d)", i, typenames[regalloc->reg_info.d[i].type],
+               regalloc->reg_info.d[i].fp ? ",fp" : "",
                regalloc->reg_info.d[i].uses);
     }
     printf("\nAssignments:");
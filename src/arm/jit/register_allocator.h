@@ -10,13 +10,17 @@ typedef enum {
     REG_TEMP,
     REG_SAVED,
     REG_STACK,
+    REG_FLOAT,
 
     REG_MAX
 } RegType;
 
+// float values that are only used by float ops and vfp stores are kept apart
+// from the rest so the backends can put them in simd registers
 typedef struct {
     u32 uses;
     RegType type;
+    bool fp;
 } RegInfo;
 
 typedef struct {
@@ -47,7 +51,7 @@ RegAllocation allocate_registers(IRBlock* block);
 void regalloc_free(RegAllocation* regalloc);
 
 HostRegAllocation allocate_host_registers(RegAllocation* regalloc, u32 ntemp,
-                                          u32 nsaved);
+                                          u32 nsaved, u32 nfloat);
 void hostregalloc_free(HostRegAllocation* hostregs);
 
 void regalloc_print(RegAllocation* regalloc);
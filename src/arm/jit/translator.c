@@ -656,12 +656,21 @@ DECL_ARM_COMPILE(pack_sat) {
             instr.pack_sat.u << 2 | instr.pack_sat.s << 1 | instr.pack_sat.h;
         u32 op2 = instr.pack_sat.shift & 1;
         switch (op1) {
-            case 0:
-                EMITV_STORE_REG(instr.pack_sat.rd,
-                                EMITVV(MEDIA_SEL,
-                                       EMIT_LOAD_REG(instr.pack_sat.rn),
-                                       EMIT_LOAD_REG(instr.pack_sat.rm)));
+            case 0: {
+                // expand each GE bit to a byte mask
+                u32 vrn = EMIT_LOAD_REG(instr.pack_sat.rn);
+                u32 vrm = EMIT_LOAD_REG(instr.pack_sat.rm);
+                EMIT00(LOAD_GE);
+                EMITVI(MUL, LASTV, 0x00204081);
+                EMITVI(AND, LASTV, 0x01010101);
+                u32 vmask = EMITVI(MUL, LASTV, 0xff);
+                u32 vsel = EMITVV(AND, vrn, vmask);
+                EMIT0V(NOT, vmask);
+                EMITVV(AND, vrm, LASTV);
+                EMITVV(OR, vsel, LASTV);
+                EMITV_STORE_REG(instr.pack_sat.rd, LASTV);
                 break;
+            }
             case 3:
                 if (op2) {
                     EMITV_STORE_REG(
@@ -693,10 +702,14 @@ DECL_ARM_COMPILE(parallel_arith) {
                         case 0:
                             EMITVV(MEDIA_UADD8, vrn, vrm);
                             EMITV_STORE_REG(instr.parallel_arith.rd, LASTV);
+                            EMITVV(MEDIA_GE_UADD8, vrn, vrm);
+                            EMIT0V(STORE_GE, LASTV);
                             break;
                         case 3:
                             EMITVV(MEDIA_USUB8, vrn, vrm);
                             EMITV_STORE_REG(instr.parallel_arith.rd, LASTV);
+                            EMITVV(MEDIA_GE_USUB8, vrn, vrm);
+                            EMIT0V(STORE_GE, LASTV);
                             break;
                     }
                 } else {
@@ -745,8 +758,10 @@ DECL_ARM_COMPILE(parallel_arith) {
                             lwarn("unknown parallel arith sadd8 %08x", instr.w);
                             break;
                         case 3:
-                            EMITVV(MEDIA_SSUB8, vrn, vrm);
+                            EMITVV(MEDIA_USUB8, vrn, vrm);
                             EMITV_STORE_REG(instr.parallel_arith.rd, LASTV);
+                            EMITVV(MEDIA_GE_SSUB8, vrn, vrm);
+                            EMIT0V(STORE_GE, LASTV);
                             break;
                     }
                 } else {
@@ -1168,16 +1183,32 @@ DECL_ARM_COMPILE(branch) {
 
 DECL_ARM_COMPILE(cp_double_reg_trans) {
     if ((instr.cp_double_reg_trans.cpnum & ~1) == 10) {
+        // the pair of single registers moved, a double register is the same
+        // as the two single registers it overlaps
+        u32 vm;
+        if (instr.cp_double_reg_trans.cpnum & 1) {
+            vm = instr.cp_double_reg_trans.crm << 1;
+        } else {
+            vm = instr.cp_double_reg_trans.crm << 1 |
+                 ((instr.cp_double_reg_trans.cp >> 1) & 1);
+        }
         if (instr.cp_double_reg_trans.l) {
-            u32 vlo = EMITI0(VFP_READ64L, instr.w);
-            u32 vhi = EMITI0(VFP_READ64H, instr.w);
-            EMITV_STORE_REG(instr.cp_double_reg_trans.rdlo, vlo);
-            EMITV_STORE_REG(instr.cp_double_reg_trans.rdhi, vhi);
+            if (vm < 31) {
+                u32 vlo = EMITI0(LOAD_VFP, vm);
+                u32 vhi = EMITI0(LOAD_VFP, vm + 1);
+                EMITV_STORE_REG(instr.cp_double_reg_trans.rdlo, vlo);
+                EMITV_STORE_REG(instr.cp_double_reg_trans.rdhi, vhi);
+            } else {
+                u32 vlo = EMITI0(VFP_READ64L, instr.w);
+                u32 vhi = EMITI0(VFP_READ64H, instr.w);
+                EMITV_STORE_REG(instr.cp_double_reg_trans.rdlo, vlo);
+                EMITV_STORE_REG(instr.cp_double_reg_trans.rdhi, vhi);
+            }
         } else {
             u32 vlo = EMIT_LOAD_REG(instr.cp_double_reg_trans.rdlo);
             u32 vhi = EMIT_LOAD_REG(instr.cp_double_reg_trans.rdhi);
-            EMITIV(VFP_WRITE64L, instr.w, vlo);
-            EMITIV(VFP_WRITE64H, instr.w, vhi);
+            EMITIV(STORE_VFP, vm, vlo);
+            if (vm < 31) EMITIV(STORE_VFP, vm + 1, vhi);
         }
     } else {
         lerror("unknown coprocessor cp%d", instr.cp_reg_trans.cpnum);
@@ -1213,9 +1244,96 @@ DECL_ARM_COMPILE(cp_data_trans) {
     return true;
 }
 
+// lowers single precision vfp arithmetic into ir float instructions so the
+// operands can stay in host registers across the block
+// returns false if the instruction needs to go through VFP_DATA_PROC
+static bool compile_vfp_arith(IRBlock* block, ArmInstr instr) {
+    if (instr.cp_data_proc.cpnum & 1) return false;
+
+    u32 vd =
+        instr.cp_data_proc.crd << 1 | ((instr.cp_data_proc.cpopc >> 2) & 1);
+    u32 vn = instr.cp_data_proc.crn << 1 | (instr.cp_data_proc.cp >> 2);
+    u32 vm = instr.cp_data_proc.crm << 1 | (instr.cp_data_proc.cp & 1);
+    bool op = instr.cp_data_proc.cp & 2;
+
+    u32 res;
+    switch (instr.cp_data_proc.cpopc & 0b1011) {
+        case 0:
+        case 1: {
+            u32 n = EMITI0(LOAD_VFP, vn);
+            u32 m = EMITI0(LOAD_VFP, vm);
+            u32 prod = EMITVV(FMUL, n, m);
+            u32 acc = EMITI0(LOAD_VFP, vd);
+            if (instr.cp_data_proc.cpopc & 1) {
+                if (op) {
+                    res = EMITVV(FADD, acc, prod);
+                    res = EMIT0V(FNEG, res);
+                } else {
+                    res = EMITVV(FSUB, prod, acc);
+                }
+            } else {
+                if (op) {
+                    res = EMITVV(FSUB, acc, prod);
+                } else {
+                    res = EMITVV(FADD, acc, prod);
+                }
+            }
+            break;
+        }
+        case 2:
+        case 3:
+        case 8: {
+            u32 n = EMITI0(LOAD_VFP, vn);
+            u32 m = EMITI0(LOAD_VFP, vm);
+            switch (instr.cp_data_proc.cpopc & 0b1011) {
+                case 2:
+                    res = EMITVV(FMUL, n, m);
+                    if (op) res = EMIT0V(FNEG, res);
+                    break;
+                case 3:
+                    if (op) {
+                        res = EMITVV(FSUB, n, m);
+                    } else {
+                        res = EMITVV(FADD, n, m);
+                    }
+                    break;
+                default:
+                    res = EMITVV(FDIV, n, m);
+                    break;
+            }
+            break;
+        }
+        case 11:
+            op = instr.cp_data_proc.cp & 4;
+            switch (instr.cp_data_proc.crn) {
+                case 0:
+                    res = EMITI0(LOAD_VFP, vm);
+                    if (op) res = EMIT0V(FABS, res);
+                    break;
+                case 1:
+                    res = EMITI0(LOAD_VFP, vm);
+                    if (op) {
+                        res = EMIT0V(FSQRT, res);
+                    } else {
+                        res = EMIT0V(FNEG, res);
+                    }
+                    break;
+                default:
+                    return false;
+            }
+            break;
+        default:
+            return false;
+    }
+    EMITIV(STORE_VFP, vd, res);
+    return true;
+}
+
 DECL_ARM_COMPILE(cp_data_proc) {
     if ((instr.cp_data_proc.cpnum & ~1) == 10) {
-        EMITI0(VFP_DATA_PROC, instr.w);
+        if (!compile_vfp_arith(block, instr)) {
+            EMITI0(VFP_DATA_PROC, instr.w);
+        }
     } else {
         lerror("unknown coprocessor cp%d", instr.cp_reg_trans.cpnum);
     }
@@ -1224,8 +1342,19 @@ DECL_ARM_COMPILE(cp_data_proc) {
 
 DECL_ARM_COMPILE(cp_reg_trans) {
     if ((instr.cp_reg_trans.cpnum & ~1) == 10) {
+        // cpopc 7 is for the special registers, otherwise it moves a single
+        // register or half of a double register
+        u32 vn = instr.cp_reg_trans.crn << 1;
+        if (instr.cp_reg_trans.cpnum & 1) vn |= instr.cp_reg_trans.cpopc & 1;
+        else vn |= instr.cp_reg_trans.cp >> 2;
+        bool special = instr.cp_reg_trans.cpopc == 7;
+
         if (instr.cp_reg_trans.l) {
-            EMITI0(VFP_READ, instr.w);
+            if (special) {
+                EMITI0(VFP_READ, instr.w);
+            } else {
+                EMITI0(LOAD_VFP, vn);
+            }
             if (instr.cp_reg_trans.rd == 15) {
                 u32 tmp = EMITVI(AND, LASTV, 0xf0000000);
                 EMIT00(LOAD_CPSR);
@@ -1237,7 +1366,11 @@ DECL_ARM_COMPILE(cp_reg_trans) {
             }
         } else {
             EMIT_LOAD_REG(instr.cp_reg_trans.rd);
-            EMITIV(VFP_WRITE, instr.w, LASTV);
+            if (special) {
+                EMITIV(VFP_WRITE, instr.w, LASTV);
+            } else {
+                EMITIV(STORE_VFP, vn, LASTV);
+            }
         }
     } else if (instr.cp_reg_trans.cpnum == 15 &&
                instr.cp_reg_trans.cpopc == 0) {
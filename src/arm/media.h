@@ -3,14 +3,17 @@
 
 #include "arm_core.h"
 
-u32 media_uadd8(ArmCore* cpu, u32 a, u32 b);
-u32 media_usub8(ArmCore* cpu, u32 a, u32 b);
-u32 media_uqadd8(ArmCore* cpu, u32 a, u32 b);
-u32 media_uqsub8(ArmCore* cpu, u32 a, u32 b);
-u32 media_uhadd8(ArmCore* cpu, u32 a, u32 b);
-u32 media_ssub8(ArmCore* cpu, u32 a, u32 b);
-u32 media_qsub8(ArmCore* cpu, u32 a, u32 b);
+u32 media_uadd8(u32 a, u32 b);
+u32 media_usub8(u32 a, u32 b);
+u32 media_uqadd8(u32 a, u32 b);
+u32 media_uqsub8(u32 a, u32 b);
+u32 media_uhadd8(u32 a, u32 b);
+u32 media_qsub8(u32 a, u32 b);
 
-u32 media_sel(ArmCore* cpu, u32 a, u32 b);
+// the GE flags are computed separately from the result since they are only
+// needed when something like sel reads them
+u32 media_ge_uadd8(u32 a, u32 b);
+u32 media_ge_usub8(u32 a, u32 b);
+u32 media_ge_ssub8(u32 a, u32 b);
 
 #endif
@@ -3,6 +3,7 @@
 #include "emulator.h"
 
 #include "aac.h"
+#include "dspmix.h"
 #include "dspstructs.h"
 
 #include "dspptr.inc"
@@ -168,7 +169,8 @@ void refill_bufs(DSP* dsp, int ch, DSPInputConfig* cfg) {
     }
 }
 
-void dsp_process_chn(DSP* dsp, DSPMemory* m, int ch, s32 (*mixer)[2]) {
+void dsp_process_chn(DSP* dsp, DSPMemory* m, int ch,
+                     s32 (*mixer)[FRAME_SAMPLES]) {
     auto cfg = &m->input_cfg[ch];
     auto stat = &m->input_status[ch];
 
@@ -186,25 +188,32 @@ void dsp_process_chn(DSP* dsp, DSPMemory* m, int ch, s32 (*mixer)[2]) {
         cfg->dirty_flags &= ~(DIRTY_RESET | DIRTY_PARTIAL_RESET);
         linfo("ch%d reset", ch);
         reset_chn(dsp, ch, stat);
+        dsp_resample_reset(&dsp->resamplers[ch]);
     }
 
     stat->active = cfg->active;
 
-    u32 nSamples = FRAME_SAMPLES * cfg->rate;
-
-    s16 lsamples[nSamples] = {};
-    s16 rsamples[nSamples] = {};
+    auto rs = &dsp->resamplers[ch];
+    u32 step = dsp_resample_step(cfg->rate);
+    u32 nSamples = dsp_resample_len(rs, step);
+    bool stereo = cfg->format.num_chan == 2;
+
+    // the resampler fills the space before the new samples with the end of
+    // the last frame
+    alignas(16) s16 lsamples[RESAMPLE_TAPS + RESAMPLE_MAX_LEN];
+    alignas(16) s16 rsamples[RESAMPLE_TAPS + RESAMPLE_MAX_LEN];
+    s16* ldst = &lsamples[RESAMPLE_TAPS];
+    s16* rdst = &rsamples[RESAMPLE_TAPS];
     u32 curSample = 0;
 
-    s32 lframe[FRAME_SAMPLES] = {};
-    s32 rframe[FRAME_SAMPLES] = {};
+    alignas(16) s32 frame[2][FRAME_SAMPLES];
 
-    if (!stat->active) goto dsp_ch_end;
+    if (!stat->active) goto dsp_ch_silent;
 
     update_bufs(dsp, ch, cfg);
     refill_bufs(dsp, ch, cfg);
 
-    if (!dsp->bufQueues[ch].size) goto dsp_ch_end;
+    if (!dsp->bufQueues[ch].size) goto dsp_ch_silent;
 
     u32 rem = nSamples;
     while (rem > 0) {
@@ -221,105 +230,64 @@ void dsp_process_chn(DSP* dsp, DSPMemory* m, int ch, s32 (*mixer)[2]) {
 
         if (!buf->paddr) {
             lwarn("null audio buffer");
-        } else if (cfg->format.num_chan == 2) {
+            memset(&ldst[curSample], 0, bufRem * sizeof(s16));
+            memset(&rdst[curSample], 0, bufRem * sizeof(s16));
+        } else if (stereo) {
             switch (cfg->format.codec) {
                 case DSPFMT_PCM16: {
                     s16(*src)[2] = PTR(buf->paddr);
+                    src += buf->pos;
                     for (int s = 0; s < bufRem; s++) {
-                        lsamples[curSample] = src[buf->pos][0];
-                        rsamples[curSample] = src[buf->pos][1];
-                        curSample++;
-                        buf->pos++;
+                        ldst[curSample + s] = src[s][0];
+                        rdst[curSample + s] = src[s][1];
                     }
                     break;
                 }
                 case DSPFMT_PCM8: {
                     s8(*src)[2] = PTR(buf->paddr);
+                    src += buf->pos;
                     for (int s = 0; s < bufRem; s++) {
-                        lsamples[curSample] = src[buf->pos][0];
-                        rsamples[curSample] = src[buf->pos][1];
-                        curSample++;
-                        buf->pos++;
+                        ldst[curSample + s] = src[s][0];
+                        rdst[curSample + s] = src[s][1];
                     }
                     break;
                 }
                 case DSPFMT_ADPCM:
                     lwarn("stereo adpcm?");
+                    memset(&ldst[curSample], 0, bufRem * sizeof(s16));
+                    memset(&rdst[curSample], 0, bufRem * sizeof(s16));
+                    break;
             }
         } else {
+            // mono sources are only decoded and resampled once
             switch (cfg->format.codec) {
                 case DSPFMT_PCM16: {
                     // easy
                     s16* src = PTR(buf->paddr);
-                    memcpy(&lsamples[curSample], &src[buf->pos],
+                    memcpy(&ldst[curSample], &src[buf->pos],
                            bufRem * sizeof(s16));
-                    memcpy(&rsamples[curSample], &src[buf->pos],
-                           bufRem * sizeof(s16));
-                    curSample += bufRem;
-                    buf->pos += bufRem;
                     break;
                 }
                 case DSPFMT_PCM8: {
                     s8* src = PTR(buf->paddr);
+                    src += buf->pos;
                     for (int s = 0; s < bufRem; s++) {
-                        lsamples[curSample] = src[buf->pos];
-                        rsamples[curSample] = src[buf->pos];
-                        curSample++;
-                        buf->pos++;
+                        ldst[curSample + s] = src[s];
                     }
                     break;
                 }
-                case DSPFMT_ADPCM: {
-                    // https://github.com/Thealexbarney/DspTool/blob/master/dsptool/decode.c
-
-                    u8* src = PTR(buf->paddr);
-                    // get back to where we were in the buffer
+                case DSPFMT_ADPCM:
                     // i am assuming play pos does not count the index bytes
                     // as samples
-                    src += (buf->pos / 14) * 8;
-                    if (buf->pos % 14 > 0) {
-                        src += 1 + (buf->pos % 14) / 2;
-                    }
-
-                    auto coeffs = m->input_adpcm_coeffs[ch];
-
-                    for (int s = 0; s < bufRem; s++) {
-                        // every 14 samples there is a new index
-                        if (buf->pos % 14 == 0) {
-                            buf->adpcm.indexScale = *src++;
-                        }
-
-                        int diff =
-                            (sbit(4))((buf->pos++ & 1) ? *src++ : *src >> 4);
-                        diff <<= buf->adpcm.scale;
-                        // adpcm coeffs are fixed s5.11
-                        // samples are fixed s1.15
-
-                        int sample =
-                            coeffs[buf->adpcm.index][0] *
-                                buf->adpcm.history[0] +
-                            coeffs[buf->adpcm.index][1] * buf->adpcm.history[1];
-                        // sample is now fixed s6.26
-                        sample += BIT(10); // round instead of floor
-                        sample >>= 11;     // make it s6.15
-                        sample += diff;
-                        // clamp sample back to -1,1
-                        if (sample > INT16_MAX) sample = INT16_MAX;
-                        if (sample < INT16_MIN) sample = INT16_MIN;
-
-                        // update history
-                        buf->adpcm.history[1] = buf->adpcm.history[0];
-                        buf->adpcm.history[0] = sample;
-
-                        lsamples[curSample] = sample;
-                        rsamples[curSample] = sample;
-                        curSample++;
-                    }
+                    dsp_adpcm_decode(&buf->adpcm, m->input_adpcm_coeffs[ch],
+                                     PTR(buf->paddr), buf->pos, bufRem,
+                                     &ldst[curSample]);
                     break;
-                }
             }
         }
 
+        curSample += bufRem;
+        buf->pos += bufRem;
         rem -= bufRem;
 
         if (buf->pos == buf->len) {
@@ -335,6 +303,12 @@ void dsp_process_chn(DSP* dsp, DSPMemory* m, int ch, s32 (*mixer)[2]) {
         }
     }
 
+    // pad with silence if we ran out of data
+    memset(&ldst[curSample], 0, (nSamples - curSample) * sizeof(s16));
+    if (stereo) {
+        memset(&rdst[curSample], 0, (nSamples - curSample) * sizeof(s16));
+    }
+
     if (dsp->bufQueues[ch].size) {
         stat->cur_buf = FIFO_peek(dsp->bufQueues[ch]).id;
         SETDSPU32(stat->pos, FIFO_peek(dsp->bufQueues[ch]).pos);
@@ -343,50 +317,32 @@ void dsp_process_chn(DSP* dsp, DSPMemory* m, int ch, s32 (*mixer)[2]) {
         reset_chn(dsp, ch, stat);
     }
 
-    // attempt to interpolate samples
-
-    for (int s = 0; s < FRAME_SAMPLES; s++) {
-        float pos = (float) s * nSamples / FRAME_SAMPLES;
-        if (pos < 0) pos = 0;
-        if (pos >= nSamples) pos = nSamples - 1;
-        switch (cfg->interp_mode) {
-            case DSPINTRP_NEAREST:
-                lframe[s] = lsamples[(int) pos];
-                rframe[s] = rsamples[(int) pos];
-                break;
-            case DSPINTRP_LINEAR:
-            case DSPINTRP_POLYPHASE: {
-                float frac = pos - (int) pos;
-                int pos0 = (int) pos;
-                int pos1 = (int) pos + 1;
-                if (pos1 >= nSamples) pos1 = nSamples - 1;
-                lframe[s] = lsamples[pos0] * (1 - frac) + lsamples[pos1] * frac;
-                rframe[s] = rsamples[pos0] * (1 - frac) + rsamples[pos1] * frac;
-                break;
-            }
-        }
-    }
-
     // dsp does 4-channel mixing instead of just 2
+    // resampling, gain and mixing into the bus are all done in one pass
+    dsp_resample_mix(rs, cfg->interp_mode, step, (s16*[]) {lsamples, rsamples},
+                     stereo, cfg->mix[0],
+                     (g_dsp_chn_disable & BIT(ch)) ? nullptr : mixer, frame);
 
+    dsp->silent[ch] = 0;
     for (int s = 0; s < FRAME_SAMPLES; s++) {
-        lframe[s] *= cfg->mix[0][0];
-        rframe[s] *= cfg->mix[0][1];
+        FIFO_push(g_dsp_chn_hist[ch][0], frame[0][s]);
+        FIFO_push(g_dsp_chn_hist[ch][1], frame[1][s]);
     }
-
-    if (g_dsp_chn_disable & BIT(ch)) goto dsp_ch_end;
-
-    for (int s = 0; s < FRAME_SAMPLES; s++) {
-        mixer[s][0] += lframe[s];
-        mixer[s][1] += rframe[s];
+    goto dsp_ch_end;
+
+dsp_ch_silent:
+    // nothing to resample, start fresh when the channel plays again
+    dsp_resample_reset(rs);
+    // once the histories are full of zeros there is nothing left to push
+    if (dsp->silent[ch] < FIFO_MAX(g_dsp_chn_hist[ch][0])) {
+        for (int s = 0; s < FRAME_SAMPLES; s++) {
+            FIFO_push(g_dsp_chn_hist[ch][0], 0);
+            FIFO_push(g_dsp_chn_hist[ch][1], 0);
+        }
+        dsp->silent[ch] += FRAME_SAMPLES;
     }
 
 dsp_ch_end:
-    for (int s = 0; s < FRAME_SAMPLES; s++) {
-        FIFO_push(g_dsp_chn_hist[ch][0], lframe[s]);
-        FIFO_push(g_dsp_chn_hist[ch][1], rframe[s]);
-    }
-
     // this bit is extremely important
     stat->cur_buf_dirty = stat->cur_buf != og_cur_buf;
 }
@@ -403,8 +359,8 @@ void dsp_process_frame(DSP* dsp) {
 
     linfo("frame count=%d", m->frame_count);
 
-    // interleaved stereo
-    s32 mixer[FRAME_SAMPLES][2] = {};
+    // planar stereo so channels can be mixed in with vector adds
+    alignas(16) s32 mixer[2][FRAME_SAMPLES] = {};
 
     for (int i = 0; i < 24; i++) {
         dsp_process_chn(dsp, m, i, mixer);
@@ -413,17 +369,17 @@ void dsp_process_frame(DSP* dsp) {
     // presumably we are supposed to do things here too
 
     for (int s = 0; s < FRAME_SAMPLES; s++) {
-        mixer[s][0] *= m->master_cfg.master_vol;
-        mixer[s][1] *= m->master_cfg.master_vol;
+        mixer[0][s] *= m->master_cfg.master_vol;
+        mixer[1][s] *= m->master_cfg.master_vol;
 
-        FIFO_push(g_dsp_hist[0], mixer[s][0]);
-        FIFO_push(g_dsp_hist[1], mixer[s][1]);
+        FIFO_push(g_dsp_hist[0], mixer[0][s]);
+        FIFO_push(g_dsp_hist[1], mixer[1][s]);
     }
 
     s16 final[FRAME_SAMPLES][2];
     for (int s = 0; s < FRAME_SAMPLES; s++) {
-        final[s][0] = clamp16(mixer[s][0] * (ctremu.volume / 100.f));
-        final[s][1] = clamp16(mixer[s][1] * (ctremu.volume / 100.f));
+        final[s][0] = clamp16(mixer[0][s] * (ctremu.volume / 100.f));
+        final[s][1] = clamp16(mixer[1][s] * (ctremu.volume / 100.f));
     }
 
     if (ctremu.audio_cb) ctremu.audio_cb(final, FRAME_SAMPLES);
@@ -433,5 +389,7 @@ void dsp_reset(DSP* dsp) {
     dsp->audio_pipe_pos = 0;
     for (int i = 0; i < DSP_CHANNELS; i++) {
         FIFO_clear(dsp->bufQueues[i]);
+        dsp_resample_reset(&dsp->resamplers[i]);
+        dsp->silent[i] = 0;
     }
 }
@@ -38,6 +38,14 @@ typedef struct {
     u16 id;
 } BufInfo;
 
+#define RESAMPLE_TAPS 4
+
+// resampling state carried between frames
+typedef struct {
+    u32 phase; // 16.16 fractional position in the input
+    s16 hist[2][RESAMPLE_TAPS];
+} DSPResampler;
+
 typedef struct {
 #ifdef FASTMEM
     u8* mem;
@@ -56,6 +64,11 @@ typedef struct {
     // because games overwrite them before they finish playing
     FIFO(BufInfo, 4) bufQueues[DSP_CHANNELS];
 
+    DSPResampler resamplers[DSP_CHANNELS];
+    // samples of silence pushed to the channel histories since the channel
+    // last played
+    u32 silent[DSP_CHANNELS];
+
 } DSP;
 
 typedef FIFO(s32, 32768) DSPSampHist;
@@ -0,0 +1,188 @@
+#include "dspmix.h"
+
+#include <math.h>
+
+#include "dspstructs.h"
+
+// the signal path of a channel: decoding the source buffer, resampling it to
+// the output rate and mixing it into the bus
+// resampling is streaming, the fractional position and the last few input
+// samples carry over to the next frame so there are no seams or drift at
+// frame boundaries
+
+typedef float v4f __attribute__((vector_size(16)));
+typedef s32 v4i __attribute__((vector_size(16)));
+typedef u32 v4u __attribute__((vector_size(16)));
+typedef s16 v4s __attribute__((vector_size(8)));
+
+#define POLYPHASE_BITS 8
+#define POLYPHASE_PHASES BIT(POLYPHASE_BITS)
+
+// one row of taps for each fractional position
+static alignas(16) float polyphase_taps[POLYPHASE_PHASES][RESAMPLE_TAPS];
+static bool polyphase_ready;
+
+// 4 tap lanczos (windowed sinc) filter, normalized so each phase has unity
+// gain
+static void init_polyphase() {
+    for (int p = 0; p < POLYPHASE_PHASES; p++) {
+        float f = (float) p / POLYPHASE_PHASES;
+        float sum = 0;
+        for (int t = 0; t < RESAMPLE_TAPS; t++) {
+            float x = (t - 1) - f;
+            float w = 1;
+            if (x != 0) {
+                w = 2 * sinf(M_PI * x) * sinf(M_PI * x / 2) /
+                    (M_PI * M_PI * x * x);
+            }
+            polyphase_taps[p][t] = w;
+            sum += w;
+        }
+        for (int t = 0; t < RESAMPLE_TAPS; t++) {
+            polyphase_taps[p][t] /= sum;
+        }
+    }
+    polyphase_ready = true;
+}
+
+// adpcm data is in frames of 8 bytes, a header with the predictor index and
+// scale followed by 14 4-bit samples
+// https://github.com/Thealexbarney/DspTool/blob/master/dsptool/decode.c
+void dsp_adpcm_decode(ADPCMData* st, s16 (*coeffs)[2], u8* buf, u32 pos,
+                      u32 count, s16* out) {
+    u8* src = buf + (pos / 14) * 8;
+    u32 i = pos % 14;
+    s32 h0 = st->history[0];
+    s32 h1 = st->history[1];
+    while (count) {
+        // the header is only read at the start of a frame, if we are resuming
+        // in the middle of one it is already in st
+        if (i == 0) st->indexScale = src[0];
+        u32 n = 14 - i;
+        if (n > count) n = count;
+
+        // unpack the whole frame first, only the filter is serial
+        s32 diff[14];
+        for (int k = 0; k < 7; k++) {
+            diff[2 * k] = (sbit(4)) (src[1 + k] >> 4);
+            diff[2 * k + 1] = (sbit(4)) src[1 + k];
+        }
+
+        // adpcm coeffs are fixed s5.11
+        // samples are fixed s1.15
+        s32 c0 = coeffs[st->index][0];
+        s32 c1 = coeffs[st->index][1];
+        int scale = st->scale;
+        for (u32 k = i; k < i + n; k++) {
+            // sample is fixed s6.26 until we round and shift it
+            s32 sample = c0 * h0 + c1 * h1;
+            sample = (sample + (1 << 10)) >> 11;
+            sample += diff[k] << scale;
+            // clamp sample back to -1,1
+            if (sample > INT16_MAX) sample = INT16_MAX;
+            if (sample < INT16_MIN) sample = INT16_MIN;
+            h1 = h0;
+            h0 = sample;
+            *out++ = sample;
+        }
+
+        count -= n;
+        i += n;
+        if (i == 14) {
+            i = 0;
+            src += 8;
+        }
+    }
+    st->history[0] = h0;
+    st->history[1] = h1;
+}
+
+// rate is input samples per output sample
+u32 dsp_resample_step(float rate) {
+    if (!(rate > 0)) return 0;
+    if (rate > RESAMPLE_MAX_RATE) rate = RESAMPLE_MAX_RATE;
+    return rate * 0x10000 + 0.5f;
+}
+
+// number of new input samples consumed by the next frame
+u32 dsp_resample_len(DSPResampler* rs, u32 step) {
+    return (rs->phase + FRAME_SAMPLES * step) >> 16;
+}
+
+void dsp_resample_reset(DSPResampler* rs) {
+    *rs = (DSPResampler) {};
+}
+
+// 4 output samples at positions pos, measured from b[1]
+static inline v4f resample4(int mode, s16* b, v4u pos) {
+    v4u idx = pos >> 16;
+    v4f res;
+    switch (mode) {
+        case DSPINTRP_NEAREST:
+            for (int k = 0; k < 4; k++) {
+                res[k] = b[idx[k] + 1];
+            }
+            break;
+        case DSPINTRP_LINEAR: {
+            v4f s0, s1;
+            for (int k = 0; k < 4; k++) {
+                s0[k] = b[idx[k] + 1];
+                s1[k] = b[idx[k] + 2];
+            }
+            v4f frac = __builtin_convertvector(pos & 0xffff, v4f) *
+                       (1.f / 0x10000);
+            res = s0 + (s1 - s0) * frac;
+            break;
+        }
+        default: {
+            v4u phase = (pos & 0xffff) >> (16 - POLYPHASE_BITS);
+            for (int k = 0; k < 4; k++) {
+                v4s raw;
+                memcpy(&raw, &b[idx[k]], sizeof raw);
+                v4f m = __builtin_convertvector(raw, v4f) *
+                        *(v4f*) polyphase_taps[phase[k]];
+                res[k] = (m[0] + m[1]) + (m[2] + m[3]);
+            }
+            break;
+        }
+    }
+    return res;
+}
+
+// in holds RESAMPLE_TAPS free samples followed by the new input for the
+// frame, which are filled with the history from the previous frame
+// the left and right outputs are scaled by their gain, written to out and
+// added to bus if it is not null
+void dsp_resample_mix(DSPResampler* rs, int mode, u32 step, s16** in,
+                      bool stereo, float* gain, s32 (*bus)[FRAME_SAMPLES],
+                      s32 (*out)[FRAME_SAMPLES]) {
+    if (mode == DSPINTRP_POLYPHASE && !polyphase_ready) init_polyphase();
+
+    u32 len = dsp_resample_len(rs, step);
+    int nsides = stereo ? 2 : 1;
+    for (int i = 0; i < nsides; i++) {
+        memcpy(in[i], rs->hist[i], sizeof rs->hist[i]);
+    }
+
+    v4u pos = rs->phase + (v4u) {0, 1, 2, 3} * step;
+    v4f gl = {gain[0], gain[0], gain[0], gain[0]};
+    v4f gr = {gain[1], gain[1], gain[1], gain[1]};
+    for (int s = 0; s < FRAME_SAMPLES; s += 4) {
+        v4f l = resample4(mode, in[0], pos);
+        v4f r = stereo ? resample4(mode, in[1], pos) : l;
+        v4i li = __builtin_convertvector(l * gl, v4i);
+        v4i ri = __builtin_convertvector(r * gr, v4i);
+        memcpy(&out[0][s], &li, sizeof li);
+        memcpy(&out[1][s], &ri, sizeof ri);
+        if (bus) {
+            *(v4i*) &bus[0][s] += li;
+            *(v4i*) &bus[1][s] += ri;
+        }
+        pos += 4 * step;
+    }
+
+    for (int i = 0; i < nsides; i++) {
+        memcpy(rs->hist[i], &in[i][len], sizeof rs->hist[i]);
+    }
+    rs->phase = (rs->phase + FRAME_SAMPLES * step) & 0xffff;
+}
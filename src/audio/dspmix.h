@@ -0,0 +1,23 @@
+#ifndef DSPMIX_H
+#define DSPMIX_H
+
+#include "common.h"
+
+#include "dsp.h"
+
+// the largest sample rate ratio we resample from, 16x is way beyond anything
+// games use and keeps the per frame input buffer on the stack small
+#define RESAMPLE_MAX_RATE 16
+#define RESAMPLE_MAX_LEN (FRAME_SAMPLES * RESAMPLE_MAX_RATE)
+
+void dsp_adpcm_decode(ADPCMData* st, s16 (*coeffs)[2], u8* buf, u32 pos,
+                      u32 count, s16* out);
+
+u32 dsp_resample_step(float rate);
+u32 dsp_resample_len(DSPResampler* rs, u32 step);
+void dsp_resample_mix(DSPResampler* rs, int mode, u32 step, s16** in,
+                      bool stereo, float* gain, s32 (*bus)[FRAME_SAMPLES],
+                      s32 (*out)[FRAME_SAMPLES]);
+void dsp_resample_reset(DSPResampler* rs);
+
+#endif
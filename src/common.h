@@ -8,6 +8,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #define eprintf(format, ...) fprintf(stderr, format __VA_OPT__(, ) __VA_ARGS__)
 #define printfln(format, ...) printf(format "\n" __VA_OPT__(, ) __VA_ARGS__)
@@ -70,6 +71,13 @@ typedef float fvec4[4];
 
 #define countof(a) (sizeof a / sizeof *a)
 
+// monotonic host time for measuring how long things take
+static inline u64 time_now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1'000'000'000ull + ts.tv_nsec;
+}
+
 // N must be a power of 2
 #define FIFO(T, N)                                                             \
     struct {                                                                   \
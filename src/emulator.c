@@ -7,6 +7,7 @@
 #include "3ds.h"
 #include "arm/jit/jit.h"
 #include "config.h"
+#include "perfmap.h"
 
 #ifdef _WIN32
 #define mkdir(path, ...) mkdir(path)
@@ -25,7 +26,10 @@ void emulator_load_default_settings() {
     ctremu.outputfilter = FILTER_LINEAR;
     ctremu.videoscale = 1;
     ctremu.vshthreads = 0;
+    ctremu.swrenderer = false;
+    ctremu.swrenderthreads = 3;
     ctremu.shaderjit = true;
+    ctremu.specializeShaders = true;
     ctremu.hwvshaders = true;
     ctremu.safeShaderMul = true;
     ctremu.ubershader = false;
@@ -42,7 +46,19 @@ void emulator_load_default_settings() {
     g_jit_config.max_block_instrs = 128;
     g_jit_config.optimize = true;
     g_jit_config.linking = true;
+    g_jit_config.idle_loops = true;
     ctremu.ignore_null = false;
+    ctremu.hugepages = true;
+    ctremu.prefaultmem = false;
+
+    ctremu.rewind = false;
+#if defined(__linux__) && defined(__x86_64__)
+    ctremu.rewindinterval = 1;
+#else
+    // without soft dirty bits every snapshot hashes all of memory
+    ctremu.rewindinterval = 8;
+#endif
+    ctremu.rewindbudget = 256;
     ctremu.micEnable = true;
     ctremu.camEnable = true;
 
@@ -88,6 +104,7 @@ void emulator_init() {
     mkdir("3ds/sys_files", S_IRWXU);
     mkdir("3ds/sdmc", S_IRWXU);
     mkdir("3ds/sdmc/3ds", S_IRWXU);
+    mkdir("3ds/states", S_IRWXU);
     // homebrew needs this file to exist but the contents dont matter for hle
     // audio
     FILE* fp;
@@ -103,9 +120,18 @@ void emulator_init() {
     if (ctremu.vshthreads > MAX_VSH_THREADS)
         ctremu.vshthreads = MAX_VSH_THREADS;
     if (ctremu.vshthreads < 0) ctremu.vshthreads = 0;
+    if (ctremu.swrenderthreads > MAX_RAST_THREADS)
+        ctremu.swrenderthreads = MAX_RAST_THREADS;
+    if (ctremu.swrenderthreads < 0) ctremu.swrenderthreads = 0;
     if (ctremu.volume < 0) ctremu.volume = 0;
     if (ctremu.volume > 200) ctremu.volume = 200;
+    if (ctremu.rewindinterval < 1) ctremu.rewindinterval = 1;
+    if (ctremu.rewindbudget < 16) ctremu.rewindbudget = 16;
     ctremu.ubershader = false;
+#ifdef NOJIT
+    // the shader jit also needs executable memory
+    ctremu.shaderjit = false;
+#endif
 
     save_config();
 }
@@ -116,6 +142,8 @@ void emulator_quit() {
         ctremu.initialized = false;
     }
 
+    perfmap_close();
+
     free(ctremu.romfilenoext);
     free(ctremu.romfile);
     ctremu.romfile = nullptr;
@@ -158,6 +186,11 @@ void emulator_set_rom(const char* filename) {
     else ctremu.romfilenodir = ctremu.romfile;
     ctremu.romfilenoext = strdup(ctremu.romfilenodir);
     char* c = strrchr(ctremu.romfilenoext, '.');
+    // a compressed rom has the extension of the image before .zst
+    if (c && !strcmp(c, ".zst")) {
+        *c = '\0';
+        c = strrchr(ctremu.romfilenoext, '.');
+    }
     if (c) *c = '\0';
 }
 
@@ -179,6 +212,24 @@ bool emulator_reset() {
     return true;
 }
 
+// one state slot per game, saving again adds to it until it is rewritten
+void emulator_save_state() {
+    if (!ctremu.initialized) return;
+    char* path;
+    asprintf(&path, "3ds/states/%s.state", ctremu.system.romimage.name);
+    savestate_save(&ctremu.system, path);
+    free(path);
+}
+
+bool emulator_load_state() {
+    if (!ctremu.initialized) return false;
+    char* path;
+    asprintf(&path, "3ds/states/%s.state", ctremu.system.romimage.name);
+    bool ok = savestate_load(&ctremu.system, path);
+    free(path);
+    return ok;
+}
+
 void emulator_calc_viewports() {
     int swt, swb;
     if (ctremu.swapscreens) {
@@ -50,18 +50,25 @@ typedef struct {
     char* history[HISTORYLEN];
 
     bool initialized;
+    bool headless; // no window and no gl context
     bool running;
     bool fastforward;
     bool pause;
     bool mute;
     bool fullscreen;
     bool pending_reset;
+    bool pending_savestate;
+    bool pending_loadstate;
+    bool pending_rewind;
 
     bool vsync;
     bool audiosync;
     int videoscale;
     bool shaderjit;
+    bool specializeShaders;
     int vshthreads;
+    bool swrenderer;
+    int swrenderthreads;
     bool hwvshaders;
     bool safeShaderMul;
     bool ubershader;
@@ -90,6 +97,12 @@ typedef struct {
     bool detectRegion;
 
     bool ignore_null;
+    bool hugepages;
+    bool prefaultmem;
+
+    bool rewind;
+    int rewindinterval;
+    int rewindbudget;
 
     struct {
         struct {
@@ -125,6 +138,9 @@ void emulator_quit();
 
 bool emulator_reset();
 
+void emulator_save_state();
+bool emulator_load_state();
+
 void emulator_calc_viewports();
 
 void emulator_load_default_settings();
@@ -0,0 +1,325 @@
+#include "gamelist.h"
+
+#include <dirent.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <sys/stat.h>
+
+#include "kernel/loader.h"
+#include "unicode.h"
+
+#define CACHE_MAGIC 0x4c473354 // T3GL
+
+static struct {
+    pthread_t thread;
+    bool running;
+    char* dir;
+
+    pthread_mutex_t lock;
+    bool die;
+    bool done;
+
+    // every file in the folder, followed by the cached files from other
+    // folders so they are written back
+    Vec(GameInfo*) files;
+    Vec(GameInfo*) todo; // files the workers still have to open
+    u32 next;
+    Vec(GameInfo*) found; // games for the ui, up to taken were handed out
+    u32 taken;
+
+    Vec(GameInfo*) cached; // sorted by path
+} scan = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+static int compar_path(GameInfo** a, GameInfo** b) {
+    return strcmp((*a)->path, (*b)->path);
+}
+
+static bool scan_dying() {
+    pthread_mutex_lock(&scan.lock);
+    bool res = scan.die;
+    pthread_mutex_unlock(&scan.lock);
+    return res;
+}
+
+static void cache_load() {
+    FILE* fp = fopen(GAMELIST_CACHE, "rb");
+    if (!fp) return;
+
+    u32 hdr[3];
+    if (fread(hdr, sizeof hdr, 1, fp) != 1 || hdr[0] != CACHE_MAGIC ||
+        hdr[1] != GAMELIST_CACHE_VERSION) {
+        fclose(fp);
+        return;
+    }
+    // a truncated cache keeps the entries before the damage
+    for (u32 i = 0; i < hdr[2]; i++) {
+        u32 len;
+        if (fread(&len, sizeof len, 1, fp) != 1 || len > 4096) break;
+        GameInfo* g = calloc(1, sizeof *g);
+        g->path = calloc(len + 1, 1);
+        u8 valid = 0;
+        bool ok = fread(g->path, 1, len, fp) == len &&
+                  fread(&g->filesize, sizeof g->filesize, 1, fp) == 1 &&
+                  fread(&g->mtime, sizeof g->mtime, 1, fp) == 1 &&
+                  fread(&valid, 1, 1, fp) == 1;
+        g->valid = valid;
+        if (ok && g->valid) ok = fread(&g->meta, sizeof g->meta, 1, fp) == 1;
+        g->meta.gamename[countof(g->meta.gamename) - 1] = '\0';
+        g->meta.publisher[countof(g->meta.publisher) - 1] = '\0';
+        if (!ok) {
+            free(g->path);
+            free(g);
+            break;
+        }
+        Vec_push(scan.cached, g);
+    }
+    fclose(fp);
+
+    qsort(scan.cached.d, scan.cached.size, sizeof scan.cached.d[0],
+          (void*) compar_path);
+}
+
+static void cache_save() {
+    FILE* fp = fopen(GAMELIST_CACHE, "wb");
+    if (!fp) {
+        lwarn("could not write game list cache");
+        return;
+    }
+    u32 hdr[3] = {CACHE_MAGIC, GAMELIST_CACHE_VERSION, scan.files.size};
+    fwrite(hdr, sizeof hdr, 1, fp);
+    Vec_foreach(gp, scan.files) {
+        auto g = *gp;
+        u32 len = strlen(g->path);
+        u8 valid = g->valid;
+        fwrite(&len, sizeof len, 1, fp);
+        fwrite(g->path, 1, len, fp);
+        fwrite(&g->filesize, sizeof g->filesize, 1, fp);
+        fwrite(&g->mtime, sizeof g->mtime, 1, fp);
+        fwrite(&valid, 1, 1, fp);
+        if (g->valid) fwrite(&g->meta, sizeof g->meta, 1, fp);
+    }
+    fclose(fp);
+}
+
+// icons are 8x8 tiles in rows, with the x and y bits interleaved in each tile
+static void icon_deswizzle(u16 dst[48][48], u16* src) {
+    for (int t = 0; t < 36; t++) {
+        int tx = t % 6 * 8;
+        int ty = t / 6 * 8;
+        for (int i = 0; i < 64; i++) {
+            int x = (i & 1) | (i >> 1 & 2) | (i >> 2 & 4);
+            int y = (i >> 1 & 1) | (i >> 2 & 2) | (i >> 3 & 4);
+            dst[ty + y][tx + x] = *src++;
+        }
+    }
+}
+
+static void scan_file(GameInfo* g) {
+    RomFile f;
+    if (!romfile_open(&f, g->path, false)) {
+        // it might open next time, so it shouldn't match the cached entry
+        g->mtime = -1;
+        return;
+    }
+
+    int smdhOff = find_smdh(&f, g->path);
+    if (smdhOff == -1) {
+        romfile_close(&f);
+        return;
+    }
+
+    auto m = &g->meta;
+    m->size = f.size;
+
+    SMDHFile smdh = {};
+    romfile_read(&f, smdhOff, &smdh, sizeof smdh);
+
+    char ext[8];
+    romfile_ext(g->path, ext);
+    if (!strcmp(ext, ".3dsx")) {
+        convert_utf16(m->gamename, countof(m->gamename),
+                      smdh.titles[1].shortname,
+                      countof(smdh.titles[1].shortname));
+    } else {
+        convert_utf16(m->gamename, countof(m->gamename),
+                      smdh.titles[1].longname,
+                      countof(smdh.titles[1].longname));
+    }
+    for (int i = 0; i < countof(m->gamename); i++) {
+        if (m->gamename[i] == '\n') m->gamename[i] = ' ';
+    }
+    convert_utf16(m->publisher, countof(m->publisher),
+                  smdh.titles[1].publisher, countof(smdh.titles[1].publisher));
+    m->region = smdh.settings.regionLock;
+
+    // icons generally stored 48x48 in rgb565 format, swizzled
+    u16 iconraw[48 * 48];
+    // skip smaller icon
+    romfile_read(&f, smdhOff + sizeof smdh + 24 * 24 * 2, iconraw,
+                 sizeof iconraw);
+    icon_deswizzle(m->icon, iconraw);
+
+    romfile_close(&f);
+
+    g->valid = true;
+}
+
+static void* scan_worker(void*) {
+    while (true) {
+        pthread_mutex_lock(&scan.lock);
+        if (scan.die || scan.next == scan.todo.size) {
+            pthread_mutex_unlock(&scan.lock);
+            break;
+        }
+        auto g = scan.todo.d[scan.next++];
+        pthread_mutex_unlock(&scan.lock);
+
+        scan_file(g);
+
+        pthread_mutex_lock(&scan.lock);
+        if (g->valid) Vec_push(scan.found, g);
+        pthread_mutex_unlock(&scan.lock);
+    }
+    return nullptr;
+}
+
+static void* scan_thread(void*) {
+    cache_load();
+    // cached entries that were reused for a file in the folder
+    u8* reused = calloc(scan.cached.size + 1, 1);
+
+    DIR* dp = opendir(scan.dir);
+    if (!dp) {
+        lwarn("could not open game folder %s", scan.dir);
+    }
+    struct dirent* ent;
+    while (dp && (ent = readdir(dp))) {
+        if (scan_dying()) break;
+
+        char* path;
+        asprintf(&path, "%s/%s", scan.dir, ent->d_name);
+        struct stat st;
+        if (stat(path, &st) || !S_ISREG(st.st_mode)) {
+            free(path);
+            continue;
+        }
+
+        GameInfo key = {.path = path};
+        GameInfo* pkey = &key;
+        GameInfo** hit =
+            bsearch(&pkey, scan.cached.d, scan.cached.size,
+                    sizeof scan.cached.d[0], (void*) compar_path);
+        GameInfo* g;
+        if (hit && (*hit)->filesize == (u64) st.st_size &&
+            (*hit)->mtime == st.st_mtime) {
+            g = *hit;
+            reused[hit - scan.cached.d] = true;
+            free(path);
+            if (g->valid) {
+                pthread_mutex_lock(&scan.lock);
+                Vec_push(scan.found, g);
+                pthread_mutex_unlock(&scan.lock);
+            }
+        } else {
+            g = calloc(1, sizeof *g);
+            g->path = path;
+            g->filesize = st.st_size;
+            g->mtime = st.st_mtime;
+            Vec_push(scan.todo, g);
+        }
+        Vec_push(scan.files, g);
+    }
+    if (dp) closedir(dp);
+
+    // entries left over are from other folders or for files that are gone
+    size_t dirlen = strlen(scan.dir);
+    Vec_foreach(gp, scan.cached) {
+        auto g = *gp;
+        if (reused[gp - scan.cached.d]) continue;
+        if (!strncmp(g->path, scan.dir, dirlen) && g->path[dirlen] == '/') {
+            free(g->path);
+            free(g);
+        } else {
+            Vec_push(scan.files, g);
+        }
+    }
+    Vec_free(scan.cached);
+    free(reused);
+
+    pthread_t workers[GAMELIST_WORKERS];
+    int nworkers = 0;
+    for (int i = 0; i < GAMELIST_WORKERS && i < scan.todo.size; i++) {
+        if (pthread_create(&workers[nworkers], nullptr, scan_worker, nullptr))
+            break;
+        nworkers++;
+    }
+    if (!nworkers) scan_worker(nullptr);
+    for (int i = 0; i < nworkers; i++) {
+        pthread_join(workers[i], nullptr);
+    }
+
+    if (!scan_dying()) cache_save();
+
+    pthread_mutex_lock(&scan.lock);
+    scan.done = true;
+    pthread_mutex_unlock(&scan.lock);
+    return nullptr;
+}
+
+// scans the folder in the background, cached games are found right away and
+// the rest as the workers get to them
+void gamelist_scan(char* dir) {
+    gamelist_scan_stop();
+    if (!dir) return;
+
+    scan.dir = strdup(dir);
+    scan.die = false;
+    scan.done = false;
+    scan.running = !pthread_create(&scan.thread, nullptr, scan_thread, nullptr);
+    if (!scan.running) {
+        lerror("could not start game list scan");
+        free(scan.dir);
+        scan.dir = nullptr;
+    }
+}
+
+// the next game found since the last call, the caller owns its path
+bool gamelist_scan_take(GameInfo* g) {
+    pthread_mutex_lock(&scan.lock);
+    bool ok = scan.taken < scan.found.size;
+    if (ok) {
+        *g = *scan.found.d[scan.taken++];
+        g->path = strdup(g->path);
+    }
+    pthread_mutex_unlock(&scan.lock);
+    return ok;
+}
+
+bool gamelist_scanning() {
+    pthread_mutex_lock(&scan.lock);
+    bool res = scan.running && !scan.done;
+    pthread_mutex_unlock(&scan.lock);
+    return res;
+}
+
+void gamelist_scan_stop() {
+    if (!scan.running) return;
+
+    pthread_mutex_lock(&scan.lock);
+    scan.die = true;
+    pthread_mutex_unlock(&scan.lock);
+    pthread_join(scan.thread, nullptr);
+    scan.running = false;
+
+    Vec_foreach(gp, scan.files) {
+        free((*gp)->path);
+        free(*gp);
+    }
+    Vec_free(scan.files);
+    Vec_free(scan.todo);
+    Vec_free(scan.found);
+    scan.next = 0;
+    scan.taken = 0;
+    free(scan.dir);
+    scan.dir = nullptr;
+}
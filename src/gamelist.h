@@ -0,0 +1,36 @@
+#ifndef GAMELIST_H
+#define GAMELIST_H
+
+#include "common.h"
+
+// what was found in each file is kept here so the next scan only opens the
+// files that were added or changed since
+#define GAMELIST_CACHE "gamelist.cache"
+#define GAMELIST_CACHE_VERSION 1
+
+#define GAMELIST_WORKERS 4
+// found games handed to the ui each frame, each needs a texture upload
+#define GAMELIST_UPLOADS 16
+
+typedef struct {
+    char* path;
+    // the file is scanned again when either of these changes
+    u64 filesize;
+    s64 mtime;
+    bool valid; // files that aren't games are cached too so they are skipped
+
+    struct {
+        char gamename[128];
+        char publisher[64];
+        u32 region;
+        u64 size; // of the image, after decompression
+        u16 icon[48][48]; // rgb565, not swizzled
+    } meta;
+} GameInfo;
+
+void gamelist_scan(char* dir);
+bool gamelist_scan_take(GameInfo* g);
+bool gamelist_scanning();
+void gamelist_scan_stop();
+
+#endif
@@ -1,7 +1,7 @@
 #include "gui.h"
 
 #include <SDL3/SDL.h>
-#include <dirent.h>
+#include <float.h>
 #include <unistd.h>
 
 #include <imgui/dcimgui.h>
@@ -9,9 +9,9 @@
 #include "arm/jit/jit.h"
 #include "cpu.h"
 #include "emulator.h"
-#include "kernel/loader.h"
+#include "gamelist.h"
+#include "profiler.h"
 #include "services/applets.h"
-#include "unicode.h"
 
 #ifdef __linux__
 #define OPEN_CMD "xdg-open"
@@ -37,7 +37,7 @@ void file_callback(void*, const char* const* files, int) {
 void load_rom_dialog() {
     SDL_DialogFileFilter filetypes = {
         .name = "3DS Applications",
-        .pattern = "3ds;cci;cxi;app;elf;axf;3dsx",
+        .pattern = "3ds;cci;cxi;app;elf;axf;3dsx;zst",
     };
 
     SDL_ShowOpenFileDialog(file_callback, nullptr, g_window, &filetypes, 1,
@@ -132,6 +132,18 @@ void draw_menubar() {
             }
             ImGui_Separator();
 
+            if (ImGui_MenuItemEx("Save State", "F4", false, true)) {
+                ctremu.pending_savestate = true;
+            }
+            if (ImGui_MenuItemEx("Load State", "F8", false, true)) {
+                ctremu.pending_loadstate = true;
+            }
+            if (ImGui_MenuItemEx("Rewind", "Backspace", false,
+                                 ctremu.rewind)) {
+                ctremu.pending_rewind = true;
+            }
+            ImGui_Separator();
+
             ImGui_MenuItemBoolPtr("Fast Forward", "Tab", &ctremu.fastforward,
                                   true);
             ImGui_MenuItemBoolPtr("Mute", "F6", &ctremu.mute, true);
@@ -199,6 +211,13 @@ void draw_menubar() {
             ImGui_MenuItemBoolPtr("CPU Trace Log", nullptr, &g_cpulog, true);
             ImGui_Separator();
             ImGui_MenuItemBoolPtr("Wireframe", nullptr, &g_wireframe, true);
+            ImGui_Separator();
+            if (ImGui_MenuItem("Profiler")) {
+                uistate.profiler = true;
+            }
+            if (ImGui_MenuItem("JIT Statistics")) {
+                uistate.jitstats = true;
+            }
             ImGui_EndMenu();
         }
 
@@ -239,83 +258,56 @@ int compar_game(struct GameEntry* a, struct GameEntry* b) {
     return strcmp(a->gamename, b->gamename);
 }
 
-void create_gamelist() {
+void free_gamelist() {
     Vec_foreach(g, gamelist) {
         free(g->filename);
         glDeleteTextures(1, &g->icontex);
     }
     Vec_free(gamelist);
-    gamelist_refresh = false;
+}
 
-    if (!ctremu.gamedir) return;
+// the scan runs in the background, the games it has found so far are added a
+// few at a time so the window doesn't stall on the texture uploads
+void update_gamelist() {
+    if (gamelist_refresh) {
+        free_gamelist();
+        gamelist_refresh = false;
+        gamelist_scan(ctremu.gamedir);
+    }
 
-    DIR* dp = opendir(ctremu.gamedir);
-    if (!dp) return;
-    struct dirent* ent;
-    while ((ent = readdir(dp))) {
+    GameInfo gi;
+    int added = 0;
+    while (added < GAMELIST_UPLOADS && gamelist_scan_take(&gi)) {
         struct GameEntry g;
-        asprintf(&g.filename, "%s/%s", ctremu.gamedir, ent->d_name);
-
-        int smdhOff = find_smdh(g.filename);
-        if (smdhOff == -1) continue;
-
-        FILE* fp = fopen(g.filename, "rb");
-        if (!fp) continue;
-
-        fseek(fp, 0, SEEK_END);
-        g.size = ftell(fp);
+        g.filename = gi.path;
+        strcpy(g.gamename, gi.meta.gamename);
+        strcpy(g.publisher, gi.meta.publisher);
+        g.region = gi.meta.region;
+        g.size = gi.meta.size;
 
-        fseek(fp, smdhOff, SEEK_SET);
-
-        SMDHFile smdh;
-        fread(&smdh, sizeof smdh, 1, fp);
-
-        if (!strcmp(strrchr(g.filename, '.'), ".3dsx")) {
-            convert_utf16(g.gamename, countof(g.gamename),
-                          smdh.titles[1].shortname,
-                          countof(smdh.titles[1].shortname));
-        } else {
-            convert_utf16(g.gamename, countof(g.gamename),
-                          smdh.titles[1].longname,
-                          countof(smdh.titles[1].longname));
-        }
-        for (int i = 0; i < countof(g.gamename); i++) {
-            if (g.gamename[i] == '\n') g.gamename[i] = ' ';
-        }
-        convert_utf16(g.publisher, countof(g.publisher),
-                      smdh.titles[1].publisher,
-                      countof(smdh.titles[1].publisher));
-        g.region = smdh.settings.regionLock;
-
-        // icons generally stored 48x48 in rgb565 format, swizzled
-        u16 iconraw[48 * 48];
-        u16 icon[48][48];
-        // skip smaller icon
-        fseek(fp, 24 * 24 * 2, SEEK_CUR);
-        fread(iconraw, sizeof(u16), 48 * 48, fp);
-        for (int y = 0; y < 48; y++) {
-            for (int x = 0; x < 48; x++) {
-                icon[y][x] = iconraw[morton_swizzle(48, x, y)];
-            }
-        }
         glGenTextures(1, &g.icontex);
         glBindTexture(GL_TEXTURE_2D, g.icontex);
         glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, 48, 48, 0, GL_RGB,
-                     GL_UNSIGNED_SHORT_5_6_5, icon);
+                     GL_UNSIGNED_SHORT_5_6_5, gi.meta.icon);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
 
-        fclose(fp);
-
         Vec_push(gamelist, g);
+        added++;
+    }
+
+    if (added) {
+        qsort(gamelist.d, gamelist.size, sizeof(gamelist.d[0]),
+              (void*) compar_game);
     }
-    closedir(dp);
+}
 
-    qsort(gamelist.d, gamelist.size, sizeof(gamelist.d[0]),
-          (void*) compar_game);
+void destroy_gamelist() {
+    gamelist_scan_stop();
+    free_gamelist();
 }
 
 void draw_gamelist() {
-    if (gamelist_refresh) create_gamelist();
+    update_gamelist();
 
     ImGui_SetNextWindowViewport(ImGui_GetMainViewport()->ID);
     ImGui_SetNextWindowPos(ImGui_GetMainViewport()->WorkPos, 0);
@@ -339,6 +331,10 @@ void draw_gamelist() {
     if (ImGui_Button("Refresh")) {
         gamelist_refresh = true;
     }
+    if (gamelist_scanning()) {
+        ImGui_SameLine();
+        ImGui_TextDisabled("Scanning...");
+    }
 
     ImGui_BeginChild("gamelist_child", (ImVec2) {}, 0, 0);
     ImGui_BeginTable("gamelist", 5,
@@ -511,6 +507,17 @@ void draw_settings() {
             ImGui_SeparatorText("Camera");
             ImGui_Checkbox("Enable Camera", &ctremu.camEnable);
 
+            ImGui_SeparatorText("Rewind");
+            ImGui_Checkbox("Enable Rewind", &ctremu.rewind);
+            ImGui_BeginDisabled(!ctremu.rewind);
+            ImGui_SetNextItemWidth(150);
+            ImGui_InputInt("Frames Between Snapshots", &ctremu.rewindinterval);
+            if (ctremu.rewindinterval < 1) ctremu.rewindinterval = 1;
+            ImGui_SetNextItemWidth(150);
+            ImGui_InputInt("Memory Budget (MB)", &ctremu.rewindbudget);
+            if (ctremu.rewindbudget < 16) ctremu.rewindbudget = 16;
+            ImGui_EndDisabled();
+
             break;
         }
         case PANE_CPU: {
@@ -522,9 +529,14 @@ void draw_settings() {
                            &g_jit_config.max_block_instrs);
             ImGui_Checkbox("Enable Optimization", &g_jit_config.optimize);
             ImGui_Checkbox("Enable Block Linking", &g_jit_config.linking);
+            ImGui_Checkbox("Skip Idle Loops", &g_jit_config.idle_loops);
             ImGui_EndDisabled();
             ImGui_SeparatorText("Memory");
             ImGui_Checkbox("Ignore Invalid Access", &ctremu.ignore_null);
+            ImGui_BeginDisabled(ctremu.initialized);
+            ImGui_Checkbox("Use Huge Pages", &ctremu.hugepages);
+            ImGui_Checkbox("Prefault Memory", &ctremu.prefaultmem);
+            ImGui_EndDisabled();
             break;
         }
         case PANE_VIDEO: {
@@ -564,8 +576,20 @@ void draw_settings() {
             if (ctremu.vshthreads < 0) ctremu.vshthreads = 0;
             if (ctremu.vshthreads > MAX_VSH_THREADS)
                 ctremu.vshthreads = MAX_VSH_THREADS;
+            ImGui_Checkbox("Software Renderer", &ctremu.swrenderer);
+            ImGui_Indent();
+            ImGui_BeginDisabled(!ctremu.swrenderer);
+            ImGui_SetNextItemWidth(150);
+            ImGui_InputInt("Rasterizer Threads", &ctremu.swrenderthreads);
+            if (ctremu.swrenderthreads < 0) ctremu.swrenderthreads = 0;
+            if (ctremu.swrenderthreads > MAX_RAST_THREADS)
+                ctremu.swrenderthreads = MAX_RAST_THREADS;
             ImGui_EndDisabled();
+            ImGui_Unindent();
+            ImGui_EndDisabled();
+#ifndef NOJIT
             ImGui_Checkbox("Shader JIT", &ctremu.shaderjit);
+#endif
             ImGui_Checkbox("Hardware Vertex Shaders", &ctremu.hwvshaders);
             ImGui_Indent();
             ImGui_BeginDisabled(!ctremu.hwvshaders);
@@ -573,6 +597,7 @@ void draw_settings() {
             ImGui_EndDisabled();
             ImGui_Unindent();
             // ImGui_Checkbox("Use Ubershader", &ctremu.ubershader);
+            ImGui_Checkbox("Specialize Shaders", &ctremu.specializeShaders);
             ImGui_Checkbox("Hash Textures", &ctremu.hashTextures);
             ImGui_Checkbox("Enable Texture Reinterpret",
                            &ctremu.reinterpretTexture);
@@ -948,9 +973,225 @@ void draw_audioview() {
     ImGui_End();
 }
 
+ProfReport profreport;
+u64 profreport_time;
+
+void draw_profiler() {
+    if (!ctremu.initialized) uistate.profiler = false;
+    if (!uistate.profiler) return;
+
+    ImGuiWindowFlags flags = ImGuiWindowFlags_NoCollapse;
+    if (ImGui_GetIO()->ConfigFlags & ImGuiConfigFlags_ViewportsEnable) {
+        flags |= ImGuiWindowFlags_NoTitleBar;
+    }
+
+    ImGui_SetNextWindowClass(&(ImGuiWindowClass) {
+        .ViewportFlagsOverrideSet = ImGuiViewportFlags_NoAutoMerge});
+
+    ImGui_SetNextWindowSize((ImVec2) {800, 600}, ImGuiCond_FirstUseEver);
+
+    ImGui_Begin("Profiler", &uistate.profiler, flags);
+
+    bool refresh = false;
+    if (g_profiler.running) {
+        if (ImGui_Button("Stop")) {
+            profiler_stop(&ctremu.system);
+            refresh = true;
+        }
+    } else {
+        if (ImGui_Button("Start")) {
+            profiler_start(&ctremu.system);
+            refresh = true;
+        }
+    }
+    ImGui_SameLine();
+    if (ImGui_Button("Refresh")) refresh = true;
+    ImGui_SameLine();
+    if (ImGui_Button("Save Flame Graph")) {
+        profiler_write_folded(&ctremu.system, ctremu.romfilenoext);
+    }
+
+    // the report is rebuilt every second while profiling
+    if (g_profiler.running &&
+        time_now_ns() - profreport_time > 1'000'000'000) {
+        refresh = true;
+    }
+    if (refresh) {
+        profiler_free_report(&profreport);
+        profiler_build_report(&ctremu.system, &profreport);
+        profreport_time = time_now_ns();
+    }
+
+    u64 cycles = profreport.total_cycles;
+    u64 samples = profreport.total_samples;
+    ImGui_Text("%lu cycles, %lu samples (%.1f%% hle, %.1f%% idle)",
+               (unsigned long) cycles, (unsigned long) samples,
+               samples ? 100.0 * profreport.hle_samples / samples : 0.0,
+               samples ? 100.0 * profreport.idle_samples / samples : 0.0);
+
+#define PCT(n, total) ((total) ? 100.0 * (n) / (total) : 0.0)
+#define MAXROWS 500
+
+    ImGui_BeginTabBar("##proftabbar", 0);
+
+    if (ImGui_BeginTabItem("Functions", nullptr, 0)) {
+        if (ImGui_BeginTable("##proffuncs", 4,
+                             ImGuiTableFlags_RowBg | ImGuiTableFlags_ScrollY |
+                                 ImGuiTableFlags_BordersOuterV)) {
+            ImGui_TableSetupScrollFreeze(0, 1);
+            ImGui_TableSetupColumn("Module", 0);
+            ImGui_TableSetupColumn("Function", 0);
+            ImGui_TableSetupColumn("Cycles", 0);
+            ImGui_TableSetupColumn("Samples", 0);
+            ImGui_TableHeadersRow();
+            for (int i = 0; i < profreport.functions.size && i < MAXROWS;
+                 i++) {
+                auto f = &profreport.functions.d[i];
+                ImGui_TableNextRow();
+                ImGui_TableNextColumn();
+                ImGui_Text("%s", f->module);
+                ImGui_TableNextColumn();
+                ImGui_Text("%s", f->symbol ? f->symbol : "?");
+                ImGui_TableNextColumn();
+                ImGui_Text("%.2f%%", PCT(f->cycles, cycles));
+                ImGui_TableNextColumn();
+                ImGui_Text("%.2f%%", PCT(f->samples, samples));
+            }
+            ImGui_EndTable();
+        }
+        ImGui_EndTabItem();
+    }
+
+    if (ImGui_BeginTabItem("Blocks", nullptr, 0)) {
+        if (ImGui_BeginTable("##profblocks", 6,
+                             ImGuiTableFlags_RowBg | ImGuiTableFlags_ScrollY |
+                                 ImGuiTableFlags_BordersOuterV)) {
+            ImGui_TableSetupScrollFreeze(0, 1);
+            ImGui_TableSetupColumn("Address", 0);
+            ImGui_TableSetupColumn("Location", 0);
+            ImGui_TableSetupColumn("Executions", 0);
+            ImGui_TableSetupColumn("Cycles/Exec", 0);
+            ImGui_TableSetupColumn("Cycles", 0);
+            ImGui_TableSetupColumn("Samples", 0);
+            ImGui_TableHeadersRow();
+            for (int i = 0; i < profreport.blocks.size && i < MAXROWS; i++) {
+                auto b = &profreport.blocks.d[i];
+                ImGui_TableNextRow();
+                ImGui_TableNextColumn();
+                ImGui_Text("%08x-%08x%s", b->start_addr, b->end_addr,
+                           b->attrs & BIT(5) ? " (T)" : "");
+                ImGui_TableNextColumn();
+                if (b->symbol) {
+                    ImGui_Text("%s:%s+%x", b->module, b->symbol, b->symoff);
+                } else {
+                    ImGui_Text("%s", b->module);
+                }
+                ImGui_TableNextColumn();
+                ImGui_Text("%lu", (unsigned long) b->execs);
+                ImGui_TableNextColumn();
+                ImGui_Text("%.1f", b->execs ? (double) b->cycles / b->execs
+                                            : 0.0);
+                ImGui_TableNextColumn();
+                ImGui_Text("%.2f%%", PCT(b->cycles, cycles));
+                ImGui_TableNextColumn();
+                ImGui_Text("%.2f%%", PCT(b->samples, samples));
+            }
+            ImGui_EndTable();
+        }
+        ImGui_EndTabItem();
+    }
+
+#undef PCT
+#undef MAXROWS
+
+    ImGui_EndTabBar();
+
+    ImGui_End();
+}
+
+void draw_jitstats() {
+    if (!uistate.jitstats) return;
+
+    ImGuiWindowFlags flags = ImGuiWindowFlags_NoCollapse;
+    if (ImGui_GetIO()->ConfigFlags & ImGuiConfigFlags_ViewportsEnable) {
+        flags |= ImGuiWindowFlags_NoTitleBar;
+    }
+
+    ImGui_SetNextWindowClass(&(ImGuiWindowClass) {
+        .ViewportFlagsOverrideSet = ImGuiViewportFlags_NoAutoMerge});
+
+    ImGui_SetNextWindowSize((ImVec2) {500, 600}, ImGuiCond_FirstUseEver);
+
+    ImGui_Begin("JIT Statistics", &uistate.jitstats, flags);
+
+    JITStats* st = &g_jit_stats;
+    u64 blocks = st->blocks_compiled;
+
+    ImGui_SeparatorText("Blocks");
+    ImGui_Text("Compiled: %lu (%lu live, %.1f KiB code)",
+               (unsigned long) blocks, (unsigned long) st->live_blocks,
+               st->live_code_bytes / 1024.0);
+    ImGui_Text("Average: %.1f instrs, %.1f bytes of code",
+               blocks ? (double) st->guest_instrs / blocks : 0.0,
+               blocks ? (double) st->code_bytes / blocks : 0.0);
+    ImGui_Text("Destroyed: %lu", (unsigned long) st->blocks_destroyed);
+    ImGui_Text("Invalidations: %lu (%lu blocks)",
+               (unsigned long) st->invalidations,
+               (unsigned long) st->invalidated_blocks);
+    ImGui_Text("Destroyed through links: %lu",
+               (unsigned long) st->unlinked_blocks);
+    ImGui_Text("Links patched: %lu", (unsigned long) st->links_patched);
+    ImGui_Text("Idle loops: %lu", (unsigned long) st->idle_loops);
+
+    ImGui_SeparatorText("Compile Time");
+    ImGui_Text("Total: %.2f ms (%.2f us/block)", st->compile_ns / 1e6,
+               blocks ? st->compile_ns / 1e3 / blocks : 0.0);
+    if (ImGui_BeginTable("##jitphases", 3,
+                         ImGuiTableFlags_RowBg |
+                             ImGuiTableFlags_SizingFixedFit)) {
+        ImGui_TableSetupColumn("Phase", 0);
+        ImGui_TableSetupColumn("ms", 0);
+        ImGui_TableSetupColumn("%", 0);
+        ImGui_TableHeadersRow();
+        for (int i = 0; i < JIT_PHASE_MAX; i++) {
+            ImGui_TableNextRow();
+            ImGui_TableNextColumn();
+            ImGui_Text("%s", jit_phase_names[i]);
+            ImGui_TableNextColumn();
+            ImGui_Text("%.2f", st->phase_ns[i] / 1e6);
+            ImGui_TableNextColumn();
+            ImGui_Text("%.1f", st->compile_ns
+                                   ? 100.0 * st->phase_ns[i] / st->compile_ns
+                                   : 0.0);
+        }
+        ImGui_EndTable();
+    }
+
+    // each bar is sizes up to the next power of 2
+    ImGui_SeparatorText("Guest Instructions per Block");
+    float hist[JIT_HIST_CODE];
+    for (int i = 0; i < JIT_HIST_INSTRS; i++) hist[i] = st->instrs_hist[i];
+    ImGui_PlotHistogramEx("##instrshist", hist, JIT_HIST_INSTRS, 0,
+                          "1 .. 256", 0, FLT_MAX, (ImVec2) {0, 80},
+                          sizeof(float));
+    ImGui_SeparatorText("Code Bytes per Block");
+    for (int i = 0; i < JIT_HIST_CODE; i++) hist[i] = st->code_hist[i];
+    ImGui_PlotHistogramEx("##codehist", hist, JIT_HIST_CODE, 0, "1 .. 64K", 0,
+                          FLT_MAX, (ImVec2) {0, 80}, sizeof(float));
+
+    ImGui_Separator();
+    if (ImGui_Button("Reset")) jit_stats_reset();
+    ImGui_SameLine();
+    if (ImGui_Button("Close")) uistate.jitstats = false;
+
+    ImGui_End();
+}
+
 void draw_gui() {
     draw_swkbd();
     draw_settings();
     draw_textureview();
     draw_audioview();
+    draw_profiler();
+    draw_jitstats();
 }
@@ -7,6 +7,8 @@ extern struct UIState {
 
     bool textureview;
     bool audioview;
+    bool profiler;
+    bool jitstats;
 
     int* waiting_key;
 } uistate;
@@ -16,6 +18,7 @@ void load_rom_dialog();
 void setup_gui_theme();
 void draw_menubar();
 void draw_gamelist();
+void destroy_gamelist();
 void draw_gui();
 
 #endif
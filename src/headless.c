@@ -0,0 +1,415 @@
+#include "headless.h"
+
+#include <SDL3/SDL.h>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "3ds.h"
+#include "arm/jit/jit.h"
+#include "emulator.h"
+#include "video/renderer_gl.h"
+
+// runs a rom for a fixed number of frames without a window or audio device
+// and writes timing information for each frame as json, for benchmarking
+
+struct HeadlessArgs headless_args;
+
+// gpu timer results are read a few frames later to not stall the pipeline
+#define QUERY_RING 4
+
+typedef struct {
+    int frame;
+    u32 btns;
+    s16 cx, cy;
+    bool touch;
+    u16 tx, ty;
+} InputEvent;
+
+typedef Vec(InputEvent) InputScript;
+
+typedef struct {
+    u64 wall_ns;
+    u64 cpu_ns;
+    u64 gpu_ns;
+    u64 jit_ns;
+    s64 dtlb_misses; // -1 if the counter is not available
+} FrameStats;
+
+static const struct {
+    const char* name;
+    u32 bit;
+} buttonnames[] = {
+    {"a", BIT(0)},      {"b", BIT(1)},     {"select", BIT(2)},
+    {"start", BIT(3)},  {"right", BIT(4)}, {"left", BIT(5)},
+    {"up", BIT(6)},     {"down", BIT(7)},  {"r", BIT(8)},
+    {"l", BIT(9)},      {"x", BIT(10)},    {"y", BIT(11)},
+};
+
+static SDL_Window* window;
+static SDL_GLContext glcontext;
+
+static int dtlb_fd = -1;
+
+// dTLB load misses of the emulation thread, to see the effect of the guest
+// memory backing, -1 in the results when perf_event_paranoid is above 2 or
+// the host isn't linux
+static void dtlb_open() {
+#ifdef __linux__
+    struct perf_event_attr attr = {
+        .type = PERF_TYPE_HW_CACHE,
+        .size = sizeof attr,
+        .config = PERF_COUNT_HW_CACHE_DTLB |
+                  PERF_COUNT_HW_CACHE_OP_READ << 8 |
+                  PERF_COUNT_HW_CACHE_RESULT_MISS << 16,
+        .exclude_kernel = 1,
+        .exclude_hv = 1,
+    };
+    dtlb_fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    if (dtlb_fd < 0) linfo("dTLB miss counter not available");
+#endif
+}
+
+static s64 dtlb_read() {
+#ifdef __linux__
+    s64 count;
+    if (dtlb_fd >= 0 && read(dtlb_fd, &count, sizeof count) == sizeof count) {
+        return count;
+    }
+#endif
+    return -1;
+}
+
+static void dtlb_close() {
+#ifdef __linux__
+    if (dtlb_fd >= 0) close(dtlb_fd);
+#endif
+    dtlb_fd = -1;
+}
+
+// each line of the input script is a frame number followed by the inputs
+// held from that frame on, for example
+// 120 a up circle=0,32767 touch=160,120
+// and lines starting with # are ignored
+static bool load_input_script(const char* path, InputScript* events) {
+    FILE* fp = fopen(path, "r");
+    if (!fp) {
+        lerror("could not open input script %s", path);
+        return false;
+    }
+
+    char line[256];
+    int lineno = 0;
+    while (fgets(line, sizeof line, fp)) {
+        lineno++;
+        char* save;
+        char* tok = strtok_r(line, " \t\r\n", &save);
+        if (!tok || tok[0] == '#') continue;
+
+        InputEvent ev = {};
+        char* end;
+        ev.frame = strtol(tok, &end, 10);
+        if (*end ||
+            (events->size && ev.frame < events->d[events->size - 1].frame)) {
+            lerror("invalid frame number on line %d of input script", lineno);
+            fclose(fp);
+            return false;
+        }
+
+        while ((tok = strtok_r(nullptr, " \t\r\n", &save))) {
+            int x, y;
+            if (sscanf(tok, "touch=%d,%d", &x, &y) == 2) {
+                ev.touch = true;
+                ev.tx = x;
+                ev.ty = y;
+                continue;
+            }
+            if (sscanf(tok, "circle=%d,%d", &x, &y) == 2) {
+                ev.cx = x;
+                ev.cy = y;
+                continue;
+            }
+            int i;
+            for (i = 0; i < countof(buttonnames); i++) {
+                if (!strcmp(tok, buttonnames[i].name)) break;
+            }
+            if (i == countof(buttonnames)) {
+                lerror("unknown input '%s' on line %d of input script", tok,
+                       lineno);
+                fclose(fp);
+                return false;
+            }
+            ev.btns |= buttonnames[i].bit;
+        }
+
+        Vec_push(*events, ev);
+    }
+
+    fclose(fp);
+    return true;
+}
+
+static void apply_input(InputEvent* ev) {
+    InputEvent none = {};
+    if (!ev) ev = &none;
+
+    PadState btn = {.w = ev->btns};
+    btn.cup = ev->cy > INT16_MAX / 2;
+    btn.cdown = ev->cy < INT16_MIN / 2;
+    btn.cleft = ev->cx < INT16_MIN / 2;
+    btn.cright = ev->cx > INT16_MAX / 2;
+
+    // hid updates inputs 4x per frame
+    for (int i = 0; i < 4; i++) {
+        hid_update_pad(&ctremu.system, btn.w, ev->cx, ev->cy);
+        hid_update_touch(&ctremu.system, ev->tx, ev->ty, ev->touch);
+        hid_update_accel(&ctremu.system, 0, 0, 0);
+        hid_update_gyro(&ctremu.system, 0, 0, 0);
+    }
+}
+
+static bool try_create_context(const char* driver) {
+    if (driver) SDL_SetHint(SDL_HINT_VIDEO_DRIVER, driver);
+    else SDL_ResetHint(SDL_HINT_VIDEO_DRIVER);
+
+    if (!SDL_Init(SDL_INIT_VIDEO)) return false;
+
+    SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 3);
+    SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 3);
+    SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK,
+                        SDL_GL_CONTEXT_PROFILE_CORE);
+
+    window = SDL_CreateWindow("Tanuki3DS", 1, 1,
+                              SDL_WINDOW_OPENGL | SDL_WINDOW_HIDDEN);
+    if (window) {
+        glcontext = SDL_GL_CreateContext(window);
+        if (glcontext) return true;
+        SDL_DestroyWindow(window);
+        window = nullptr;
+    }
+    SDL_Quit();
+    return false;
+}
+
+// the offscreen driver makes a surfaceless egl context so no display is
+// needed, and mesa will use llvmpipe if there is no gpu
+static bool create_context() {
+    if (!try_create_context("offscreen")) {
+        lwarn("offscreen gl context failed: %s", SDL_GetError());
+        if (!try_create_context(nullptr)) {
+            lerror("could not create gl context: %s", SDL_GetError());
+            return false;
+        }
+    }
+
+    gladLoadGLLoader((void*) SDL_GL_GetProcAddress);
+    SDL_GL_SetSwapInterval(0);
+
+    linfo("headless gl renderer: %s", glGetString(GL_RENDERER));
+    return true;
+}
+
+static void destroy_context() {
+    SDL_GL_DestroyContext(glcontext);
+    SDL_DestroyWindow(window);
+    SDL_Quit();
+}
+
+// rom names and driver strings can have quotes, backslashes or control
+// characters
+static void write_json_str(FILE* fp, const char* str) {
+    fputc('"', fp);
+    for (const u8* p = (const u8*) str; *p; p++) {
+        if (*p == '"' || *p == '\\') fprintf(fp, "\\%c", *p);
+        else if (*p < 0x20) fprintf(fp, "\\u%04x", *p);
+        else fputc(*p, fp);
+    }
+    fputc('"', fp);
+}
+
+static void write_results(FILE* fp, FrameStats* stats, int nframes,
+                          bool failed) {
+    u64 wall = 0, cpu = 0, gpu = 0, jit = 0;
+    s64 dtlb = nframes ? 0 : -1;
+    for (int i = 0; i < nframes; i++) {
+        wall += stats[i].wall_ns;
+        cpu += stats[i].cpu_ns;
+        gpu += stats[i].gpu_ns;
+        jit += stats[i].jit_ns;
+        if (stats[i].dtlb_misses < 0) dtlb = -1;
+        if (dtlb >= 0) dtlb += stats[i].dtlb_misses;
+    }
+
+#define MS(ns) ((double) (ns) / 1'000'000)
+
+    fprintf(fp, "{\n");
+    fprintf(fp, "  \"version\": \"%s\",\n", EMUVERSION);
+    fprintf(fp, "  \"rom\": ");
+    write_json_str(fp, ctremu.romfilenodir);
+    fprintf(fp, ",\n  \"renderer\": ");
+    write_json_str(fp, ctremu.swrenderer
+                           ? "software"
+                           : (const char*) glGetString(GL_RENDERER));
+    fprintf(fp, ",\n");
+#ifdef NOJIT
+    fprintf(fp, "  \"cpu\": \"cached interpreter\",\n");
+#else
+    fprintf(fp, "  \"cpu\": \"jit\",\n");
+#endif
+    fprintf(fp, "  \"completed\": %s,\n", failed ? "false" : "true");
+    fprintf(fp, "  \"frames\": %d,\n", nframes);
+    fprintf(fp, "  \"total_ms\": %.3f,\n", MS(wall));
+    fprintf(fp, "  \"avg_fps\": %.3f,\n",
+            wall ? (double) nframes * 1'000'000'000 / wall : 0);
+    fprintf(fp, "  \"avg_cpu_ms\": %.3f,\n", nframes ? MS(cpu) / nframes : 0);
+    fprintf(fp, "  \"avg_gpu_ms\": %.3f,\n", nframes ? MS(gpu) / nframes : 0);
+    fprintf(fp, "  \"jit_ms\": %.3f,\n", MS(jit));
+    fprintf(fp, "  \"dtlb_misses\": %lld,\n", (long long) dtlb);
+    fprintf(fp, "  \"jit_blocks\": %lu,\n",
+            (unsigned long) g_jit_stats.blocks_compiled);
+    fprintf(fp, "  \"jit_stats\": ");
+    jit_stats_write_json(fp, "  ");
+    fprintf(fp, ",\n");
+    fprintf(fp, "  \"per_frame\": [\n");
+    for (int i = 0; i < nframes; i++) {
+        fprintf(fp,
+                "    {\"cpu_ms\": %.3f, \"gpu_ms\": %.3f, \"jit_ms\": %.3f, "
+                "\"fps\": %.3f, \"dtlb_misses\": %lld}%s\n",
+                MS(stats[i].cpu_ns), MS(stats[i].gpu_ns), MS(stats[i].jit_ns),
+                stats[i].wall_ns ? 1'000'000'000.0 / stats[i].wall_ns : 0,
+                (long long) stats[i].dtlb_misses, i < nframes - 1 ? "," : "");
+    }
+    fprintf(fp, "  ]\n");
+    fprintf(fp, "}\n");
+
+#undef MS
+}
+
+int headless_main() {
+    if (!ctremu.romfile) {
+        eprintf("no rom given for headless mode\n");
+        return 1;
+    }
+
+    InputScript events;
+    Vec_init(events);
+    if (headless_args.inputfile &&
+        !load_input_script(headless_args.inputfile, &events)) {
+        Vec_free(events);
+        return 1;
+    }
+
+    // the software renderer doesn't need gl at all
+    ctremu.headless = true;
+    bool gl = !ctremu.swrenderer;
+    if (gl && !create_context()) {
+        Vec_free(events);
+        return 1;
+    }
+
+    // nothing is played so this can run as fast as possible
+    ctremu.audio_cb = nullptr;
+    ctremu.mute = true;
+
+    ctremu.pending_reset = false;
+    if (!emulator_reset() || !ctremu.initialized) {
+        lerror("rom loading failed");
+        if (gl) destroy_context();
+        Vec_free(events);
+        return 1;
+    }
+
+    int frames = headless_args.frames;
+    FrameStats* stats = calloc(frames, sizeof *stats);
+    dtlb_open();
+    GLuint queries[QUERY_RING];
+    if (gl) glGenQueries(QUERY_RING, queries);
+
+    // these are used after a longjmp
+    volatile int nframes = 0;
+    volatile bool query_active = false;
+    bool failed = false;
+
+    int exc;
+    if ((exc = setjmp(ctremu.exceptionJmp))) {
+        lerror("emulation stopped at frame %d with exception %d", nframes, exc);
+        if (query_active) glEndQuery(GL_TIME_ELAPSED);
+        failed = true;
+    }
+
+    int curevent = -1;
+    while (!failed && nframes < frames) {
+        int i = nframes;
+        while (curevent + 1 < events.size &&
+               events.d[curevent + 1].frame <= i) {
+            curevent++;
+        }
+        apply_input(curevent >= 0 ? &events.d[curevent] : nullptr);
+
+        if (gl && i >= QUERY_RING) {
+            glGetQueryObjectui64v(queries[i % QUERY_RING], GL_QUERY_RESULT,
+                                  &stats[i - QUERY_RING].gpu_ns);
+        }
+
+        u64 jit_start = g_jit_stats.compile_ns;
+        s64 dtlb_start = dtlb_read();
+        u64 start = time_now_ns();
+
+        gpu_start_frame(&ctremu.system.gpu);
+        if (gl) {
+            glBeginQuery(GL_TIME_ELAPSED, queries[i % QUERY_RING]);
+            query_active = true;
+        }
+        e3ds_run_frame(&ctremu.system);
+        gpu_flush_draws(&ctremu.system.gpu);
+        if (gl) {
+            glEndQuery(GL_TIME_ELAPSED);
+            query_active = false;
+        }
+
+        stats[i].cpu_ns = time_now_ns() - start;
+        stats[i].jit_ns = g_jit_stats.compile_ns - jit_start;
+        s64 dtlb_end = dtlb_read();
+        stats[i].dtlb_misses =
+            dtlb_start >= 0 && dtlb_end >= 0 ? dtlb_end - dtlb_start : -1;
+
+        // make sure the gpu work of the frame is counted in the wall time
+        if (gl) glFinish();
+        stats[i].wall_ns = time_now_ns() - start;
+
+        nframes++;
+    }
+
+    if (gl) {
+        int first = nframes > QUERY_RING ? nframes - QUERY_RING : 0;
+        for (int i = first; i < nframes; i++) {
+            glGetQueryObjectui64v(queries[i % QUERY_RING], GL_QUERY_RESULT,
+                                  &stats[i].gpu_ns);
+        }
+        glDeleteQueries(QUERY_RING, queries);
+    }
+
+    FILE* fp = stdout;
+    if (headless_args.outfile && strcmp(headless_args.outfile, "-")) {
+        fp = fopen(headless_args.outfile, "w");
+        if (!fp) {
+            lerror("could not open %s", headless_args.outfile);
+            fp = stdout;
+        }
+    }
+    write_results(fp, stats, nframes, failed);
+    if (fp != stdout) fclose(fp);
+
+    dtlb_close();
+    free(stats);
+    Vec_free(events);
+
+    // gl objects are freed when the system is destroyed
+    emulator_quit();
+
+    if (gl) destroy_context();
+
+    return failed ? 1 : 0;
+}
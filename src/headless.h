@@ -0,0 +1,12 @@
+#ifndef HEADLESS_H
+#define HEADLESS_H
+
+extern struct HeadlessArgs {
+    int frames;
+    char* inputfile;
+    char* outfile;
+} headless_args;
+
+int headless_main();
+
+#endif
@@ -12,8 +12,12 @@ u32 handle_new(E3DS* s) {
     return 0;
 }
 
+// list nodes come and go on every wait so they are recycled instead of
+// malloced, there is only ever one kernel running at a time
+static NodePool klistpool;
+
 void klist_insert(KListNode** l, KObject* o) {
-    KListNode* newNode = malloc(sizeof *newNode);
+    KListNode* newNode = nodepool_alloc(&klistpool, sizeof *newNode);
     newNode->key = o;
     newNode->next = *l;
     *l = newNode;
@@ -22,7 +26,7 @@ void klist_insert(KListNode** l, KObject* o) {
 void klist_remove(KListNode** l) {
     KListNode* cur = *l;
     *l = cur->next;
-    free(cur);
+    nodepool_free(&klistpool, cur);
 }
 
 u32 klist_remove_key(KListNode** l, KObject* o) {
@@ -82,7 +86,13 @@ void kobject_destroy(E3DS* s, KObject* o) {
         }
         case KOT_ARBITER: {
             auto arb = (KArbiter*) o;
-            FREE_SYNCOBJ(arb);
+            for (int i = 0; i < ARBITER_BUCKETS; i++) {
+                while (arb->waiting[i]) {
+                    auto t = arb->waiting[i];
+                    klist_remove_key(&t->waiting_objs, &arb->hdr);
+                    arbiter_remove(arb, t);
+                }
+            }
             free(arb);
             break;
         }
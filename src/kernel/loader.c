@@ -52,8 +52,6 @@ u32 load_elf(E3DS* s, char* filename) {
 
     fclose(fp);
 
-    s->romimage.fp = nullptr;
-
     memory_virtalloc(s, STACK_BASE - BIT(14), BIT(14), PERM_RW, MEMST_PRIVATE);
 
     strncpy(s->romimage.name, ctremu.romfilenoext, sizeof s->romimage.name - 1);
@@ -63,23 +61,23 @@ u32 load_elf(E3DS* s, char* filename) {
 
 // 3dsx file format info from citra
 u32 load_3dsx(E3DS* s, char* filename) {
-    FILE* fp = fopen(filename, "rb");
-    if (!fp) {
+    auto f = &s->romimage.file;
+    if (!romfile_open(f, filename, true)) {
         lerror("no such file");
         return -1;
     }
 
-    _3DSXHeader hdr;
-    fread(&hdr, 1, sizeof(_3DSXHeader), fp);
+    _3DSXHeader hdr = {};
+    u64 off = romfile_read(f, 0, &hdr, sizeof hdr);
 
     if (strncmp(hdr.magic, "3DSX", 4)) {
         lerror("bad magic for 3DSX: %.4s", hdr.magic);
         return -1;
     }
 
-    fseek(fp, hdr.hdrSz, SEEK_SET);
-    _3DSXRelHeader relhdr[3];
-    fread(relhdr, hdr.relHdrSz, 3, fp);
+    off = hdr.hdrSz;
+    _3DSXRelHeader relhdr[3] = {};
+    off += romfile_read(f, off, relhdr, 3 * hdr.relHdrSz);
 
     // the start address here is arbitrary
     u32 start_addr = 0x10'0000;
@@ -98,14 +96,14 @@ u32 load_3dsx(E3DS* s, char* filename) {
     memory_virtalloc(s, segstarts[2], segmemsz[2], PERM_RW, MEMST_CODE);
 
     for (int i = 0; i < 3; i++) {
-        fread(PTR(segstarts[i]), 1, segfilesz[i], fp);
+        off += romfile_read(f, off, PTR(segstarts[i]), segfilesz[i]);
     }
 
     for (int seg = 0; seg < 3; seg++) {
         u32* pos = PTR(segstarts[seg]);
         for (int r = 0; r < relhdr[seg].numAbsolute; r++) {
-            _3DSXRelocation rel;
-            fread(&rel, sizeof rel, 1, fp);
+            _3DSXRelocation rel = {};
+            off += romfile_read(f, off, &rel, sizeof rel);
             pos += rel.skip;
             for (int p = 0; p < rel.patch; p++) {
                 *pos++ += start_addr;
@@ -113,8 +111,8 @@ u32 load_3dsx(E3DS* s, char* filename) {
         }
         pos = PTR(segstarts[seg]);
         for (int r = 0; r < relhdr[seg].numRelative; r++) {
-            _3DSXRelocation rel;
-            fread(&rel, sizeof rel, 1, fp);
+            _3DSXRelocation rel = {};
+            off += romfile_read(f, off, &rel, sizeof rel);
             pos += rel.skip;
             for (int p = 0; p < rel.patch; p++) {
                 *pos -= (void*) pos - PTR(segstarts[0]);
@@ -123,7 +121,6 @@ u32 load_3dsx(E3DS* s, char* filename) {
         }
     }
 
-    s->romimage.fp = fp;
     s->romimage.romfs_off = hdr.romfsOff;
     s->romimage.smdh_off = hdr.smdhOff;
     s->romimage.is3DSX = true;
@@ -136,11 +133,11 @@ u32 load_3dsx(E3DS* s, char* filename) {
 }
 
 u32 load_ncsd(E3DS* s, char* filename) {
-    FILE* fp = fopen(filename, "rb");
-    if (!fp) return -1;
+    auto f = &s->romimage.file;
+    if (!romfile_open(f, filename, true)) return -1;
 
-    NCSDHeader hdrncsd;
-    fread(&hdrncsd, sizeof hdrncsd, 1, fp);
+    NCSDHeader hdrncsd = {};
+    romfile_read(f, 0, &hdrncsd, sizeof hdrncsd);
 
     if (strncmp(hdrncsd.magic, "NCSD", 4)) {
         lerror("bad magic for NCSD: %.4s", hdrncsd.magic);
@@ -148,39 +145,35 @@ u32 load_ncsd(E3DS* s, char* filename) {
     }
 
     u32 ncchbase = hdrncsd.part[0].offset * 0x200;
-    fclose(fp);
 
     return load_ncch(s, filename, ncchbase);
 }
 
 u32 load_ncch(E3DS* s, char* filename, u64 offset) {
-    FILE* fp = fopen(filename, "rb");
-    if (!fp) return -1;
+    // already open when this is the partition of an ncsd
+    auto f = &s->romimage.file;
+    if (!f->fp && !romfile_open(f, filename, true)) return -1;
 
     u64 base = offset;
     u64 ncchbase = base;
 
-    fseek(fp, base, SEEK_SET);
-
-    NCCHHeader hdrncch;
-    fread(&hdrncch, sizeof hdrncch, 1, fp);
+    NCCHHeader hdrncch = {};
+    romfile_read(f, base, &hdrncch, sizeof hdrncch);
 
     if (strncmp(hdrncch.magic, "NCCH", 4)) {
         lerror("bad magic for NCCH: %.4s", hdrncch.magic);
         return -1;
     }
 
-    ExHeader exhdr;
-    fread(&exhdr, sizeof exhdr, 1, fp);
+    ExHeader exhdr = {};
+    romfile_read(f, base + 0x200, &exhdr, sizeof exhdr);
 
     linfo("loading code from exefs");
 
     base += hdrncch.exefs.offset * 0x200;
 
-    fseek(fp, base, SEEK_SET);
-
-    ExeFSHeader hdrexefs;
-    fread(&hdrexefs, sizeof hdrexefs, 1, fp);
+    ExeFSHeader hdrexefs = {};
+    romfile_read(f, base, &hdrexefs, sizeof hdrexefs);
 
     base += 0x200;
 
@@ -199,14 +192,23 @@ u32 load_ncch(E3DS* s, char* filename, u64 offset) {
     }
     if (!codesize) return -1;
 
-    u8* code = malloc(codesize);
-    fseek(fp, base + codeoffset, SEEK_SET);
-    fread(code, 1, codesize, fp);
+    // the code is copied straight out of the mapped file unless it has to be
+    // decompressed first
+    u8* buf = nullptr;
+    u8* code = romfile_ptr(f, base + codeoffset, codesize);
+    if (!code) {
+        code = buf = malloc(codesize);
+        if (romfile_read(f, base + codeoffset, code, codesize) < codesize) {
+            lerror("code is past the end of the file");
+            free(buf);
+            return -1;
+        }
+    }
 
     if (exhdr.sci.flags.compressed) {
-        u8* buf = lzssrev_decompress(code, codesize, &codesize);
-        free(code);
-        code = buf;
+        u8* dec = lzssrev_decompress(code, codesize, &codesize);
+        free(buf);
+        code = buf = dec;
     }
 
     memory_virtalloc(s, exhdr.sci.text.vaddr, exhdr.sci.text.pages * PAGE_SIZE,
@@ -229,9 +231,8 @@ u32 load_ncch(E3DS* s, char* filename, u64 offset) {
                exhdr.sci.rodata.pages * PAGE_SIZE,
            exhdr.sci.data.size);
 
-    free(code);
+    free(buf);
 
-    s->romimage.fp = fp;
     s->romimage.exheader_off = ncchbase + 0x200;
     s->romimage.exefs_off = ncchbase + hdrncch.exefs.offset * 0x200;
     s->romimage.romfs_off = ncchbase + hdrncch.romfs.offset * 0x200 + 0x1000;
@@ -247,9 +248,8 @@ u32 load_ncch(E3DS* s, char* filename, u64 offset) {
 
 void parse_smdh(E3DS* s) {
 
-    SMDHFile smdh;
-    fseek(s->romimage.fp, s->romimage.smdh_off, SEEK_SET);
-    fread(&smdh, sizeof smdh, 1, s->romimage.fp);
+    SMDHFile smdh = {};
+    romfile_read(&s->romimage.file, s->romimage.smdh_off, &smdh, sizeof smdh);
     if (strncmp(smdh.magic, "SMDH", 4)) {
         lerror("bad magic for SMDH: %.4s", smdh.magic);
         return;
@@ -271,58 +271,36 @@ void parse_smdh(E3DS* s) {
     else s->romimage.region = __builtin_ctz(smdh.settings.regionLock);
 }
 
-int find_smdh(char* filename) {
-    char* ext = strrchr(filename, '.');
-    if (!ext) {
-        return -1;
-    }
+// f is the opened file
+int find_smdh(RomFile* f, char* filename) {
+    char ext[8];
+    romfile_ext(filename, ext);
 
     u32 ncchbase;
     if (!strcmp(ext, ".3ds") || !strcmp(ext, ".cci") || !strcmp(ext, ".ncsd")) {
-        FILE* fp = fopen(filename, "rb");
-        if (!fp) return -1;
-        NCSDHeader hdrncsd;
-        fread(&hdrncsd, sizeof hdrncsd, 1, fp);
-        if (strncmp(hdrncsd.magic, "NCSD", 4)) {
-            fclose(fp);
-            return -1;
-        }
-        fclose(fp);
+        NCSDHeader hdrncsd = {};
+        romfile_read(f, 0, &hdrncsd, sizeof hdrncsd);
+        if (strncmp(hdrncsd.magic, "NCSD", 4)) return -1;
         ncchbase = hdrncsd.part[0].offset * 0x200;
     } else if (!strcmp(ext, ".cxi") || !strcmp(ext, ".app") ||
                !strcmp(ext, ".ncch")) {
         ncchbase = 0;
     } else if (!strcmp(ext, ".3dsx")) {
-        FILE* fp = fopen(filename, "rb");
-        if (!fp) return -1;
-        _3DSXHeader hdr;
-        fread(&hdr, 1, sizeof(_3DSXHeader), fp);
-        if (strncmp(hdr.magic, "3DSX", 4)) {
-            fclose(fp);
-            return -1;
-        }
-        fclose(fp);
+        _3DSXHeader hdr = {};
+        romfile_read(f, 0, &hdr, sizeof hdr);
+        if (strncmp(hdr.magic, "3DSX", 4)) return -1;
         return hdr.smdhOff;
     } else {
         return -1;
     }
-    FILE* fp = fopen(filename, "rb");
-    if (!fp) return -1;
 
     u64 base = ncchbase;
-    fseek(fp, base, SEEK_SET);
-    NCCHHeader hdrncch;
-    fread(&hdrncch, sizeof hdrncch, 1, fp);
-    if (strncmp(hdrncch.magic, "NCCH", 4)) {
-        fclose(fp);
-        return -1;
-    }
-    ExHeader exhdr;
-    fread(&exhdr, sizeof exhdr, 1, fp);
+    NCCHHeader hdrncch = {};
+    romfile_read(f, base, &hdrncch, sizeof hdrncch);
+    if (strncmp(hdrncch.magic, "NCCH", 4)) return -1;
     base += hdrncch.exefs.offset * 0x200;
-    fseek(fp, base, SEEK_SET);
-    ExeFSHeader hdrexefs;
-    fread(&hdrexefs, sizeof hdrexefs, 1, fp);
+    ExeFSHeader hdrexefs = {};
+    romfile_read(f, base, &hdrexefs, sizeof hdrexefs);
     base += 0x200;
     u32 iconoff = 0;
     for (int i = 0; i < 10; i++) {
@@ -330,7 +308,6 @@ int find_smdh(char* filename) {
             iconoff = hdrexefs.file[i].offset;
         }
     }
-    fclose(fp);
     return base + iconoff;
 }
 
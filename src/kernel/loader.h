@@ -2,6 +2,7 @@
 #define LOADER_H
 
 #include "common.h"
+#include "romfile.h"
 
 // elf format information copied from linux <elf.h>
 
@@ -163,7 +164,8 @@ typedef struct {
 typedef struct _3DS E3DS;
 
 typedef struct {
-    FILE* fp;
+    RomFile file;
+
     u32 exheader_off;
     u32 exefs_off;
     u32 smdh_off;
@@ -181,7 +183,7 @@ u32 load_ncsd(E3DS* s, char* filename);
 u32 load_ncch(E3DS* s, char* filename, u64 offset);
 
 void parse_smdh(E3DS* s);
-int find_smdh(char* filename);
+int find_smdh(RomFile* f, char* filename);
 
 u8* lzssrev_decompress(u8* in, u32 src_size, u32* dst_size);
 
@@ -0,0 +1,201 @@
+#include "memdirty.h"
+
+#include <stdlib.h>
+#include <string.h>
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include "memory.h"
+
+void memdirty_init(MemDirty* d, u32 npages) {
+    *d = (MemDirty) {};
+    d->npages = npages;
+    d->pagemap = -1;
+    d->clear_refs = -1;
+}
+
+void memdirty_destroy(MemDirty* d) {
+    for (int i = 0; i < DIRTY_MAX; i++) {
+        free(d->trackers[i].hashes);
+        free(d->trackers[i].pending);
+    }
+#ifdef __linux__
+    if (d->pagemap >= 0) close(d->pagemap);
+    if (d->clear_refs >= 0) close(d->clear_refs);
+#endif
+    d->pagemap = d->clear_refs = -1;
+}
+
+// 4 lane xxhash style hash, only used to tell if a page changed
+static u64 page_hash(u8* p) {
+    const u64 P1 = 0x9e3779b185ebca87;
+    const u64 P2 = 0xc2b2ae3d27d4eb4f;
+    u64 acc[4] = {P1, P2, -P1, -P2};
+    for (int i = 0; i < PAGE_SIZE; i += 32) {
+        for (int k = 0; k < 4; k++) {
+            u64 w;
+            memcpy(&w, &p[i + 8 * k], sizeof w);
+            acc[k] += w * P2;
+            acc[k] = (acc[k] << 31 | acc[k] >> 33) * P1;
+        }
+    }
+    u64 h = acc[0] ^ (acc[1] << 7 | acc[1] >> 57) ^
+            (acc[2] << 12 | acc[2] >> 52) ^ (acc[3] << 18 | acc[3] >> 46);
+    h ^= h >> 29;
+    h *= P2;
+    return h ^ h >> 32;
+}
+
+#ifdef __linux__
+// the kernel sets the soft dirty bit of a pte on the first write after it is
+// cleared through clear_refs, and reports it in bit 55 of the pagemap
+#define PM_SOFT_DIRTY BITL(55)
+
+static bool softdirty_clear(MemDirty* d) {
+    return write(d->clear_refs, "4", 1) == 1;
+}
+
+// some kernels (arm64, or without CONFIG_MEM_SOFT_DIRTY) accept the clear but
+// never set the bit, so check that a write actually shows up
+static bool softdirty_probe(MemDirty* d) {
+    if (getpagesize() != PAGE_SIZE) return false;
+    volatile u8* p = mmap(nullptr, PAGE_SIZE, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANON, -1, 0);
+    if (p == MAP_FAILED) return false;
+    p[0] = 1;
+    u64 ent = 0;
+    bool ok = false;
+    if (softdirty_clear(d)) {
+        p[0] = 2;
+        ok = pread(d->pagemap, &ent, sizeof ent,
+                   (uintptr_t) p / PAGE_SIZE * sizeof ent) == sizeof ent &&
+             (ent & PM_SOFT_DIRTY);
+    }
+    munmap((void*) p, PAGE_SIZE);
+    return ok;
+}
+
+static void softdirty_init(MemDirty* d) {
+    d->pagemap = open("/proc/self/pagemap", O_RDONLY);
+    d->clear_refs = open("/proc/self/clear_refs", O_WRONLY);
+    if (d->pagemap >= 0 && d->clear_refs >= 0 && softdirty_probe(d)) {
+        linfo("tracking state changes with soft dirty bits");
+        return;
+    }
+    linfo("soft dirty bits not available, hashing all of memory for states");
+    if (d->pagemap >= 0) close(d->pagemap);
+    if (d->clear_refs >= 0) close(d->clear_refs);
+    d->pagemap = d->clear_refs = -1;
+}
+
+// marks pages idx, idx + 1, ... for each written page in the host range
+void memdirty_mark_range(MemDirty* d, void* ptr, u32 npages, u32 idx,
+                         u8* dirty) {
+    u64 ents[512];
+    u64 off = (uintptr_t) ptr / PAGE_SIZE * sizeof ents[0];
+    for (u32 i = 0; i < npages; i += countof(ents)) {
+        u32 n = npages - i;
+        if (n > countof(ents)) n = countof(ents);
+        if (pread(d->pagemap, ents, n * sizeof ents[0],
+                  off + i * sizeof ents[0]) != n * sizeof ents[0]) {
+            // be conservative
+            memset(&dirty[idx + i], 1, n);
+            continue;
+        }
+        for (u32 j = 0; j < n; j++) {
+            if (ents[j] & PM_SOFT_DIRTY) dirty[idx + i + j] = 1;
+        }
+    }
+}
+#endif
+
+// fills pages with the indices of the pages of mem that changed since the
+// last collect of this tracker, or with every nonzero page if all is set
+// either way this becomes the new point changes are tracked from
+// scan marks the pages the soft dirty bits say were written, data the pages
+// that can be nonzero, without it every page is hashed on a full pass
+u32 memdirty_collect(MemDirty* d, int tracker, u8* mem, bool all, u32* pages,
+                     MemDirtyMark scan, MemDirtyMark data, void* arg) {
+    auto t = &d->trackers[tracker];
+#ifdef __linux__
+    if (!d->probed) {
+        softdirty_init(d);
+        d->probed = true;
+    }
+#endif
+    if (!t->hashes) {
+        t->hashes = malloc(d->npages * sizeof(u64));
+        t->pending = calloc(d->npages, 1);
+        all = true;
+    }
+
+    static u64 zerohash;
+    if (!zerohash) {
+        static u8 zero[PAGE_SIZE];
+        zerohash = page_hash(zero);
+    }
+
+    u8* cand = t->pending;
+    // a full snapshot hashes everything anyway, otherwise the bits are only
+    // trusted for so many collects in a row
+    bool scanall = all || ++t->collects >= DIRTY_FULL_SCAN;
+#ifdef __linux__
+    // the bits are shared, so what is seen here is kept for the other trackers
+    // before they are cleared
+    if (d->pagemap >= 0) {
+        u8* marked = calloc(d->npages, 1);
+        scan(arg, marked);
+        for (int i = 0; i < DIRTY_MAX; i++) {
+            if (!d->trackers[i].pending) continue;
+            for (u32 j = 0; j < d->npages; j++) {
+                d->trackers[i].pending[j] |= marked[j];
+            }
+        }
+        free(marked);
+        if (!softdirty_clear(d)) {
+            lwarn("could not clear soft dirty bits");
+            close(d->pagemap);
+            close(d->clear_refs);
+            d->pagemap = d->clear_refs = -1;
+            scanall = true;
+        }
+    } else {
+        scanall = true;
+    }
+#else
+    scanall = true;
+#endif
+    if (scanall) {
+        t->collects = 0;
+        if (data) {
+            memset(cand, 0, d->npages);
+            data(arg, cand);
+        } else {
+            memset(cand, 1, d->npages);
+        }
+    }
+
+    u32 n = 0;
+    for (u32 i = 0; i < d->npages; i++) {
+        if (!cand[i]) {
+            // holes are zero, which is a change if the page had data before
+            if (scanall && !all && t->hashes[i] != zerohash) {
+                if (pages) pages[n] = i;
+                n++;
+            }
+            if (scanall) t->hashes[i] = zerohash;
+            continue;
+        }
+        cand[i] = 0;
+        u64 h = page_hash(&mem[i * PAGE_SIZE]);
+        if (all ? h != zerohash : h != t->hashes[i]) {
+            if (pages) pages[n] = i;
+            n++;
+        }
+        t->hashes[i] = h;
+    }
+    return n;
+}
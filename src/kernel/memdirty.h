@@ -0,0 +1,50 @@
+#ifndef MEMDIRTY_H
+#define MEMDIRTY_H
+
+#include "common.h"
+
+// finding the pages written since the last save state or rewind snapshot
+// the kernel soft dirty bits narrow it down if they are available, the page
+// hashes catch pages that were rewritten with the same contents
+// the bits live in the ptes, and a pte that is dropped and faulted back in
+// (shmem reclaim, khugepaged collapsing a huge page) comes back without the
+// bit even though the page was written, so every so often a tracker hashes
+// all the pages instead of trusting the bits
+enum {
+    DIRTY_SAVESTATE,
+    DIRTY_REWIND,
+
+    DIRTY_MAX
+};
+
+// incremental collects of a tracker between full hash passes
+#define DIRTY_FULL_SCAN 64
+
+typedef struct {
+    u32 npages;
+    int pagemap;
+    int clear_refs;
+    bool probed;
+
+    // each user has its own point it tracks changes from
+    struct {
+        u64* hashes;
+        u8* pending;
+        u32 collects; // since the last full hash pass
+    } trackers[DIRTY_MAX];
+} MemDirty;
+
+// marks a page for each page that was written, or that could have data
+typedef void (*MemDirtyMark)(void* arg, u8* pages);
+
+void memdirty_init(MemDirty* d, u32 npages);
+void memdirty_destroy(MemDirty* d);
+
+#ifdef __linux__
+void memdirty_mark_range(MemDirty* d, void* ptr, u32 npages, u32 idx,
+                         u8* dirty);
+#endif
+u32 memdirty_collect(MemDirty* d, int tracker, u8* mem, bool all, u32* pages,
+                     MemDirtyMark scan, MemDirtyMark data, void* arg);
+
+#endif
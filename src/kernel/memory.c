@@ -1,6 +1,7 @@
 #include "memory.h"
 
 #ifdef FASTMEM
+#include <errno.h>
 #include <fcntl.h>
 #include <signal.h>
 #include <sys/mman.h>
@@ -10,6 +11,7 @@
 #include "3ds.h"
 #include "common.h"
 #include "emulator.h"
+#include "savestate.h"
 
 #include "svc_types.h"
 
@@ -45,7 +47,69 @@ void sigsegv_handler(int sig, siginfo_t* info, void* ucontext) {
     }
     sigaction(sig, &(struct sigaction) {.sa_handler = SIG_DFL}, nullptr);
 }
+
+#ifndef MAP_POPULATE
+#define MAP_POPULATE 0
+#endif
+
+#define HUGE_PAGE_SIZE BIT(21)
+
+// flags for the fixed mappings of the memfd, when prefaulting mmap fills in
+// the page tables up front instead of taking a fault on each first access
+static int memfd_mapflags() {
+    return MAP_SHARED | MAP_FIXED | (ctremu.prefaultmem ? MAP_POPULATE : 0);
+}
+
+// huge pages are only a hint, the kernel still decides based on the shmem thp
+// setting and falls back to 4k pages
+// only ranges covering at least one huge page can benefit
+static bool memfd_advise(void* ptr, size_t size) {
+#ifdef MADV_HUGEPAGE
+    if (!ctremu.hugepages || size < HUGE_PAGE_SIZE) return true;
+    return madvise(ptr, size, MADV_HUGEPAGE) == 0;
+#else
+    // there is no madvise call to fail, so no error to log
+    return true;
+#endif
+}
+
+// allocate all of the backing memory now, this has to happen after
+// memfd_advise or it will be allocated as 4k pages
+static void memfd_prefault(void* ptr, size_t size) {
+#ifdef MADV_POPULATE_WRITE
+    if (madvise(ptr, size, MADV_POPULATE_WRITE) == 0) return;
 #endif
+    // the memory is still all zero here
+    for (size_t i = 0; i < size; i += PAGE_SIZE) {
+        ((volatile u8*) ptr)[i] = 0;
+    }
+}
+#endif
+
+void* nodepool_alloc(NodePool* p, size_t size) {
+    if (!p->free) {
+        u8* chunk = malloc(NODEPOOL_CHUNK * size);
+        Vec_push(p->chunks, chunk);
+        for (int i = NODEPOOL_CHUNK - 1; i >= 0; i--) {
+            *(void**) &chunk[i * size] = p->free;
+            p->free = &chunk[i * size];
+        }
+    }
+    void* n = p->free;
+    p->free = *(void**) n;
+    return n;
+}
+
+void nodepool_free(NodePool* p, void* n) {
+    *(void**) n = p->free;
+    p->free = n;
+}
+
+void nodepool_destroy(NodePool* p) {
+    Vec_foreach(c, p->chunks) free(*c);
+    Vec_free(p->chunks);
+    p->free = nullptr;
+}
 
 u32 physaddr2memoff(u32 paddr) {
     if (FCRAM_PBASE <= paddr && paddr < FCRAM_PBASE + FCRAM_SIZE) {
@@ -65,6 +129,81 @@ u32 physaddr2memoff(u32 paddr) {
     longjmp(ctremu.exceptionJmp, EXC_MEM);
 }
 
+// the vm blocks are kept in a treap keyed by startpg alongside the list, so
+// finding the block containing an address doesn't walk the whole list
+
+void vmtree_split(VMBlock* t, u32 pg, VMBlock** l, VMBlock** r) {
+    if (!t) {
+        *l = *r = nullptr;
+    } else if (t->startpg < pg) {
+        vmtree_split(t->right, pg, &t->right, r);
+        *l = t;
+    } else {
+        vmtree_split(t->left, pg, l, &t->left);
+        *r = t;
+    }
+}
+
+VMBlock* vmtree_merge(VMBlock* l, VMBlock* r) {
+    if (!l) return r;
+    if (!r) return l;
+    if (l->prio > r->prio) {
+        l->right = vmtree_merge(l->right, r);
+        return l;
+    } else {
+        r->left = vmtree_merge(l, r->left);
+        return r;
+    }
+}
+
+VMBlock* vmtree_insert(VMBlock* t, VMBlock* n) {
+    if (!t || n->prio > t->prio) {
+        vmtree_split(t, n->startpg, &n->left, &n->right);
+        return n;
+    }
+    if (n->startpg < t->startpg) t->left = vmtree_insert(t->left, n);
+    else t->right = vmtree_insert(t->right, n);
+    return t;
+}
+
+VMBlock* vmtree_remove(VMBlock* t, u32 pg) {
+    if (!t) return nullptr;
+    if (pg < t->startpg) t->left = vmtree_remove(t->left, pg);
+    else if (pg > t->startpg) t->right = vmtree_remove(t->right, pg);
+    else return vmtree_merge(t->left, t->right);
+    return t;
+}
+
+// the last block starting at or before pg
+VMBlock* vmtree_floor(VMBlock* t, u32 pg) {
+    VMBlock* res = nullptr;
+    while (t) {
+        if (t->startpg <= pg) {
+            res = t;
+            t = t->right;
+        } else {
+            t = t->left;
+        }
+    }
+    return res;
+}
+
+VMBlock* vmblock_new(E3DS* s, u32 startpg, u32 endpg, u32 perm, u32 state) {
+    VMBlock* n = nodepool_alloc(&s->process.vmpool, sizeof *n);
+    *n = (VMBlock) {.startpg = startpg,
+                    .endpg = endpg,
+                    .perm = perm,
+                    .state = state,
+                    // fibonacci hash of the node address as the priority
+                    .prio = ((uintptr_t) n * 0x9e37'79b9'7f4a'7c15) >> 32};
+    return n;
+}
+
+void vmblock_free(E3DS* s, VMBlock* b) {
+    s->process.vmtree = vmtree_remove(s->process.vmtree, b->startpg);
+    nodepool_free(&s->process.vmpool, b);
+}
+
 void memory_init(E3DS* s) {
 #ifdef FASTMEM
     s->mem_fd = memfd_create(".3dsram", 0);
@@ -74,6 +213,14 @@ void memory_init(E3DS* s) {
     }
     s->mem = mmap(nullptr, sizeof(E3DSMemory), PROT_READ | PROT_WRITE,
                   MAP_SHARED, s->mem_fd, 0);
+    if (s->mem == MAP_FAILED) {
+        perror("mmap");
+        exit(1);
+    }
+    if (!memfd_advise(s->mem, sizeof(E3DSMemory))) {
+        linfo("huge pages are not available: %s", strerror(errno));
+    }
+    if (ctremu.prefaultmem) memfd_prefault(s->mem, sizeof(E3DSMemory));
 #else
     s->mem = calloc(1, sizeof *s->mem);
 #endif
@@ -98,19 +245,21 @@ void memory_init(E3DS* s) {
 
     void* ptr =
         mmap(&s->physmem[FCRAM_PBASE], FCRAM_SIZE, PROT_READ | PROT_WRITE,
-             MAP_SHARED | MAP_FIXED, s->mem_fd, offsetof(E3DSMemory, fcram));
+             memfd_mapflags(), s->mem_fd, offsetof(E3DSMemory, fcram));
     if (ptr == MAP_FAILED) {
         perror("mmap");
         exit(1);
     }
+    memfd_advise(ptr, FCRAM_SIZE);
     ptr = mmap(&s->physmem[VRAM_PBASE], VRAM_SIZE, PROT_READ | PROT_WRITE,
-               MAP_SHARED | MAP_FIXED, s->mem_fd, offsetof(E3DSMemory, vram));
+               memfd_mapflags(), s->mem_fd, offsetof(E3DSMemory, vram));
     if (ptr == MAP_FAILED) {
         perror("mmap");
         exit(1);
     }
+    memfd_advise(ptr, VRAM_SIZE);
     ptr = mmap(&s->physmem[DSPRAM_PBASE], DSPRAM_SIZE, PROT_READ | PROT_WRITE,
-               MAP_SHARED | MAP_FIXED, s->mem_fd, offsetof(E3DSMemory, dspram));
+               memfd_mapflags(), s->mem_fd, offsetof(E3DSMemory, dspram));
     if (ptr == MAP_FAILED) {
         perror("mmap");
         exit(1);
@@ -136,9 +285,15 @@ void memory_init(E3DS* s) {
 #else
     s->gpu.mem = s->mem;
     s->dsp.mem = s->mem;
+
+    for (int i = 0; i < SWTLB_SIZE; i++) {
+        s->tlb[i].tag = -1;
+    }
+    s->cpu.tlb = s->tlb;
 #endif
 
-    FreeListNode* initNode = malloc(sizeof *initNode);
+    FreeListNode* initNode =
+        nodepool_alloc(&s->freelistpool, sizeof *initNode);
     initNode->startpg = 0;
     initNode->endpg = FCRAM_SIZE / PAGE_SIZE;
     s->freelist.next = initNode;
@@ -146,28 +301,23 @@ void memory_init(E3DS* s) {
     s->freelist.prev = initNode;
     initNode->next = &s->freelist;
 
-    VMBlock* initblk = malloc(sizeof *initblk);
-    *initblk = (VMBlock) {
-        .startpg = 0, .endpg = BIT(20), .perm = 0, .state = MEMST_FREE};
+    VMBlock* initblk = vmblock_new(s, 0, BIT(20), 0, MEMST_FREE);
+    s->process.vmtree = vmtree_insert(nullptr, initblk);
     s->process.vmblocks.startpg = BIT(20);
     s->process.vmblocks.endpg = BIT(20);
     s->process.vmblocks.next = initblk;
     s->process.vmblocks.prev = initblk;
     initblk->prev = &s->process.vmblocks;
     initblk->next = &s->process.vmblocks;
+
+    memdirty_init(&s->dirty, MEM_NPAGES);
 }
 
 void memory_destroy(E3DS* s) {
-    while (s->freelist.next != &s->freelist) {
-        auto tmp = s->freelist.next;
-        s->freelist.next = s->freelist.next->next;
-        free(tmp);
-    }
-    while (s->process.vmblocks.next != &s->process.vmblocks) {
-        VMBlock* tmp = s->process.vmblocks.next;
-        s->process.vmblocks.next = s->process.vmblocks.next->next;
-        free(tmp);
-    }
+    memdirty_destroy(&s->dirty);
+
+    nodepool_destroy(&s->freelistpool);
+    nodepool_destroy(&s->process.vmpool);
     for (int i = 0; i < BIT(10); i++) {
         free(s->process.ptab[i]);
     }
@@ -198,7 +348,7 @@ u32 memory_physalloc(E3DS* s, u32 size) {
             if (cur->startpg == cur->endpg) {
                 cur->prev->next = cur->next;
                 cur->next->prev = cur->prev;
-                free(cur);
+                nodepool_free(&s->freelistpool, cur);
             }
             return paddr;
         }
@@ -241,23 +391,74 @@ void* sw_pptr(E3DSMemory* m, u32 addr) {
     return &m->raw[physaddr2memoff(addr)];
 }
 
-void* sw_vptr(E3DS* s, u32 addr) {
+// tlb miss path of sw_vptr
+void* sw_vptr_slow(E3DS* s, u32 addr) {
     auto ent = ptabread(s->process.ptab, addr);
-    return sw_pptr(s->mem, ent.paddr + addr % PAGE_SIZE);
+    u32 off = physaddr2memoff(ent.paddr);
+#ifndef FASTMEM
+    // invalid accesses that were let through to the null page stay slow so
+    // they are still reported
+    if (ent.state != MEMST_FREE && off != offsetof(E3DSMemory, nullpage)) {
+        auto e = &s->tlb[(addr >> 12) % SWTLB_SIZE];
+        e->tag = addr >> 12;
+        e->base = (uintptr_t) &s->mem->raw[off] - PGROUNDDOWN(addr);
+    }
+#endif
+    return &s->mem->raw[off + addr % PAGE_SIZE];
 }
 
-void insert_vmblock(E3DS* s, u32 base, u32 size, u32 perm, u32 state) {
-    VMBlock* n = malloc(sizeof(VMBlock));
-    *n = (VMBlock) {.startpg = base >> 12,
-                    .endpg = (base + size) >> 12,
-                    .perm = perm,
-                    .state = state};
+#ifndef FASTMEM
+void tlb_invalidate(E3DS* s, u32 vaddr) {
+    auto e = &s->tlb[(vaddr >> 12) % SWTLB_SIZE];
+    if (e->tag == vaddr >> 12) e->tag = -1;
+}
+#endif
+
+#ifdef FASTMEM
+// pages are mapped from the memfd in runs where consecutive virtual pages are
+// also consecutive in the memfd, so mapping a large region is a single mmap
+// instead of one per page
+typedef struct {
+    u32 vaddr;
+    u32 off;
+    u32 size;
+} MapRun;
+
+void maprun_flush(E3DS* s, MapRun* run) {
+    if (!run->size) return;
+    void* ptr = mmap(&s->virtmem[run->vaddr], run->size, PROT_READ | PROT_WRITE,
+                     memfd_mapflags(), s->mem_fd, run->off);
+    if (ptr == MAP_FAILED) {
+        perror("mmap");
+        exit(1);
+    }
+    memfd_advise(ptr, run->size);
+    run->size = 0;
+}
 
-    VMBlock* l = s->process.vmblocks.next;
-    while (l != &s->process.vmblocks) {
-        if (l->startpg <= n->startpg && n->startpg < l->endpg) break;
-        l = l->next;
+void maprun_add(E3DS* s, MapRun* run, u32 vaddr, u32 paddr) {
+    u32 off = physaddr2memoff(paddr);
+    if (run->size && (vaddr != run->vaddr + run->size ||
+                      off != run->off + run->size)) {
+        maprun_flush(s, run);
+    }
+    if (!run->size) {
+        run->vaddr = vaddr;
+        run->off = off;
     }
+    run->size += PAGE_SIZE;
+}
+#endif
+
+void insert_vmblock(E3DS* s, u32 base, u32 size, u32 perm, u32 state) {
+    if (!size) return;
+
+    VMBlock* n = vmblock_new(s, base >> 12, (base + size) >> 12, perm, state);
+
+    // n only goes in the tree once the blocks it overlaps are fixed up so
+    // startpg stays unique
+    VMBlock* l = vmtree_floor(s->process.vmtree, n->startpg);
+    if (!l) l = &s->process.vmblocks;
     VMBlock* r = l->next;
     n->next = r;
     n->prev = l;
@@ -265,48 +466,48 @@ void insert_vmblock(E3DS* s, u32 base, u32 size, u32 perm, u32 state) {
     r->prev = n;
 
     while (r->startpg < n->endpg) {
-        if (r->endpg < n->endpg) {
+        if (r->endpg <= n->endpg) {
             n->next = r->next;
             n->next->prev = n;
-            free(r);
+            vmblock_free(s, r);
             r = n->next;
         } else {
+            // this keeps r in the same place in the tree
             r->startpg = n->endpg;
             break;
         }
     }
     if (n->startpg < l->endpg) {
         if (n->endpg < l->endpg) {
-            VMBlock* nr = malloc(sizeof(VMBlock));
-            *nr = *l;
+            VMBlock* nr = vmblock_new(s, n->endpg, l->endpg, l->perm, l->state);
             nr->prev = n;
             nr->next = r;
             n->next = nr;
             r->prev = nr;
-            nr->startpg = n->endpg;
-            nr->endpg = l->endpg;
+            s->process.vmtree = vmtree_insert(s->process.vmtree, nr);
             r = nr;
         }
         if (l->startpg == n->startpg) {
             n->prev = l->prev;
             n->prev->next = n;
-            free(l);
+            vmblock_free(s, l);
             l = n->prev;
         } else {
             l->endpg = n->startpg;
         }
     }
+    s->process.vmtree = vmtree_insert(s->process.vmtree, n);
     if (r->startpg < BIT(20) && r->perm == n->perm && r->state == n->state) {
         n->endpg = r->endpg;
         n->next = r->next;
         n->next->prev = n;
-        free(r);
+        vmblock_free(s, r);
     }
     if (l->startpg < BIT(20) && l->perm == n->perm && l->state == n->state) {
         l->endpg = n->endpg;
         l->next = n->next;
         l->next->prev = l;
-        free(n);
+        vmblock_free(s, n);
     }
 }
 
@@ -333,19 +534,21 @@ u32 memory_virtmap(E3DS* s, u32 paddr, u32 vaddr, u32 size, u32 perm,
           vaddr, size, paddr, perm, state);
 
     u32 npage = size / PAGE_SIZE;
+#ifdef FASTMEM
+    MapRun run = {};
+#endif
 
     for (int i = 0; i < npage; i++, vaddr += PAGE_SIZE, paddr += PAGE_SIZE) {
         ptabwrite(s->process.ptab, vaddr, paddr, perm, state);
 #ifdef FASTMEM
-        void* ptr =
-            mmap(&s->virtmem[vaddr], PAGE_SIZE, PROT_READ | PROT_WRITE,
-                 MAP_SHARED | MAP_FIXED, s->mem_fd, physaddr2memoff(paddr));
-        if (ptr == MAP_FAILED) {
-            perror("mmap");
-            exit(1);
-        }
+        maprun_add(s, &run, vaddr, paddr);
+#else
+        tlb_invalidate(s, vaddr);
 #endif
     }
+#ifdef FASTMEM
+    maprun_flush(s, &run);
+#endif
     return vaddr;
 }
 
@@ -361,6 +564,9 @@ u32 memory_virtmirror(E3DS* s, u32 srcvaddr, u32 dstvaddr, u32 size, u32 perm) {
           dstvaddr, size, srcvaddr, perm);
 
     u32 npage = size / PAGE_SIZE;
+#ifdef FASTMEM
+    MapRun run = {};
+#endif
 
     for (int i = 0; i < npage;
          i++, srcvaddr += PAGE_SIZE, dstvaddr += PAGE_SIZE) {
@@ -368,20 +574,22 @@ u32 memory_virtmirror(E3DS* s, u32 srcvaddr, u32 dstvaddr, u32 size, u32 perm) {
 
         if (ent.state == MEMST_FREE) {
             lerror("invalid src address for mirrormap %08x", srcvaddr);
+#ifdef FASTMEM
+            maprun_flush(s, &run);
+#endif
             return 0;
         }
 
         ptabwrite(s->process.ptab, dstvaddr, ent.paddr, perm, MEMST_ALIAS);
 #ifdef FASTMEM
-        void* ptr =
-            mmap(&s->virtmem[dstvaddr], PAGE_SIZE, PROT_READ | PROT_WRITE,
-                 MAP_SHARED | MAP_FIXED, s->mem_fd, physaddr2memoff(ent.paddr));
-        if (ptr == MAP_FAILED) {
-            perror("mmap");
-            exit(1);
-        }
+        maprun_add(s, &run, dstvaddr, ent.paddr);
+#else
+        tlb_invalidate(s, dstvaddr);
 #endif
     }
+#ifdef FASTMEM
+    maprun_flush(s, &run);
+#endif
     return dstvaddr;
 }
 
@@ -405,26 +613,233 @@ u32 memory_linearheap_grow(E3DS* s, u32 size, u32 perm) {
         return 0;
     }
     u32 startaddr = LINEAR_HEAP_BASE + linearblk->startpg * PAGE_SIZE;
+    u32 paddr = FCRAM_PBASE + linearblk->startpg * PAGE_SIZE;
     linearblk->startpg += npage;
     linfo("extending linear heap by %x", size);
-    memory_virtmap(s, FCRAM_PBASE, LINEAR_HEAP_BASE, npage * PAGE_SIZE, perm,
-                   MEMST_CONTINUOUS);
+    // only the new part of the heap needs to be mapped, it gets merged with
+    // the existing block
+    memory_virtmap(s, paddr, startaddr, size, perm, MEMST_CONTINUOUS);
     s->process.used_memory += size;
     return startaddr;
 }
 
 VMBlock* memory_virtquery(E3DS* s, u32 addr) {
-    linfo("querying memory at %08x", addr);
-
     addr >>= 12;
-    VMBlock* b = s->process.vmblocks.next;
-    while (b != &s->process.vmblocks) {
-        if (b->startpg <= addr && addr < b->endpg) return b;
-        b = b->next;
-    }
+    VMBlock* b = vmtree_floor(s->process.vmtree, addr);
+    if (b && addr < b->endpg) return b;
     return nullptr;
 }
 
 void sharedmem_alloc(E3DS* s, KSharedMem* shmem) {
     shmem->paddr = memory_physalloc(s, shmem->size);
 }
+
+#ifdef __linux__
+// writes can go through any view of the memory, so each one is checked
+static void softdirty_scan(E3DS* s, u8* dirty) {
+    auto d = &s->dirty;
+    memdirty_mark_range(d, s->mem, MEM_NPAGES, 0, dirty);
+#ifdef FASTMEM
+    memdirty_mark_range(d, &s->physmem[FCRAM_PBASE], FCRAM_SIZE / PAGE_SIZE,
+                        offsetof(E3DSMemory, fcram) / PAGE_SIZE, dirty);
+    memdirty_mark_range(d, &s->physmem[VRAM_PBASE], VRAM_SIZE / PAGE_SIZE,
+                        offsetof(E3DSMemory, vram) / PAGE_SIZE, dirty);
+    memdirty_mark_range(d, &s->physmem[DSPRAM_PBASE], DSPRAM_SIZE / PAGE_SIZE,
+                        offsetof(E3DSMemory, dspram) / PAGE_SIZE, dirty);
+
+    // the virtual view is scanned block by block and translated through the
+    // page table
+    u8 vdirty[1024];
+    for (auto b = s->process.vmblocks.next; b != &s->process.vmblocks;
+         b = b->next) {
+        if (b->state == MEMST_FREE) continue;
+        for (u32 pg = b->startpg; pg < b->endpg; pg += countof(vdirty)) {
+            u32 n = b->endpg - pg;
+            if (n > countof(vdirty)) n = countof(vdirty);
+            memset(vdirty, 0, n);
+            memdirty_mark_range(d, &s->virtmem[pg * PAGE_SIZE], n, 0, vdirty);
+            for (u32 i = 0; i < n; i++) {
+                if (!vdirty[i]) continue;
+                auto ent = s->process.ptab[(pg + i) >> 10][(pg + i) & MASK(10)];
+                u32 off = physaddr2memoff(ent.paddr);
+                if (off < MEM_NPAGES * PAGE_SIZE) dirty[off / PAGE_SIZE] = 1;
+            }
+        }
+    }
+#endif
+}
+#endif
+
+#ifdef FASTMEM
+// pages that were never written are still holes in the memfd, they are known
+// to be zero and reading them would only allocate them
+static void mark_data_pages(E3DS* s, u8* data) {
+    off_t end = MEM_NPAGES * PAGE_SIZE;
+    off_t pos = 0;
+    while (pos < end) {
+        off_t start = lseek(s->mem_fd, pos, SEEK_DATA);
+        if (start < 0 && errno == ENXIO) break;
+        if (start < 0) start = pos; // no hole support, everything is data
+        if (start >= end) break;
+        off_t hole = lseek(s->mem_fd, start, SEEK_HOLE);
+        if (hole < 0 || hole > end) hole = end;
+        memset(&data[start / PAGE_SIZE], 1,
+               (hole - PGROUNDDOWN(start) + PAGE_SIZE - 1) / PAGE_SIZE);
+        pos = hole;
+    }
+}
+#endif
+
+// fills pages with the indices of the pages that changed since the last
+// collect of this tracker, or with every nonzero page if all is set
+// either way this becomes the new point changes are tracked from
+u32 memory_dirty_collect(E3DS* s, int tracker, bool all, u32* pages) {
+#ifdef __linux__
+    MemDirtyMark scan = (void*) softdirty_scan;
+#else
+    MemDirtyMark scan = nullptr;
+#endif
+#ifdef FASTMEM
+    MemDirtyMark data = (void*) mark_data_pages;
+#else
+    MemDirtyMark data = nullptr;
+#endif
+    return memdirty_collect(&s->dirty, tracker, s->mem->raw, all, pages, scan,
+                            data, s);
+}
+
+// clears the machine memory before a full state is applied, with fastmem the
+// memfd pages are released instead of being written
+void memory_zero(E3DS* s) {
+#if defined(FASTMEM) && defined(__linux__)
+    if (!fallocate(s->mem_fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, 0,
+                   MEM_NPAGES * PAGE_SIZE))
+        return;
+#endif
+    memset(s->mem->raw, 0, MEM_NPAGES * PAGE_SIZE);
+}
+
+// after the page tables are replaced, the host mappings or the tlb need to
+// match them again
+static void memory_remap(E3DS* s) {
+#ifdef FASTMEM
+    void* ptr = mmap(s->virtmem, BITL(32), PROT_NONE,
+                     MAP_PRIVATE | MAP_ANON | MAP_NORESERVE | MAP_FIXED, -1, 0);
+    if (ptr == MAP_FAILED) {
+        perror("mmap");
+        exit(1);
+    }
+    if (ctremu.ignore_null) {
+        ptr = mmap(&s->virtmem[0], PAGE_SIZE, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_FIXED, s->mem_fd,
+                   offsetof(E3DSMemory, nullpage));
+        if (ptr == MAP_FAILED) {
+            perror("mmap");
+            exit(1);
+        }
+    }
+
+    MapRun run = {};
+    for (auto b = s->process.vmblocks.next; b != &s->process.vmblocks;
+         b = b->next) {
+        if (b->state == MEMST_FREE) continue;
+        for (u32 pg = b->startpg; pg < b->endpg; pg++) {
+            maprun_add(s, &run, pg * PAGE_SIZE,
+                       s->process.ptab[pg >> 10][pg & MASK(10)].paddr);
+        }
+    }
+    maprun_flush(s, &run);
+#else
+    for (int i = 0; i < SWTLB_SIZE; i++) {
+        s->tlb[i].tag = -1;
+    }
+#endif
+}
+
+// the physical free list, the vm blocks and the page table
+void memory_serialize(E3DS* s, StateSer* ss) {
+    u32 nfree = 0;
+    for (auto n = s->freelist.next; n != &s->freelist; n = n->next) {
+        nfree++;
+    }
+    SER(ss, nfree);
+    if (ss->load) {
+        nodepool_destroy(&s->freelistpool);
+        s->freelist.next = s->freelist.prev = &s->freelist;
+        for (u32 i = 0; i < nfree && !ss->err; i++) {
+            FreeListNode* n = nodepool_alloc(&s->freelistpool, sizeof *n);
+            SER(ss, n->startpg);
+            SER(ss, n->endpg);
+            if (n->startpg >= n->endpg || n->endpg > FCRAM_SIZE / PAGE_SIZE) {
+                ss->err = true;
+            }
+            n->prev = s->freelist.prev;
+            n->next = &s->freelist;
+            n->prev->next = n;
+            s->freelist.prev = n;
+        }
+    } else {
+        for (auto n = s->freelist.next; n != &s->freelist; n = n->next) {
+            SER(ss, n->startpg);
+            SER(ss, n->endpg);
+        }
+    }
+
+    u32 nblocks = 0;
+    for (auto b = s->process.vmblocks.next; b != &s->process.vmblocks;
+         b = b->next) {
+        nblocks++;
+    }
+    SER(ss, nblocks);
+    auto vmblocks = &s->process.vmblocks;
+    if (ss->load) {
+        for (int i = 0; i < BIT(10); i++) {
+            free(s->process.ptab[i]);
+            s->process.ptab[i] = nullptr;
+        }
+        nodepool_destroy(&s->process.vmpool);
+        s->process.vmtree = nullptr;
+        vmblocks->next = vmblocks->prev = vmblocks;
+    }
+    // the blocks have to cover the whole address space in order
+    u32 pg = 0;
+    VMBlock* b = vmblocks->next;
+    for (u32 i = 0; i < nblocks && !ss->err; i++) {
+        VMBlock tmp = {};
+        if (!ss->load) tmp = *b;
+        SER(ss, tmp.startpg);
+        SER(ss, tmp.endpg);
+        SER(ss, tmp.perm);
+        SER(ss, tmp.state);
+        if (ss->load) {
+            if (tmp.startpg != pg || tmp.endpg <= pg || tmp.endpg > BIT(20)) {
+                ss->err = true;
+                break;
+            }
+            b = vmblock_new(s, tmp.startpg, tmp.endpg, tmp.perm, tmp.state);
+            b->prev = vmblocks->prev;
+            b->next = vmblocks;
+            b->prev->next = b;
+            vmblocks->prev = b;
+            s->process.vmtree = vmtree_insert(s->process.vmtree, b);
+        }
+        pg = tmp.endpg;
+
+        if (tmp.state != MEMST_FREE) {
+            for (u32 p = tmp.startpg; p < tmp.endpg; p++) {
+                PageEntry ent = {};
+                if (!ss->load) ent = s->process.ptab[p >> 10][p & MASK(10)];
+                SER(ss, ent);
+                if (ss->load) {
+                    ptabwrite(s->process.ptab, p * PAGE_SIZE, ent.paddr,
+                              ent.perm, ent.state);
+                }
+            }
+        }
+        b = b->next;
+    }
+    if (ss->load) {
+        if (pg != BIT(20)) ss->err = true;
+        if (!ss->err) memory_remap(s);
+    }
+}
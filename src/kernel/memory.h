@@ -4,6 +4,7 @@
 #include "common.h"
 
 #include "kernel.h"
+#include "memdirty.h"
 
 #define PAGE_SIZE BIT(12)
 
@@ -27,6 +28,20 @@ typedef union {
 } E3DSMemory;
 
 typedef struct _3DS E3DS;
+typedef struct _StateSer StateSer;
+
+// pages of E3DSMemory that make up the machine state, the null page is not
+// part of it
+#define MEM_NPAGES (offsetof(E3DSMemory, nullpage) / PAGE_SIZE)
+
+// the vm and physical memory bookkeeping nodes are allocated in chunks and
+// recycled through a free list instead of one malloc each
+#define NODEPOOL_CHUNK 256
+
+typedef struct {
+    void* free;
+    Vec(void*) chunks;
+} NodePool;
 
 typedef struct _FreeListNode {
     u32 startpg;
@@ -50,6 +65,11 @@ typedef struct _VMBlock {
     u32 state;
     struct _VMBlock* next;
     struct _VMBlock* prev;
+
+    // blocks are also in a treap by startpg for lookups
+    struct _VMBlock* left;
+    struct _VMBlock* right;
+    u32 prio;
 } VMBlock;
 
 typedef struct {
@@ -61,7 +81,7 @@ typedef struct {
 } KSharedMem;
 
 void* sw_pptr(E3DSMemory* m, u32 addr);
-void* sw_vptr(E3DS* s, u32 addr);
+void* sw_vptr_slow(E3DS* s, u32 addr);
 
 #ifdef FASTMEM
 #define PPTR(addr) ((void*) &s->physmem[addr])
@@ -83,8 +103,16 @@ u32 memory_virtalloc(E3DS* s, u32 addr, u32 size, u32 perm, u32 state);
 u32 memory_linearheap_grow(E3DS* s, u32 size, u32 perm);
 VMBlock* memory_virtquery(E3DS* s, u32 addr);
 
+u32 memory_dirty_collect(E3DS* s, int tracker, bool all, u32* pages);
+void memory_zero(E3DS* s);
+void memory_serialize(E3DS* s, StateSer* ss);
+
 void sharedmem_alloc(E3DS* s, KSharedMem* shmem);
 
+void* nodepool_alloc(NodePool* p, size_t size);
+void nodepool_free(NodePool* p, void* n);
+void nodepool_destroy(NodePool* p);
+
 
 #define FCRAMUSERSIZE (96 * BIT(20))
 
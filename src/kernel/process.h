@@ -11,6 +11,8 @@ typedef struct _KProcess {
     PageTable ptab;
 
     VMBlock vmblocks;
+    VMBlock* vmtree;
+    NodePool vmpool;
 
     KObject* handles[HANDLE_MAX];
 
@@ -0,0 +1,425 @@
+#include "romfile.h"
+
+#include <zstd.h>
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+#define fseek(a, b, c) _fseeki64(a, b, c)
+#define ftell(a) _ftelli64(a)
+#endif
+
+#define ZSTD_FRAME_MAGIC 0xfd2fb528
+
+typedef typeof(((RomFile*) 0)->prefetch_thrd.jobs.d[0]) RomJob;
+
+// reads bytes of the file itself
+static size_t read_at(RomFile* f, u64 off, void* dst, size_t size) {
+    if (f->map) {
+        if (off >= f->mapsize) return 0;
+        if (size > f->mapsize - off) size = f->mapsize - off;
+        memcpy(dst, f->map + off, size);
+        return size;
+    }
+    pthread_mutex_lock(&f->iolock);
+    fseek(f->fp, off, SEEK_SET);
+    size = fread(dst, 1, size, f->fp);
+    pthread_mutex_unlock(&f->iolock);
+    return size;
+}
+
+static void zstd_free(RomZstd* z) {
+    for (int i = 0; i < LRU_MAX(z->cache); i++) {
+        free(z->cache.d[i].data);
+    }
+    ZSTD_freeDCtx(z->dctx);
+    free(z->coff);
+    free(z->doff);
+    free(z->queued);
+    free(z->buf);
+    free(z->cbuf);
+    free(z);
+}
+
+static RomZstd* zstd_open(RomFile* f, u64 filesize) {
+    u8 footer[9];
+    if (filesize < 17 || read_at(f, filesize - 9, footer, 9) < 9) {
+        return nullptr;
+    }
+    u32 nframes, magic;
+    u8 desc = footer[4];
+    memcpy(&nframes, &footer[0], 4);
+    memcpy(&magic, &footer[5], 4);
+    if (magic != ZSTD_SEEKABLE_MAGIC || (desc & 0x7c)) return nullptr;
+
+    // each entry is the compressed and decompressed size of a frame and
+    // optionally a checksum
+    u32 entsize = desc & BIT(7) ? 12 : 8;
+    u64 tablesize = (u64) nframes * entsize + 9;
+    if (tablesize + 8 > filesize) {
+        lerror("seek table is bigger than the file");
+        return nullptr;
+    }
+    u64 tableoff = filesize - tablesize;
+    u32 skip[2];
+    if (read_at(f, tableoff - 8, skip, 8) < 8 ||
+        skip[0] != ZSTD_SKIPPABLE_MAGIC || skip[1] != tablesize) {
+        lerror("bad seek table frame");
+        return nullptr;
+    }
+
+    u8* table = malloc(tablesize);
+    if (read_at(f, tableoff, table, tablesize) < tablesize) {
+        free(table);
+        return nullptr;
+    }
+
+    RomZstd* z = calloc(1, sizeof *z);
+    z->nframes = nframes;
+    z->coff = malloc((nframes + 1) * sizeof *z->coff);
+    z->doff = malloc((nframes + 1) * sizeof *z->doff);
+    u64 c = 0, d = 0;
+    bool ok = true;
+    for (u32 i = 0; i < nframes; i++) {
+        u32 csize, dsize;
+        memcpy(&csize, &table[i * entsize], 4);
+        memcpy(&dsize, &table[i * entsize + 4], 4);
+        z->coff[i] = c;
+        z->doff[i] = d;
+        c += csize;
+        d += dsize;
+        if (dsize > ROM_FRAME_MAX || csize > ROM_FRAME_MAX) ok = false;
+        if (dsize > z->maxframe) z->maxframe = dsize;
+        if (csize > z->maxcframe) z->maxcframe = csize;
+    }
+    z->coff[nframes] = c;
+    z->doff[nframes] = d;
+    free(table);
+
+    if (!ok || c > tableoff - 8) {
+        lerror("bad seek table");
+        zstd_free(z);
+        return nullptr;
+    }
+
+    z->dctx = ZSTD_createDCtx();
+    z->buf = malloc(z->maxframe);
+    if (!f->map) z->cbuf = malloc(z->maxcframe);
+    z->queued = calloc(nframes, 1);
+    LRU_init(z->cache);
+    z->cachemax = ROM_CACHE;
+    if (z->maxframe && ROM_CACHE_BYTES / z->maxframe < z->cachemax) {
+        z->cachemax = ROM_CACHE_BYTES / z->maxframe;
+    }
+
+    linfo("rom is compressed in %d frames of up to %d bytes", nframes,
+          z->maxframe);
+    return z;
+}
+
+// the frame with the data at off
+static u32 frame_find(RomZstd* z, u64 off) {
+    u32 lo = 0, hi = z->nframes - 1;
+    while (lo < hi) {
+        u32 mid = lo + (hi - lo + 1) / 2;
+        if (z->doff[mid] <= off) lo = mid;
+        else hi = mid - 1;
+    }
+    return lo;
+}
+
+static bool frame_decompress(RomFile* f, u32 i, void* dctx, u8* cbuf,
+                             u8* out) {
+    auto z = f->zstd;
+    u64 csize = z->coff[i + 1] - z->coff[i];
+    u64 dsize = z->doff[i + 1] - z->doff[i];
+    const u8* src = f->map ? f->map + z->coff[i] : cbuf;
+    if (!f->map && read_at(f, z->coff[i], cbuf, csize) < csize) return false;
+    size_t n = ZSTD_decompressDCtx(dctx, out, dsize, src, csize);
+    if (ZSTD_isError(n) || n != dsize) {
+        lerror("could not decompress rom frame %d: %s", i,
+               ZSTD_isError(n) ? ZSTD_getErrorName(n) : "wrong size");
+        return false;
+    }
+    return true;
+}
+
+// all cache accesses are under the prefetch lock
+static bool cache_has(RomZstd* z, u32 i) {
+    auto e = LRU_search(z->cache, i + 1);
+    return e && e->key == i + 1;
+}
+
+// buf goes into the cache and gets back a buffer to reuse
+static RomFrame* cache_put(RomZstd* z, u32 i, u8** buf) {
+    // free the least recently used frames so the buffers stay in the budget
+    while (!cache_has(z, i) && z->cache.size >= z->cachemax) {
+        auto old = LRU_eject(z->cache);
+        old->key = 0;
+        free(old->data);
+        old->data = nullptr;
+    }
+    auto e = LRU_load(z->cache, i + 1);
+    e->key = i + 1;
+    u8* old = e->data;
+    e->data = *buf;
+    *buf = old ? old : malloc(z->maxframe);
+    return e;
+}
+
+static void* romfile_worker(RomFile* f) {
+    auto t = &f->prefetch_thrd;
+    auto z = f->zstd;
+
+    void* dctx = nullptr;
+    u8* buf = nullptr;
+    u8* cbuf = nullptr;
+    if (z) {
+        dctx = ZSTD_createDCtx();
+        buf = malloc(z->maxframe);
+        if (!f->map) cbuf = malloc(z->maxcframe);
+    }
+
+    pthread_mutex_lock(&t->lock);
+    while (true) {
+        while (!t->jobs.size && !t->die) {
+            pthread_cond_wait(&t->cond, &t->lock);
+        }
+        if (t->die) break;
+        RomJob j;
+        FIFO_pop(t->jobs, j);
+
+        if (z) {
+            u32 i = j.start;
+            if (!cache_has(z, i)) {
+                pthread_mutex_unlock(&t->lock);
+                bool ok = frame_decompress(f, i, dctx, cbuf, buf);
+                pthread_mutex_lock(&t->lock);
+                if (ok) cache_put(z, i, &buf);
+            }
+            z->queued[i] = 0;
+            pthread_cond_broadcast(&t->done);
+            continue;
+        }
+
+#ifndef _WIN32
+        // the hint only starts the io, touching the pages waits for it here
+        // so the read that gets to them later doesn't have to
+        pthread_mutex_unlock(&t->lock);
+        u64 pgsz = sysconf(_SC_PAGESIZE);
+        j.start &= ~(pgsz - 1);
+        madvise(f->map + j.start, j.end - j.start, MADV_WILLNEED);
+        for (u64 p = j.start; p < j.end; p += pgsz) {
+            (void) *(volatile u8*) &f->map[p];
+        }
+        pthread_mutex_lock(&t->lock);
+#endif
+    }
+    pthread_mutex_unlock(&t->lock);
+
+    ZSTD_freeDCtx(dctx);
+    free(buf);
+    free(cbuf);
+    return nullptr;
+}
+
+bool romfile_open(RomFile* f, char* filename, bool prefetch) {
+    *f = (RomFile) {};
+    f->fp = fopen(filename, "rb");
+    if (!f->fp) return false;
+
+    auto t = &f->prefetch_thrd;
+    pthread_mutex_init(&t->lock, nullptr);
+    pthread_cond_init(&t->cond, nullptr);
+    pthread_cond_init(&t->done, nullptr);
+    pthread_mutex_init(&f->iolock, nullptr);
+
+    fseek(f->fp, 0, SEEK_END);
+    u64 filesize = ftell(f->fp);
+#ifndef _WIN32
+    if (filesize) {
+        void* map =
+            mmap(nullptr, filesize, PROT_READ, MAP_PRIVATE, fileno(f->fp), 0);
+        if (map != MAP_FAILED) {
+            f->map = map;
+            f->mapsize = filesize;
+        } else {
+            lwarn("could not map the rom, reading it through stdio");
+        }
+    }
+#endif
+
+    f->size = filesize;
+    f->zstd = zstd_open(f, filesize);
+    if (f->zstd) {
+        f->size = f->zstd->doff[f->zstd->nframes];
+    } else {
+        u32 magic = 0;
+        read_at(f, 0, &magic, 4);
+        if (magic == ZSTD_FRAME_MAGIC) {
+            lerror("compressed roms need to be in the zstd seekable format");
+            romfile_close(f);
+            return false;
+        }
+    }
+
+    if (prefetch) {
+        t->nthreads = f->zstd ? ROM_WORKERS : f->map ? 1 : 0;
+        for (int i = 0; i < t->nthreads; i++) {
+            pthread_create(&t->threads[i], nullptr, (void*) romfile_worker, f);
+        }
+    }
+
+    return true;
+}
+
+void romfile_close(RomFile* f) {
+    if (!f->fp) return;
+
+    auto t = &f->prefetch_thrd;
+    pthread_mutex_lock(&t->lock);
+    t->die = true;
+    pthread_cond_broadcast(&t->cond);
+    pthread_mutex_unlock(&t->lock);
+    for (int i = 0; i < t->nthreads; i++) {
+        pthread_join(t->threads[i], nullptr);
+    }
+    pthread_mutex_destroy(&t->lock);
+    pthread_cond_destroy(&t->cond);
+    pthread_cond_destroy(&t->done);
+    pthread_mutex_destroy(&f->iolock);
+
+    if (f->zstd) zstd_free(f->zstd);
+#ifndef _WIN32
+    if (f->map) munmap(f->map, f->mapsize);
+#endif
+    fclose(f->fp);
+    *f = (RomFile) {};
+}
+
+static void romfile_readahead(RomFile* f, u64 off, u64 end) {
+    auto t = &f->prefetch_thrd;
+    if (!t->nthreads) return;
+
+    f->clock++;
+
+    int victim = 0;
+    typeof(&f->streams[0]) st = nullptr;
+    for (int i = 0; i < ROM_STREAMS; i++) {
+        if (f->streams[i].next == off) {
+            st = &f->streams[i];
+            break;
+        }
+        if (f->streams[i].used < f->streams[victim].used) victim = i;
+    }
+    if (!st) {
+        // a single read could be anything, only prefetch once it continues
+        st = &f->streams[victim];
+        *st = (typeof(*st)) {.next = end, .ahead = end, .used = f->clock};
+        return;
+    }
+
+    st->next = end;
+    st->used = f->clock;
+    if (st->ahead < end) st->ahead = end;
+    st->window = st->window ? st->window * 2 : ROM_READAHEAD_MIN;
+    if (st->window > ROM_READAHEAD_MAX) st->window = ROM_READAHEAD_MAX;
+
+    // ask for more once half of what was prefetched has been read
+    if (st->ahead - end >= st->window / 2 || st->ahead >= f->size) return;
+    u64 want = end + st->window;
+    if (want > f->size) want = f->size;
+
+    pthread_mutex_lock(&t->lock);
+    if (f->zstd) {
+        auto z = f->zstd;
+        // no more frames than fit in the cache next to the ones being read
+        u32 last = frame_find(z, end - 1) + z->cachemax / 2;
+        if (last < z->nframes && z->doff[last] < want) want = z->doff[last];
+        u32 i = frame_find(z, st->ahead);
+        if (z->doff[i] < st->ahead) i++;
+        for (; i < z->nframes && z->doff[i] < want; i++) {
+            if (t->jobs.size == FIFO_MAX(t->jobs)) break;
+            if (z->queued[i] || cache_has(z, i)) continue;
+            z->queued[i] = 1;
+            FIFO_push(t->jobs, ((RomJob) {i, 0}));
+        }
+        st->ahead = i < z->nframes ? z->doff[i] : f->size;
+        pthread_cond_broadcast(&t->cond);
+    } else if (t->jobs.size < FIFO_MAX(t->jobs)) {
+        FIFO_push(t->jobs, ((RomJob) {st->ahead, want}));
+        st->ahead = want;
+        pthread_cond_signal(&t->cond);
+    }
+    pthread_mutex_unlock(&t->lock);
+}
+
+static u32 zstd_read(RomFile* f, u64 off, u8* dst, u32 size) {
+    auto z = f->zstd;
+    auto t = &f->prefetch_thrd;
+
+    u32 done = 0;
+    u32 i = frame_find(z, off);
+    while (done < size) {
+        u64 pos = off + done;
+        while (z->doff[i + 1] <= pos) i++;
+        u32 len = z->doff[i + 1] - pos;
+        if (len > size - done) len = size - done;
+
+        pthread_mutex_lock(&t->lock);
+        RomFrame* e;
+        // a worker might already be on it
+        while (!(e = LRU_find(z->cache, i + 1)) && z->queued[i]) {
+            pthread_cond_wait(&t->done, &t->lock);
+        }
+        if (!e) {
+            pthread_mutex_unlock(&t->lock);
+            if (!frame_decompress(f, i, z->dctx, z->cbuf, z->buf)) {
+                return done;
+            }
+            pthread_mutex_lock(&t->lock);
+            e = cache_put(z, i, &z->buf);
+        }
+        memcpy(dst + done, e->data + (pos - z->doff[i]), len);
+        pthread_mutex_unlock(&t->lock);
+
+        done += len;
+    }
+    return done;
+}
+
+// returns how much was read, which is less than size past the end of the image
+u32 romfile_read(RomFile* f, u64 off, void* dst, u32 size) {
+    if (!f->fp || off >= f->size || !size) return 0;
+    if (size > f->size - off) size = f->size - off;
+    romfile_readahead(f, off, off + size);
+    if (f->zstd) return zstd_read(f, off, dst, size);
+    return read_at(f, off, dst, size);
+}
+
+// the image data itself if it is mapped, so it can be used without a copy
+u8* romfile_ptr(RomFile* f, u64 off, u32 size) {
+    if (!f->map || f->zstd || off > f->size || size > f->size - off) {
+        return nullptr;
+    }
+    return f->map + off;
+}
+
+// the extension of a rom file name, without the .zst of a compressed one
+void romfile_ext(char* filename, char ext[static 8]) {
+    ext[0] = '\0';
+    char* end = filename + strlen(filename);
+    char* e = strrchr(filename, '.');
+    if (e && !strcmp(e, ".zst")) {
+        end = e;
+        e = nullptr;
+        for (char* p = filename; p < end; p++) {
+            if (*p == '.') e = p;
+        }
+    }
+    if (!e || end - e >= 8) return;
+    memcpy(ext, e, end - e);
+    ext[end - e] = '\0';
+}
@@ -0,0 +1,93 @@
+#ifndef ROMFILE_H
+#define ROMFILE_H
+
+#include <pthread.h>
+#include <stdio.h>
+
+#include "common.h"
+
+// reads that continue where an earlier one stopped are a stream, each time a
+// stream continues the data after it is prefetched with the window doubling
+#define ROM_STREAMS 8
+#define ROM_READAHEAD_MIN BIT(17)
+#define ROM_READAHEAD_MAX BIT(23)
+#define ROM_JOBS 256
+
+#define ROM_WORKERS 4
+// decompressed frames kept around for a compressed image, as many as fit in
+// the budget up to the number of cache entries
+#define ROM_CACHE 64
+#define ROM_CACHE_BYTES BIT(28)
+// frames bigger than this are not worth seeking in
+#define ROM_FRAME_MAX BIT(26)
+
+#define ZSTD_SEEKABLE_MAGIC 0x8f92eab1
+#define ZSTD_SKIPPABLE_MAGIC 0x184d2a5e
+
+typedef struct _RomFrame {
+    u32 key; // frame index + 1
+    u8* data;
+    struct _RomFrame *next, *prev;
+} RomFrame;
+
+// an image in the zstd seekable format, independently compressed frames
+// followed by a table of their sizes in a skippable frame
+typedef struct {
+    u32 nframes;
+    u64* coff; // where each frame starts in the file, one more for the end
+    u64* doff; // where its data starts in the image, one more for the end
+    u32 maxframe;
+    u32 maxcframe;
+
+    void* dctx; // for decompressing on the reading thread
+    u8* buf;
+    u8* cbuf;
+
+    LRUCache(RomFrame, ROM_CACHE) cache;
+    u32 cachemax; // frames that fit in the budget, each buffer is maxframe
+    u8* queued; // per frame, set while a worker has it
+} RomZstd;
+
+typedef struct {
+    FILE* fp;
+    u64 size; // of the image, after decompression
+    // the whole file mapped read only so reads are one copy from here, null
+    // when it can't be mapped and reads go through fp instead
+    u8* map;
+    u64 mapsize;
+    RomZstd* zstd; // null if the image isn't compressed
+
+    struct {
+        u64 next;  // where the next read continues the stream
+        u64 ahead; // how far it has been prefetched
+        u32 window;
+        u32 used;
+    } streams[ROM_STREAMS];
+    u32 clock;
+
+    // prefetch the pages of a mapped image or decompress the frames of a
+    // compressed one ahead of the reads
+    struct {
+        pthread_t threads[ROM_WORKERS];
+        int nthreads;
+        pthread_mutex_t lock;
+        pthread_cond_t cond;
+        pthread_cond_t done; // a frame was decompressed
+        bool die;
+        // a range of a mapped image, or the index of a frame in start
+        FIFO(struct {
+            u64 start;
+            u64 end;
+        }, ROM_JOBS) jobs;
+    } prefetch_thrd;
+    pthread_mutex_t iolock; // for fp when workers read through it
+} RomFile;
+
+bool romfile_open(RomFile* f, char* filename, bool prefetch);
+void romfile_close(RomFile* f);
+u32 romfile_read(RomFile* f, u64 off, void* dst, u32 size);
+u8* romfile_ptr(RomFile* f, u64 off, u32 size);
+
+void romfile_ext(char* filename, char ext[static 8]);
+
+#endif
@@ -136,7 +136,7 @@ DECL_SVC(SleepThread) {
         // this acts as thread yield, this thread will stay
         // ready but let another thread run for now
         // importantly if no other threads are ready we do nothing
-        if (s->readylist.next != &s->readylist) {
+        if (s->ready.prios) {
             caller->state = THRD_SLEEP;
             thread_reschedule(s);
             thread_ready(s, caller);
@@ -170,17 +170,13 @@ DECL_SVC(SetThreadPriority) {
         return;
     }
 
-    t->priority = R(1);
-
-    if (t->state == THRD_READY) {
-        t->next->prev = t->prev;
-        t->prev->next = t->next;
-        // need this so thread ready knows this wasnt already in readylist
-        t->state = THRD_SLEEP;
-        t->next = t->prev = nullptr;
-        thread_ready(s, t);
+    if (R(1) >= THRD_MAX_PRIO) {
+        R(0) = -1;
+        return;
     }
 
+    thread_set_priority(s, t, R(1));
+
     linfo("thread %d has priority %#x", t->id, t->priority);
 
     thread_reschedule(s);
@@ -440,47 +436,15 @@ DECL_SVC(ArbitrateAddress) {
     switch (type) {
         case ARBITRATE_SIGNAL:
             linfo("signaling address %08x", addr);
-            if (value < 0) {
-                KListNode** cur = &arbiter->waiting_thrds;
-                while (*cur) {
-                    KThread* t = (KThread*) (*cur)->key;
-                    if (t->waiting_addr == addr) {
-                        thread_wakeup(s, t, &arbiter->hdr);
-                        klist_remove(cur);
-                    } else {
-                        cur = &(*cur)->next;
-                    }
-                }
-            } else {
-                for (int i = 0; i < value; i++) {
-                    u32 maxprio = THRD_MAX_PRIO;
-                    KListNode** toRemove = nullptr;
-                    KListNode** cur = &arbiter->waiting_thrds;
-                    while (*cur) {
-                        KThread* t = (KThread*) (*cur)->key;
-                        if (t->waiting_addr == addr) {
-                            if (t->priority < maxprio) {
-                                maxprio = t->priority;
-                                toRemove = cur;
-                            }
-                        }
-                        cur = &(*cur)->next;
-                    }
-                    if (!toRemove) break;
-                    KThread* t = (KThread*) (*toRemove)->key;
-                    thread_wakeup(s, t, &arbiter->hdr);
-                    klist_remove(toRemove);
-                }
-            }
+            arbiter_signal(s, arbiter, addr, value);
             break;
         case ARBITRATE_WAIT:
         case ARBITRATE_DEC_WAIT:
         case ARBITRATE_WAIT_TIMEOUT:
         case ARBITRATE_DEC_WAIT_TIMEOUT:
             if (*(s32*) PTR(addr) < value) {
-                klist_insert(&arbiter->waiting_thrds, &caller->hdr);
+                arbiter_wait(arbiter, caller, addr);
                 klist_insert(&caller->waiting_objs, &arbiter->hdr);
-                caller->waiting_addr = addr;
                 linfo("waiting on address %08x", addr);
                 caller->wait_any = false;
                 if (type == ARBITRATE_WAIT_TIMEOUT ||
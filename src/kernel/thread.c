@@ -1,6 +1,7 @@
 #include "thread.h"
 
 #include "3ds.h"
+#include "profiler.h"
 
 void e3ds_restore_context(E3DS* s) {
     if (!CUR_THREAD) return;
@@ -19,10 +20,7 @@ void e3ds_save_context(E3DS* s) {
 }
 
 void thread_init(E3DS* s, u32 entrypoint) {
-    s->readylist.priority = 0;
-    s->readylist.id = 0;
-    s->readylist.next = &s->readylist;
-    s->readylist.prev = &s->readylist;
+    s->ready = (ReadyQueue) {};
 
     s->process.nexttid = 0;
     s->process.allocTls = 0;
@@ -31,12 +29,10 @@ void thread_init(E3DS* s, u32 entrypoint) {
 
     s->process.handles[0] = &thd->hdr;
     s->process.handles[0]->refcount = 2;
+    g_profiler.tid = thd->id;
 
     // manually schedule the main thread
-    thd->next->prev = thd->prev;
-    thd->prev->next = thd->next;
-    thd->next = nullptr;
-    thd->prev = nullptr;
+    thread_unready(s, thd);
     thd->state = THRD_RUNNING;
 }
 
@@ -79,26 +75,33 @@ KThread* thread_create(E3DS* s, u32 entrypoint, u32 stacktop, u32 priority,
 }
 
 void thread_ready(E3DS* s, KThread* t) {
-    if (t->state == THRD_READY || t->next || t->prev) {
+    if (t->state == THRD_READY) {
         lerror("thread already ready (this should never happen)");
         return;
     }
 
     t->state = THRD_READY;
 
-    t->next = &s->readylist;
-    t->prev = s->readylist.prev;
-    t->next->prev = t;
-    t->prev->next = t;
+    // threads of the same priority run in the order they became ready
+    auto q = &s->ready.q[t->priority];
+    t->next = nullptr;
+    t->prev = q->tail;
+    if (q->tail) q->tail->next = t;
+    else q->head = t;
+    q->tail = t;
+    s->ready.prios |= BITL(t->priority);
+}
 
-    while (t->priority < t->prev->priority) {
-        t->prev->next = t->next;
-        t->next->prev = t->prev;
-        t->next = t->prev;
-        t->prev = t->prev->prev;
-        t->prev->next = t;
-        t->next->prev = t;
-    }
+// takes a ready thread out of its queue, the caller sets the new state
+void thread_unready(E3DS* s, KThread* t) {
+    auto q = &s->ready.q[t->priority];
+    if (t->prev) t->prev->next = t->next;
+    else q->head = t->next;
+    if (t->next) t->next->prev = t->prev;
+    else q->tail = t->prev;
+    t->next = nullptr;
+    t->prev = nullptr;
+    if (!q->head) s->ready.prios &= ~BITL(t->priority);
 }
 
 void thread_reschedule(E3DS* s) {
@@ -111,26 +114,21 @@ void thread_reschedule(E3DS* s) {
     }
 
     // find the next thread
+    KThread* top = nullptr;
+    if (s->ready.prios) {
+        top = s->ready.q[__builtin_ctzll(s->ready.prios)].head;
+    }
     if (cur && cur->state == THRD_RUNNING) {
-        if (s->readylist.next == &s->readylist) {
-            // no other threads are ready so dont switch
-            next = cur;
+        // only switch to a new thread if its priority is
+        // higher than the current thread
+        if (top && top->priority < cur->priority) {
+            next = top;
         } else {
-            // only switch to a new thread if its priority is
-            // higher than the current thread
-            if (s->readylist.next->priority < CUR_THREAD->priority) {
-                next = s->readylist.next;
-            } else {
-                next = cur;
-            }
+            next = cur;
         }
     } else {
-        if (s->readylist.next == &s->readylist) {
-            // no more threads are ready right now
-            next = nullptr;
-        } else {
-            next = s->readylist.next;
-        }
+        // null if no more threads are ready right now
+        next = top;
     }
 
     if (CUR_THREAD == next) {
@@ -138,15 +136,12 @@ void thread_reschedule(E3DS* s) {
         return;
     }
 
-    // put cur thread into ready list if necessary
+    // put cur thread into ready queue if necessary
     if (cur && cur->state == THRD_RUNNING) thread_ready(s, CUR_THREAD);
 
     if (next) {
-        // pop from the ready list
-        next->next->prev = next->prev;
-        next->prev->next = next->next;
-        next->next = nullptr;
-        next->prev = nullptr;
+        // pop from the ready queue
+        thread_unready(s, next);
         next->state = THRD_RUNNING;
         s->cpu.halt = false;
     } else {
@@ -156,6 +151,7 @@ void thread_reschedule(E3DS* s) {
     if (cur) s->process.handles[0]->refcount--;
     s->process.handles[0] = &next->hdr;
     if (next) s->process.handles[0]->refcount++;
+    if (next) g_profiler.tid = next->id;
 
     if (cur && next) {
         linfo("switching from thread %d to thread %d", cur->id, next->id);
@@ -166,6 +162,26 @@ void thread_reschedule(E3DS* s) {
     }
 }
 
+void thread_set_priority(E3DS* s, KThread* t, s32 priority) {
+    if (t->state == THRD_READY) {
+        thread_unready(s, t);
+        t->priority = priority;
+        // need this so thread ready knows this wasnt already ready
+        t->state = THRD_SLEEP;
+        thread_ready(s, t);
+        return;
+    }
+
+    // a waiting thread also has to move to its new place in the arbiter queue
+    KArbiter* arb = nullptr;
+    for (auto k = t->waiting_objs; k; k = k->next) {
+        if (k->key->type == KOT_ARBITER) arb = (KArbiter*) k->key;
+    }
+    if (arb) arbiter_remove(arb, t);
+    t->priority = priority;
+    if (arb) arbiter_wait(arb, t, t->waiting_addr);
+}
+
 void thread_sleep(E3DS* s, KThread* t, s64 timeout) {
     linfo("sleeping thread %d with timeout %ld", t->id, timeout);
 
@@ -236,10 +252,7 @@ void thread_kill(E3DS* s, KThread* t) {
 
     s->process.allocTls &= ~BIT((t->tls - TLS_BASE) / TLS_SIZE);
 
-    if (t->state == THRD_READY) {
-        t->next->prev = t->prev;
-        t->prev->next = t->next;
-    }
+    if (t->state == THRD_READY) thread_unready(s, t);
 
     t->state = THRD_DEAD;
 
@@ -284,6 +297,51 @@ KThread* remove_highest_prio(KListNode** l) {
     return wakeupthread;
 }
 
+static KThread** arbiter_bucket(KArbiter* arb, u32 addr) {
+    return &arb->waiting[(addr >> 2) % ARBITER_BUCKETS];
+}
+
+void arbiter_wait(KArbiter* arb, KThread* t, u32 addr) {
+    t->waiting_addr = addr;
+
+    // goes after the threads of the same or higher priority
+    KThread** l = arbiter_bucket(arb, addr);
+    KThread* prev = nullptr;
+    while (*l && (*l)->priority <= t->priority) {
+        prev = *l;
+        l = &(*l)->arbnext;
+    }
+    t->arbnext = *l;
+    t->arbprev = prev;
+    if (*l) (*l)->arbprev = t;
+    *l = t;
+}
+
+void arbiter_remove(KArbiter* arb, KThread* t) {
+    KThread** head = arbiter_bucket(arb, t->waiting_addr);
+    if (!t->arbprev && *head != t) return;
+    if (t->arbprev) t->arbprev->arbnext = t->arbnext;
+    else *head = t->arbnext;
+    if (t->arbnext) t->arbnext->arbprev = t->arbprev;
+    t->arbnext = nullptr;
+    t->arbprev = nullptr;
+}
+
+// wakes up to count threads waiting on addr from the highest priority, or all
+// of them if count is negative
+void arbiter_signal(E3DS* s, KArbiter* arb, u32 addr, s32 count) {
+    KThread* t = *arbiter_bucket(arb, addr);
+    while (t && count != 0) {
+        KThread* next = t->arbnext;
+        if (t->waiting_addr == addr) {
+            arbiter_remove(arb, t);
+            thread_wakeup(s, t, &arb->hdr);
+            if (count > 0) count--;
+        }
+        t = next;
+    }
+}
+
 KEvent* event_create(bool sticky) {
     KEvent* ev = calloc(1, sizeof *ev);
     ev->hdr.type = KOT_EVENT;
@@ -479,7 +537,7 @@ void sync_cancel(KThread* t, KObject* o) {
         }
         case KOT_ARBITER: {
             auto arb = (KArbiter*) o;
-            klist_remove_key(&arb->waiting_thrds, &t->hdr);
+            arbiter_remove(arb, t);
             break;
         }
         case KOT_SESSION:
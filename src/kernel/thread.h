@@ -41,6 +41,7 @@ typedef struct _KThread {
     } ctx;
 
     u32 waiting_addr;
+    struct _KThread *arbnext, *arbprev; // in an arbiter wait queue
     KListNode* waiting_objs;
     bool wait_any;
 
@@ -48,7 +49,7 @@ typedef struct _KThread {
 
     KListNode* owned_mutexes;
 
-    struct _KThread *next, *prev; // in the ready list
+    struct _KThread *next, *prev; // in the ready queue
 
     u32 id;
     s32 priority;
@@ -98,14 +99,27 @@ typedef struct {
     KListNode* waiting_thrds;
 } KMutex;
 
+// waiting threads are hashed by address into buckets each ordered by priority
+// so a signal only looks at the threads that could be waiting on it
+#define ARBITER_BUCKETS 32
+
 typedef struct {
     KObject hdr;
 
-    KListNode* waiting_thrds;
+    KThread* waiting[ARBITER_BUCKETS];
 } KArbiter;
 
 #define THRD_MAX_PRIO 0x40
 
+// a queue per priority and a bit set for each one that is not empty, so the
+// highest priority ready thread is the lowest set bit
+typedef struct {
+    u64 prios;
+    struct {
+        KThread *head, *tail;
+    } q[THRD_MAX_PRIO];
+} ReadyQueue;
+
 #define CUR_THREAD ((KThread*) s->process.handles[0])
 
 void e3ds_restore_context(E3DS* s);
@@ -115,7 +129,9 @@ void thread_init(E3DS* s, u32 entrypoint);
 KThread* thread_create(E3DS* s, u32 entrypoint, u32 stacktop, u32 priority,
                        u32 arg, s32 processorID);
 void thread_ready(E3DS* s, KThread* t);
+void thread_unready(E3DS* s, KThread* t);
 void thread_reschedule(E3DS* s);
+void thread_set_priority(E3DS* s, KThread* t, s32 priority);
 
 void thread_sleep(E3DS* s, KThread* t, s64 timeout);
 void thread_wakeup_timeout(E3DS* s, KThread* t);
@@ -135,6 +151,10 @@ void mutex_release(E3DS* s, KMutex* mtx);
 KSemaphore* semaphore_create(s32 init, s32 max);
 void semaphore_release(E3DS* s, KSemaphore* sem, s32 count);
 
+void arbiter_wait(KArbiter* arb, KThread* t, u32 addr);
+void arbiter_remove(KArbiter* arb, KThread* t);
+void arbiter_signal(E3DS* s, KArbiter* arb, u32 addr, s32 count);
+
 bool sync_wait(E3DS* s, KThread* t, KObject* o);
 void sync_cancel(KThread* t, KObject* o);
 
@@ -10,8 +10,11 @@
 #include <imgui/dcimgui_impl_sdl3.h>
 
 #include "3ds.h"
+#include "arm/jit/jit.h"
 #include "emulator.h"
 #include "gui.h"
+#include "headless.h"
+#include "perfmap.h"
 #include "video/renderer_gl.h"
 
 #ifdef _WIN32
@@ -29,6 +32,7 @@ SDL_AudioStream* g_audio_input;
 SDL_Camera* g_camera;
 
 char* romfile_arg;
+char* jitstats_arg;
 
 #define FREECAM_SPEED 5.0
 #define FREECAM_ROTATE_SPEED 0.02
@@ -40,13 +44,51 @@ void glDebugOutput(GLenum source, GLenum type, unsigned int id, GLenum severity,
 }
 #endif
 
+// the working directory is changed later so paths given on the command line
+// need to be absolute
+char* abspath_arg(const char* path) {
+    if (path[0] == '/' || !strcmp(path, "-")) return strdup(path);
+    char* cwd = getcwd(nullptr, 0);
+    char* res;
+    asprintf(&res, "%s/%s", cwd, path);
+    free(cwd);
+    return res;
+}
+
 void read_args(int argc, char** argv) {
     char c;
-    while ((c = getopt(argc, argv, "hl")) != (char) -1) {
+    while ((c = getopt(argc, argv, "hlpb:i:o:j:")) != (char) -1) {
         switch (c) {
             case 'l':
                 g_infologs = true;
                 break;
+            case 'p':
+                g_perfmap = true;
+                break;
+            case 'b':
+                headless_args.frames = atoi(optarg);
+                break;
+            case 'i':
+                headless_args.inputfile = abspath_arg(optarg);
+                break;
+            case 'o':
+                headless_args.outfile = abspath_arg(optarg);
+                break;
+            case 'j':
+                jitstats_arg = abspath_arg(optarg);
+                break;
+            case 'h':
+                printf("usage: %s [options] [romfile]\n"
+                       "  -l          enable info logs\n"
+                       "  -p          write jit symbols to /tmp/perf-<pid>.map "
+                       "for perf\n"
+                       "  -b frames   run headless for this many frames and "
+                       "print timing as json\n"
+                       "  -i file     input script for headless mode\n"
+                       "  -o file     output file for headless mode\n"
+                       "  -j file     write jit statistics as json on exit\n",
+                       argv[0]);
+                exit(0);
         }
     }
     argc -= optind;
@@ -56,6 +98,18 @@ void read_args(int argc, char** argv) {
     }
 }
 
+void write_jitstats() {
+    if (!jitstats_arg) return;
+    FILE* fp = strcmp(jitstats_arg, "-") ? fopen(jitstats_arg, "w") : stdout;
+    if (!fp) {
+        lerror("could not open %s", jitstats_arg);
+        return;
+    }
+    jit_stats_write_json(fp, "");
+    fprintf(fp, "\n");
+    if (fp != stdout) fclose(fp);
+}
+
 void hotkey_press(SDL_Keycode key) {
     if (ImGui_GetIO()->WantCaptureKeyboard) return;
     switch (key) {
@@ -74,6 +128,12 @@ void hotkey_press(SDL_Keycode key) {
         case SDLK_F3:
             uistate.settings = true;
             break;
+        case SDLK_F4:
+            ctremu.pending_savestate = true;
+            break;
+        case SDLK_F8:
+            ctremu.pending_loadstate = true;
+            break;
         case SDLK_F7:
             ctremu.freecam_enable = !ctremu.freecam_enable;
             glm_mat4_identity(ctremu.freecam_mtx);
@@ -403,6 +463,14 @@ int main(int argc, char** argv) {
         free(romfile_arg);
     }
 
+    if (headless_args.frames > 0) {
+        int res = headless_main();
+        write_jitstats();
+        free(headless_args.inputfile);
+        free(headless_args.outfile);
+        return res;
+    }
+
     SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO | SDL_INIT_GAMEPAD |
              SDL_INIT_CAMERA);
 
@@ -505,6 +573,36 @@ int main(int argc, char** argv) {
             SDL_ClearAudioStream(g_audio);
         }
 
+        // states are taken between frames where the cpu context is saved
+        if (ctremu.pending_savestate) {
+            ctremu.pending_savestate = false;
+            emulator_save_state();
+        }
+        if (ctremu.pending_loadstate) {
+            ctremu.pending_loadstate = false;
+            if (emulator_load_state()) {
+                SDL_ClearAudioStream(g_audio);
+            } else {
+                SDL_ShowSimpleMessageBox(SDL_MESSAGEBOX_ERROR, "Tanuki3DS",
+                                         "Save state loading failed", g_window);
+            }
+        }
+        // while backspace is held every frame steps back instead of running,
+        // so no newer snapshots get taken in between
+        bool rewinding = false;
+        if (ctremu.rewind && !ImGui_GetIO()->WantCaptureKeyboard &&
+            SDL_GetKeyboardState(nullptr)[SDL_SCANCODE_BACKSPACE]) {
+            ctremu.pending_rewind = true;
+        }
+        if (ctremu.pending_rewind) {
+            ctremu.pending_rewind = false;
+            if (ctremu.initialized && !ctremu.pause &&
+                rewind_step(&ctremu.system)) {
+                SDL_ClearAudioStream(g_audio);
+                rewinding = true;
+            }
+        }
+
         SDL_Event e;
         while (SDL_PollEvent(&e)) {
             bool forward_imgui = true;
@@ -548,12 +646,12 @@ int main(int argc, char** argv) {
         SDL_GetWindowSizeInPixels(g_window, &ctremu.windowW, &ctremu.windowH);
         emulator_calc_viewports();
 
-        if (!ctremu.pause) {
+        if (!ctremu.pause && !rewinding) {
             update_input();
             update_mic();
             update_cam();
 
-            gpu_gl_start_frame(&ctremu.system.gpu);
+            gpu_start_frame(&ctremu.system.gpu);
 
             Uint64 frame_start = SDL_GetTicksNS();
             e3ds_run_frame(&ctremu.system);
@@ -614,8 +712,8 @@ int main(int argc, char** argv) {
             free(wintitle);
         }
 
-        if (ctremu.fastforward && !ctremu.pause) {
-            gpu_gl_start_frame(&ctremu.system.gpu);
+        if (ctremu.fastforward && !ctremu.pause && !rewinding) {
+            gpu_start_frame(&ctremu.system.gpu);
             while (SDL_GetTicksNS() - prev_frame_time < frame_ticks) {
                 Uint64 frame_start = SDL_GetTicksNS();
                 e3ds_run_frame(&ctremu.system);
@@ -641,6 +739,8 @@ int main(int argc, char** argv) {
         prev_frame_time = SDL_GetTicksNS();
     }
 
+    destroy_gamelist();
+
     cImGui_ImplOpenGL3_Shutdown();
     cImGui_ImplSDL3_Shutdown();
     ImGui_DestroyContext(nullptr);
@@ -658,5 +758,7 @@ int main(int argc, char** argv) {
 
     emulator_quit();
 
+    write_jitstats();
+
     return 0;
 }
@@ -0,0 +1,87 @@
+#include "perfmap.h"
+
+#include <inttypes.h>
+#include <stdarg.h>
+#include <unistd.h>
+
+bool g_perfmap;
+
+typedef struct {
+    char name[64];
+    u32 start;
+    u32 size;
+} PerfMapModule;
+
+static FILE* mapfile;
+static Vec(PerfMapModule) modules;
+
+static void perfmap_write(void* code, size_t size, const char* fmt, ...) {
+    if (!mapfile) {
+        char path[64];
+        snprintf(path, sizeof path, "/tmp/perf-%d.map", getpid());
+        mapfile = fopen(path, "w");
+        if (!mapfile) {
+            lerror("could not open %s, disabling perf map", path);
+            g_perfmap = false;
+            return;
+        }
+        // perf reads the file after we exit (or crash), so don't keep
+        // anything buffered
+        setvbuf(mapfile, nullptr, _IOLBF, 0);
+        linfo("writing jit symbols to %s", path);
+    }
+
+    fprintf(mapfile, "%lx %zx ", (unsigned long) code, size);
+    va_list args;
+    va_start(args, fmt);
+    vfprintf(mapfile, fmt, args);
+    va_end(args);
+    fputc('\n', mapfile);
+}
+
+// cros register their text segment here when they are loaded, anything not
+// in a cro is part of the main exefs code
+void perfmap_add_module(char* name, u32 start, u32 size) {
+    if (!g_perfmap) return;
+    PerfMapModule m = {.start = start, .size = size};
+    snprintf(m.name, sizeof m.name, "%s", name);
+    Vec_push(modules, m);
+}
+
+void perfmap_remove_module(u32 start) {
+    for (int i = 0; i < modules.size; i++) {
+        if (modules.d[i].start == start) {
+            modules.d[i] = modules.d[--modules.size];
+            return;
+        }
+    }
+}
+
+void perfmap_clear_modules() {
+    Vec_free(modules);
+}
+
+static char* module_name(u32 addr) {
+    Vec_foreach(m, modules) {
+        if (addr - m->start < m->size) return m->name;
+    }
+    return "exefs";
+}
+
+// blocks get freed and their code reused when the guest code is invalidated,
+// perf uses the latest symbol for an address so this is fine
+void perfmap_add_arm_block(void* code, size_t size, u32 start, u32 end,
+                           bool thumb) {
+    perfmap_write(code, size, "%s:%08x-%08x:%s", module_name(start), start,
+                  end, thumb ? "thumb" : "arm");
+}
+
+void perfmap_add_shader(void* code, size_t size, u64 hash) {
+    perfmap_write(code, size, "pica_vsh:%016" PRIx64, hash);
+}
+
+void perfmap_close() {
+    if (mapfile) fclose(mapfile);
+    mapfile = nullptr;
+    perfmap_clear_modules();
+}
@@ -0,0 +1,21 @@
+#ifndef PERFMAP_H
+#define PERFMAP_H
+
+#include "common.h"
+
+// writes symbols for jit code to /tmp/perf-<pid>.map so linux perf can
+// resolve samples in jitted code to the guest code it came from
+
+extern bool g_perfmap;
+
+void perfmap_add_module(char* name, u32 start, u32 size);
+void perfmap_remove_module(u32 start);
+void perfmap_clear_modules();
+
+void perfmap_add_arm_block(void* code, size_t size, u32 start, u32 end,
+                           bool thumb);
+void perfmap_add_shader(void* code, size_t size, u64 hash);
+
+void perfmap_close();
+
+#endif
@@ -0,0 +1,405 @@
+#include "profiler.h"
+
+#include <time.h>
+
+#include "kernel/memory.h"
+#include "services/ldr.h"
+
+struct Profiler g_profiler = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+typedef struct {
+    u32 addr;
+    char* name;
+} ProfSymbol;
+
+typedef struct {
+    u32 start;
+    u32 size;
+    char* name;
+} ProfModule;
+
+typedef struct {
+    Vec(ProfModule) modules;
+    Vec(ProfSymbol) symbols; // sorted by address
+} ProfSymtab;
+
+static void* sampler_thread(void*) {
+    struct timespec period = {0, 1'000'000'000 / PROFILER_HZ};
+    while (g_profiler.running) {
+        nanosleep(&period, nullptr);
+
+        int where = g_profiler.where;
+        if (where == PROF_NONE) continue;
+
+        // these are read while the emulator is running, but a sample being
+        // slightly off doesn't matter
+        E3DS* s = g_profiler.sys;
+        ProfSample smp = {};
+        if (where == PROF_HLE) {
+            smp.tid = s->cpu.halt ? -2 : -1;
+        } else {
+            smp.pc = s->cpu.pc;
+            smp.attrs = s->cpu.cpsr.jitattrs;
+            smp.tid = g_profiler.tid;
+        }
+
+        pthread_mutex_lock(&g_profiler.lock);
+        if (g_profiler.samples.size < PROFILER_MAX_SAMPLES) {
+            Vec_push(g_profiler.samples, smp);
+        }
+        pthread_mutex_unlock(&g_profiler.lock);
+    }
+    return nullptr;
+}
+
+void profiler_start(E3DS* s) {
+    if (g_profiler.running) return;
+
+    profiler_clear();
+    g_profiler.sys = s;
+
+    // existing blocks don't have counters so everything needs to be
+    // recompiled
+    g_jit_config.profile = true;
+    jit_free_all(&s->cpu);
+
+    g_profiler.running = true;
+    pthread_create(&g_profiler.thread, nullptr, sampler_thread, nullptr);
+}
+
+void profiler_stop(E3DS* s) {
+    if (!g_profiler.running) return;
+
+    g_profiler.running = false;
+    pthread_join(g_profiler.thread, nullptr);
+
+    // this keeps the counts of the instrumented blocks and gets rid of the
+    // counting overhead
+    g_jit_config.profile = false;
+    jit_free_all(&s->cpu);
+}
+
+void profiler_clear() {
+    pthread_mutex_lock(&g_profiler.lock);
+    Vec_free(g_profiler.samples);
+    pthread_mutex_unlock(&g_profiler.lock);
+    Vec_free(g_profiler.retired);
+}
+
+void profiler_retire_block(JITBlock* block) {
+    ProfBlock b = {
+        .start_addr = block->start_addr,
+        .end_addr = block->end_addr,
+        .attrs = block->attrs,
+        .execs = block->counters.execs,
+        .cycles = block->counters.cycles,
+    };
+    Vec_push(g_profiler.retired, b);
+}
+
+static char* report_string(ProfReport* report, char* str) {
+    char* res = strdup(str);
+    Vec_push(report->strings, res);
+    return res;
+}
+
+// the crs has the exports of the main exefs code, and every loaded cro is in
+// one of the two lists starting at the crs
+static void symtab_add_module(E3DS* s, ProfSymtab* tab, ProfReport* report,
+                              u32 vaddr, char* name) {
+    CROHeader* hdr = PTR(vaddr);
+    CROSegment* segs = PTR(hdr->segmenttable.addr);
+    if (!hdr->segmenttable.size || segs[0].id != CROSEG_TEXT) return;
+
+    ProfModule m = {segs[0].addr, segs[0].size, report_string(report, name)};
+    Vec_push(tab->modules, m);
+
+    CRONamedExport* syms = PTR(hdr->exports.named_symbols.addr);
+    for (int i = 0; i < hdr->exports.named_symbols.size; i++) {
+        if (syms[i].loc.id != CROSEG_TEXT) continue;
+        ProfSymbol sym = {segs[0].addr + syms[i].loc.offset,
+                          report_string(report, PTR(syms[i].name_addr))};
+        Vec_push(tab->symbols, sym);
+    }
+}
+
+#define CMP(a, b) (((a) > (b)) - ((a) < (b)))
+
+static int compar_symbol(ProfSymbol* a, ProfSymbol* b) {
+    return CMP(a->addr, b->addr);
+}
+
+static void symtab_build(E3DS* s, ProfSymtab* tab, ProfReport* report) {
+    Vec_init(tab->modules);
+    Vec_init(tab->symbols);
+
+    u32 crs = s->services.ldr.crs_addr;
+    if (crs) {
+        symtab_add_module(s, tab, report, crs, "exefs");
+        CROHeader* crshdr = PTR(crs);
+        u32 lists[2] = {crshdr->next, crshdr->prev};
+        for (int i = 0; i < 2; i++) {
+            for (u32 cur = lists[i]; cur;) {
+                CROHeader* hdr = PTR(cur);
+                symtab_add_module(s, tab, report, cur, PTR(hdr->name_addr));
+                cur = hdr->next;
+            }
+        }
+    }
+
+    qsort(tab->symbols.d, tab->symbols.size, sizeof(ProfSymbol),
+          (void*) compar_symbol);
+}
+
+static void symtab_free(ProfSymtab* tab) {
+    Vec_free(tab->modules);
+    Vec_free(tab->symbols);
+}
+
+static void symtab_lookup(ProfSymtab* tab, u32 addr, ProfBlock* b) {
+    b->module = "exefs";
+    b->symbol = nullptr;
+    b->symoff = 0;
+
+    u32 modstart = 0;
+    Vec_foreach(m, tab->modules) {
+        if (addr - m->start < m->size) {
+            b->module = m->name;
+            modstart = m->start;
+            break;
+        }
+    }
+
+    // last symbol at or before addr
+    int lo = 0, hi = tab->symbols.size;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (tab->symbols.d[mid].addr <= addr) lo = mid + 1;
+        else hi = mid;
+    }
+    if (lo == 0) return;
+    ProfSymbol* sym = &tab->symbols.d[lo - 1];
+    if (sym->addr < modstart) return;
+    b->symbol = sym->name;
+    b->symoff = addr - sym->addr;
+}
+
+static int compar_block_addr(ProfBlock* a, ProfBlock* b) {
+    if (a->start_addr != b->start_addr)
+        return CMP(a->start_addr, b->start_addr);
+    return CMP(a->attrs, b->attrs);
+}
+
+// most expensive first
+static int compar_block_cost(ProfBlock* a, ProfBlock* b) {
+    if (a->cycles != b->cycles) return CMP(b->cycles, a->cycles);
+    return CMP(b->samples, a->samples);
+}
+
+// null symbols sort last
+static int compar_function_name(ProfFunction* a, ProfFunction* b) {
+    int res = strcmp(a->module, b->module);
+    if (res) return res;
+    if (!a->symbol || !b->symbol) return !a->symbol - !b->symbol;
+    return strcmp(a->symbol, b->symbol);
+}
+
+static int compar_function_cost(ProfFunction* a, ProfFunction* b) {
+    if (a->cycles != b->cycles) return CMP(b->cycles, a->cycles);
+    return CMP(b->samples, a->samples);
+}
+
+void profiler_build_report(E3DS* s, ProfReport* report) {
+    *report = (ProfReport) {};
+
+    Vec(ProfBlock) all;
+    Vec_init(all);
+
+    Vec_foreach(b, g_profiler.retired) {
+        Vec_push(all, *b);
+    }
+    ArmCore* cpu = &s->cpu;
+    for (int i = 0; i < 64; i++) {
+        if (!cpu->jit_cache[i]) continue;
+        for (int j = 0; j < BIT(16); j++) {
+            if (!cpu->jit_cache[i][j]) continue;
+            for (int k = 0; k < BIT(16) >> 1; k++) {
+                JITBlock* block = cpu->jit_cache[i][j][k];
+                if (!block || !block->counters.execs) continue;
+                ProfBlock b = {
+                    .start_addr = block->start_addr,
+                    .end_addr = block->end_addr,
+                    .attrs = block->attrs,
+                    .execs = block->counters.execs,
+                    .cycles = block->counters.cycles,
+                };
+                Vec_push(all, b);
+            }
+        }
+    }
+
+    // samples are merged with the blocks they landed in
+    pthread_mutex_lock(&g_profiler.lock);
+    Vec_foreach(smp, g_profiler.samples) {
+        report->total_samples++;
+        if (smp->tid == -1) {
+            report->hle_samples++;
+        } else if (smp->tid == -2) {
+            report->idle_samples++;
+        } else {
+            ProfBlock b = {.start_addr = smp->pc,
+                           .end_addr = smp->pc,
+                           .attrs = smp->attrs,
+                           .samples = 1};
+            Vec_push(all, b);
+        }
+    }
+    pthread_mutex_unlock(&g_profiler.lock);
+
+    qsort(all.d, all.size, sizeof(ProfBlock), (void*) compar_block_addr);
+
+    Vec_foreach(b, all) {
+        if (report->blocks.size) {
+            ProfBlock* last = &report->blocks.d[report->blocks.size - 1];
+            if (!compar_block_addr(last, b)) {
+                if (b->end_addr > last->end_addr) last->end_addr = b->end_addr;
+                last->execs += b->execs;
+                last->cycles += b->cycles;
+                last->samples += b->samples;
+                continue;
+            }
+        }
+        Vec_push(report->blocks, *b);
+    }
+    Vec_free(all);
+
+    ProfSymtab tab;
+    symtab_build(s, &tab, report);
+
+    Vec(ProfFunction) funcs;
+    Vec_init(funcs);
+    Vec_foreach(b, report->blocks) {
+        symtab_lookup(&tab, b->start_addr, b);
+        report->total_cycles += b->cycles;
+        ProfFunction f = {b->module, b->symbol, b->cycles, b->samples};
+        Vec_push(funcs, f);
+    }
+    symtab_free(&tab);
+
+    qsort(funcs.d, funcs.size, sizeof(ProfFunction),
+          (void*) compar_function_name);
+    Vec_foreach(f, funcs) {
+        if (report->functions.size) {
+            ProfFunction* last =
+                &report->functions.d[report->functions.size - 1];
+            if (!compar_function_name(last, f)) {
+                last->cycles += f->cycles;
+                last->samples += f->samples;
+                continue;
+            }
+        }
+        Vec_push(report->functions, *f);
+    }
+    Vec_free(funcs);
+
+    qsort(report->blocks.d, report->blocks.size, sizeof(ProfBlock),
+          (void*) compar_block_cost);
+    qsort(report->functions.d, report->functions.size, sizeof(ProfFunction),
+          (void*) compar_function_cost);
+}
+
+void profiler_free_report(ProfReport* report) {
+    Vec_free(report->blocks);
+    Vec_free(report->functions);
+    Vec_foreach(str, report->strings) {
+        free(*str);
+    }
+    Vec_free(report->strings);
+}
+
+static void write_frames(FILE* fp, ProfBlock* b) {
+    fprintf(fp, "%s;", b->module);
+    if (b->symbol) fprintf(fp, "%s;", b->symbol);
+    fprintf(fp, "%08x_%s", b->start_addr, b->attrs & BIT(5) ? "thumb" : "arm");
+}
+
+static int compar_sample(ProfSample* a, ProfSample* b) {
+    if (a->tid != b->tid) return CMP(a->tid, b->tid);
+    if (a->pc != b->pc) return CMP(a->pc, b->pc);
+    return CMP(a->attrs, b->attrs);
+}
+
+// writes <basename>.cycles.folded with the cycle counts of each block and
+// <basename>.samples.folded with the samples of each thread, in the folded
+// stack format used by flamegraph.pl and most flame graph viewers
+bool profiler_write_folded(E3DS* s, char* basename) {
+    ProfReport report;
+    profiler_build_report(s, &report);
+
+    char* path;
+    asprintf(&path, "%s.cycles.folded", basename);
+    FILE* fp = fopen(path, "w");
+    if (!fp) {
+        lerror("could not open %s", path);
+        free(path);
+        profiler_free_report(&report);
+        return false;
+    }
+    Vec_foreach(b, report.blocks) {
+        if (!b->cycles) continue;
+        write_frames(fp, b);
+        fprintf(fp, " %lu\n", (unsigned long) b->cycles);
+    }
+    fclose(fp);
+    linfo("wrote %s", path);
+    free(path);
+
+    asprintf(&path, "%s.samples.folded", basename);
+    fp = fopen(path, "w");
+    if (!fp) {
+        lerror("could not open %s", path);
+        free(path);
+        profiler_free_report(&report);
+        return false;
+    }
+
+    pthread_mutex_lock(&g_profiler.lock);
+    Vec(ProfSample) samples;
+    Vec_init(samples);
+    Vec_foreach(smp, g_profiler.samples) {
+        Vec_push(samples, *smp);
+    }
+    pthread_mutex_unlock(&g_profiler.lock);
+
+    qsort(samples.d, samples.size, sizeof(ProfSample), (void*) compar_sample);
+
+    ProfSymtab tab;
+    symtab_build(s, &tab, &report);
+    for (int i = 0; i < samples.size;) {
+        int j = i;
+        while (j < samples.size && !compar_sample(&samples.d[i], &samples.d[j]))
+            j++;
+        ProfSample* smp = &samples.d[i];
+        if (smp->tid == -1) {
+            fprintf(fp, "hle");
+        } else if (smp->tid == -2) {
+            fprintf(fp, "idle");
+        } else {
+            ProfBlock b = {.start_addr = smp->pc, .attrs = smp->attrs};
+            symtab_lookup(&tab, smp->pc, &b);
+            fprintf(fp, "thread %d;", smp->tid);
+            write_frames(fp, &b);
+        }
+        fprintf(fp, " %d\n", j - i);
+        i = j;
+    }
+    symtab_free(&tab);
+    Vec_free(samples);
+
+    fclose(fp);
+    linfo("wrote %s", path);
+    free(path);
+
+    profiler_free_report(&report);
+    return true;
+}
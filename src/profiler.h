@@ -0,0 +1,88 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <pthread.h>
+
+#include "3ds.h"
+#include "arm/jit/jit.h"
+#include "common.h"
+
+// guest level profiler
+// blocks count their executions and cycles in the generated code, and a
+// timer thread samples the guest pc (which is the start of the running block)
+// and thread, so time can also be attributed to guest threads, hle and idle
+
+#define PROFILER_HZ 1000
+#define PROFILER_MAX_SAMPLES BIT(22)
+
+enum {
+    PROF_NONE, // not emulating, samples are dropped
+    PROF_CPU,  // running guest code
+    PROF_HLE,  // running scheduler events (hle services, gpu, dsp)
+};
+
+typedef struct {
+    u32 pc;
+    u32 attrs;
+    s32 tid; // -1 for hle, -2 when idle
+} ProfSample;
+
+typedef struct {
+    u32 start_addr;
+    u32 end_addr;
+    u32 attrs;
+    u64 execs;
+    u64 cycles;
+    u64 samples;
+    char* module;
+    char* symbol; // nearest exported symbol before the block, or null
+    u32 symoff;
+} ProfBlock;
+
+typedef struct {
+    char* module;
+    char* symbol;
+    u64 cycles;
+    u64 samples;
+} ProfFunction;
+
+typedef struct {
+    Vec(ProfBlock) blocks;       // sorted by cycles
+    Vec(ProfFunction) functions; // sorted by cycles
+    u64 total_cycles;
+    u64 total_samples;
+    u64 hle_samples;
+    u64 idle_samples;
+
+    // owns the module and symbol names
+    Vec(char*) strings;
+} ProfReport;
+
+extern struct Profiler {
+    _Atomic bool running;
+
+    // kept up to date by the emulator so the sampler doesn't need to touch
+    // the kernel objects
+    _Atomic int where;
+    _Atomic s32 tid;
+
+    E3DS* sys;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    Vec(ProfSample) samples;
+
+    // counters of blocks that were destroyed while profiling
+    Vec(ProfBlock) retired;
+} g_profiler;
+
+void profiler_start(E3DS* s);
+void profiler_stop(E3DS* s);
+void profiler_clear();
+
+void profiler_retire_block(JITBlock* block);
+
+void profiler_build_report(E3DS* s, ProfReport* report);
+void profiler_free_report(ProfReport* report);
+bool profiler_write_folded(E3DS* s, char* basename);
+
+#endif
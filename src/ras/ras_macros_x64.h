@@ -572,6 +572,10 @@
 #define DPPS(op1, op2, op3) __EMIT(OpVMI, 1, 0x0f3a40, op1, MKOPV(op2), op3)
 #define DPPD(op1, op2, op3) __EMIT(OpVMI, 1, 0x0f3a41, op1, MKOPV(op2), op3)
 
+#define PCMPGTB(op1, op2) __EMIT(OpVM, 1, 0, 0x0f64, op1, MKOPV(op2))
+#define PCMPEQB(op1, op2) __EMIT(OpVM, 1, 0, 0x0f74, op1, MKOPV(op2))
+#define PMOVMSKB(op1, op2)                                                     \
+    __EMIT(OpVM, 1, 0, 0x0fd7, (rasX64Xmm) {(op1).idx}, MKOPV(op2))
 #define PSUBUSB(op1, op2) __EMIT(OpVM, 1, 0, 0x0fd8, op1, MKOPV(op2))
 #define PSUBUSW(op1, op2) __EMIT(OpVM, 1, 0, 0x0fd9, op1, MKOPV(op2))
 #define PMINUB(op1, op2) __EMIT(OpVM, 1, 0, 0x0fda, op1, MKOPV(op2))
@@ -580,6 +584,7 @@
 #define PADDUSW(op1, op2) __EMIT(OpVM, 1, 0, 0x0fdd, op1, MKOPV(op2))
 #define PMAXUB(op1, op2) __EMIT(OpVM, 1, 0, 0x0fde, op1, MKOPV(op2))
 #define PANDN(op1, op2) __EMIT(OpVM, 1, 0, 0x0fdf, op1, MKOPV(op2))
+#define PAVGB(op1, op2) __EMIT(OpVM, 1, 0, 0x0fe0, op1, MKOPV(op2))
 #define PSUBSB(op1, op2) __EMIT(OpVM, 1, 0, 0x0fe8, op1, MKOPV(op2))
 #define PSUBSW(op1, op2) __EMIT(OpVM, 1, 0, 0x0fe9, op1, MKOPV(op2))
 #define PMINSW(op1, op2) __EMIT(OpVM, 1, 0, 0x0fea, op1, MKOPV(op2))
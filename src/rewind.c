@@ -0,0 +1,295 @@
+#include "rewind.h"
+
+#include "3ds.h"
+#include "emulator.h"
+#include "savestate.h"
+
+// captured on the emulator thread, turned into deltas on the worker
+typedef struct {
+    Rewind* rw;
+    u8* machine;
+    u32 machinesize;
+    u32 npages;
+    u32* pages;
+    u8* copy;
+} RewindJob;
+
+static u8* varint_put(u8* op, size_t v) {
+    while (v >= 0x80) {
+        *op++ = v | 0x80;
+        v >>= 7;
+    }
+    *op++ = v;
+    return op;
+}
+
+static bool varint_get(const u8** ip, const u8* iend, size_t* v) {
+    *v = 0;
+    for (int shift = 0; *ip < iend && shift < 64; shift += 7) {
+        u8 b = *(*ip)++;
+        *v |= (size_t) (b & 0x7f) << shift;
+        if (!(b & 0x80)) return true;
+    }
+    return false;
+}
+
+// the xor of a and b as pairs of a run of equal bytes to skip and a run of
+// bytes to xor, out needs room for 2 * n + 16 bytes
+static size_t xrle_encode(u8* out, const u8* a, const u8* b, size_t n) {
+    u8* op = out;
+    size_t i = 0;
+    while (i < n) {
+        size_t start = i;
+        while (i < n && a[i] == b[i]) i++;
+        if (i == n) break;
+        size_t lit = i;
+        // short equal runs are cheaper to keep in the literal
+        size_t end = i;
+        while (i < n && i - end < 4) {
+            if (a[i] != b[i]) end = i + 1;
+            i++;
+        }
+        op = varint_put(op, lit - start);
+        op = varint_put(op, end - lit);
+        for (size_t j = lit; j < end; j++) {
+            *op++ = a[j] ^ b[j];
+        }
+        i = end;
+    }
+    return op - out;
+}
+
+static bool xrle_apply(u8* dst, size_t n, const u8* in, size_t insize) {
+    const u8* ip = in;
+    const u8* iend = in + insize;
+    size_t pos = 0;
+    while (ip < iend) {
+        size_t skip, len;
+        if (!varint_get(&ip, iend, &skip) || !varint_get(&ip, iend, &len))
+            return false;
+        if (skip > n - pos) return false;
+        pos += skip;
+        if (len > n - pos || len > iend - ip) return false;
+        for (size_t j = 0; j < len; j++) {
+            dst[pos + j] ^= ip[j];
+        }
+        ip += len;
+        pos += len;
+    }
+    return true;
+}
+
+static RewindEntry* entry_at(Rewind* rw, u32 i) {
+    return &rw->ring[(rw->head + i) % REWIND_MAX];
+}
+
+static void entry_free(Rewind* rw, RewindEntry* e) {
+    rw->used -= e->mdeltasize + e->pdeltasize;
+    free(e->mdelta);
+    free(e->pdelta);
+    *e = (RewindEntry) {};
+}
+
+static void* rewind_worker(void* arg) {
+    RewindJob* job = arg;
+    auto rw = job->rw;
+
+    // the snapshot that was the newest becomes a delta against this one
+    RewindEntry* last = rw->count ? entry_at(rw, rw->count - 1) : nullptr;
+    if (last) {
+        u32 n = rw->machinesize > job->machinesize ? rw->machinesize
+                                                   : job->machinesize;
+        u8* a = calloc(n, 1);
+        u8* b = calloc(n, 1);
+        memcpy(a, rw->machine, rw->machinesize);
+        memcpy(b, job->machine, job->machinesize);
+        last->mdelta = malloc(2 * n + 16);
+        last->mdeltasize = xrle_encode(last->mdelta, a, b, n);
+        last->mdelta = realloc(last->mdelta, last->mdeltasize + 1);
+        free(a);
+        free(b);
+    }
+
+    Vec(u8) pd = {};
+    static const u8 zero[PAGE_SIZE];
+    for (u32 i = 0; i < job->npages; i++) {
+        u32 pg = job->pages[i];
+        u8* cur = &job->copy[i * PAGE_SIZE];
+        const u8* old = rw->shadow[pg] ? rw->shadow[pg] : zero;
+        if (last) {
+            if (pd.cap - pd.size < 2 * PAGE_SIZE + 32) {
+                Vec_resize(pd, 2 * pd.cap + 2 * PAGE_SIZE + 32);
+            }
+            u8* hdr = &pd.d[pd.size];
+            u32 len = xrle_encode(hdr + 8, old, cur, PAGE_SIZE);
+            memcpy(hdr, &pg, 4);
+            memcpy(hdr + 4, &len, 4);
+            pd.size += 8 + len;
+        }
+        if (!rw->shadow[pg]) {
+            rw->shadow[pg] = malloc(PAGE_SIZE);
+            rw->used += PAGE_SIZE;
+        }
+        memcpy(rw->shadow[pg], cur, PAGE_SIZE);
+    }
+    if (last) {
+        last->pdelta = realloc(pd.d, pd.size + 1);
+        last->pdeltasize = pd.size;
+        rw->used += last->mdeltasize + last->pdeltasize;
+    } else {
+        Vec_free(pd);
+    }
+
+    free(rw->machine);
+    rw->used += job->machinesize;
+    rw->used -= rw->machinesize;
+    rw->machine = job->machine;
+    rw->machinesize = job->machinesize;
+
+    // drop the oldest snapshots to stay in the budget, the newest is always
+    // kept even if the shadow alone is over it
+    size_t budget = (size_t) ctremu.rewindbudget << 20;
+    while (rw->count == REWIND_MAX || (rw->count > 1 && rw->used > budget)) {
+        entry_free(rw, entry_at(rw, 0));
+        rw->head = (rw->head + 1) % REWIND_MAX;
+        rw->count--;
+    }
+    *entry_at(rw, rw->count++) =
+        (RewindEntry) {.machinesize = job->machinesize};
+
+    free(job->pages);
+    free(job->copy);
+    free(job);
+    return nullptr;
+}
+
+static void rewind_join(Rewind* rw) {
+    if (!rw->busy) return;
+    pthread_join(rw->worker, nullptr);
+    rw->busy = false;
+}
+
+// called at the end of every frame, when the cpu context is saved
+void rewind_frame(E3DS* s) {
+    auto rw = &s->rewind;
+    if (!ctremu.rewind) {
+        if (rw->count) rewind_reset(s);
+        return;
+    }
+    if (++rw->frames < ctremu.rewindinterval) return;
+    rw->frames = 0;
+
+    rewind_join(rw);
+    if (!rw->shadow) rw->shadow = calloc(MEM_NPAGES, sizeof *rw->shadow);
+
+    RewindJob* job = calloc(1, sizeof *job);
+    job->rw = rw;
+
+    StateSer ss;
+    savestate_capture(s, &ss);
+    job->machine = ss.buf.d;
+    job->machinesize = ss.buf.size;
+    Vec_init(ss.buf);
+    ser_free(&ss);
+
+    // the first snapshot is against an empty shadow
+    job->pages = malloc(MEM_NPAGES * sizeof *job->pages);
+    job->npages =
+        memory_dirty_collect(s, DIRTY_REWIND, !rw->count, job->pages);
+    job->copy = malloc((size_t) job->npages * PAGE_SIZE);
+    for (u32 i = 0; i < job->npages; i++) {
+        memcpy(&job->copy[i * PAGE_SIZE],
+               &s->mem->raw[job->pages[i] * PAGE_SIZE], PAGE_SIZE);
+    }
+
+    rw->busy = !pthread_create(&rw->worker, nullptr, rewind_worker, job);
+    if (!rw->busy) rewind_worker(job);
+}
+
+// goes back to the newest snapshot, or the one before it if there is one
+bool rewind_step(E3DS* s) {
+    auto rw = &s->rewind;
+    rewind_join(rw);
+    if (!rw->count) return false;
+
+    savestate_sync(s);
+
+    // undo what changed since the newest snapshot
+    u32* pages = malloc(MEM_NPAGES * sizeof *pages);
+    u32 n = memory_dirty_collect(s, DIRTY_REWIND, false, pages);
+    for (u32 i = 0; i < n; i++) {
+        u8* dst = &s->mem->raw[pages[i] * PAGE_SIZE];
+        if (rw->shadow[pages[i]]) memcpy(dst, rw->shadow[pages[i]], PAGE_SIZE);
+        else memset(dst, 0, PAGE_SIZE);
+    }
+    free(pages);
+
+    bool ok = true;
+    if (rw->count > 1) {
+        auto prev = entry_at(rw, rw->count - 2);
+
+        u8* p = prev->pdelta;
+        u8* end = prev->pdelta + prev->pdeltasize;
+        while (ok && end - p >= 8) {
+            u32 pg, len;
+            memcpy(&pg, p, 4);
+            memcpy(&len, p + 4, 4);
+            p += 8;
+            if (!rw->shadow[pg]) {
+                rw->shadow[pg] = calloc(1, PAGE_SIZE);
+                rw->used += PAGE_SIZE;
+            }
+            ok = xrle_apply(rw->shadow[pg], PAGE_SIZE, p, len);
+            memcpy(&s->mem->raw[pg * PAGE_SIZE], rw->shadow[pg], PAGE_SIZE);
+            p += len;
+        }
+
+        u32 msize = rw->machinesize > prev->machinesize ? rw->machinesize
+                                                        : prev->machinesize;
+        u8* m = calloc(msize, 1);
+        memcpy(m, rw->machine, rw->machinesize);
+        ok = ok && xrle_apply(m, msize, prev->mdelta, prev->mdeltasize);
+        free(rw->machine);
+        rw->used += prev->machinesize;
+        rw->used -= rw->machinesize;
+        rw->machine = m;
+        rw->machinesize = prev->machinesize;
+
+        entry_free(rw, prev);
+        prev->machinesize = rw->machinesize;
+        rw->count--;
+    }
+
+    ok = ok && savestate_apply(s, rw->machine, rw->machinesize);
+    // the restored pages are the new point to track from
+    memory_dirty_collect(s, DIRTY_REWIND, false, nullptr);
+    rw->frames = 0;
+
+    if (!ok) {
+        lerror("rewind history is broken");
+        rewind_reset(s);
+        ctremu.pending_reset = true;
+    }
+    return ok;
+}
+
+void rewind_reset(E3DS* s) {
+    auto rw = &s->rewind;
+    rewind_join(rw);
+    while (rw->count) {
+        entry_free(rw, entry_at(rw, --rw->count));
+    }
+    rw->head = 0;
+    rw->used = 0;
+    free(rw->machine);
+    rw->machine = nullptr;
+    rw->machinesize = 0;
+    if (rw->shadow) {
+        for (u32 i = 0; i < MEM_NPAGES; i++) {
+            free(rw->shadow[i]);
+        }
+        free(rw->shadow);
+        rw->shadow = nullptr;
+    }
+    rw->frames = 0;
+}
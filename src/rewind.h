@@ -0,0 +1,49 @@
+#ifndef REWIND_H
+#define REWIND_H
+
+#include <pthread.h>
+
+#include "common.h"
+
+typedef struct _3DS E3DS;
+
+#define REWIND_MAX 4096
+
+// a snapshot in the history
+// only the newest machine state is kept whole, every older snapshot stores
+// the xor of its machine state and the changed pages with the next newer
+// snapshot, run length encoded since most of it is zero
+typedef struct {
+    u32 machinesize;
+    u32 mdeltasize;
+    u8* mdelta;
+
+    size_t pdeltasize;
+    u8* pdelta;
+} RewindEntry;
+
+typedef struct {
+    RewindEntry ring[REWIND_MAX];
+    u32 head;
+    u32 count;
+    // bytes in deltas, the newest machine state and the shadow pages, limited
+    // by the budget
+    size_t used;
+
+    u8* machine;
+    u32 machinesize;
+    // memory at the newest snapshot, pages are allocated when they first have
+    // data
+    u8** shadow;
+
+    int frames;
+
+    pthread_t worker;
+    bool busy;
+} Rewind;
+
+void rewind_frame(E3DS* s);
+bool rewind_step(E3DS* s);
+void rewind_reset(E3DS* s);
+
+#endif
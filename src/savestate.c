@@ -0,0 +1,805 @@
+#include "savestate.h"
+
+#include <zstd.h>
+
+#include "3ds.h"
+#include "arm/jit/jit.h"
+#include "emulator.h"
+#include "kernel/ipc.h"
+
+#define STATE_MAGIC "T3DSSTAT"
+#define STATE_VERSION 4
+#define RECORD_MAGIC 0x4443'4552 // RECD
+
+enum {
+    REC_FULL = BIT(0),
+};
+
+// states are only valid for the same build and game, the function offsets
+// change with any change to the code
+typedef struct {
+    char magic[8];
+    u32 version;
+    u32 size;
+    s64 funcs[4];
+    char rom[128];
+} StateHeader;
+
+// followed by a zstd frame with the machine state, the indices of the pages
+// in the record and the pages themselves
+typedef struct {
+    u32 magic;
+    u32 flags;
+    u32 npages;
+    u32 machinesize;
+    u64 rawsize;
+    u64 compsize;
+} StateRecord;
+
+// compression and writing happen on a worker thread so saving only stalls
+// the emulator for the time it takes to copy out the changed pages
+typedef struct {
+    SaveStates* st;
+    char* path;
+    StateHeader hdr;
+    StateRecord rec;
+    u8* raw;
+} StateJob;
+
+// a low level since the worker has to keep up with states saved in a row
+#define STATE_ZSTD_LEVEL 1
+
+void ser_bytes(StateSer* ss, void* p, size_t len) {
+    if (!len) return;
+    if (!ss->load) {
+        if (ss->buf.size + len > ss->buf.cap) {
+            Vec_resize(ss->buf, 2 * (ss->buf.size + len));
+        }
+        memcpy(&ss->buf.d[ss->buf.size], p, len);
+        ss->buf.size += len;
+        return;
+    }
+    if (ss->err || len > ss->size - ss->pos) {
+        ss->err = true;
+        memset(p, 0, len);
+        return;
+    }
+    memcpy(p, &ss->data[ss->pos], len);
+    ss->pos += len;
+}
+
+// function pointers are stored relative to a function in the binary
+#define FUNC_BASE ((uintptr_t) e3ds_init)
+#define FUNC_NULL INT64_MIN
+
+static void ser_func(StateSer* ss, void* pf) {
+    uintptr_t f;
+    memcpy(&f, pf, sizeof f);
+    s64 off = f ? (s64) (f - FUNC_BASE) : FUNC_NULL;
+    SER(ss, off);
+    if (!ss->load) return;
+    f = off == FUNC_NULL ? 0 : FUNC_BASE + off;
+    memcpy(pf, &f, sizeof f);
+}
+
+static void ser_str(StateSer* ss, char** str) {
+    u32 len = !ss->load && *str ? strlen(*str) + 1 : 0;
+    SER(ss, len);
+    if (ss->load) *str = len && !ss->err ? calloc(len, 1) : nullptr;
+    if (!*str) return;
+    ser_bytes(ss, *str, len);
+    (*str)[len - 1] = '\0';
+}
+
+#define KOBJ_EMBEDDED BIT(31)
+
+void ser_kobj(StateSer* ss, KObject** o) {
+    E3DS* s = ss->s;
+    u32 id = 0;
+    if (!ss->load) {
+        if (*o && (u8*) *o >= (u8*) s && (u8*) *o < (u8*) (s + 1)) {
+            id = KOBJ_EMBEDDED | ((u8*) *o - (u8*) s);
+        } else if (*o) {
+            size_t i = 0;
+            while (i < ss->objs.size && ss->objs.d[i] != *o) i++;
+            if (i == ss->objs.size) Vec_push(ss->objs, *o);
+            id = i + 1;
+        }
+        SER(ss, id);
+        return;
+    }
+
+    SER(ss, id);
+    *o = nullptr;
+    if (id & KOBJ_EMBEDDED) {
+        u32 off = id & ~KOBJ_EMBEDDED;
+        if (off > sizeof *s - sizeof(KObject)) ss->err = true;
+        else *o = (KObject*) ((u8*) s + off);
+    } else if (id) {
+        // heap objects are created after the rest of the state
+        Vec_push(ss->fixups, ((typeof(*ss->fixups.d)) {o, id}));
+    }
+}
+
+static void klist_free(KListNode** l) {
+    while (*l) klist_remove(l);
+}
+
+static void ser_klist(StateSer* ss, KListNode** l) {
+    u32 n = 0;
+    for (auto k = *l; k; k = k->next) n++;
+    SER(ss, n);
+    if (!ss->load) {
+        for (auto k = *l; k; k = k->next) {
+            ser_kobj(ss, &k->key);
+            SER(ss, k->val);
+        }
+        return;
+    }
+    klist_free(l);
+    for (u32 i = 0; i < n && !ss->err; i++) {
+        klist_insert(l, nullptr);
+        ser_kobj(ss, &(*l)->key);
+        SER(ss, (*l)->val);
+        l = &(*l)->next;
+    }
+}
+
+static const size_t kobj_size[KOT_MAX] = {
+    [KOT_THREAD] = sizeof(KThread),       [KOT_MUTEX] = sizeof(KMutex),
+    [KOT_SEMAPHORE] = sizeof(KSemaphore), [KOT_EVENT] = sizeof(KEvent),
+    [KOT_TIMER] = sizeof(KTimer),         [KOT_SHAREDMEM] = sizeof(KSharedMem),
+    [KOT_ARBITER] = sizeof(KArbiter),     [KOT_SESSION] = sizeof(KSession),
+    [KOT_RESLIMIT] = sizeof(KObject),
+};
+
+static void ser_kobj_body(StateSer* ss, KObject* o) {
+    SER(ss, o->refcount);
+    switch (o->type) {
+        case KOT_THREAD: {
+            auto t = (KThread*) o;
+            SER(ss, t->ctx);
+            SER(ss, t->waiting_addr);
+            ser_kobj(ss, (KObject**) &t->arbnext);
+            ser_kobj(ss, (KObject**) &t->arbprev);
+            ser_klist(ss, &t->waiting_objs);
+            SER(ss, t->wait_any);
+            ser_klist(ss, &t->waiting_thrds);
+            ser_klist(ss, &t->owned_mutexes);
+            ser_kobj(ss, (KObject**) &t->next);
+            ser_kobj(ss, (KObject**) &t->prev);
+            SER(ss, t->id);
+            SER(ss, t->priority);
+            SER(ss, t->state);
+            SER(ss, t->cpu);
+            SER(ss, t->tls);
+            break;
+        }
+        case KOT_EVENT: {
+            auto e = (KEvent*) o;
+            SER(ss, e->signal);
+            SER(ss, e->sticky);
+            ser_klist(ss, &e->waiting_thrds);
+            ser_func(ss, &e->callback);
+            break;
+        }
+        case KOT_TIMER: {
+            auto t = (KTimer*) o;
+            SER(ss, t->signal);
+            SER(ss, t->sticky);
+            SER(ss, t->repeat);
+            SER(ss, t->interval);
+            ser_klist(ss, &t->waiting_thrds);
+            break;
+        }
+        case KOT_SEMAPHORE: {
+            auto sem = (KSemaphore*) o;
+            ser_klist(ss, &sem->waiting_thrds);
+            SER(ss, sem->count);
+            SER(ss, sem->max);
+            break;
+        }
+        case KOT_MUTEX: {
+            auto m = (KMutex*) o;
+            ser_kobj(ss, (KObject**) &m->locker_thrd);
+            SER(ss, m->recursive_lock_count);
+            ser_klist(ss, &m->waiting_thrds);
+            break;
+        }
+        case KOT_ARBITER: {
+            auto arb = (KArbiter*) o;
+            for (int i = 0; i < ARBITER_BUCKETS; i++) {
+                ser_kobj(ss, (KObject**) &arb->waiting[i]);
+            }
+            break;
+        }
+        case KOT_SESSION: {
+            auto ses = (KSession*) o;
+            ser_func(ss, &ses->handler);
+            SER(ss, ses->arg);
+            break;
+        }
+        case KOT_SHAREDMEM: {
+            auto shm = (KSharedMem*) o;
+            SER(ss, shm->paddr);
+            SER(ss, shm->mapaddr);
+            SER(ss, shm->size);
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+// frees an object of the replaced state, the objects it refers to are freed
+// the same way so only its own lists go with it
+static void kobj_free(KObject* o) {
+    switch (o->type) {
+        case KOT_THREAD: {
+            auto t = (KThread*) o;
+            klist_free(&t->waiting_objs);
+            klist_free(&t->waiting_thrds);
+            klist_free(&t->owned_mutexes);
+            break;
+        }
+        case KOT_EVENT:
+            klist_free(&((KEvent*) o)->waiting_thrds);
+            break;
+        case KOT_TIMER:
+            klist_free(&((KTimer*) o)->waiting_thrds);
+            break;
+        case KOT_SEMAPHORE:
+            klist_free(&((KSemaphore*) o)->waiting_thrds);
+            break;
+        case KOT_MUTEX:
+            klist_free(&((KMutex*) o)->waiting_thrds);
+            break;
+        default:
+            break;
+    }
+    free(o);
+}
+
+static void ser_bodies(StateSer* ss) {
+    if (!ss->load) {
+        // bodies can reach more objects which are added to the end
+        for (size_t i = 0; i < ss->objs.size; i++) {
+            u32 type = ss->objs.d[i]->type;
+            SER(ss, type);
+            ser_kobj_body(ss, ss->objs.d[i]);
+        }
+        u32 end = KOT_MAX;
+        SER(ss, end);
+        return;
+    }
+
+    while (!ss->err) {
+        u32 type;
+        SER(ss, type);
+        if (type == KOT_MAX) break;
+        if (type >= KOT_MAX || !kobj_size[type]) {
+            ss->err = true;
+            break;
+        }
+        KObject* o = calloc(1, kobj_size[type]);
+        o->type = type;
+        Vec_push(ss->objs, o);
+        ser_kobj_body(ss, o);
+    }
+    Vec_foreach(f, ss->fixups) {
+        if (f->id <= ss->objs.size) *f->p = ss->objs.d[f->id - 1];
+        else ss->err = true;
+    }
+}
+
+static void ser_cpu(StateSer* ss) {
+    auto cpu = &ss->s->cpu;
+    // everything before the memory callbacks is guest state
+    ser_bytes(ss, cpu, offsetof(ArmCore, read8));
+    SER(ss, cpu->vector_base);
+    SER(ss, cpu->cycles);
+    SER(ss, cpu->halt);
+    SER(ss, cpu->irq);
+}
+
+static void ser_sched(StateSer* ss) {
+    auto sched = &ss->s->sched;
+    auto q = &sched->event_queue;
+    SER(ss, sched->now);
+    u32 n = q->size;
+    SER(ss, n);
+    if (ss->load) {
+        FIFO_clear(*q);
+        if (n > EVENT_MAX) {
+            ss->err = true;
+            return;
+        }
+    }
+    for (u32 i = 0; i < n && !ss->err; i++) {
+        auto ev = &q->d[(q->head + i) % EVENT_MAX];
+        SER(ss, ev->time);
+        ser_func(ss, &ev->handler);
+        // these take a kernel object, the rest take a number
+        if (ev->handler == (SchedulerCallback) thread_wakeup_timeout ||
+            ev->handler == (SchedulerCallback) timer_signal) {
+            ser_kobj(ss, (KObject**) &ev->arg);
+        } else {
+            u64 arg = (uintptr_t) ev->arg;
+            SER(ss, arg);
+            ev->arg = (void*) (uintptr_t) arg;
+        }
+    }
+    if (ss->load) {
+        q->tail = n;
+        q->size = n;
+    }
+}
+
+// the file system service is left out since it only has host files
+static void ser_services(StateSer* ss) {
+    auto srv = &ss->s->services;
+
+    ser_kobj_body(ss, &srv->notif_sem.hdr);
+
+    ser_kobj_body(ss, &srv->apt.lock.hdr);
+    ser_kobj_body(ss, &srv->apt.notif_event.hdr);
+    ser_kobj_body(ss, &srv->apt.resume_event.hdr);
+    ser_kobj_body(ss, &srv->apt.shared_font.hdr);
+    ser_kobj_body(ss, &srv->apt.capture_block.hdr);
+    SER(ss, srv->apt.application_cpu_time_limit);
+    SER(ss, srv->apt.swkbd);
+    SER(ss, srv->apt.nextparam.appid);
+    SER(ss, srv->apt.nextparam.cmd);
+    SER(ss, srv->apt.nextparam.paramsize);
+    SER(ss, srv->apt.nextparam.param);
+    ser_kobj(ss, &srv->apt.nextparam.kobj);
+
+    ser_kobj(ss, (KObject**) &srv->gsp.event);
+    ser_kobj_body(ss, &srv->gsp.sharedmem.hdr);
+    SER(ss, srv->gsp.registered);
+    SER(ss, srv->gsp.lcdfbs);
+
+    ser_kobj_body(ss, &srv->hid.sharedmem.hdr);
+    for (int i = 0; i < HIDEVENT_MAX; i++) {
+        ser_kobj_body(ss, &srv->hid.events[i].hdr);
+    }
+
+    ser_kobj(ss, (KObject**) &srv->dsp.audio_event);
+    ser_kobj(ss, (KObject**) &srv->dsp.binary_event);
+    SER(ss, srv->dsp.comp_loaded);
+    ser_kobj_body(ss, &srv->dsp.sem_event.hdr);
+    SER(ss, srv->dsp.sem_mask);
+
+    SER(ss, srv->fs.priority);
+    // file and directory sessions refer to host files by index, the ones of
+    // the loaded state are opened again at the same indices
+    for (int i = 0; i < FS_FILE_MAX; i++) {
+        char* path = srv->fs.filepaths[i];
+        u32 flags = srv->fs.fileflags[i];
+        ser_str(ss, &path);
+        SER(ss, flags);
+        if (ss->load) {
+            fs_reopen_file(ss->s, i, path, flags);
+            free(path);
+        }
+    }
+    for (int i = 0; i < FS_FILE_MAX; i++) {
+        char* path = srv->fs.dirpaths[i];
+        ser_str(ss, &path);
+        if (ss->load) {
+            fs_reopen_dir(ss->s, i, path);
+            free(path);
+        }
+    }
+
+    ser_kobj_body(ss, &srv->cecd.cecinfo.hdr);
+
+    auto y2r = &srv->y2r;
+    SER(ss, y2r->enableInterrupt);
+    SER(ss, y2r->busy);
+    ser_kobj_body(ss, &y2r->transferend.hdr);
+    SER(ss, y2r->srcY);
+    SER(ss, y2r->srcU);
+    SER(ss, y2r->srcV);
+    SER(ss, y2r->dst);
+    SER(ss, y2r->inputFmt);
+    SER(ss, y2r->outputFmt);
+    SER(ss, y2r->rotation);
+    SER(ss, y2r->blockMode);
+    SER(ss, y2r->width);
+    SER(ss, y2r->height);
+    SER(ss, y2r->alpha);
+    SER(ss, y2r->coeffs);
+
+    SER(ss, srv->ldr.crs_addr);
+
+    ser_kobj_body(ss, &srv->ir.connection_status.hdr);
+
+    auto mic = &srv->mic;
+    ser_kobj_body(ss, &mic->event.hdr);
+    ser_kobj(ss, (KObject**) &mic->shmem);
+    SER(ss, mic->gain);
+    SER(ss, mic->sampling);
+    SER(ss, mic->encoding);
+    SER(ss, mic->sampleRate);
+    SER(ss, mic->loop);
+
+    auto cam = &srv->cam;
+    ser_kobj_body(ss, &cam->recvEvent.hdr);
+    ser_kobj_body(ss, &cam->vsyncEvent.hdr);
+    ser_kobj_body(ss, &cam->errEvent.hdr);
+    SER(ss, cam->capturing);
+    SER(ss, cam->width);
+    SER(ss, cam->height);
+    SER(ss, cam->rgb);
+    SER(ss, cam->trimming);
+    SER(ss, cam->x0);
+    SER(ss, cam->y0);
+    SER(ss, cam->x1);
+    SER(ss, cam->y1);
+    SER(ss, cam->dstAddr);
+
+    ser_kobj_body(ss, &srv->csnd.shmem.hdr);
+}
+
+// the caches are rebuilt from memory after loading
+static void ser_gpu(StateSer* ss) {
+    auto gpu = &ss->s->gpu;
+
+    typeof(gpu->vsh)* shus[] = {&gpu->gsh, &gpu->vsh};
+    for (int i = 0; i < countof(shus); i++) {
+        SER(ss, shus[i]->progdata);
+        SER(ss, shus[i]->opdescs);
+        SER(ss, shus[i]->code_idx);
+        SER(ss, shus[i]->curuniform);
+        SER(ss, shus[i]->curunifi);
+        SER(ss, shus[i]->floatuniform);
+    }
+
+    SER(ss, gpu->fixattrs);
+    SER(ss, gpu->curfixattr);
+    SER(ss, gpu->curfixi);
+    u32 nimm = gpu->immattrs.size;
+    SER(ss, nimm);
+    if (ss->load) {
+        if (nimm > BIT(16)) {
+            ss->err = true;
+            return;
+        }
+        if (nimm > gpu->immattrs.cap) Vec_resize(gpu->immattrs, nimm);
+        gpu->immattrs.size = nimm;
+    }
+    ser_bytes(ss, gpu->immattrs.d, nimm * sizeof *gpu->immattrs.d);
+
+    SER(ss, gpu->lightLuts);
+    SER(ss, gpu->fogLut);
+    SER(ss, gpu->proctexMapLut);
+    SER(ss, gpu->proctexNoiseLut);
+    SER(ss, gpu->proctexLut);
+    SER(ss, gpu->proctex.offset);
+    SER(ss, gpu->proctex.width);
+
+    SER(ss, gpu->regs);
+}
+
+static void ser_dsp(StateSer* ss) {
+    auto dsp = &ss->s->dsp;
+    SER(ss, dsp->audio_pipe_pos);
+    SER(ss, dsp->binary_pipe);
+    SER(ss, dsp->bufQueues);
+    SER(ss, dsp->resamplers);
+    SER(ss, dsp->silent);
+}
+
+// everything except the memory contents
+static void ser_machine(StateSer* ss) {
+    E3DS* s = ss->s;
+
+    ser_cpu(ss);
+    ser_sched(ss);
+    memory_serialize(s, ss);
+
+    ser_kobj_body(ss, &s->process.hdr);
+    for (int i = 0; i < HANDLE_MAX; i++) {
+        ser_kobj(ss, &s->process.handles[i]);
+    }
+    SER(ss, s->process.nexttid);
+    SER(ss, s->process.allocTls);
+    SER(ss, s->process.used_memory);
+    SER(ss, s->ready.prios);
+    for (int i = 0; i < THRD_MAX_PRIO; i++) {
+        ser_kobj(ss, (KObject**) &s->ready.q[i].head);
+        ser_kobj(ss, (KObject**) &s->ready.q[i].tail);
+    }
+
+    ser_services(ss);
+    ser_gpu(ss);
+    ser_dsp(ss);
+
+    SER(ss, s->lastAudioFrame);
+    SER(ss, s->frame_complete);
+
+    ser_bodies(ss);
+}
+
+void ser_free(StateSer* ss) {
+    Vec_free(ss->buf);
+    Vec_free(ss->objs);
+    Vec_free(ss->fixups);
+}
+
+void savestate_capture(E3DS* s, StateSer* ss) {
+    *ss = (StateSer) {.s = s};
+    ser_machine(ss);
+}
+
+void savestate_sync(E3DS* s) {
+    gpu_flush_draws(&s->gpu);
+    gpu_poll_readbacks(&s->gpu, true);
+}
+
+bool savestate_apply(E3DS* s, u8* data, size_t size) {
+    // find the objects of the current state to free them after
+    StateSer old;
+    savestate_capture(s, &old);
+
+    StateSer ss = {.s = s, .load = true, .data = data, .size = size};
+    ser_machine(&ss);
+    bool ok = !ss.err;
+    ser_free(&ss);
+
+    // if the load failed partway the old objects can still be referenced
+    if (ok) {
+        Vec_foreach(o, old.objs) kobj_free(*o);
+    }
+    ser_free(&old);
+
+    jit_free_all(&s->cpu);
+    gpu_drop_caches(&s->gpu);
+    return ok;
+}
+
+static void state_header(E3DS* s, StateHeader* h) {
+    *h = (StateHeader) {.version = STATE_VERSION, .size = sizeof *s};
+    memcpy(h->magic, STATE_MAGIC, sizeof h->magic);
+    h->funcs[0] = (uintptr_t) thread_wakeup_timeout - FUNC_BASE;
+    h->funcs[1] = (uintptr_t) timer_signal - FUNC_BASE;
+    h->funcs[2] = (uintptr_t) gsp_handle_event - FUNC_BASE;
+    h->funcs[3] = (uintptr_t) memory_serialize - FUNC_BASE;
+    snprintf(h->rom, sizeof h->rom, "%s", s->romimage.name);
+}
+
+static void savestate_join(E3DS* s) {
+    if (!s->states.busy) return;
+    pthread_join(s->states.worker, nullptr);
+    s->states.busy = false;
+}
+
+static void* state_writer(void* arg) {
+    StateJob* job = arg;
+    auto st = job->st;
+    bool full = job->rec.flags & REC_FULL;
+
+    size_t bound = ZSTD_compressBound(job->rec.rawsize);
+    u8* comp = malloc(bound);
+    size_t n = ZSTD_compress(comp, bound, job->raw, job->rec.rawsize,
+                             STATE_ZSTD_LEVEL);
+    free(job->raw);
+    job->rec.compsize = ZSTD_isError(n) ? 0 : n;
+
+    // a new chain replaces the file, records are added after the end of the
+    // last good one
+    FILE* fp = fopen(job->path, full ? "wb" : "r+b");
+    bool ok = fp && !ZSTD_isError(n);
+    if (ok && full) ok = fwrite(&job->hdr, sizeof job->hdr, 1, fp) == 1;
+    if (ok && !full) ok = !fseek(fp, st->end, SEEK_SET);
+    ok = ok && fwrite(&job->rec, sizeof job->rec, 1, fp) == 1 &&
+         fwrite(comp, 1, job->rec.compsize, fp) == job->rec.compsize;
+    if (fp && fclose(fp)) ok = false;
+
+    if (ok) {
+        st->end = (full ? sizeof job->hdr : st->end) + sizeof job->rec +
+                  job->rec.compsize;
+        linfo("wrote %s record with %u pages to %s (%ld kb)",
+              full ? "full" : "incremental", job->rec.npages, job->path,
+              (long) (job->rec.compsize >> 10));
+    } else {
+        lerror("could not write save state %s", job->path);
+        st->failed = true;
+    }
+
+    free(comp);
+    free(job->path);
+    free(job);
+    return nullptr;
+}
+
+void savestate_save(E3DS* s, char* path) {
+    auto st = &s->states;
+    savestate_join(s);
+
+    bool full = st->failed || !st->path || strcmp(st->path, path) ||
+                st->records >= SAVESTATE_CHAIN_MAX;
+
+    StateSer ss;
+    savestate_capture(s, &ss);
+
+    u32* pages = malloc(MEM_NPAGES * sizeof *pages);
+    u32 npages = memory_dirty_collect(s, DIRTY_SAVESTATE, full, pages);
+
+    StateJob* job = calloc(1, sizeof *job);
+    job->st = st;
+    job->path = strdup(path);
+    if (full) state_header(s, &job->hdr);
+    job->rec = (StateRecord) {
+        .magic = RECORD_MAGIC,
+        .flags = full ? REC_FULL : 0,
+        .npages = npages,
+        .machinesize = ss.buf.size,
+        .rawsize = ss.buf.size + (u64) npages * (sizeof *pages + PAGE_SIZE),
+    };
+
+    job->raw = malloc(job->rec.rawsize);
+    u8* p = job->raw;
+    memcpy(p, ss.buf.d, ss.buf.size);
+    p += ss.buf.size;
+    memcpy(p, pages, npages * sizeof *pages);
+    p += npages * sizeof *pages;
+    for (u32 i = 0; i < npages; i++, p += PAGE_SIZE) {
+        memcpy(p, &s->mem->raw[pages[i] * PAGE_SIZE], PAGE_SIZE);
+    }
+    free(pages);
+    ser_free(&ss);
+
+    if (full) {
+        free(st->path);
+        st->path = strdup(path);
+        st->records = 0;
+        st->failed = false;
+    }
+    st->records++;
+
+    st->busy = !pthread_create(&st->worker, nullptr, state_writer, job);
+    if (!st->busy) state_writer(job);
+}
+
+static bool record_valid(StateRecord* rec, size_t avail) {
+    return rec->magic == RECORD_MAGIC && rec->compsize <= avail &&
+           rec->npages <= MEM_NPAGES &&
+           rec->rawsize == rec->machinesize +
+                               (u64) rec->npages * (sizeof(u32) + PAGE_SIZE);
+}
+
+// decompresses a record and checks its page list
+static u8* record_read(u8* data, StateRecord* rec) {
+    u8* raw = malloc(rec->rawsize);
+    size_t n =
+        ZSTD_decompress(raw, rec->rawsize, data + sizeof *rec, rec->compsize);
+    if (ZSTD_isError(n) || n != rec->rawsize) {
+        free(raw);
+        return nullptr;
+    }
+    u32* pages = (u32*) (raw + rec->machinesize);
+    for (u32 i = 0; i < rec->npages; i++) {
+        u32 pg;
+        memcpy(&pg, &pages[i], sizeof pg);
+        if (pg >= MEM_NPAGES) {
+            free(raw);
+            return nullptr;
+        }
+    }
+    return raw;
+}
+
+bool savestate_load(E3DS* s, char* path) {
+    auto st = &s->states;
+    savestate_join(s);
+
+    FILE* fp = fopen(path, "rb");
+    if (!fp) {
+        lerror("could not open save state %s", path);
+        return false;
+    }
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    rewind(fp);
+    u8* data = size > 0 ? malloc(size) : nullptr;
+    if (!data || fread(data, 1, size, fp) != size) {
+        lerror("could not read save state %s", path);
+        fclose(fp);
+        free(data);
+        return false;
+    }
+    fclose(fp);
+
+    StateHeader hdr, want;
+    state_header(s, &want);
+    memcpy(&hdr, data, size < sizeof hdr ? size : sizeof hdr);
+    if (size < sizeof hdr || memcmp(hdr.magic, want.magic, sizeof hdr.magic)) {
+        lerror("%s is not a save state", path);
+        free(data);
+        return false;
+    }
+    if (memcmp(hdr.rom, want.rom, sizeof hdr.rom)) {
+        lerror("save state %s is for a different game", path);
+        free(data);
+        return false;
+    }
+    if (memcmp(&hdr, &want, sizeof hdr)) {
+        lerror("save state %s is from a different build", path);
+        free(data);
+        return false;
+    }
+
+    // check every record before touching the state, a save that was cut off
+    // leaves a broken record at the end which is dropped
+    size_t pos = sizeof hdr;
+    int nrecs = 0;
+    while (size - pos >= sizeof(StateRecord)) {
+        StateRecord rec;
+        memcpy(&rec, &data[pos], sizeof rec);
+        if (!record_valid(&rec, size - pos - sizeof rec)) break;
+        if (!nrecs && !(rec.flags & REC_FULL)) break;
+        u8* raw = record_read(&data[pos], &rec);
+        if (!raw) break;
+        free(raw);
+        pos += sizeof rec + rec.compsize;
+        nrecs++;
+    }
+    if (!nrecs) {
+        lerror("save state %s is damaged", path);
+        free(data);
+        return false;
+    }
+    if (pos != size) lwarn("dropping a damaged record at the end of %s", path);
+    size_t end = pos;
+
+    savestate_sync(s);
+
+    u8* raw = nullptr;
+    StateRecord rec;
+    pos = sizeof hdr;
+    for (int i = 0; i < nrecs; i++) {
+        memcpy(&rec, &data[pos], sizeof rec);
+        free(raw);
+        raw = record_read(&data[pos], &rec);
+        pos += sizeof rec + rec.compsize;
+
+        if (rec.flags & REC_FULL) memory_zero(s);
+        u8* pages = raw + rec.machinesize;
+        u8* pagedata = pages + rec.npages * sizeof(u32);
+        for (u32 j = 0; j < rec.npages; j++) {
+            u32 pg;
+            memcpy(&pg, &pages[j * sizeof pg], sizeof pg);
+            memcpy(&s->mem->raw[pg * PAGE_SIZE], &pagedata[j * PAGE_SIZE],
+                   PAGE_SIZE);
+        }
+    }
+    free(data);
+
+    bool ok = savestate_apply(s, raw, rec.machinesize);
+    free(raw);
+    memory_dirty_collect(s, DIRTY_SAVESTATE, true, nullptr);
+    // the rewind history is from before the load
+    rewind_reset(s);
+
+    if (!ok) {
+        lerror("save state %s is corrupted", path);
+        ctremu.pending_reset = true;
+        return false;
+    }
+
+    free(st->path);
+    st->path = strdup(path);
+    st->records = nrecs;
+    st->end = end;
+    st->failed = false;
+    linfo("loaded %d records from %s", nrecs, path);
+    return true;
+}
+
+void savestate_destroy(E3DS* s) {
+    savestate_join(s);
+    free(s->states.path);
+    s->states.path = nullptr;
+}
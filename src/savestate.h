@@ -0,0 +1,67 @@
+#ifndef SAVESTATE_H
+#define SAVESTATE_H
+
+#include <pthread.h>
+
+#include "common.h"
+#include "kernel/kernel.h"
+
+typedef struct _3DS E3DS;
+
+// a state file is a full snapshot followed by incremental records, each with
+// only the memory pages written since the record before it
+// after this many records the next save starts a new file so loading doesn't
+// have to replay a long chain
+#define SAVESTATE_CHAIN_MAX 32
+
+typedef struct {
+    char* path; // file the next save appends to
+    int records;
+    long end; // where the next record goes
+    bool failed;
+
+    pthread_t worker;
+    bool busy;
+} SaveStates;
+
+// walks the machine state in the same order for saving and loading
+// kernel objects can be referenced from anywhere so references are written as
+// ids, objects inside E3DS by their offset and heap objects by the order they
+// were first reached in, with their contents written after the rest of the
+// state
+typedef struct _StateSer {
+    E3DS* s;
+    bool load;
+    bool err;
+
+    Vec(u8) buf; // when saving
+    u8* data;    // when loading
+    size_t size;
+    size_t pos;
+
+    Vec(KObject*) objs;
+    size_t nbodies;
+    Vec(struct {
+        KObject** p;
+        u32 id;
+    }) fixups;
+} StateSer;
+
+void ser_bytes(StateSer* ss, void* p, size_t len);
+#define SER(ss, v) ser_bytes(ss, &(v), sizeof(v))
+void ser_kobj(StateSer* ss, KObject** o);
+
+void ser_free(StateSer* ss);
+
+// the machine state except for the memory contents
+void savestate_capture(E3DS* s, StateSer* ss);
+// waits for everything that can still write to memory
+void savestate_sync(E3DS* s);
+// replaces the machine state, the memory contents have to be in place already
+bool savestate_apply(E3DS* s, u8* data, size_t size);
+
+void savestate_save(E3DS* s, char* path);
+bool savestate_load(E3DS* s, char* path);
+void savestate_destroy(E3DS* s);
+
+#endif
@@ -53,6 +53,66 @@ void sanitize_filepath(char* s) {
 #endif
 }
 
+static FILE* open_host_file(char* filepath, u32 flags) {
+    int mode = 0;
+    switch (flags & 3) {
+        case 0b01:
+            mode = O_RDONLY;
+            break;
+        case 0b10:
+            mode = O_WRONLY;
+            break;
+        case 0b11:
+            mode = O_RDWR;
+            break;
+    }
+    if (flags & BIT(2)) mode |= O_CREAT;
+#ifdef _WIN32
+    mode |= O_BINARY;
+#endif
+
+    int hostfd = open(filepath, mode, S_IRUSR | S_IWUSR);
+    if (hostfd < 0) {
+        lwarn("file %s not found", filepath);
+        return nullptr;
+    }
+
+    char* fopenmode = "rb";
+    switch (flags & 3) {
+        case 0b01:
+            fopenmode = "rb";
+            break;
+        case 0b10:
+            fopenmode = "wb";
+            break;
+        case 0b11:
+            fopenmode = "rb+";
+            break;
+    }
+
+    FILE* fp = fdopen(hostfd, fopenmode);
+    if (!fp) {
+        perror("fdopen");
+        close(hostfd);
+        return nullptr;
+    }
+    return fp;
+}
+
+static void close_file(E3DS* s, int fd) {
+    if (s->services.fs.files[fd]) fclose(s->services.fs.files[fd]);
+    s->services.fs.files[fd] = nullptr;
+    free(s->services.fs.filepaths[fd]);
+    s->services.fs.filepaths[fd] = nullptr;
+}
+
+static void close_dir(E3DS* s, int fd) {
+    if (s->services.fs.dirs[fd]) closedir(s->services.fs.dirs[fd]);
+    s->services.fs.dirs[fd] = nullptr;
+    free(s->services.fs.dirpaths[fd]);
+    s->services.fs.dirpaths[fd] = nullptr;
+}
+
 char* archive_basepath(E3DS* s, u64 archive) {
     char* basepath;
     switch (archive & MASKL(32)) {
@@ -264,8 +324,7 @@ DECL_PORT(fs) {
                 ses =
                     fs_open_file(s, archivehandle, pathtype, path, pathsize, 0);
                 if (ses) {
-                    fclose(s->services.fs.files[ses->arg]);
-                    s->services.fs.files[ses->arg] = nullptr;
+                    close_file(s, ses->arg);
                     kobject_destroy(s, &ses->hdr);
                     cmdbuf[1] = -1;
                 } else {
@@ -517,7 +576,7 @@ DECL_PORT(fs) {
 DECL_PORT_ARG(fs_selfncch, base) {
     u32* cmdbuf = PTR(cmd_addr);
 
-    if (!s->romimage.fp) {
+    if (!s->romimage.file.fp) {
         lerror("there is no romfs");
         cmdbuf[0] = IPCHDR(1, 0);
         cmdbuf[1] = -1;
@@ -536,9 +595,8 @@ DECL_PORT_ARG(fs_selfncch, base) {
 
             cmdbuf[0] = IPCHDR(2, 0);
             cmdbuf[1] = 0;
-            fseek(s->romimage.fp, base + offset, SEEK_SET);
-
-            cmdbuf[2] = fread(data, 1, size, s->romimage.fp);
+            cmdbuf[2] =
+                romfile_read(&s->romimage.file, base + offset, data, size);
             break;
         }
         case 0x0808: {
@@ -662,6 +720,8 @@ DECL_PORT_ARG(fs_file, fd) {
     FILE* fp = s->services.fs.files[fd];
 
     if (!fp) {
+        // a file from a save state that could not be opened again
+        if (cmd.command == 0x0808) close_file(s, fd);
         lerror("invalid fd");
         cmdbuf[0] = IPCHDR(1, 0);
         cmdbuf[1] = -1;
@@ -721,8 +781,7 @@ DECL_PORT_ARG(fs_file, fd) {
         }
         case 0x0808: {
             linfo("closing file");
-            fclose(fp);
-            s->services.fs.files[fd] = nullptr;
+            close_file(s, fd);
             cmdbuf[0] = IPCHDR(1, 0);
             cmdbuf[1] = 0;
             break;
@@ -742,6 +801,7 @@ DECL_PORT_ARG(fs_dir, fd) {
     DIR* dp = s->services.fs.dirs[fd];
 
     if (!dp) {
+        if (cmd.command == 0x0802) close_dir(s, fd);
         lerror("invalid fd");
         cmdbuf[0] = IPCHDR(1, 0);
         cmdbuf[1] = -1;
@@ -810,12 +870,7 @@ DECL_PORT_ARG(fs_dir, fd) {
         }
         case 0x0802: {
             linfo("closing dir");
-            closedir(dp);
-            s->services.fs.dirs[fd] = nullptr;
-#ifdef _WIN32
-            free(s->services.fs.dirpaths[fd]);
-            s->services.fs.dirpaths[fd] = nullptr;
-#endif
+            close_dir(s, fd);
             cmdbuf[0] = IPCHDR(1, 0);
             cmdbuf[1] = 0;
             break;
@@ -976,9 +1031,9 @@ KSession* fs_open_file(E3DS* s, u64 archive, u32 pathtype, void* rawpath,
                     }
                     case 2: {
                         char* filename = (char*) &path[1];
-                        ExeFSHeader hdr;
-                        fseek(s->romimage.fp, s->romimage.exefs_off, SEEK_SET);
-                        fread(&hdr, sizeof hdr, 1, s->romimage.fp);
+                        ExeFSHeader hdr = {};
+                        romfile_read(&s->romimage.file,
+                                     s->romimage.exefs_off, &hdr, sizeof hdr);
                         u32 offset = 0;
                         for (int i = 0; i < 10; i++) {
                             if (!strcmp(hdr.file[i].name, filename)) {
@@ -1012,7 +1067,7 @@ KSession* fs_open_file(E3DS* s, u64 archive, u32 pathtype, void* rawpath,
 
             int fd = -1;
             for (int i = 0; i < FS_FILE_MAX; i++) {
-                if (s->services.fs.files[i] == nullptr) {
+                if (!s->services.fs.filepaths[i]) {
                     fd = i;
                     break;
                 }
@@ -1025,56 +1080,18 @@ KSession* fs_open_file(E3DS* s, u64 archive, u32 pathtype, void* rawpath,
             char* filepath =
                 create_text_path(s, archive, pathtype, rawpath, pathsize);
 
-            int mode = 0;
-            switch (flags & 3) {
-                case 0b01:
-                    mode = O_RDONLY;
-                    break;
-                case 0b10:
-                    mode = O_WRONLY;
-                    break;
-                case 0b11:
-                    mode = O_RDWR;
-                    break;
-            }
-            if (flags & BIT(2)) mode |= O_CREAT;
-#ifdef _WIN32
-            mode |= O_BINARY;
-#endif
-
-            int hostfd = open(filepath, mode, S_IRUSR | S_IWUSR);
-            if (hostfd < 0) {
-                lwarn("file %s not found", filepath);
-                free(filepath);
-                return nullptr;
-            }
-
-            char* fopenmode = "rb";
-            switch (flags & 3) {
-                case 0b01:
-                    fopenmode = "rb";
-                    break;
-                case 0b10:
-                    fopenmode = "wb";
-                    break;
-                case 0b11:
-                    fopenmode = "rb+";
-                    break;
-            }
-
-            FILE* fp = fdopen(hostfd, fopenmode);
+            FILE* fp = open_host_file(filepath, flags);
             if (!fp) {
-                perror("fdopen");
                 free(filepath);
                 return nullptr;
             }
             s->services.fs.files[fd] = fp;
+            s->services.fs.filepaths[fd] = filepath;
+            s->services.fs.fileflags[fd] = flags;
 
             KSession* ses = session_create_arg(port_handle_fs_file, fd);
             linfo("opened file %s with fd %d", filepath, fd);
 
-            free(filepath);
-
             return ses;
             break;
         }
@@ -1167,7 +1184,7 @@ KSession* fs_open_dir(E3DS* s, u64 archive, u32 pathtype, void* rawpath,
 
             int fd = -1;
             for (int i = 0; i < FS_FILE_MAX; i++) {
-                if (s->services.fs.dirs[i] == nullptr) {
+                if (!s->services.fs.dirpaths[i]) {
                     fd = i;
                     break;
                 }
@@ -1187,15 +1204,11 @@ KSession* fs_open_dir(E3DS* s, u64 archive, u32 pathtype, void* rawpath,
                 return nullptr;
             }
             s->services.fs.dirs[fd] = dp;
-#ifdef _WIN32
-            s->services.fs.dirpaths[fd] = strdup(filepath);
-#endif
+            s->services.fs.dirpaths[fd] = filepath;
 
             KSession* ses = session_create_arg(port_handle_fs_dir, fd);
             linfo("opened directory %s with fd %d", filepath, fd);
 
-            free(filepath);
-
             return ses;
             break;
         }
@@ -1233,17 +1246,32 @@ bool fs_create_dir(E3DS* s, u64 archive, u32 pathtype, void* rawpath,
     }
 }
 
+// save states open the files that were open when they were made, at the
+// same index
+// a file that can't be opened keeps its index until its sessions close it, so
+// they fail instead of using a different file
+void fs_reopen_file(E3DS* s, int fd, char* path, u32 flags) {
+    close_file(s, fd);
+    if (!path) return;
+    // it has been created already if it was meant to be
+    s->services.fs.files[fd] = open_host_file(path, flags & ~BIT(2));
+    s->services.fs.filepaths[fd] = strdup(path);
+    s->services.fs.fileflags[fd] = flags;
+}
+
+// directories are listed from the start again
+void fs_reopen_dir(E3DS* s, int fd, char* path) {
+    close_dir(s, fd);
+    if (!path) return;
+    s->services.fs.dirs[fd] = opendir(path);
+    if (!s->services.fs.dirs[fd]) lwarn("directory %s not found", path);
+    s->services.fs.dirpaths[fd] = strdup(path);
+}
+
 void fs_close_all_files(E3DS* s) {
     for (int i = 0; i < FS_FILE_MAX; i++) {
-        if (s->services.fs.files[i]) fclose(s->services.fs.files[i]);
-    }
-    for (int i = 0; i < FS_FILE_MAX; i++) {
-        if (s->services.fs.dirs[i]) {
-            closedir(s->services.fs.dirs[i]);
-#ifdef _WIN32
-            free(s->services.fs.dirpaths[i]);
-#endif
-        }
+        close_file(s, i);
+        close_dir(s, i);
     }
 
     free(mii_data_custom);
@@ -47,9 +47,11 @@ typedef struct {
 typedef struct {
     FILE* files[FS_FILE_MAX];
     DIR* dirs[FS_FILE_MAX];
-#ifdef _WIN32
+    // sessions refer to files by index, the paths are kept so save states can
+    // open the same files at the same indices
+    char* filepaths[FS_FILE_MAX];
+    u32 fileflags[FS_FILE_MAX];
     char* dirpaths[FS_FILE_MAX];
-#endif
 
     u32 priority;
 } FSData;
@@ -73,6 +75,8 @@ KSession* fs_open_dir(E3DS* s, u64 archive, u32 pathtype, void* rawpath,
 bool fs_create_dir(E3DS* s, u64 archive, u32 pathtype, void* rawpath,
                    u32 pathsize);
 
+void fs_reopen_file(E3DS* s, int fd, char* path, u32 flags);
+void fs_reopen_dir(E3DS* s, int fd, char* path);
 void fs_close_all_files(E3DS* s);
 
 #endif
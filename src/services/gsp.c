@@ -7,6 +7,8 @@
 
 #define GSPMEM ((GSPSharedMem*) PPTR(s->services.gsp.sharedmem.paddr))
 
+#define READBACK_POLL_CYCLES 20'000
+
 DECL_PORT(gsp_gpu) {
     u32* cmdbuf = PTR(cmd_addr);
     switch (cmd.command) {
@@ -180,6 +182,22 @@ void gsp_handle_event(E3DS* s, u32 id) {
     }
 }
 
+// texture copies that read back a framebuffer finish asynchronously
+// and the interrupt is only sent once the data is in memory
+void gsp_readback_event(E3DS* s) {
+    if (!gpu_poll_readbacks(&s->gpu, false)) {
+        add_event(&s->sched, (SchedulerCallback) gsp_readback_event, 0,
+                  READBACK_POLL_CYCLES);
+        return;
+    }
+    gsp_handle_event(s, GSPEVENT_PPF);
+}
+
+// a command only waits for the readbacks that land in memory it uses
+static void wait_readbacks(E3DS* s, u32 vaddr, u32 size) {
+    gpu_wait_readbacks(&s->gpu, vaddr_to_paddr(vaddr), size);
+}
+
 void gsp_handle_command(E3DS* s) {
     auto cmds = &GSPMEM->commands[0];
 
@@ -192,6 +210,8 @@ void gsp_handle_command(E3DS* s) {
             u32 size = cmds->d[cmds->cur].args[2];
             linfo("dma request from %08x to %08x of size 0x%x", src, dest,
                   size);
+            wait_readbacks(s, src, size);
+            wait_readbacks(s, dest, size);
             memcpy(PTR(dest), PTR(src), size);
             gpu_invalidate_range(&s->gpu, vaddr_to_paddr(dest), size);
             gsp_handle_event(s, GSPEVENT_DMA);
@@ -202,9 +222,12 @@ void gsp_handle_command(E3DS* s) {
             u32 bufsize = cmds->d[cmds->cur].args[1];
             linfo("sending command list at %08x with size 0x%x", bufaddr,
                   bufsize);
+            // draws can sample from anywhere in memory
+            gpu_poll_readbacks(&s->gpu, true);
             gpu_reset_needs_rehesh(&s->gpu);
             gpu_run_command_list(&s->gpu, vaddr_to_paddr(bufaddr & ~7),
                                  bufsize);
+            gpu_flush_draws(&s->gpu);
             gsp_handle_event(s, GSPEVENT_P3D);
             break;
         }
@@ -222,6 +245,8 @@ void gsp_handle_command(E3DS* s) {
                 if (!cmd->buf[i].st) continue;
                 linfo("memory fill at fb %08x-%08x with %x", cmd->buf[i].st,
                       cmd->buf[i].end, cmd->buf[i].val);
+                wait_readbacks(s, cmd->buf[i].st,
+                               cmd->buf[i].end - cmd->buf[i].st);
                 gpu_clear_fb(&s->gpu, vaddr_to_paddr(cmd->buf[i].st),
                              vaddr_to_paddr(cmd->buf[i].end), cmd->buf[i].val,
                              (cmd->ctl[i] >> 8) + 2);
@@ -239,7 +264,7 @@ void gsp_handle_command(E3DS* s) {
             u16 wout = dimout & 0xffff;
             u16 hout = dimout >> 16;
             u32 flags = cmds->d[cmds->cur].args[4];
-            [[maybe_unused]] u8 fmtin = (flags >> 8) & 7;
+            u8 fmtin = (flags >> 8) & 7;
             u8 fmtout = (flags >> 12) & 7;
             u8 scalemode = (flags >> 24) & 3;
             bool scalex = scalemode >= 1;
@@ -258,6 +283,9 @@ void gsp_handle_command(E3DS* s) {
                   "flags %x",
                   addrin, win, hin, addrout, wout, hout, flags);
 
+            wait_readbacks(s, addrin, win * hin * fmtBpp[fmtin]);
+            wait_readbacks(s, addrout, wout * hout * fmtBpp[fmtout]);
+
             update_fbinfos(s);
 
             bool found = false;
@@ -320,11 +348,24 @@ void gsp_handle_command(E3DS* s) {
                   addrin, pitchin, gapin, addrout, pitchout, gapout, copysize,
                   flags);
 
+            // the gaps between lines are part of the range too
+            if (pitchin && pitchout) {
+                wait_readbacks(s, addrin,
+                               copysize + (copysize / pitchin + 1) * gapin);
+                wait_readbacks(s, addrout,
+                               copysize + (copysize / pitchout + 1) * gapout);
+            }
+
             gpu_texture_copy(&s->gpu, vaddr_to_paddr(addrin),
                              vaddr_to_paddr(addrout), copysize, pitchin, gapin,
                              pitchout, gapout);
 
-            gsp_handle_event(s, GSPEVENT_PPF);
+            if (gpu_poll_readbacks(&s->gpu, false)) {
+                gsp_handle_event(s, GSPEVENT_PPF);
+            } else {
+                add_event(&s->sched, (SchedulerCallback) gsp_readback_event, 0,
+                          READBACK_POLL_CYCLES);
+            }
             break;
         }
         case 0x05: {
@@ -339,6 +380,7 @@ void gsp_handle_command(E3DS* s) {
             }* cmd = (void*) &cmds->d[cmds->cur];
             for (int i = 0; i < 3; i++) {
                 if (cmd->buf[i].size == 0) break;
+                wait_readbacks(s, cmd->buf[i].addr, cmd->buf[i].size);
                 gpu_invalidate_range(&s->gpu, vaddr_to_paddr(cmd->buf[i].addr),
                                      cmd->buf[i].size);
             }
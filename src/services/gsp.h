@@ -86,5 +86,6 @@ DECL_PORT(gsp_gpu);
 
 void gsp_handle_event(E3DS* s, u32 id);
 void gsp_handle_command(E3DS* s);
+void gsp_readback_event(E3DS* s);
 
 #endif
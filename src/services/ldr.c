@@ -4,6 +4,7 @@
 #include "arm/jit/jit.h"
 #include "kernel/memory.h"
 #include "kernel/svc_types.h"
+#include "perfmap.h"
 
 DECL_PORT(ldr_ro) {
     u32* cmdbuf = PTR(cmd_addr);
@@ -231,6 +232,8 @@ void ldr_load_cro(E3DS* s, u32 vaddr, u32 data, u32 bss, bool autolink) {
     char* name = PTR(hdr->name_addr);
     linfo("loading cro %s", name);
 
+    perfmap_add_module(name, hdr->code.addr, hdr->code.size);
+
     CROSegment* segs = PTR(hdr->segmenttable.addr);
     // when patching symbols in data it needs to be done in
     // the cro itself not in the external data buffer
@@ -341,6 +344,8 @@ void ldr_unload_cro(E3DS* s, u32 vaddr) {
 
     linfo("unloading cro %s", PTR(hdr->name_addr));
 
+    perfmap_remove_module(hdr->code.addr);
+
     // remove from link list
     // see the diagram in the cro doc (this is so dumb)
     if (hdr->next) {
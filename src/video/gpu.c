@@ -4,7 +4,9 @@
 #include "emulator.h"
 #include "kernel/memory.h"
 
+#include "gpu_hash.h"
 #include "renderer_gl.h"
+#include "renderer_sw.h"
 #include "shader.h"
 #include "shaderdec.h"
 #include "shadergen_fs.h"
@@ -19,18 +21,83 @@ void gpu_init(GPU* gpu) {
     LRU_init(gpu->vshaders_sw);
     LRU_init(gpu->vshaders_hw);
     LRU_init(gpu->fshaders);
+    LRU_init(gpu->cmdlists);
 
     gpu_vshrunner_init(gpu);
 
-    renderer_gl_init(&gpu->gl, gpu);
+    if (ctremu.swrenderer) {
+        renderer_sw_init(&gpu->sw, gpu);
+        // gl is only used to show the screens, without a window there is no
+        // gl context at all
+        if (!ctremu.headless) renderer_gl_init_screens(&gpu->gl);
+    } else {
+        renderer_gl_init(&gpu->gl, gpu);
+    }
 }
 
 void gpu_destroy(GPU* gpu) {
-    renderer_gl_destroy(&gpu->gl, gpu);
+    if (ctremu.swrenderer) {
+        renderer_sw_destroy(&gpu->sw, gpu);
+        if (!ctremu.headless) renderer_gl_destroy_screens(&gpu->gl);
+    } else {
+        renderer_gl_destroy(&gpu->gl, gpu);
+    }
 
     shaderjit_free_all(gpu);
 
     gpu_vshrunner_destroy(gpu);
+
+    for (int i = 0; i < CMDLIST_MAX; i++) {
+        Vec_free(gpu->cmdlists.d[i].ops);
+    }
+}
+
+// whether a register write changes state the open draw batch was set up
+// with, in which case the batch needs to be submitted before the write
+static bool breaks_draw_batch(GPU* gpu, u16 id, bool changed) {
+    switch (id) {
+        // these are only used by the draw itself
+        case GPUREG(geom.nverts) - 1: // index buffer offset and format
+        case GPUREG(geom.nverts):
+        case GPUREG(geom.vtx_off):
+        case GPUREG(geom.drawarrays):
+        case GPUREG(geom.drawelements):
+        case GPUREG(geom.cmdbuf.size[0])... GPUREG(geom.cmdbuf.jmp[1]):
+        case GPUREG(geom.start_draw_func0):
+        case GPUREG(geom.restart_primitive):
+        case GPUREG(fb.fb_invalidate):
+        case GPUREG(fb.fb_flush):
+            return false;
+        // writing the lut data always modifies the luts
+        case GPUREG(lighting.lutData[0])... GPUREG(lighting.lutData[7]):
+        case GPUREG(tex.fogLutData[0])... GPUREG(tex.fogLutData[7]):
+        case GPUREG(tex.proctexLutData[0])... GPUREG(tex.proctexLutData[7]):
+            return true;
+        case GPUREG(geom.config):
+        case GPUREG(geom.prim_config):
+            return changed;
+    }
+
+    if (GPUREG(geom) <= id && id < GPUREG(vsh) + 0x30) {
+        // vertex input and shader state
+        // sw vertex shaders are run when the draw is queued so these
+        // only matter for hw vertex shaders
+        if (gpu->gl.batch.sw) return false;
+        switch (id) {
+            case GPUREG(geom.fixattr_data[0])... GPUREG(geom.fixattr_data[2]):
+            case GPUREG(gsh.floatuniform_data[0])... GPUREG(
+                gsh.floatuniform_data[7]):
+            case GPUREG(gsh.codetrans_data[0])... GPUREG(gsh.codetrans_data[8]):
+            case GPUREG(gsh.opdescs_data[0])... GPUREG(gsh.opdescs_data[8]):
+            case GPUREG(vsh.floatuniform_data[0])... GPUREG(
+                vsh.floatuniform_data[7]):
+            case GPUREG(vsh.codetrans_data[0])... GPUREG(vsh.codetrans_data[8]):
+            case GPUREG(vsh.opdescs_data[0])... GPUREG(vsh.opdescs_data[8]):
+                return true;
+        }
+    }
+
+    return changed;
 }
 
 void gpu_write_internalreg(GPU* gpu, u16 id, u32 param, u32 mask) {
@@ -39,8 +106,12 @@ void gpu_write_internalreg(GPU* gpu, u16 id, u32 param, u32 mask) {
         return;
     }
     linfo("command %03x (0x%08x) & %08x (%f)", id, param, mask, I2F(param));
-    gpu->regs.w[id] &= ~mask;
-    gpu->regs.w[id] |= param & mask;
+    u32 val = (gpu->regs.w[id] & ~mask) | (param & mask);
+    bool changed = val != gpu->regs.w[id];
+    if (gpu->gl.batch.active && breaks_draw_batch(gpu, id, changed)) {
+        gpu_flush_draws(gpu);
+    }
+    gpu->regs.w[id] = val;
     switch (id) {
         case GPUREG(geom.cmdbuf.jmp[0]):
             gpu_run_command_list(gpu, gpu->regs.geom.cmdbuf.addr[0] << 3,
@@ -98,6 +169,8 @@ void gpu_write_internalreg(GPU* gpu, u16 id, u32 param, u32 mask) {
             }
             break;
         case GPUREG(lighting.lutData[0])... GPUREG(lighting.lutData[7]): {
+            // queued software draws read the luts when they are rasterized
+            if (ctremu.swrenderer) gpu_sw_flush_draws(gpu);
             u16 val = param & MASK(12);
             gpu->lightLuts[gpu->regs.lighting.lutNum]
                           [gpu->regs.lighting.lutIndex++] = val << 4 | val >> 8;
@@ -246,6 +319,9 @@ void gpu_write_internalreg(GPU* gpu, u16 id, u32 param, u32 mask) {
         case GPUREG(vsh.intuniform[0])... GPUREG(vsh.intuniform[3]):
         case GPUREG(vsh.booluniform):
             gpu->vsh_uniform_dirty = true;
+            // specialized shaders have these compiled in
+            if (ctremu.specializeShaders && changed)
+                gpu->vsh.code_dirty = true;
             break;
         case GPUREG(gsh.entrypoint):
             gpu->gsh.code_dirty = true;
@@ -289,12 +365,41 @@ void gpu_reset_needs_rehesh(GPU* gpu) {
     }
 }
 
-void gpu_run_command_list(GPU* gpu, u32 paddr, u32 size) {
-
-    paddr &= ~15;
-    size &= ~15;
+// registers with side effects beyond setting the register
+// these must be the same as the cases in gpu_write_internalreg
+static bool reg_is_action(u16 id) {
+    switch (id) {
+        case GPUREG(geom.cmdbuf.jmp[0]):
+        case GPUREG(geom.cmdbuf.jmp[1]):
+        case GPUREG(geom.drawarrays):
+        case GPUREG(geom.drawelements):
+        case GPUREG(geom.fixattr_data[0])... GPUREG(geom.fixattr_data[2]):
+        case GPUREG(geom.start_draw_func0):
+        case GPUREG(lighting.lutData[0])... GPUREG(lighting.lutData[7]):
+        case GPUREG(tex.fogLutData[0])... GPUREG(tex.fogLutData[7]):
+        case GPUREG(tex.proctexLutData[0])... GPUREG(tex.proctexLutData[7]):
+        case GPUREG(gsh.floatuniform_data[0])... GPUREG(
+            gsh.floatuniform_data[7]):
+        case GPUREG(vsh.floatuniform_data[0])... GPUREG(
+            vsh.floatuniform_data[7]):
+        case GPUREG(vsh.intuniform[0])... GPUREG(vsh.intuniform[3]):
+        case GPUREG(vsh.booluniform):
+        case GPUREG(gsh.entrypoint):
+        case GPUREG(gsh.codetrans_data[0])... GPUREG(gsh.codetrans_data[8]):
+        case GPUREG(gsh.opdescs_data[0])... GPUREG(gsh.opdescs_data[8]):
+        case GPUREG(vsh.entrypoint):
+        case GPUREG(raster.sh_outmap[0])... GPUREG(raster.sh_outmap[6]):
+        case GPUREG(vsh.codetrans_data[0])... GPUREG(vsh.codetrans_data[8]):
+        case GPUREG(vsh.opdescs_data[0])... GPUREG(vsh.opdescs_data[8]):
+            return true;
+        default:
+            return id >= GPUREG_MAX;
+    }
+}
 
-    u32* cmds = PTR(paddr);
+// decodes a command list into a flat list of register writes
+static void decode_command_list(CmdListCacheEntry* ent, u32* cmds, u32 size) {
+    ent->ops.size = 0;
 
     u32* cur = cmds;
     u32* end = cmds + (size / 4);
@@ -306,11 +411,13 @@ void gpu_run_command_list(GPU* gpu, u32 paddr, u32 size) {
         if (c.mask & BIT(2)) mask |= 0xff << 16;
         if (c.mask & BIT(3)) mask |= 0xff << 24;
 
-        gpu_write_internalreg(gpu, c.id, cur[0], mask);
+        Vec_push(ent->ops, ((GPUCmdOp) {c.id, reg_is_action(c.id), mask,
+                                        cur[0]}));
         cur += 2;
         if (c.incmode) c.id++;
         for (int i = 0; i < c.nparams; i++) {
-            gpu_write_internalreg(gpu, c.id, *cur++, mask);
+            Vec_push(ent->ops, ((GPUCmdOp) {c.id, reg_is_action(c.id), mask,
+                                            *cur++}));
             if (c.incmode) c.id++;
         }
         // each command must be 8 byte aligned
@@ -318,6 +425,41 @@ void gpu_run_command_list(GPU* gpu, u32 paddr, u32 size) {
     }
 }
 
+void gpu_run_command_list(GPU* gpu, u32 paddr, u32 size) {
+
+    paddr &= ~15;
+    size &= ~15;
+
+    if (!size) return;
+
+    u32* cmds = PTR(paddr);
+
+    // games tend to submit the same command lists every frame so
+    // the decoded lists are cached by their address and contents
+    u64 hash = gpu_hash_cmdlist(cmds, size);
+    auto ent = LRU_load(gpu->cmdlists, (u64) size << 32 | paddr);
+    if (ent->hash != hash || !ent->ops.d) {
+        linfo("decoding command list at %08x size %x", paddr, size);
+        ent->hash = hash;
+        decode_command_list(ent, cmds, size);
+    }
+
+    // registers without side effects are written directly and only
+    // if their value actually changes
+    Vec_foreach(op, ent->ops) {
+        if (op->action) {
+            gpu_write_internalreg(gpu, op->id, op->param, op->mask);
+            continue;
+        }
+        u32 val = (gpu->regs.w[op->id] & ~op->mask) | (op->param & op->mask);
+        if (val == gpu->regs.w[op->id]) continue;
+        if (gpu->gl.batch.active && breaks_draw_batch(gpu, op->id, true)) {
+            gpu_flush_draws(gpu);
+        }
+        gpu->regs.w[op->id] = val;
+    }
+}
+
 // searches the framebuffer cache and return nullptr if not found
 // need to search starting at most recently used FB because
 // there can be overlapping fbs apparently
@@ -362,25 +504,169 @@ void gpu_invalidate_range(GPU* gpu, u32 paddr, u32 len) {
     }
 }
 
+// used when the whole machine state is replaced, nothing that was cached from
+// the old memory or registers can be trusted after that
+void gpu_drop_caches(GPU* gpu) {
+    for (int i = 0; i < FB_MAX; i++) {
+        auto fb = &gpu->fbs.d[i];
+        if (fb->next) LRU_remove(gpu->fbs, fb);
+        fb->key = 0;
+        fb->width = fb->height = 0;
+    }
+    gpu->curfb = &gpu->fbs.root;
+    for (int i = 0; i < TEX_MAX; i++) {
+        auto t = &gpu->textures.d[i];
+        if (t->next) LRU_remove(gpu->textures, t);
+        t->key = 0;
+    }
+
+    gpu->gsh.code_dirty = true;
+    gpu->vsh.code_dirty = true;
+    gpu->vsh_uniform_dirty = true;
+    gpu->lightLutDirty = true;
+    gpu->fogLutDirty = true;
+    gpu->proctexMapLutDirty = true;
+    gpu->proctexNoiseLutDirty = true;
+    gpu->proctexLutDirty = true;
+    gpu->lastFragUboHash = 0;
+}
+
 void gpu_display_transfer(GPU* gpu, u32 paddr, int yoff, bool scalex,
                           bool scaley, bool vflip, int screenid) {
+    gpu_flush_draws(gpu);
+    if (ctremu.swrenderer) {
+        gpu_sw_display_transfer(gpu, paddr, yoff, scalex, scaley, vflip,
+                                screenid);
+        return;
+    }
     gpu_gl_display_transfer(gpu, paddr, yoff, scalex, scaley, vflip, screenid);
 }
 
 void gpu_render_lcd_fb(GPU* gpu, u32 paddr, u32 fmt, int screenid) {
+    gpu_poll_readbacks(gpu, true);
+    gpu_flush_draws(gpu);
+    if (ctremu.swrenderer) {
+        gpu_sw_render_lcd_fb(gpu, paddr, fmt, screenid);
+        return;
+    }
     gpu_gl_render_lcd_fb(gpu, paddr, fmt, screenid);
 }
 
 void gpu_texture_copy(GPU* gpu, u32 srcpaddr, u32 dstpaddr, u32 size,
                       u32 srcpitch, u32 srcgap, u32 dstpitch, u32 dstgap) {
+    gpu_flush_draws(gpu);
+    // the software renderer keeps everything in memory already
+    if (ctremu.swrenderer) {
+        if (srcpitch && dstpitch) {
+            gpu_copy_mem(gpu, srcpaddr, dstpaddr, size, srcpitch, srcgap,
+                         dstpitch, dstgap);
+        }
+        return;
+    }
     gpu_gl_texture_copy(gpu, srcpaddr, dstpaddr, size, srcpitch, srcgap,
                         dstpitch, dstgap);
 }
 
 void gpu_clear_fb(GPU* gpu, u32 paddr, u32 len, u32 value, u32 datasz) {
+    gpu_flush_draws(gpu);
+    if (ctremu.swrenderer) {
+        gpu_fill_mem(gpu, paddr, len, value, datasz);
+        return;
+    }
     gpu_gl_clear_fb(gpu, paddr, len, value, datasz);
 }
 
+// copies between linear buffers with independent line pitch and gap
+void gpu_copy_mem(GPU* gpu, u32 srcpaddr, u32 dstpaddr, u32 size,
+                  u32 srcpitch, u32 srcgap, u32 dstpitch, u32 dstgap) {
+    u8* src = PTR(srcpaddr);
+    u8* dst = PTR(dstpaddr);
+
+    int cnt = 0;
+    int curline = 0;
+    if (srcpitch <= dstpitch) {
+        while (cnt < size) {
+            memcpy(dst, src, srcpitch);
+            cnt += srcpitch;
+            curline += srcpitch;
+            src += srcpitch + srcgap;
+            dst += srcpitch;
+            if (curline >= dstpitch) {
+                dst += dstgap;
+                curline = 0;
+            }
+        }
+    } else {
+        while (cnt < size) {
+            memcpy(dst, src, dstpitch);
+            cnt += dstpitch;
+            curline += dstpitch;
+            dst += dstpitch + dstgap;
+            src += dstpitch;
+            if (curline >= srcpitch) {
+                src += srcgap;
+                curline = 0;
+            }
+        }
+    }
+
+    gpu_invalidate_range(gpu, dstpaddr, size);
+}
+
+void gpu_fill_mem(GPU* gpu, u32 paddr, u32 endPaddr, u32 value, u32 datasz) {
+    linfo("sw memfill at %x to %x value %x datasz %d", paddr, endPaddr, value,
+          datasz);
+
+    void* cur = PTR(paddr);
+    void* end = PTR(paddr) + endPaddr - paddr;
+    switch (datasz) {
+        case 2:
+            while (cur < end) {
+                *(u16*) cur = value;
+                cur += 2;
+            }
+            break;
+        case 3:
+            while (cur < end) {
+                *(u16*) cur = value;
+                *(u8*) (cur + 2) = value >> 16;
+                cur += 3;
+            }
+            break;
+        case 4:
+            while (cur < end) {
+                *(u32*) cur = value;
+                cur += 4;
+            }
+            break;
+    }
+
+    gpu_invalidate_range(gpu, paddr, endPaddr - paddr);
+}
+
+// call before emulating gpu drawing
+void gpu_start_frame(GPU* gpu) {
+    if (ctremu.swrenderer) return;
+    gpu_gl_start_frame(gpu);
+}
+
+// shows a screen image of the software renderer
+void gpu_present_screen(GPU* gpu, int screenid) {
+    if (ctremu.headless) return;
+    gpu_gl_present_screen(gpu, gpu->sw.screens[screenid], screenid);
+}
+
+// framebuffers read back into memory arrive asynchronously
+bool gpu_poll_readbacks(GPU* gpu, bool wait) {
+    if (ctremu.swrenderer) return true;
+    return gpu_gl_poll_readbacks(gpu, wait);
+}
+
+void gpu_wait_readbacks(GPU* gpu, u32 paddr, u32 size) {
+    if (ctremu.swrenderer) return;
+    gpu_gl_wait_readbacks(gpu, paddr, size);
+}
+
 u32 morton_swizzle(u32 w, u32 x, u32 y) {
     u32 swizzle[8] = {
         0x00, 0x01, 0x04, 0x05, 0x10, 0x11, 0x14, 0x15,
@@ -706,5 +992,11 @@ void gpu_run_gsh(GPU* gpu, ShaderUnit* gsh, bool elements, int basevert,
 }
 
 void gpu_draw(GPU* gpu, bool elements, bool immediate) {
-    gpu_gl_draw(gpu, elements, immediate);
+    if (ctremu.swrenderer) gpu_sw_draw(gpu, elements, immediate);
+    else gpu_gl_draw(gpu, elements, immediate);
+}
+
+void gpu_flush_draws(GPU* gpu) {
+    if (ctremu.swrenderer) gpu_sw_flush_draws(gpu);
+    else gpu_gl_flush_draws(gpu);
 }
@@ -9,6 +9,7 @@
 
 #include "gpuregs.h"
 #include "renderer_gl.h"
+#include "renderer_sw.h"
 #include "shader.h"
 #include "shaderdec.h"
 #include "shadergen_fs.h"
@@ -16,7 +17,7 @@
 
 #define MAX_VSH_THREADS 16
 
-typedef union {
+typedef union _Vertex {
     float semantics[24];
     struct {
         fvec4 pos;
@@ -33,6 +34,7 @@ typedef union {
 
 #define FB_MAX 16
 #define TEX_MAX 256
+#define CMDLIST_MAX 64
 
 typedef struct _FBInfo {
     union {
@@ -71,8 +73,24 @@ typedef struct _TexInfo {
     struct _TexInfo *next, *prev;
 
     u32 tex;
+    u32* swpixels; // decoded level 0 for the software renderer
 } TexInfo;
 
+typedef struct {
+    u16 id;
+    bool action;
+    u32 mask;
+    u32 param;
+} GPUCmdOp;
+
+typedef struct _CmdListCacheEntry {
+    u64 key; // size << 32 | paddr
+    u64 hash;
+    Vec(GPUCmdOp) ops;
+
+    struct _CmdListCacheEntry *next, *prev;
+} CmdListCacheEntry;
+
 typedef struct _GPU {
 
 #ifdef FASTMEM
@@ -125,6 +143,7 @@ typedef struct _GPU {
     LRUCache(ShaderJitBlock, VSH_MAX) vshaders_sw;
     LRUCache(VSHCacheEntry, VSH_MAX) vshaders_hw;
     LRUCache(FSHCacheEntry, FSH_MAX) fshaders;
+    LRUCache(CmdListCacheEntry, CMDLIST_MAX) cmdlists;
 
     u64 lastFragUboHash;
 
@@ -144,6 +163,7 @@ typedef struct _GPU {
     } vsh_runner;
 
     GLState gl;
+    SWState sw;
 
     GPURegs regs;
 
@@ -197,6 +217,7 @@ void gpu_vshrunner_destroy(GPU* gpu);
 void gpu_reset_needs_rehesh(GPU* gpu);
 void gpu_run_command_list(GPU* gpu, u32 paddr, u32 size);
 void gpu_invalidate_range(GPU* gpu, u32 paddr, u32 len);
+void gpu_drop_caches(GPU* gpu);
 
 void gpu_display_transfer(GPU* gpu, u32 paddr, int yoff, bool scalex,
                           bool scaley, bool vflip, int screenid);
@@ -204,8 +225,17 @@ void gpu_render_lcd_fb(GPU* gpu, u32 paddr, u32 fmt, int screenid);
 void gpu_texture_copy(GPU* gpu, u32 srcpaddr, u32 dstpaddr, u32 size,
                       u32 srcpitch, u32 srcgap, u32 dstpitch, u32 dstgap);
 void gpu_clear_fb(GPU* gpu, u32 paddr, u32 len, u32 value, u32 datasz);
+void gpu_start_frame(GPU* gpu);
+void gpu_present_screen(GPU* gpu, int screenid);
+bool gpu_poll_readbacks(GPU* gpu, bool wait);
+void gpu_wait_readbacks(GPU* gpu, u32 paddr, u32 size);
+
+void gpu_copy_mem(GPU* gpu, u32 srcpaddr, u32 dstpaddr, u32 size,
+                  u32 srcpitch, u32 srcgap, u32 dstpitch, u32 dstgap);
+void gpu_fill_mem(GPU* gpu, u32 paddr, u32 endPaddr, u32 value, u32 datasz);
 
 void gpu_draw(GPU* gpu, bool elements, bool immediate);
+void gpu_flush_draws(GPU* gpu);
 
 FBInfo* gpu_fbcache_find_within(GPU* gpu, u32 color_paddr);
 TexInfo* gpu_texcache_find_within(GPU* gpu, u32 paddr);
@@ -15,12 +15,25 @@ static inline u64 gpu_hash_texture(void* tex, u32 size) {
     return XXH3_64bits(tex, size);
 }
 
+static inline u64 gpu_hash_cmdlist(void* cmds, u32 size) {
+    return XXH3_64bits(cmds, size);
+}
+
 static inline u64 gpu_hash_sw_shader(ShaderUnit* shu) {
     return XXH3_64bits(shu->code, SHADER_CODE_SIZE * sizeof(PICAInstr));
 }
 
+// bool and int uniforms for specialized shaders
+static inline u64 gpu_hash_sw_shader_uniforms(ShaderUnit* shu) {
+    u8 data[sizeof *shu->i * 4 + sizeof shu->b];
+    memcpy(data, shu->i, sizeof *shu->i * 4);
+    memcpy(data + sizeof *shu->i * 4, &shu->b, sizeof shu->b);
+    return XXH3_64bits(data, sizeof data);
+}
+
 static inline u64 gpu_hash_hw_shader(GPU* gpu) {
     // we need to hash the shader code, entrypoint, outmap_mask, and outmap
+    // and the bool and int uniforms if they are compiled in
     XXH3_state_t* xxst = XXH3_createState();
     XXH3_64bits_reset(xxst);
     XXH3_64bits_update(xxst, gpu->vsh.progdata, sizeof gpu->vsh.progdata);
@@ -30,6 +43,12 @@ static inline u64 gpu_hash_hw_shader(GPU* gpu) {
                        sizeof gpu->regs.vsh.outmap_mask);
     XXH3_64bits_update(xxst, gpu->regs.raster.sh_outmap,
                        sizeof gpu->regs.raster.sh_outmap);
+    if (ctremu.specializeShaders) {
+        u16 b = gpu->regs.vsh.booluniform;
+        XXH3_64bits_update(xxst, gpu->regs.vsh.intuniform,
+                           sizeof gpu->regs.vsh.intuniform);
+        XXH3_64bits_update(xxst, &b, sizeof b);
+    }
     u64 hash = XXH3_64bits_digest(xxst);
     XXH3_freeState(xxst);
     return hash;
@@ -39,6 +58,10 @@ static inline u64 gpu_hash_fs(FragConfig* fcfg) {
     return XXH3_64bits(fcfg, sizeof *fcfg);
 }
 
+static inline u64 gpu_hash_sw_fs(SWFragConfig* cfg) {
+    return XXH3_64bits(cfg, sizeof *cfg);
+}
+
 static inline u64 gpu_hash_fs_data(FragUniforms* fbuf) {
     return XXH3_64bits(fbuf, sizeof *fbuf);
 }
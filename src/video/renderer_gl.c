@@ -28,7 +28,11 @@ const char gpufragsource[] = {
 
 bool g_wireframe;
 
-void renderer_gl_init(GLState* state, GPU* gpu) {
+static void* readback_thrd_func(GPU* gpu);
+
+// the objects used to show the screens in the window, this is all the
+// software renderer needs from gl
+void renderer_gl_init_screens(GLState* state) {
     auto mainvs = glCreateShader(GL_VERTEX_SHADER);
     auto mainfs = glCreateShader(GL_FRAGMENT_SHADER);
     glShaderSource(mainvs, 1, &(const char*) {mainvertsource}, nullptr);
@@ -56,6 +60,47 @@ void renderer_gl_init(GLState* state, GPU* gpu) {
     glBindBuffer(GL_ARRAY_BUFFER, state->main_vbo);
     glBufferData(GL_ARRAY_BUFFER, 0, nullptr, GL_STATIC_DRAW);
 
+    glGenTextures(2, state->screentex);
+    glGenFramebuffers(2, state->screenfbo);
+    GLint filter =
+        ctremu.outputfilter == FILTER_NEAREST ? GL_NEAREST : GL_LINEAR;
+    for (int i = 0; i < 2; i++) {
+        glBindTexture(GL_TEXTURE_2D, state->screentex[i]);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA,
+                     SCREEN_HEIGHT * ctremu.videoscale,
+                     SCREEN_WIDTH(i) * ctremu.videoscale, 0, GL_RGBA,
+                     GL_UNSIGNED_BYTE, nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter);
+        glBindFramebuffer(GL_FRAMEBUFFER, state->screenfbo[i]);
+        glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                             state->screentex[i], 0);
+    }
+
+    glGenTextures(1, &state->swrendertex);
+    glGenFramebuffers(1, &state->swrenderfbo);
+    glBindTexture(GL_TEXTURE_2D, state->swrendertex);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glBindFramebuffer(GL_FRAMEBUFFER, state->swrenderfbo);
+    glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                         state->swrendertex, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void renderer_gl_destroy_screens(GLState* state) {
+    glDeleteProgram(state->main_program);
+    glDeleteVertexArrays(1, &state->main_vao);
+    glDeleteBuffers(1, &state->main_vbo);
+    glDeleteTextures(2, state->screentex);
+    glDeleteFramebuffers(2, state->screenfbo);
+    glDeleteTextures(1, &state->swrendertex);
+    glDeleteFramebuffers(1, &state->swrenderfbo);
+}
+
+void renderer_gl_init(GLState* state, GPU* gpu) {
+    renderer_gl_init_screens(state);
+
     state->gpu_vs = glCreateShader(GL_VERTEX_SHADER);
     glShaderSource(state->gpu_vs, 1, &(const char*) {gpuvertsource}, nullptr);
     glCompileShader(state->gpu_vs);
@@ -115,32 +160,6 @@ void renderer_gl_init(GLState* state, GPU* gpu) {
     glBindVertexArray(state->gpu_vao_hw);
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, state->gpu_ebo);
 
-    glGenTextures(2, state->screentex);
-    glGenFramebuffers(2, state->screenfbo);
-    GLint filter =
-        ctremu.outputfilter == FILTER_NEAREST ? GL_NEAREST : GL_LINEAR;
-    for (int i = 0; i < 2; i++) {
-        glBindTexture(GL_TEXTURE_2D, state->screentex[i]);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA,
-                     SCREEN_HEIGHT * ctremu.videoscale,
-                     SCREEN_WIDTH(i) * ctremu.videoscale, 0, GL_RGBA,
-                     GL_UNSIGNED_BYTE, nullptr);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter);
-        glBindFramebuffer(GL_FRAMEBUFFER, state->screenfbo[i]);
-        glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
-                             state->screentex[i], 0);
-    }
-
-    glGenTextures(1, &state->swrendertex);
-    glGenFramebuffers(1, &state->swrenderfbo);
-    glBindTexture(GL_TEXTURE_2D, state->swrendertex);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glBindFramebuffer(GL_FRAMEBUFFER, state->swrenderfbo);
-    glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
-                         state->swrendertex, 0);
-
     // create a blank texture for when games read textures
     // from invalid memory
     // the actual behavior is impossible to emulate in a hw renderer
@@ -215,10 +234,31 @@ void renderer_gl_init(GLState* state, GPU* gpu) {
                  4 * 512 * ctremu.videoscale * 512 * ctremu.videoscale, nullptr,
                  GL_STATIC_DRAW);
     glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    // framebuffers are scaled down to native resolution here before
+    // being read back
+    glGenTextures(1, &state->readbacktex);
+    glGenFramebuffers(1, &state->readbackfbo);
+    glBindTexture(GL_TEXTURE_2D, state->readbacktex);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, state->readbackfbo);
+    glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                         state->readbacktex, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    for (int i = 0; i < READBACK_MAX; i++) {
+        state->readbacks[i].state = RB_FREE;
+        glGenBuffers(1, &state->readbacks[i].pbo);
+    }
+
+    state->readback_thrd.die = false;
+    pthread_mutex_init(&state->readback_thrd.lock, nullptr);
+    pthread_cond_init(&state->readback_thrd.cond, nullptr);
+    pthread_create(&state->readback_thrd.thread, nullptr,
+                   (void*) readback_thrd_func, gpu);
 }
 
 void renderer_gl_destroy(GLState* state, GPU* gpu) {
-    glDeleteProgram(state->main_program);
+    renderer_gl_destroy_screens(state);
     glDeleteShader(state->gpu_vs);
     glDeleteShader(state->gpu_uberfs);
     for (int i = 0; i < MAX_PROGRAM; i++) {
@@ -230,17 +270,16 @@ void renderer_gl_destroy(GLState* state, GPU* gpu) {
     for (int i = 0; i < FSH_MAX; i++) {
         glDeleteShader(gpu->fshaders.d[i].fs);
     }
-    glDeleteVertexArrays(1, &state->main_vao);
     glDeleteVertexArrays(1, &state->gpu_vao_sw);
     glDeleteVertexArrays(1, &state->gpu_vao_hw);
-    glDeleteBuffers(1, &state->main_vbo);
     glDeleteBuffers(12, state->gpu_vbos);
     glDeleteBuffers(4, state->ubos);
     glDeleteBuffers(1, &state->gpu_ebo);
-    glDeleteTextures(2, state->screentex);
-    glDeleteFramebuffers(2, state->screenfbo);
-    glDeleteTextures(1, &state->swrendertex);
-    glDeleteFramebuffers(1, &state->swrenderfbo);
+    Vec_free(state->batch.vtx);
+    Vec_free(state->batch.idx);
+    Vec_free(state->batch.first);
+    Vec_free(state->batch.count);
+    Vec_free(state->batch.idxoff);
     for (int i = 0; i < FB_MAX; i++) {
         glDeleteFramebuffers(1, &gpu->fbs.d[i].fbo);
         glDeleteTextures(1, &gpu->fbs.d[i].color_tex);
@@ -255,6 +294,21 @@ void renderer_gl_destroy(GLState* state, GPU* gpu) {
     glDeleteTextures(1, &state->proctexmaptex);
     glDeleteTextures(1, &state->proctexnoisetex);
     glDeleteBuffers(1, &state->pbo);
+
+    pthread_mutex_lock(&state->readback_thrd.lock);
+    state->readback_thrd.die = true;
+    pthread_cond_broadcast(&state->readback_thrd.cond);
+    pthread_mutex_unlock(&state->readback_thrd.lock);
+    pthread_join(state->readback_thrd.thread, nullptr);
+    pthread_mutex_destroy(&state->readback_thrd.lock);
+    pthread_cond_destroy(&state->readback_thrd.cond);
+    for (int i = 0; i < READBACK_MAX; i++) {
+        auto rb = &state->readbacks[i];
+        if (rb->state == RB_QUEUED) glDeleteSync(rb->fence);
+        glDeleteBuffers(1, &rb->pbo);
+    }
+    glDeleteTextures(1, &state->readbacktex);
+    glDeleteFramebuffers(1, &state->readbackfbo);
 }
 
 // call before emulating gpu drawing
@@ -296,6 +350,7 @@ void render_gl_main(GLState* state) {
 }
 
 void renderer_gl_update_freecam(GLState* state) {
+    if (ctremu.swrenderer) return;
     glBindBuffer(GL_UNIFORM_BUFFER, state->freecam_ubo);
     if (ctremu.freecam_enable) {
         glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof ctremu.freecam_mtx,
@@ -485,6 +540,17 @@ void gpu_gl_display_transfer(GPU* gpu, u32 paddr, int yoffdst, bool scalex,
     glBindFramebuffer(GL_FRAMEBUFFER, gpu->curfb->fbo);
 }
 
+// gl formats matching the layout of each color format in memory
+static const GLenum colorfmt_glfmt[8] = {
+    GL_RGBA, GL_BGR, GL_RGB, GL_RGBA, GL_RGBA, GL_RGBA, GL_RGBA, GL_RGBA,
+};
+static const GLenum colorfmt_gltype[8] = {
+    GL_UNSIGNED_INT_8_8_8_8,   GL_UNSIGNED_BYTE,
+    GL_UNSIGNED_SHORT_5_6_5,   GL_UNSIGNED_SHORT_5_5_5_1,
+    GL_UNSIGNED_SHORT_4_4_4_4, GL_UNSIGNED_INT_8_8_8_8,
+    GL_UNSIGNED_INT_8_8_8_8,   GL_UNSIGNED_INT_8_8_8_8,
+};
+
 void gpu_gl_render_lcd_fb(GPU* gpu, u32 paddr, u32 fmt, int screenid) {
     linfo("directly rendering lcd fb at %08x to screen %d", paddr, screenid);
 
@@ -493,15 +559,8 @@ void gpu_gl_render_lcd_fb(GPU* gpu, u32 paddr, u32 fmt, int screenid) {
     void* data = PTR(paddr);
 
     int colorfmt = fmt & 7;
-    GLuint glfmt = (GLuint[8]) {
-        GL_RGBA, GL_BGR, GL_RGB, GL_RGBA, GL_RGBA, GL_RGBA, GL_RGBA, GL_RGBA,
-    }[colorfmt];
-    GLuint gltype = (GLuint[8]) {
-        GL_UNSIGNED_INT_8_8_8_8,   GL_UNSIGNED_BYTE,
-        GL_UNSIGNED_SHORT_5_6_5,   GL_UNSIGNED_SHORT_5_5_5_1,
-        GL_UNSIGNED_SHORT_4_4_4_4, GL_UNSIGNED_INT_8_8_8_8,
-        GL_UNSIGNED_INT_8_8_8_8,   GL_UNSIGNED_INT_8_8_8_8,
-    }[colorfmt];
+    GLuint glfmt = colorfmt_glfmt[colorfmt];
+    GLuint gltype = colorfmt_gltype[colorfmt];
 
     glBindTexture(GL_TEXTURE_2D, gpu->gl.swrendertex);
     glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, SCREEN_HEIGHT,
@@ -522,6 +581,192 @@ void gpu_gl_render_lcd_fb(GPU* gpu, u32 paddr, u32 fmt, int screenid) {
     glBindFramebuffer(GL_FRAMEBUFFER, gpu->curfb->fbo);
 }
 
+// shows an image drawn by the software renderer on a screen
+void gpu_gl_present_screen(GPU* gpu, u32* pixels, int screenid) {
+    glBindTexture(GL_TEXTURE_2D, gpu->gl.swrendertex);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, SCREEN_HEIGHT,
+                 SCREEN_WIDTH(screenid), 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+
+    // scissor test and color mask affects blit framebuffer
+    glDisable(GL_SCISSOR_TEST);
+    glColorMask(true, true, true, true);
+
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, gpu->gl.swrenderfbo);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, gpu->gl.screenfbo[screenid]);
+
+    glBlitFramebuffer(0, 0, SCREEN_HEIGHT, SCREEN_WIDTH(screenid), 0, 0,
+                      SCREEN_HEIGHT * ctremu.videoscale,
+                      SCREEN_WIDTH(screenid) * ctremu.videoscale,
+                      GL_COLOR_BUFFER_BIT, GL_NEAREST);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, gpu->curfb->fbo);
+}
+
+static void* readback_thrd_func(GPU* gpu) {
+    auto thrd = &gpu->gl.readback_thrd;
+    pthread_mutex_lock(&thrd->lock);
+    while (true) {
+        FBReadback* rb = nullptr;
+        for (int i = 0; i < READBACK_MAX; i++) {
+            if (gpu->gl.readbacks[i].state == RB_CONVERTING) {
+                rb = &gpu->gl.readbacks[i];
+                break;
+            }
+        }
+        if (!rb) {
+            if (thrd->die) break;
+            pthread_cond_wait(&thrd->cond, &thrd->lock);
+            continue;
+        }
+        pthread_mutex_unlock(&thrd->lock);
+
+        // gl gives us the rows bottom to top and the framebuffer in memory
+        // is tiled the same way as textures
+        u8* dst = PTR(rb->paddr);
+        u8* src = rb->data;
+        for (int y = 0; y < rb->height; y++) {
+            for (int x = 0; x < rb->width; x++) {
+                memcpy(&dst[morton_swizzle(rb->width, x, y) * rb->Bpp],
+                       &src[((rb->height - 1 - y) * rb->width + x) * rb->Bpp],
+                       rb->Bpp);
+            }
+        }
+
+        pthread_mutex_lock(&thrd->lock);
+        rb->state = RB_DONE;
+        pthread_cond_broadcast(&thrd->cond);
+    }
+    pthread_mutex_unlock(&thrd->lock);
+    return nullptr;
+}
+
+// returns whether the readback has finished
+// if wait is set this blocks until it has
+static bool poll_readback(GPU* gpu, FBReadback* rb, bool wait) {
+    auto thrd = &gpu->gl.readback_thrd;
+
+    // only this thread ever sets queued so no need to lock here
+    if (rb->state == RB_QUEUED) {
+        GLenum res;
+        do {
+            res = glClientWaitSync(rb->fence, GL_SYNC_FLUSH_COMMANDS_BIT,
+                                   wait ? 1'000'000'000 : 0);
+        } while (wait && res == GL_TIMEOUT_EXPIRED);
+        if (res == GL_TIMEOUT_EXPIRED) return false;
+        glDeleteSync(rb->fence);
+
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, rb->pbo);
+        rb->data = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0,
+                                    rb->width * rb->height * rb->Bpp,
+                                    GL_MAP_READ_BIT);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+        pthread_mutex_lock(&thrd->lock);
+        rb->state = RB_CONVERTING;
+        pthread_cond_broadcast(&thrd->cond);
+        pthread_mutex_unlock(&thrd->lock);
+    }
+
+    pthread_mutex_lock(&thrd->lock);
+    while (wait && rb->state == RB_CONVERTING) {
+        pthread_cond_wait(&thrd->cond, &thrd->lock);
+    }
+    bool converted = rb->state == RB_DONE;
+    bool done = rb->state != RB_CONVERTING;
+    pthread_mutex_unlock(&thrd->lock);
+
+    if (converted) {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, rb->pbo);
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        rb->state = RB_FREE;
+
+        gpu_invalidate_range(gpu, rb->paddr, rb->width * rb->height * rb->Bpp);
+        gpu_copy_mem(gpu, rb->copy.srcpaddr, rb->copy.dstpaddr, rb->copy.size,
+                     rb->copy.srcpitch, rb->copy.srcgap, rb->copy.dstpitch,
+                     rb->copy.dstgap);
+    }
+    return done;
+}
+
+// returns whether all pending readbacks have finished
+// if wait is set this blocks until they have
+bool gpu_gl_poll_readbacks(GPU* gpu, bool wait) {
+    bool done = true;
+    for (int i = 0; i < READBACK_MAX; i++) {
+        if (!poll_readback(gpu, &gpu->gl.readbacks[i], wait)) done = false;
+    }
+    return done;
+}
+
+// a readback writes the framebuffer and then the destination of its copy
+static bool readback_overlaps(FBReadback* rb, u32 paddr, u32 size) {
+    u32 fbend = rb->paddr + rb->width * rb->height * rb->Bpp;
+    if (paddr < fbend && rb->paddr < paddr + size) return true;
+    u32 dstend = rb->copy.dstpaddr + rb->copy.size +
+                 (rb->copy.size / rb->copy.dstpitch + 1) * rb->copy.dstgap;
+    return paddr < dstend && rb->copy.dstpaddr < paddr + size;
+}
+
+// finishes the readbacks touching the given range, the others keep going
+void gpu_gl_wait_readbacks(GPU* gpu, u32 paddr, u32 size) {
+    for (int i = 0; i < READBACK_MAX; i++) {
+        auto rb = &gpu->gl.readbacks[i];
+        if (rb->state == RB_FREE) continue;
+        poll_readback(gpu, rb, readback_overlaps(rb, paddr, size));
+    }
+}
+
+// starts reading back the color buffer of fb into its location in memory
+static FBReadback* readback_fb(GPU* gpu, FBInfo* fb) {
+    FBReadback* rb = nullptr;
+    for (int i = 0; i < READBACK_MAX; i++) {
+        if (gpu->gl.readbacks[i].state == RB_FREE) {
+            rb = &gpu->gl.readbacks[i];
+            break;
+        }
+    }
+    if (!rb) {
+        gpu_gl_poll_readbacks(gpu, true);
+        rb = &gpu->gl.readbacks[0];
+    }
+
+    rb->paddr = fb->color_paddr;
+    rb->width = fb->width;
+    rb->height = fb->height;
+    rb->Bpp = fb->color_Bpp;
+
+    // scissor test and color mask affects blit framebuffer
+    glDisable(GL_SCISSOR_TEST);
+    glColorMask(true, true, true, true);
+
+    glBindTexture(GL_TEXTURE_2D, gpu->gl.readbacktex);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, fb->width, fb->height, 0, GL_RGBA,
+                 GL_UNSIGNED_BYTE, nullptr);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, fb->fbo);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, gpu->gl.readbackfbo);
+    glBlitFramebuffer(0, 0, fb->width * ctremu.videoscale,
+                      fb->height * ctremu.videoscale, 0, 0, fb->width,
+                      fb->height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, gpu->gl.readbackfbo);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, rb->pbo);
+    glBufferData(GL_PIXEL_PACK_BUFFER, fb->width * fb->height * fb->color_Bpp,
+                 nullptr, GL_STREAM_READ);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, fb->width, fb->height, colorfmt_glfmt[fb->color_fmt],
+                 colorfmt_gltype[fb->color_fmt], nullptr);
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    rb->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    rb->state = RB_QUEUED;
+
+    // make sure this gets rebound before next draw
+    glBindFramebuffer(GL_FRAMEBUFFER, gpu->curfb->fbo);
+
+    return rb;
+}
+
 void gpu_gl_texture_copy(GPU* gpu, u32 srcpaddr, u32 dstpaddr, u32 size,
                          u32 srcpitch, u32 srcgap, u32 dstpitch, u32 dstgap) {
 
@@ -565,44 +810,22 @@ void gpu_gl_texture_copy(GPU* gpu, u32 srcpaddr, u32 dstpaddr, u32 size,
     }
 
     if (srcfb) {
-        lwarnonce("reading back fb into memory");
-        // this case requires us to read the framebuffer back to ram
-        // it is very slow
+        linfo("reading back fb at %x into memory", srcfb->color_paddr);
+        // the framebuffer needs to be in memory before the copy can be done
+        // so the copy is finished when the readback completes
+        auto rb = readback_fb(gpu, srcfb);
+        rb->copy.srcpaddr = srcpaddr;
+        rb->copy.dstpaddr = dstpaddr;
+        rb->copy.size = size;
+        rb->copy.srcpitch = srcpitch;
+        rb->copy.srcgap = srcgap;
+        rb->copy.dstpitch = dstpitch;
+        rb->copy.dstgap = dstgap;
         return;
     }
 
-    u8* src = PTR(srcpaddr);
-    u8* dst = PTR(dstpaddr);
-
-    int cnt = 0;
-    int curline = 0;
-    if (srcpitch <= dstpitch) {
-        while (cnt < size) {
-            memcpy(dst, src, srcpitch);
-            cnt += srcpitch;
-            curline += srcpitch;
-            src += srcpitch + srcgap;
-            dst += srcpitch;
-            if (curline >= dstpitch) {
-                dst += dstgap;
-                curline = 0;
-            }
-        }
-    } else {
-        while (cnt < size) {
-            memcpy(dst, src, dstpitch);
-            cnt += dstpitch;
-            curline += dstpitch;
-            dst += dstpitch + dstgap;
-            src += dstpitch;
-            if (curline >= srcpitch) {
-                src += srcgap;
-                curline = 0;
-            }
-        }
-    }
-
-    gpu_invalidate_range(gpu, dstpaddr, size);
+    gpu_copy_mem(gpu, srcpaddr, dstpaddr, size, srcpitch, srcgap, dstpitch,
+                 dstgap);
 }
 
 void gpu_gl_clear_fb(GPU* gpu, u32 paddr, u32 endPaddr, u32 value, u32 datasz) {
@@ -681,34 +904,7 @@ void gpu_gl_clear_fb(GPU* gpu, u32 paddr, u32 endPaddr, u32 value, u32 datasz) {
 
     // fallback to sw memfill if no fbs were filled
 
-    linfo("sw memfill at %x to %x value %x datasz %d", paddr, endPaddr, value,
-          datasz);
-
-    void* cur = PTR(paddr);
-    void* end = PTR(paddr) + endPaddr - paddr;
-    switch (datasz) {
-        case 2:
-            while (cur < end) {
-                *(u16*) cur = value;
-                cur += 2;
-            }
-            break;
-        case 3:
-            while (cur < end) {
-                *(u16*) cur = value;
-                *(u8*) (cur + 2) = value >> 16;
-                cur += 3;
-            }
-            break;
-        case 4:
-            while (cur < end) {
-                *(u32*) cur = value;
-                cur += 4;
-            }
-            break;
-    }
-
-    gpu_invalidate_range(gpu, paddr, endPaddr - paddr);
+    gpu_fill_mem(gpu, paddr, endPaddr, value, datasz);
 }
 
 #define LOAD_TEX(t, glfmt, gltype)                                             \
@@ -1210,16 +1406,9 @@ static const GLenum prim_mode[4] = {
 
 static const GLuint indextypes[2] = {GL_UNSIGNED_BYTE, GL_UNSIGNED_SHORT};
 
-void gpu_gl_draw(GPU* gpu, bool elements, bool immediate) {
-    int nattrs = gpu->regs.geom.vsh_num_attr + 1;
-    int nverts =
-        immediate ? gpu->immattrs.size / nattrs : gpu->regs.geom.nverts;
-    int primMode = gpu->regs.geom.prim_config.mode;
-
-    linfo("drawing %s %s nverts=%d, prim mode=%d",
-          elements ? "elements" : "arrays", immediate ? "immediate mode" : "",
-          nverts, primMode);
-
+// sets up all the gl state for a draw except for the vertex data
+// this is shared by every draw in a batch
+static void setup_draw_state(GPU* gpu, bool swshaders) {
     update_cur_fb(gpu);
 
     // ensure unused entries are 0 so the hashing is consistent
@@ -1490,7 +1679,6 @@ void gpu_gl_draw(GPU* gpu, bool elements, bool immediate) {
     }
 
     // vertex shaders
-    bool swshaders = !ctremu.hwvshaders || gpu->regs.geom.config.use_gsh;
     GLuint vs;
     if (swshaders) {
         vs = gpu->gl.gpu_vs;
@@ -1577,6 +1765,104 @@ void gpu_gl_draw(GPU* gpu, bool elements, bool immediate) {
     glUniform1f(glGetUniformLocation(prog, "depthOffset"), dmOffset);
     glUniform1f(glGetUniformLocation(prog, "depthScale"), dmScale);
     glUniform1i(glGetUniformLocation(prog, "depthWBuffer"), wbuffer);
+}
+
+// a draw that samples from the framebuffer it renders to needs the
+// framebuffer copied into the texture before each draw
+static bool reads_cur_fb(GPU* gpu) {
+    TexUnitRegs* units[3] = {&gpu->regs.tex.tex0, &gpu->regs.tex.tex1,
+                             &gpu->regs.tex.tex2};
+    for (int i = 0; i < 3; i++) {
+        if (!(gpu->regs.tex.config.raw & BIT(i))) continue;
+        u32 paddr = units[i]->addr << 3;
+        if (paddr == gpu->curfb->color_paddr ||
+            paddr == gpu->curfb->depth_paddr)
+            return true;
+    }
+    return false;
+}
+
+// the register writes that would change the state of the open batch
+// already flushed it (see gpu_write_internalreg) so we only need to check
+// what is decided per draw
+static bool can_batch_draw(GPU* gpu, bool swshaders, bool elements,
+                           bool immediate) {
+    auto b = &gpu->gl.batch;
+    if (!b->active || b->noappend) return false;
+    if (b->sw != swshaders || b->elements != elements) return false;
+    if (elements && b->indexsize != gpu->regs.geom.indexfmt) return false;
+    // hw immediate mode vertices are uploaded directly
+    if (!swshaders && immediate) return false;
+    return b->count.size < DRAWBATCH_MAX;
+}
+
+void gpu_gl_flush_draws(GPU* gpu) {
+    auto b = &gpu->gl.batch;
+    if (!b->active) return;
+    b->active = false;
+    if (!b->count.size) return;
+
+    linfo("submitting batch of %zu draws", b->count.size);
+
+    if (b->sw) {
+        glBindBuffer(GL_ARRAY_BUFFER, gpu->gl.gpu_vbos[0]);
+        glBufferData(GL_ARRAY_BUFFER, b->vtx.size * sizeof(Vertex), b->vtx.d,
+                     GL_STREAM_DRAW);
+    } else {
+        // upload the range of vertices used by any draw in the batch
+        // and make the draws relative to the start of it
+        setup_hw_vao(gpu, b->minvtx, b->maxvtx + 1 - b->minvtx);
+        Vec_foreach(f, b->first) {
+            *f -= b->minvtx;
+        }
+    }
+
+    if (b->elements) {
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, b->idx.size, b->idx.d,
+                     GL_STREAM_DRAW);
+        glMultiDrawElementsBaseVertex(
+            prim_mode[b->primMode], b->count.d, indextypes[b->indexsize],
+            (const void* const*) b->idxoff.d, b->count.size, b->first.d);
+    } else {
+        glMultiDrawArrays(prim_mode[b->primMode], b->first.d, b->count.d,
+                          b->count.size);
+    }
+
+    b->vtx.size = 0;
+    b->idx.size = 0;
+    b->first.size = 0;
+    b->count.size = 0;
+    b->idxoff.size = 0;
+}
+
+void gpu_gl_draw(GPU* gpu, bool elements, bool immediate) {
+    int nattrs = gpu->regs.geom.vsh_num_attr + 1;
+    int nverts =
+        immediate ? gpu->immattrs.size / nattrs : gpu->regs.geom.nverts;
+    int primMode = gpu->regs.geom.prim_config.mode;
+
+    linfo("drawing %s %s nverts=%d, prim mode=%d",
+          elements ? "elements" : "arrays", immediate ? "immediate mode" : "",
+          nverts, primMode);
+
+    bool swshaders = !ctremu.hwvshaders || gpu->regs.geom.config.use_gsh;
+    // geometry shader output is never indexed
+    bool outelements = elements && !gpu->regs.geom.config.use_gsh;
+
+    auto b = &gpu->gl.batch;
+    if (!can_batch_draw(gpu, swshaders, outelements, immediate)) {
+        gpu_gl_flush_draws(gpu);
+        setup_draw_state(gpu, swshaders);
+
+        b->active = true;
+        b->sw = swshaders;
+        b->elements = outelements;
+        b->indexsize = gpu->regs.geom.indexfmt;
+        b->primMode = primMode;
+        b->noappend = reads_cur_fb(gpu);
+        b->minvtx = INT32_MAX;
+        b->maxvtx = 0;
+    }
 
     // starting  index
     int basevert = immediate ? 0 : gpu->regs.geom.vtx_off;
@@ -1584,7 +1870,7 @@ void gpu_gl_draw(GPU* gpu, bool elements, bool immediate) {
     // drawelements)
     int nbufverts = nverts;
 
-    // setup index buffer and find min/max index
+    // find min/max index and queue the index data
     void* indexbuf = nullptr;
     bool indexsize = gpu->regs.geom.indexfmt;
     if (elements) {
@@ -1601,12 +1887,19 @@ void gpu_gl_draw(GPU* gpu, bool elements, bool immediate) {
             if (idx < minind) minind = idx;
             if (idx > maxind) maxind = idx;
         }
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, nverts * BIT(indexsize), indexbuf,
-                     GL_STREAM_DRAW);
         // update these since we are drawing elements
         basevert = minind;
         nbufverts = maxind + 1 - minind;
     }
+    if (outelements) {
+        // keep the index data aligned for the index type
+        b->idx.size = (b->idx.size + 1) & ~1;
+        if (b->idx.cap < b->idx.size + nverts * BIT(indexsize))
+            Vec_resize(b->idx, 2 * (b->idx.size + nverts * BIT(indexsize)));
+        Vec_push(b->idxoff, (void*) b->idx.size);
+        memcpy(&b->idx.d[b->idx.size], indexbuf, nverts * BIT(indexsize));
+        b->idx.size += nverts * BIT(indexsize);
+    }
 
     if (swshaders) {
         fvec4 vshout[nbufverts][16];
@@ -1629,34 +1922,37 @@ void gpu_gl_draw(GPU* gpu, bool elements, bool immediate) {
             basevert = 0;
             nverts = gsh.gsh.outvtx.size;
             nbufverts = nverts;
-            elements = false;
         }
 
-        // use the outmap config to setup the final vertex buffer sent to gpu
+        // use the outmap config to append to the vertex buffer sent to gpu
         // for the fragment shader
-        Vertex vbuf[nbufverts];
+        size_t vtxbase = b->vtx.size;
+        if (b->vtx.cap < vtxbase + nbufverts)
+            Vec_resize(b->vtx, 2 * (vtxbase + nbufverts));
         for (int i = 0; i < nbufverts; i++) {
-            gpu_write_outmap_vtx(gpu, &vbuf[i], fshin[i]);
+            gpu_write_outmap_vtx(gpu, &b->vtx.d[b->vtx.size++], fshin[i]);
         }
         Vec_free(gsh.gsh.outvtx);
 
-        glBufferData(GL_ARRAY_BUFFER, sizeof vbuf, vbuf, GL_STREAM_DRAW);
+        // for elements this is the base vertex, otherwise the first vertex
+        Vec_push(b->first, vtxbase - (outelements ? basevert : 0));
+        Vec_push(b->count, nverts);
+    } else if (immediate) {
+        // the immediate mode vertices are gone after this draw so it
+        // is done right away
+        setup_hw_vao_imm(gpu);
+        glDrawArrays(prim_mode[primMode], 0, nverts);
+        b->active = false;
     } else {
-        if (immediate) {
-            setup_hw_vao_imm(gpu);
-        } else {
-            setup_hw_vao(gpu, basevert, nbufverts);
-        }
+        if (basevert < b->minvtx) b->minvtx = basevert;
+        if (basevert + nbufverts - 1 > b->maxvtx)
+            b->maxvtx = basevert + nbufverts - 1;
+        // indices are absolute vertex numbers so the base vertex is only
+        // adjusted for the uploaded range on flush
+        Vec_push(b->first, outelements ? 0 : basevert);
+        Vec_push(b->count, nverts);
     }
     Vec_free(gpu->immattrs);
 
-    // finally do the draw call
-    if (elements) {
-        glDrawElementsBaseVertex(prim_mode[primMode], nverts,
-                                 indextypes[indexsize], 0, -basevert);
-    } else {
-        glDrawArrays(prim_mode[primMode], 0, nverts);
-    }
-
     gpu->curfb->dirty = true;
 }
@@ -2,12 +2,37 @@
 #define RENDERER_GL_H
 
 #include <glad/glad.h>
+#include <pthread.h>
 
 #include "common.h"
 
 #define MAX_PROGRAM 1024
 
 typedef struct _GPU GPU;
+typedef union _Vertex Vertex;
+
+// consecutive draws that only differ in their vertex data are queued
+// and submitted with one multi draw call
+#define DRAWBATCH_MAX 256
+
+typedef struct {
+    bool active;
+    bool noappend;
+    bool sw;
+    bool elements;
+    bool indexsize;
+    int primMode;
+
+    Vec(Vertex) vtx;
+    Vec(u8) idx;
+
+    Vec(GLint) first; // first vertex for arrays, base vertex for elements
+    Vec(GLsizei) count;
+    Vec(void*) idxoff;
+
+    // range of vertices to upload for hw vertex shaders
+    int minvtx, maxvtx;
+} DrawBatch;
 
 typedef struct _ProgCacheEntry {
     union {
@@ -22,6 +47,30 @@ typedef struct _ProgCacheEntry {
     struct _ProgCacheEntry *next, *prev;
 } ProgCacheEntry;
 
+#define READBACK_MAX 4
+
+// framebuffer contents being read back into memory
+// the pbo is filled asynchronously and once the fence is signaled it is
+// mapped and swizzled into memory on the readback thread
+typedef struct {
+    enum { RB_FREE, RB_QUEUED, RB_CONVERTING, RB_DONE } state;
+
+    GLuint pbo;
+    GLsync fence;
+    void* data;
+
+    u32 paddr;
+    u32 width, height;
+    u32 Bpp;
+
+    // the texture copy that needed the readback is done once the
+    // framebuffer is in memory
+    struct {
+        u32 srcpaddr, dstpaddr, size;
+        u32 srcpitch, srcgap, dstpitch, dstgap;
+    } copy;
+} FBReadback;
+
 typedef struct {
     GLuint main_vao;
     GLuint main_vbo;
@@ -37,6 +86,8 @@ typedef struct {
 
     LRUCache(ProgCacheEntry, MAX_PROGRAM) progcache;
 
+    DrawBatch batch;
+
     GLuint screentex[2];
     GLuint screenfbo[2];
 
@@ -47,6 +98,16 @@ typedef struct {
 
     GLuint pbo;
 
+    GLuint readbacktex;
+    GLuint readbackfbo;
+    FBReadback readbacks[READBACK_MAX];
+    struct {
+        pthread_t thread;
+        pthread_mutex_t lock;
+        pthread_cond_t cond;
+        bool die;
+    } readback_thrd;
+
     GLuint lightluttex;
     GLuint fogluttex;
     GLuint proctexmaptex;
@@ -66,6 +127,8 @@ typedef struct {
 
 extern bool g_wireframe;
 
+void renderer_gl_init_screens(GLState* state);
+void renderer_gl_destroy_screens(GLState* state);
 void renderer_gl_init(GLState* state, GPU* gpu);
 void renderer_gl_destroy(GLState* state, GPU* gpu);
 
@@ -76,10 +139,14 @@ void renderer_gl_update_freecam(GLState* state);
 void gpu_gl_display_transfer(GPU* gpu, u32 paddr, int yoff, bool scalex,
                           bool scaley, bool vflip, int screenid);
 void gpu_gl_render_lcd_fb(GPU* gpu, u32 paddr, u32 fmt, int screenid);
+void gpu_gl_present_screen(GPU* gpu, u32* pixels, int screenid);
 void gpu_gl_texture_copy(GPU* gpu, u32 srcpaddr, u32 dstpaddr, u32 size,
                       u32 srcpitch, u32 srcgap, u32 dstpitch, u32 dstgap);
 void gpu_gl_clear_fb(GPU* gpu, u32 paddr, u32 len, u32 value, u32 datasz);
+bool gpu_gl_poll_readbacks(GPU* gpu, bool wait);
+void gpu_gl_wait_readbacks(GPU* gpu, u32 paddr, u32 size);
 
 void gpu_gl_draw(GPU* gpu, bool elements, bool immediate);
+void gpu_gl_flush_draws(GPU* gpu);
 
 #endif
@@ -0,0 +1,1986 @@
+#include "renderer_sw.h"
+
+#include <math.h>
+
+#include "3ds.h"
+#include "emulator.h"
+
+#include "etc1.h"
+#include "gpu.h"
+#include "gpu_hash.h"
+
+#include "gpuptr.inc"
+
+// the software renderer draws directly into the framebuffers in emulated
+// memory, so unlike the gl renderer nothing has to be read back and
+// display transfers/texture copies just work on memory
+// draws are queued with a snapshot of the state they need and binned into
+// tiles, then on flush the tiles are rasterized in parallel, each tile being
+// owned by one thread so triangles stay in submission order within it
+
+enum {
+    ATTR_COLOR = 0,
+    ATTR_TC0 = 4,
+    ATTR_TC1 = 6,
+    ATTR_TC2 = 8,
+    ATTR_TCW = 10,
+    ATTR_NORMAL = 11,
+    ATTR_VIEW = 14,
+    ATTR_TANGENT = 17,
+};
+
+// the spotlight and distance attenuation luts of each light
+#define LUT_SP_BASE 8
+#define LUT_DA_BASE 16
+
+// triangles are clipped against w > 0 in clip space
+#define CLIP_EPS 1e-5f
+
+#define SWAP(a, b)                                                             \
+    ({                                                                         \
+        auto _t = a;                                                           \
+        a = b;                                                                 \
+        b = _t;                                                                \
+    })
+
+typedef struct {
+    fvec4 pos;
+    float attr[SW_NATTR];
+} ClipVertex;
+
+// parameters for transforming and binning the triangles of a draw
+typedef struct {
+    float vx, vy, vw, vh;
+    float dscale, doffset;
+    bool wbuffer;
+    int cullmode;
+    int xmin, ymin, xmax, ymax;
+    u32 state;
+} SetupParams;
+
+static const int colorfmt_bpp[8] = {4, 3, 2, 2, 2, 4, 4, 4};
+static const int depthfmt_bpp[4] = {2, 2, 3, 4};
+
+static const int texfmtbpp[16] = {
+    32, 24, 16, 16, 16, 16, 16, 8, 8, 8, 4, 4, 4, 8, 0, 0,
+};
+
+#define TEXSIZE(w, h, fmt, level)                                              \
+    (((w) >> (level)) * ((h) >> (level)) * texfmtbpp[fmt] / 8)
+
+static void* rast_thrd_func(GPU* gpu);
+
+void renderer_sw_init(SWState* state, GPU* gpu) {
+    Vec_init(state->states);
+    Vec_init(state->tris);
+    for (int i = 0; i < countof(state->bins); i++) {
+        Vec_init(state->bins[i]);
+    }
+    Vec_init(state->vtx);
+    LRU_init(state->shaders);
+
+    for (int i = 0; i < 2; i++) {
+        state->screens[i] =
+            calloc(SCREEN_HEIGHT * SCREEN_WIDTH(i), sizeof(u32));
+    }
+
+    pthread_mutex_init(&state->runner.lock, nullptr);
+    pthread_cond_init(&state->runner.start, nullptr);
+    pthread_cond_init(&state->runner.done, nullptr);
+    state->runner.gen = 0;
+    state->runner.die = false;
+    state->runner.nthreads = ctremu.swrenderthreads;
+    for (int i = 0; i < state->runner.nthreads; i++) {
+        pthread_create(&state->runner.threads[i], nullptr,
+                       (void*) rast_thrd_func, gpu);
+    }
+}
+
+void renderer_sw_destroy(SWState* state, GPU* gpu) {
+    pthread_mutex_lock(&state->runner.lock);
+    state->runner.die = true;
+    pthread_cond_broadcast(&state->runner.start);
+    pthread_mutex_unlock(&state->runner.lock);
+    for (int i = 0; i < state->runner.nthreads; i++) {
+        pthread_join(state->runner.threads[i], nullptr);
+    }
+    pthread_mutex_destroy(&state->runner.lock);
+    pthread_cond_destroy(&state->runner.start);
+    pthread_cond_destroy(&state->runner.done);
+
+    Vec_free(state->states);
+    Vec_free(state->tris);
+    for (int i = 0; i < countof(state->bins); i++) {
+        Vec_free(state->bins[i]);
+    }
+    Vec_free(state->vtx);
+    free(state->screens[0]);
+    free(state->screens[1]);
+
+    for (int i = 0; i < TEX_MAX; i++) {
+        free(gpu->textures.d[i].swpixels);
+        gpu->textures.d[i].swpixels = nullptr;
+    }
+}
+
+static inline v4f splat(float f) {
+    return (v4f) {f, f, f, f};
+}
+
+static inline v4f vmin(v4f a, v4f b) {
+    v4i m = a < b;
+    return (v4f) ((m & (v4i) a) | (~m & (v4i) b));
+}
+
+static inline v4f vmax(v4f a, v4f b) {
+    v4i m = a > b;
+    return (v4f) ((m & (v4i) a) | (~m & (v4i) b));
+}
+
+static inline v4f vclamp(v4f a) {
+    return vmin(vmax(a, splat(0)), splat(1));
+}
+
+static inline float clampf(float f) {
+    return f < 0 ? 0 : f > 1 ? 1 : f;
+}
+
+// rgba8 is kept with r in the low byte
+static inline v4f unpack_rgba(u32 c) {
+    return (v4f) {c & 0xff, c >> 8 & 0xff, c >> 16 & 0xff, c >> 24} *
+           (1 / 255.f);
+}
+
+static inline u32 pack_rgba(v4f c) {
+    c = c * 255.f + 0.5f;
+    return (u32) c[0] | (u32) c[1] << 8 | (u32) c[2] << 16 |
+           (u32) c[3] << 24;
+}
+
+#define RGBA(r, g, b, a) ((r) | (g) << 8 | (b) << 16 | (u32) (a) << 24)
+
+#define EXPAND5(v) ((v) << 3 | (v) >> 2)
+#define EXPAND6(v) ((v) << 2 | (v) >> 4)
+#define EXPAND4(v) ((v) * 0x11)
+
+// unpacks a pixel of a color buffer format into rgba8
+static inline u32 read_color(u8* p, int fmt) {
+    switch (fmt) {
+        case 0: {
+            u32 v = *(u32*) p;
+            return RGBA(v >> 24, v >> 16 & 0xff, v >> 8 & 0xff, v & 0xff);
+        }
+        case 1:
+            return RGBA(p[2], p[1], p[0], 0xff);
+        case 2: {
+            u16 v = *(u16*) p;
+            return RGBA(EXPAND5(v >> 11), EXPAND6(v >> 5 & 0x3f),
+                        EXPAND5(v & 0x1f), 0xff);
+        }
+        case 3: {
+            u16 v = *(u16*) p;
+            return RGBA(EXPAND5(v >> 11), EXPAND5(v >> 6 & 0x1f),
+                        EXPAND5(v >> 1 & 0x1f), (v & 1) * 0xff);
+        }
+        case 4: {
+            u16 v = *(u16*) p;
+            return RGBA(EXPAND4(v >> 12), EXPAND4(v >> 8 & 0xf),
+                        EXPAND4(v >> 4 & 0xf), EXPAND4(v & 0xf));
+        }
+        default:
+            return 0;
+    }
+}
+
+static inline void write_color(u8* p, int fmt, u32 c) {
+    u32 r = c & 0xff;
+    u32 g = c >> 8 & 0xff;
+    u32 b = c >> 16 & 0xff;
+    u32 a = c >> 24;
+    switch (fmt) {
+        case 0:
+            *(u32*) p = r << 24 | g << 16 | b << 8 | a;
+            break;
+        case 1:
+            p[0] = b;
+            p[1] = g;
+            p[2] = r;
+            break;
+        case 2:
+            *(u16*) p = (r >> 3) << 11 | (g >> 2) << 5 | b >> 3;
+            break;
+        case 3:
+            *(u16*) p = (r >> 3) << 11 | (g >> 3) << 6 | (b >> 3) << 1 | a >> 7;
+            break;
+        case 4:
+            *(u16*) p = (r >> 4) << 12 | (g >> 4) << 8 | (b >> 4) << 4 | a >> 4;
+            break;
+    }
+}
+
+// depth is in the low 24 bits and stencil in the high 8 bits
+static inline u32 read_depth(u8* p, int fmt) {
+    switch (fmt) {
+        case 2:
+            return p[0] | p[1] << 8 | p[2] << 16;
+        case 3:
+            return *(u32*) p;
+        default:
+            return *(u16*) p;
+    }
+}
+
+static inline void write_depth(u8* p, int fmt, u32 v) {
+    switch (fmt) {
+        case 2:
+            p[0] = v;
+            p[1] = v >> 8;
+            p[2] = v >> 16;
+            break;
+        case 3:
+            *(u32*) p = v;
+            break;
+        default:
+            *(u16*) p = v;
+            break;
+    }
+}
+
+static inline bool compare(int func, u32 a, u32 b) {
+    switch (func) {
+        case 0:
+            return false;
+        case 1:
+            return true;
+        case 2:
+            return a == b;
+        case 3:
+            return a != b;
+        case 4:
+            return a < b;
+        case 5:
+            return a <= b;
+        case 6:
+            return a > b;
+        case 7:
+            return a >= b;
+    }
+    unreachable();
+}
+
+static inline u8 stencil_op(int op, u8 s, u8 ref) {
+    switch (op) {
+        case 0:
+            return s;
+        case 1:
+            return 0;
+        case 2:
+            return ref;
+        case 3:
+            return s == 0xff ? s : s + 1;
+        case 4:
+            return s == 0 ? s : s - 1;
+        case 5:
+            return ~s;
+        case 6:
+            return s + 1;
+        case 7:
+            return s - 1;
+    }
+    unreachable();
+}
+
+static inline u32 logic_op(int op, u32 s, u32 d) {
+    switch (op) {
+        case 0:
+            return 0;
+        case 1:
+            return s & d;
+        case 2:
+            return s & ~d;
+        case 3:
+            return s;
+        case 4:
+            return ~0;
+        case 5:
+            return ~s;
+        case 6:
+            return d;
+        case 7:
+            return ~d;
+        case 8:
+            return ~(s & d);
+        case 9:
+            return s | d;
+        case 10:
+            return ~(s | d);
+        case 11:
+            return s ^ d;
+        case 12:
+            return ~(s ^ d);
+        case 13:
+            return ~s & d;
+        case 14:
+            return s | ~d;
+        case 15:
+            return ~s | d;
+    }
+    unreachable();
+}
+
+// -1 for the border color
+static inline int wrap_coord(int c, int size, int mode) {
+    switch (mode) {
+        case 0:
+            return c < 0 ? 0 : c >= size ? size - 1 : c;
+        case 1:
+            return c < 0 || c >= size ? -1 : c;
+        case 2:
+            c %= size;
+            return c < 0 ? c + size : c;
+        case 3: {
+            c %= 2 * size;
+            if (c < 0) c += 2 * size;
+            return c < size ? c : 2 * size - 1 - c;
+        }
+    }
+    unreachable();
+}
+
+static inline v4f fetch_texel(SWTexUnit* u, int x, int y) {
+    x = wrap_coord(x, u->width, u->wrap_s);
+    y = wrap_coord(y, u->height, u->wrap_t);
+    if (x < 0 || y < 0) return unpack_rgba(u->border);
+    return unpack_rgba(u->pixels[y * u->width + x]);
+}
+
+static v4f sample_tex(SWTexUnit* u, float s, float t) {
+    if (!u->pixels) return splat(0);
+    if (u->linear) {
+        float fx = s * u->width - 0.5f;
+        float fy = t * u->height - 0.5f;
+        float x0 = floorf(fx);
+        float y0 = floorf(fy);
+        float ax = fx - x0;
+        float ay = fy - y0;
+        v4f c00 = fetch_texel(u, x0, y0);
+        v4f c10 = fetch_texel(u, x0 + 1, y0);
+        v4f c01 = fetch_texel(u, x0, y0 + 1);
+        v4f c11 = fetch_texel(u, x0 + 1, y0 + 1);
+        v4f c0 = c00 + (c10 - c00) * ax;
+        v4f c1 = c01 + (c11 - c01) * ax;
+        return c0 + (c1 - c0) * ay;
+    } else {
+        return fetch_texel(u, floorf(s * u->width), floorf(t * u->height));
+    }
+}
+
+// tev operands and combiners, the ones a stage uses are picked when the
+// pipeline is compiled
+static v4f oprgb_src(v4f s) {
+    return s;
+}
+
+static v4f oprgb_inv(v4f s) {
+    return 1.f - s;
+}
+
+static v4f oprgb_a(v4f s) {
+    return splat(s[3]);
+}
+
+static v4f oprgb_inva(v4f s) {
+    return 1.f - splat(s[3]);
+}
+
+static v4f oprgb_r(v4f s) {
+    return splat(s[0]);
+}
+
+static v4f oprgb_invr(v4f s) {
+    return 1.f - splat(s[0]);
+}
+
+static v4f oprgb_g(v4f s) {
+    return splat(s[1]);
+}
+
+static v4f oprgb_invg(v4f s) {
+    return 1.f - splat(s[1]);
+}
+
+static v4f oprgb_b(v4f s) {
+    return splat(s[2]);
+}
+
+static v4f oprgb_invb(v4f s) {
+    return 1.f - splat(s[2]);
+}
+
+// the unused operands act like 0
+static const SWOperandRgb tev_operands_rgb[16] = {
+    oprgb_src, oprgb_inv,  oprgb_a,   oprgb_inva, oprgb_r,   oprgb_invr,
+    oprgb_src, oprgb_src,  oprgb_g,   oprgb_invg, oprgb_src, oprgb_src,
+    oprgb_b,   oprgb_invb, oprgb_src, oprgb_src,
+};
+
+static float opa_a(v4f s) {
+    return s[3];
+}
+
+static float opa_inva(v4f s) {
+    return 1 - s[3];
+}
+
+static float opa_r(v4f s) {
+    return s[0];
+}
+
+static float opa_invr(v4f s) {
+    return 1 - s[0];
+}
+
+static float opa_g(v4f s) {
+    return s[1];
+}
+
+static float opa_invg(v4f s) {
+    return 1 - s[1];
+}
+
+static float opa_b(v4f s) {
+    return s[2];
+}
+
+static float opa_invb(v4f s) {
+    return 1 - s[2];
+}
+
+static const SWOperandA tev_operands_a[16] = {
+    opa_a, opa_inva, opa_r, opa_invr, opa_g, opa_invg, opa_b, opa_invb,
+    opa_a, opa_a,    opa_a, opa_a,    opa_a, opa_a,    opa_a, opa_a,
+};
+
+static v4f comb_replace(v4f a, v4f, v4f) {
+    return a;
+}
+
+static v4f comb_modulate(v4f a, v4f b, v4f) {
+    return a * b;
+}
+
+static v4f comb_add(v4f a, v4f b, v4f) {
+    return vmin(a + b, splat(1));
+}
+
+static v4f comb_addsigned(v4f a, v4f b, v4f) {
+    return vclamp(a + b - 0.5f);
+}
+
+static v4f comb_interpolate(v4f a, v4f b, v4f c) {
+    return a * c + b * (1.f - c);
+}
+
+static v4f comb_subtract(v4f a, v4f b, v4f) {
+    return vmax(a - b, splat(0));
+}
+
+static v4f comb_dot3(v4f a, v4f b, v4f) {
+    v4f d = (a - 0.5f) * (b - 0.5f);
+    float dot = 4 * (d[0] + d[1] + d[2]);
+    return splat(dot < 0 ? 0 : dot);
+}
+
+static v4f comb_muladd(v4f a, v4f b, v4f c) {
+    return vmin(a * b + c, splat(1));
+}
+
+static v4f comb_addmul(v4f a, v4f b, v4f c) {
+    return vmin(a + b, splat(1)) * c;
+}
+
+static const SWCombineRgb tev_combiners_rgb[10] = {
+    comb_replace,  comb_modulate, comb_add,  comb_addsigned, comb_interpolate,
+    comb_subtract, comb_dot3,     comb_dot3, comb_muladd,    comb_addmul,
+};
+
+static float comba_replace(float a, float, float) {
+    return a;
+}
+
+static float comba_modulate(float a, float b, float) {
+    return a * b;
+}
+
+static float comba_add(float a, float b, float) {
+    return fminf(a + b, 1);
+}
+
+static float comba_addsigned(float a, float b, float) {
+    return clampf(a + b - 0.5f);
+}
+
+static float comba_interpolate(float a, float b, float c) {
+    return a * c + b * (1 - c);
+}
+
+static float comba_subtract(float a, float b, float) {
+    return fmaxf(a - b, 0);
+}
+
+static float comba_dot3(float a, float b, float) {
+    return fmaxf(4 * (a - 0.5f) * (b - 0.5f), 0);
+}
+
+static float comba_muladd(float a, float b, float c) {
+    return fminf(a * b + c, 1);
+}
+
+static float comba_addmul(float a, float b, float c) {
+    return fminf(a + b, 1) * c;
+}
+
+static const SWCombineA tev_combiners_a[10] = {
+    comba_replace,  comba_modulate,    comba_add,
+    comba_addsigned, comba_interpolate, comba_subtract,
+    comba_dot3,     comba_dot3,        comba_muladd,
+    comba_addmul,
+};
+
+// operands read by each combiner
+static const u8 tev_combiner_args[10] = {1, 2, 2, 2, 3, 2, 2, 2, 3, 3};
+
+static inline v4f normalize3(v4f v) {
+    float len = sqrtf(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+    return len > 0 ? v / len : v;
+}
+
+static inline float dot3(v4f a, v4f b) {
+    return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+}
+
+static inline v4f cross3(v4f a, v4f b) {
+    return (v4f) {a[1] * b[2] - a[2] * b[1], a[2] * b[0] - a[0] * b[2],
+                  a[0] * b[1] - a[1] * b[0], 0};
+}
+
+// the luts are sampled the way the gl renderer samples its lut texture,
+// filtered linearly between the 256 entries and clamped at the edges
+static inline float lut_sample(u16* lut, float u) {
+    float f = u * 256 - 0.5f;
+    float i0 = floorf(f);
+    float fr = f - i0;
+    int a = fminf(fmaxf(i0, 0), 255);
+    int b = fminf(fmaxf(i0 + 1, 0), 255);
+    return (lut[a] + (lut[b] - lut[a]) * fr) / 65535.f;
+}
+
+// in holds dot(n, h), dot(v, h), dot(n, v), dot(n, l), dot(l, p) and
+// dot(t, h_proj), which is what the input select of each lut picks from
+static inline float lut_read(SWDrawState* st, int sel, int lut, float* in) {
+    auto li = &st->sh.lutin[sel];
+    float x = in[li->input];
+    float u;
+    if (li->abs) {
+        u = fabsf(x);
+    } else {
+        // signed inputs are stored as two's complement indices
+        x = fminf(fmaxf(x * 128, -127.5f), 127.5f) / 256;
+        u = x - floorf(x);
+    }
+    return lut_sample(st->lightluts[lut], u) * li->scale;
+}
+
+static void shade_lighting(SWDrawState* st, float* attr, v4f* srcs,
+                           v4f* lprimary, v4f* lsecondary) {
+    auto sh = &st->sh;
+
+    v4f n = normalize3((v4f) {attr[ATTR_NORMAL], attr[ATTR_NORMAL + 1],
+                              attr[ATTR_NORMAL + 2], 0});
+    v4f t = normalize3((v4f) {attr[ATTR_TANGENT], attr[ATTR_TANGENT + 1],
+                              attr[ATTR_TANGENT + 2], 0});
+    v4f view = {attr[ATTR_VIEW], attr[ATTR_VIEW + 1], attr[ATTR_VIEW + 2], 0};
+
+    if (sh->bumpmode) {
+        v4f bump = 2 * srcs[TEVSRC_TEX0 + sh->bumptex] - 1;
+        if (sh->bumprecalc) {
+            float xy = bump[0] * bump[0] + bump[1] * bump[1];
+            bump[2] = sqrtf(fmaxf(1 - xy, 0));
+        }
+        // rotate it by the tbn matrix
+        v4f r = t * bump[0] + cross3(n, t) * bump[1] + n * bump[2];
+        if (sh->bumpmode == 1) n = normalize3(r);
+        if (sh->bumpmode == 2) t = normalize3(r);
+    }
+
+    v4f v = normalize3(view);
+
+    v4f shadow = splat(1);
+    if (sh->shadow) {
+        shadow = srcs[TEVSRC_TEX0 + sh->shadowtex];
+        if (sh->shadowinv) shadow = 1.f - shadow;
+    }
+
+    v4f prim = splat(0);
+    v4f sec = splat(0);
+    // the last light's inputs are kept for the fresnel lut
+    float in[8] = {};
+    for (int i = 0; i < sh->numlights; i++) {
+        auto lc = &sh->light[i];
+        auto ld = &st->light[i];
+
+        v4f l = lc->directional ? ld->vec : view + ld->vec;
+        float dist = sqrtf(dot3(l, l));
+        if (dist > 0) l /= dist;
+        v4f h = normalize3(l + v);
+        float ndotl = dot3(n, l);
+
+        in[0] = dot3(n, h);
+        in[1] = dot3(v, h);
+        in[2] = dot3(n, v);
+        in[3] = ndotl;
+        in[4] = dot3(l, ld->spotdir);
+        if (sh->lutproj) in[5] = dot3(t, normalize3(h - n * in[0]));
+
+        float nl = lc->twosided ? fabsf(ndotl) : fmaxf(ndotl, 0);
+        v4f cp = ld->diffuse * nl;
+
+        float g = 1;
+        if (lc->g0 || lc->g1) {
+            v4f lv = l + v;
+            g = nl / dot3(lv, lv);
+        }
+
+        v4f s0 = ld->specular0;
+        if (sh->luts & BIT(LLUT_D0)) s0 *= lut_read(st, LLUT_D0, LLUT_D0, in);
+        if (lc->g0) s0 *= g;
+        v4f s1 = ld->specular1;
+        if (sh->luts & BIT(LLUT_D1)) s1 *= lut_read(st, LLUT_D1, LLUT_D1, in);
+        if (sh->refl) {
+            v4f r = splat(1);
+            if (sh->luts & BIT(LLUT_RR))
+                r[0] = lut_read(st, LLUT_RR, LLUT_RR, in);
+            if (sh->reflsplat) {
+                r = splat(r[0]);
+            } else {
+                if (sh->luts & BIT(LLUT_RG))
+                    r[1] = lut_read(st, LLUT_RG, LLUT_RG, in);
+                if (sh->luts & BIT(LLUT_RB))
+                    r[2] = lut_read(st, LLUT_RB, LLUT_RB, in);
+            }
+            s1 *= r;
+        }
+        if (lc->g1) s1 *= g;
+        v4f cs = s0 + s1;
+
+        if (lc->shadow) {
+            if (sh->shadowprimary) cp *= shadow;
+            if (sh->shadowsecondary) cs *= shadow;
+        }
+
+        cp += ld->ambient;
+
+        if (sh->clamphighlights && !(ndotl >= 0)) continue;
+
+        if (lc->spot) {
+            float s = lut_read(st, LLUT_SP, LUT_SP_BASE + lc->num, in);
+            cp *= s;
+            cs *= s;
+        }
+        if (lc->distattn) {
+            float a = lut_sample(st->lightluts[LUT_DA_BASE + lc->num],
+                                 ld->attn_bias + ld->attn_scale * dist);
+            cp *= a;
+            cs *= a;
+        }
+
+        prim += cp;
+        sec += cs;
+    }
+
+    float fr = 1;
+    if (sh->frprimary || sh->frsecondary) {
+        fr = lut_read(st, LLUT_FR, LLUT_FR, in);
+    }
+    prim[3] = sh->frprimary ? fr : 1;
+    sec[3] = sh->frsecondary ? fr : 1;
+    if (sh->shadowalpha) {
+        prim[3] *= shadow[3];
+        sec[3] *= shadow[3];
+    }
+
+    prim += st->ambient;
+    *lprimary = vmin(prim, splat(1));
+    *lsecondary = vmin(sec, splat(1));
+}
+
+static v4f shade_fragment(SWDrawState* st, SWTriangle* t, float l0, float l1,
+                          float l2, float depth) {
+    auto sh = &st->sh;
+
+    float w = 1 / (l0 * t->iw[0] + l1 * t->iw[1] + l2 * t->iw[2]);
+    float attr[SW_NATTR];
+    for (int i = 0; i < sh->nattr; i++) {
+        attr[i] =
+            (l0 * t->attr[0][i] + l1 * t->attr[1][i] + l2 * t->attr[2][i]) * w;
+    }
+
+    v4f srcs[16] = {};
+    srcs[TEVSRC_COLOR] = (v4f) {attr[ATTR_COLOR], attr[ATTR_COLOR + 1],
+                                attr[ATTR_COLOR + 2], attr[ATTR_COLOR + 3]};
+
+    if (sh->usetex[0]) {
+        float s = attr[ATTR_TC0];
+        float u = attr[ATTR_TC0 + 1];
+        switch (sh->tex0type) {
+            case 0:
+                srcs[TEVSRC_TEX0] = sample_tex(&st->tex[0], s, u);
+                break;
+            case 3:
+                srcs[TEVSRC_TEX0] =
+                    sample_tex(&st->tex[0], s / attr[ATTR_TCW],
+                               u / attr[ATTR_TCW]);
+                break;
+            default:
+                srcs[TEVSRC_TEX0] = splat(1);
+                break;
+        }
+    }
+    if (sh->usetex[1]) {
+        srcs[TEVSRC_TEX1] =
+            sample_tex(&st->tex[1], attr[ATTR_TC1], attr[ATTR_TC1 + 1]);
+    }
+    if (sh->usetex[2]) {
+        int tc = sh->tex2coord ? ATTR_TC1 : ATTR_TC2;
+        srcs[TEVSRC_TEX2] = sample_tex(&st->tex[2], attr[tc], attr[tc + 1]);
+    }
+
+    if (sh->lighting) {
+        shade_lighting(st, attr, srcs, &srcs[TEVSRC_LIGHT_PRIMARY],
+                       &srcs[TEVSRC_LIGHT_SECONDARY]);
+    }
+
+    v4f cur = splat(0);
+    v4f buf = st->bufcolor;
+    for (int i = 0; i < sh->nsteps; i++) {
+        auto s = &sh->steps[i];
+
+        v4f tmp;
+        if (s->combine) {
+            srcs[TEVSRC_BUFFER] = buf;
+            srcs[TEVSRC_CONSTANT] = st->tevcolor[s->stage];
+            srcs[TEVSRC_PREVIOUS] = cur;
+
+            v4f a[3] = {};
+            for (int k = 0; k < s->nrgb; k++) {
+                a[k] = s->rgbop[k](srcs[s->rgbsrc[k]]);
+            }
+            tmp = s->rgbcomb(a[0], a[1], a[2]);
+            if (s->dot3rgba) {
+                tmp[3] = tmp[0];
+            } else {
+                float b[3] = {};
+                for (int k = 0; k < s->na; k++) {
+                    b[k] = s->aop[k](srcs[s->asrc[k]]);
+                }
+                tmp[3] = s->acomb(b[0], b[1], b[2]);
+            }
+        }
+
+        if (s->bufrgb) {
+            buf[0] = cur[0];
+            buf[1] = cur[1];
+            buf[2] = cur[2];
+        }
+        if (s->bufa) buf[3] = cur[3];
+
+        if (s->combine) cur = tmp;
+
+        if (s->rgbscale != 1) {
+            float a = cur[3];
+            cur = vmin(cur * s->rgbscale, splat(1));
+            cur[3] = a;
+        }
+        if (s->ascale != 1) cur[3] = fminf(cur[3] * s->ascale, 1);
+    }
+
+    return vclamp(cur);
+}
+
+static inline v4f apply_fog(SWDrawState* st, v4f c, float depth) {
+    float z = st->fogzflip ? 1 - depth : depth;
+    float fz = z * 128;
+    int i = fz;
+    if (i < 0) i = 0;
+    if (i > 127) i = 127;
+    float fr = clampf(fz - i);
+    float f = (st->foglut[i] + (st->foglut[i + 1] - st->foglut[i]) * fr) /
+              65535.f;
+    v4f res = st->fogcolor + (c - st->fogcolor) * f;
+    res[3] = c[3];
+    return res;
+}
+
+static inline v4f blend_factor(int f, v4f src, v4f dst, v4f cst) {
+    switch (f) {
+        case 0:
+            return splat(0);
+        case 1:
+            return splat(1);
+        case 2:
+            return src;
+        case 3:
+            return 1.f - src;
+        case 4:
+            return dst;
+        case 5:
+            return 1.f - dst;
+        case 6:
+            return splat(src[3]);
+        case 7:
+            return splat(1 - src[3]);
+        case 8:
+            return splat(dst[3]);
+        case 9:
+            return splat(1 - dst[3]);
+        case 10:
+            return cst;
+        case 11:
+            return 1.f - cst;
+        case 12:
+            return splat(cst[3]);
+        case 13:
+            return splat(1 - cst[3]);
+        case 14: {
+            float m = fminf(src[3], 1 - dst[3]);
+            return (v4f) {m, m, m, 1};
+        }
+        default:
+            return splat(0);
+    }
+}
+
+static inline v4f blend_eq(int eq, v4f s, v4f d, v4f sf, v4f df) {
+    switch (eq) {
+        case 1:
+            return s * sf - d * df;
+        case 2:
+            return d * df - s * sf;
+        case 3:
+            return vmin(s, d);
+        case 4:
+            return vmax(s, d);
+        default:
+            return s * sf + d * df;
+    }
+}
+
+static u32 blend(SWDrawState* st, v4f src, u32 dstpx) {
+    if (!st->blend) {
+        return logic_op(st->logicop, pack_rgba(src), dstpx);
+    }
+    v4f dst = unpack_rgba(dstpx);
+    v4f srcf = blend_factor(st->rgb_src, src, dst, st->blendcolor);
+    v4f dstf = blend_factor(st->rgb_dst, src, dst, st->blendcolor);
+    srcf[3] = blend_factor(st->a_src, src, dst, st->blendcolor)[3];
+    dstf[3] = blend_factor(st->a_dst, src, dst, st->blendcolor)[3];
+    v4f res = blend_eq(st->rgb_eq, src, dst, srcf, dstf);
+    res[3] = blend_eq(st->a_eq, src, dst, srcf, dstf)[3];
+    return pack_rgba(vclamp(res));
+}
+
+static void draw_pixel(SWState* sw, SWDrawState* st, SWTriangle* t, int x,
+                       int y, float l0, float l1, float l2) {
+    float depth = l0 * t->z[0] + l1 * t->z[1] + l2 * t->z[2];
+    if (depth < 0 || depth > 1) return;
+
+    u32 off = morton_swizzle(sw->fb.width, x, sw->fb.height - 1 - y);
+
+    v4f color;
+    bool shaded = false;
+    // the alpha test happens before anything touches the depth buffer
+    if (st->alphatest) {
+        color = shade_fragment(st, t, l0, l1, l2, depth);
+        shaded = true;
+        if (!compare(st->alphafunc, (u32) (color[3] * 255 + 0.5f),
+                     st->alpharef))
+            return;
+    }
+
+    if (sw->fb.depth) {
+        u8* dp = sw->fb.depth + off * depthfmt_bpp[sw->fb.depth_fmt];
+        u32 dsval = read_depth(dp, sw->fb.depth_fmt);
+        u32 newval = dsval;
+
+        bool hasstencil = st->stenciltest && sw->fb.depth_fmt == 3;
+        u8 stencil = dsval >> 24;
+        if (hasstencil) {
+            if (!compare(st->stencilfunc, st->stencilref & st->stencilmask,
+                         stencil & st->stencilmask)) {
+                u8 s = stencil_op(st->stencilop[0], stencil, st->stencilref);
+                s = (stencil & ~st->stencilwritemask) |
+                    (s & st->stencilwritemask);
+                write_depth(dp, 3, (dsval & MASK(24)) | s << 24);
+                return;
+            }
+        }
+
+        u32 zmax = sw->fb.depth_fmt < 2 ? MASK(16) : MASK(24);
+        u32 z = depth * zmax + 0.5f;
+        u32 zbuf = dsval & zmax;
+        bool zpass = compare(st->depthfunc, z, zbuf);
+
+        if (hasstencil) {
+            u8 s = stencil_op(st->stencilop[zpass ? 2 : 1], stencil,
+                              st->stencilref);
+            s = (stencil & ~st->stencilwritemask) | (s & st->stencilwritemask);
+            newval = (newval & MASK(24)) | s << 24;
+        }
+        if (zpass && st->depthwrite) newval = (newval & ~zmax) | z;
+        if (newval != dsval) write_depth(dp, sw->fb.depth_fmt, newval);
+
+        if (!zpass) return;
+    }
+
+    if (!st->colormask) return;
+
+    if (!shaded) color = shade_fragment(st, t, l0, l1, l2, depth);
+    if (st->fog) color = apply_fog(st, color, depth);
+
+    u8* cp = sw->fb.color + off * colorfmt_bpp[sw->fb.color_fmt];
+    u32 dstpx = read_color(cp, sw->fb.color_fmt);
+    u32 px = blend(st, color, dstpx);
+    px = (px & st->colormask) | (dstpx & ~st->colormask);
+    write_color(cp, sw->fb.color_fmt, px);
+}
+
+static void raster_triangle(SWState* sw, SWTriangle* t, int x0, int y0,
+                            int x1, int y1) {
+    SWDrawState* st = &sw->states.d[t->state];
+
+    if (t->xmin > x0) x0 = t->xmin;
+    if (t->ymin > y0) y0 = t->ymin;
+    if (t->xmax < x1) x1 = t->xmax;
+    if (t->ymax < y1) y1 = t->ymax;
+    if (x0 > x1 || y0 > y1) return;
+
+    // edge i is opposite vertex i, so its value is the barycentric weight
+    // of vertex i scaled by the area
+    float A[3], B[3], C[3];
+    bool topleft[3];
+    for (int i = 0; i < 3; i++) {
+        int a = (i + 1) % 3;
+        int b = (i + 2) % 3;
+        A[i] = t->y[a] - t->y[b];
+        B[i] = t->x[b] - t->x[a];
+        C[i] = t->x[a] * t->y[b] - t->x[b] * t->y[a];
+        // pixels exactly on an edge are only drawn for left and top edges
+        topleft[i] = A[i] > 0 || (A[i] == 0 && B[i] < 0);
+    }
+    float area = C[0] + C[1] + C[2];
+    float invarea = 1 / area;
+
+    const v4f xoff = {0.5f, 1.5f, 2.5f, 3.5f};
+    const v4f lanes = {0, 1, 2, 3};
+
+    // 4 pixels of a row are tested against the edges at once
+    for (int y = y0; y <= y1; y++) {
+        float py = y + 0.5f;
+        v4f rowe[3];
+        for (int i = 0; i < 3; i++) {
+            rowe[i] = splat(B[i] * py + C[i]);
+        }
+        for (int x = x0; x <= x1; x += 4) {
+            v4f px = (float) x + xoff;
+            v4i inside = (float) (x1 - x) >= lanes;
+            v4f e[3];
+            for (int i = 0; i < 3; i++) {
+                e[i] = rowe[i] + A[i] * px;
+                inside &= topleft[i] ? e[i] >= 0 : e[i] > 0;
+            }
+            if (!(inside[0] | inside[1] | inside[2] | inside[3])) continue;
+            for (int l = 0; l < 4; l++) {
+                if (!inside[l]) continue;
+                draw_pixel(sw, st, t, x + l, y, e[0][l] * invarea,
+                           e[1][l] * invarea, e[2][l] * invarea);
+            }
+        }
+    }
+}
+
+static void raster_tile(SWState* sw, int tile) {
+    int x0 = (tile % sw->fb.tilesx) << SW_TILE_SHIFT;
+    int y0 = (tile / sw->fb.tilesx) << SW_TILE_SHIFT;
+    int x1 = x0 + SW_TILE_SIZE - 1;
+    int y1 = y0 + SW_TILE_SIZE - 1;
+    Vec_foreach(i, sw->bins[tile]) {
+        raster_triangle(sw, &sw->tris.d[*i], x0, y0, x1, y1);
+    }
+}
+
+static void run_tiles(SWState* sw) {
+    int ntiles = sw->fb.tilesx * sw->fb.tilesy;
+    int tile;
+    while ((tile = sw->runner.nexttile++) < ntiles) {
+        if (sw->bins[tile].size) raster_tile(sw, tile);
+    }
+}
+
+static void* rast_thrd_func(GPU* gpu) {
+    auto r = &gpu->sw.runner;
+    u32 gen = 0;
+
+    pthread_mutex_lock(&r->lock);
+    while (true) {
+        while (r->gen == gen && !r->die) {
+            pthread_cond_wait(&r->start, &r->lock);
+        }
+        if (r->die) break;
+        gen = r->gen;
+        pthread_mutex_unlock(&r->lock);
+
+        run_tiles(&gpu->sw);
+
+        pthread_mutex_lock(&r->lock);
+        if (--r->busy == 0) pthread_cond_signal(&r->done);
+    }
+    pthread_mutex_unlock(&r->lock);
+    return nullptr;
+}
+
+void gpu_sw_flush_draws(GPU* gpu) {
+    auto sw = &gpu->sw;
+    if (!sw->tris.size) return;
+
+    linfo("rasterizing %zu triangles from %zu draws", sw->tris.size,
+          sw->states.size);
+
+    sw->fb.color = PTR(sw->fb.color_paddr);
+    sw->fb.depth = sw->fb.depth_paddr ? PTR(sw->fb.depth_paddr) : nullptr;
+
+    auto r = &sw->runner;
+    r->nexttile = 0;
+    if (r->nthreads) {
+        pthread_mutex_lock(&r->lock);
+        r->busy = r->nthreads;
+        r->gen++;
+        pthread_cond_broadcast(&r->start);
+        pthread_mutex_unlock(&r->lock);
+    }
+    run_tiles(sw);
+    if (r->nthreads) {
+        pthread_mutex_lock(&r->lock);
+        while (r->busy) pthread_cond_wait(&r->done, &r->lock);
+        pthread_mutex_unlock(&r->lock);
+    }
+
+    for (int i = 0; i < sw->fb.tilesx * sw->fb.tilesy; i++) {
+        sw->bins[i].size = 0;
+    }
+    sw->tris.size = 0;
+    sw->states.size = 0;
+
+    // textures decoded from these buffers are now stale
+    gpu_invalidate_range(gpu, sw->fb.color_paddr,
+                         sw->fb.width * sw->fb.height *
+                             colorfmt_bpp[sw->fb.color_fmt]);
+    if (sw->fb.depth_paddr) {
+        gpu_invalidate_range(gpu, sw->fb.depth_paddr,
+                             sw->fb.width * sw->fb.height *
+                                 depthfmt_bpp[sw->fb.depth_fmt]);
+    }
+}
+
+// the framebuffer cache is still kept so display transfers can find
+// the dimensions of the source framebuffer
+static bool update_cur_fb(GPU* gpu) {
+    auto sw = &gpu->sw;
+
+    u32 color_paddr = gpu->regs.fb.colorbuf_loc << 3;
+    u32 depth_paddr = gpu->regs.fb.depthbuf_loc << 3;
+    u32 w = gpu->regs.fb.dim.width;
+    u32 h = gpu->regs.fb.dim.height + 1;
+    u32 color_fmt = gpu->regs.fb.colorbuf_fmt.fmt;
+    u32 depth_fmt = gpu->regs.fb.depthbuf_fmt & 3;
+
+    if (!color_paddr) {
+        lwarn("null framebuffer");
+        return false;
+    }
+    if (w > 1024 || h > 1024 || (w & 7)) {
+        lwarnonce("invalid framebuffer size %dx%d", w, h);
+        return false;
+    }
+    if (!is_valid_physmem(color_paddr) ||
+        !is_valid_physmem(color_paddr + w * h * colorfmt_bpp[color_fmt] - 1)) {
+        lwarnonce("out of bounds framebuffer at %08x", color_paddr);
+        return false;
+    }
+    if (depth_paddr &&
+        (!is_valid_physmem(depth_paddr) ||
+         !is_valid_physmem(depth_paddr + w * h * depthfmt_bpp[depth_fmt] -
+                           1))) {
+        lwarnonce("out of bounds depth buffer at %08x", depth_paddr);
+        depth_paddr = 0;
+    }
+
+    if (sw->fb.color_paddr != color_paddr ||
+        sw->fb.depth_paddr != depth_paddr || sw->fb.width != w ||
+        sw->fb.height != h || sw->fb.color_fmt != color_fmt ||
+        sw->fb.depth_fmt != depth_fmt) {
+        gpu_sw_flush_draws(gpu);
+
+        sw->fb.color_paddr = color_paddr;
+        sw->fb.depth_paddr = depth_paddr;
+        sw->fb.width = w;
+        sw->fb.height = h;
+        sw->fb.color_fmt = color_fmt;
+        sw->fb.depth_fmt = depth_fmt;
+        sw->fb.tilesx = (w + SW_TILE_SIZE - 1) >> SW_TILE_SHIFT;
+        sw->fb.tilesy = (h + SW_TILE_SIZE - 1) >> SW_TILE_SHIFT;
+
+        linfo("drawing on fb at %x with depth buffer at %x", color_paddr,
+              depth_paddr);
+    }
+
+    auto fb = LRU_load(gpu->fbs, color_paddr);
+    if (fb->color_paddr != color_paddr || fb->width != w || h > fb->height) {
+        fb->color_paddr = color_paddr;
+        fb->width = w;
+        fb->height = h;
+    }
+    fb->depth_paddr = depth_paddr;
+    fb->color_fmt = color_fmt;
+    fb->color_Bpp = colorfmt_bpp[color_fmt];
+    fb->depth_fmt = depth_fmt;
+    gpu->curfb = fb;
+
+    return true;
+}
+
+typedef struct {
+    u8 d[3];
+} u24;
+
+static void decode_texture(GPU* gpu, TexInfo* tex) {
+    linfo("decoding texture from %x with dims %dx%d and fmt=%d", tex->paddr,
+          tex->width, tex->height, tex->fmt);
+
+    int w = tex->width;
+    int h = tex->height;
+    u32* pixels = tex->swpixels =
+        realloc(tex->swpixels, w * h * sizeof *tex->swpixels);
+    void* rawdata = PTR(tex->paddr);
+
+#define DECODE(t, expr)                                                        \
+    ({                                                                         \
+        t* data = rawdata;                                                     \
+        for (int x = 0; x < w; x++) {                                          \
+            for (int y = 0; y < h; y++) {                                      \
+                t v = data[morton_swizzle(w, x, y)];                           \
+                pixels[(h - 1 - y) * w + x] = expr;                            \
+            }                                                                  \
+        }                                                                      \
+    })
+#define NIBBLE(i) (((u8*) rawdata)[(i) / 2] >> 4 * ((i) & 1) & 0xf)
+#define DECODE4(expr)                                                          \
+    ({                                                                         \
+        for (int x = 0; x < w; x++) {                                          \
+            for (int y = 0; y < h; y++) {                                      \
+                u8 v = EXPAND4(NIBBLE(morton_swizzle(w, x, y)));               \
+                pixels[(h - 1 - y) * w + x] = expr;                            \
+            }                                                                  \
+        }                                                                      \
+    })
+
+    switch (tex->fmt) {
+        case 0: // rgba8888
+            DECODE(u32, RGBA(v >> 24, v >> 16 & 0xff, v >> 8 & 0xff, v & 0xff));
+            break;
+        case 1: // rgb888
+            DECODE(u24, RGBA(v.d[2], v.d[1], v.d[0], 0xff));
+            break;
+        case 2: // rgba5551
+            DECODE(u16, RGBA(EXPAND5(v >> 11), EXPAND5(v >> 6 & 0x1f),
+                             EXPAND5(v >> 1 & 0x1f), (v & 1) * 0xff));
+            break;
+        case 3: // rgb565
+            DECODE(u16, RGBA(EXPAND5(v >> 11), EXPAND6(v >> 5 & 0x3f),
+                             EXPAND5(v & 0x1f), 0xff));
+            break;
+        case 4: // rgba4444
+            DECODE(u16, RGBA(EXPAND4(v >> 12), EXPAND4(v >> 8 & 0xf),
+                             EXPAND4(v >> 4 & 0xf), EXPAND4(v & 0xf)));
+            break;
+        case 5: // ia88
+            DECODE(u16, RGBA(v >> 8, v >> 8, v >> 8, v & 0xff));
+            break;
+        case 6: // hilo8
+            DECODE(u16, RGBA(v & 0xff, v >> 8, 0, 0xff));
+            break;
+        case 7: // i8
+            DECODE(u8, RGBA(v, v, v, 0xff));
+            break;
+        case 8: // a8
+            DECODE(u8, RGBA(0, 0, 0, v));
+            break;
+        case 9: // ia44
+            DECODE(u8, RGBA(EXPAND4(v >> 4), EXPAND4(v >> 4), EXPAND4(v >> 4),
+                            EXPAND4(v & 0xf)));
+            break;
+        case 10: // i4
+            DECODE4(RGBA(v, v, v, 0xff));
+            break;
+        case 11: // a4
+            DECODE4(RGBA(0, 0, 0, v));
+            break;
+        case 12: { // etc1
+            u8(*dec)[3] = malloc(w * h * 3);
+            etc1_decompress_texture(w, h, rawdata, (void*) dec);
+            for (int i = 0; i < w * h; i++) {
+                pixels[i] = RGBA(dec[i][0], dec[i][1], dec[i][2], 0xff);
+            }
+            free(dec);
+            break;
+        }
+        case 13: { // etc1a4
+            etc1a4_decompress_texture(w, h, rawdata, (void*) pixels);
+            break;
+        }
+        default:
+            lerror("unknown texture format %d", tex->fmt);
+            memset(pixels, 0, w * h * sizeof *pixels);
+    }
+
+#undef DECODE
+#undef DECODE4
+#undef NIBBLE
+}
+
+// shares the texture cache with the gl renderer
+static void load_texture(GPU* gpu, SWTexUnit* unit, TexUnitRegs* regs,
+                         u32 fmt) {
+    *unit = (SWTexUnit) {};
+
+    if (regs->addr == 0) {
+        lwarnonce("null texture");
+        return;
+    }
+    if (regs->width < 8 || regs->height < 8 || fmt > 13) {
+        lwarnonce("invalid texture %dx%d fmt=%d", regs->width, regs->height,
+                  fmt);
+        return;
+    }
+
+    u32 paddr = regs->addr << 3;
+    u32 texsize = 0;
+    for (int i = regs->lod.min; i <= regs->lod.max; i++) {
+        texsize += TEXSIZE(regs->width, regs->height, fmt, i);
+    }
+
+    if (!is_valid_physmem(paddr) || !is_valid_physmem(paddr + texsize - 1)) {
+        lwarnonce("out of bounds texture");
+        return;
+    }
+
+    // rendering to a texture that is then sampled in the same batch
+    if (gpu->sw.tris.size &&
+        ((paddr < gpu->sw.fb.color_paddr +
+                      gpu->sw.fb.width * gpu->sw.fb.height *
+                          colorfmt_bpp[gpu->sw.fb.color_fmt] &&
+          gpu->sw.fb.color_paddr < paddr + texsize) ||
+         (gpu->sw.fb.depth_paddr &&
+          paddr < gpu->sw.fb.depth_paddr +
+                      gpu->sw.fb.width * gpu->sw.fb.height *
+                          depthfmt_bpp[gpu->sw.fb.depth_fmt] &&
+          gpu->sw.fb.depth_paddr < paddr + texsize))) {
+        gpu_sw_flush_draws(gpu);
+    }
+
+    auto tex = LRU_load(gpu->textures, paddr);
+    if (tex->paddr != paddr || tex->width != regs->width ||
+        tex->height != regs->height || tex->fmt != fmt ||
+        tex->minlod != regs->lod.min || tex->maxlod != regs->lod.max ||
+        !tex->swpixels) {
+        tex->paddr = paddr;
+        tex->width = regs->width;
+        tex->height = regs->height;
+        tex->fmt = fmt;
+        tex->minlod = regs->lod.min;
+        tex->maxlod = regs->lod.max;
+        tex->size = texsize;
+
+        tex->hash = gpu_hash_texture(PTR(tex->paddr), tex->size);
+        tex->needs_rehash = false;
+
+        // queued draws could still be using the old image
+        gpu_sw_flush_draws(gpu);
+        decode_texture(gpu, tex);
+    } else if (tex->needs_rehash) {
+        u64 hash = gpu_hash_texture(PTR(tex->paddr), tex->size);
+        tex->needs_rehash = false;
+        if (hash != tex->hash) {
+            tex->hash = hash;
+            gpu_sw_flush_draws(gpu);
+            decode_texture(gpu, tex);
+        }
+    }
+
+    unit->pixels = tex->swpixels;
+    unit->width = tex->width;
+    unit->height = tex->height;
+    unit->wrap_s = regs->param.wrap_s;
+    unit->wrap_t = regs->param.wrap_t;
+    unit->linear = regs->param.mag_filter;
+    unit->border = RGBA(regs->border.r, regs->border.g, regs->border.b,
+                        regs->border.a);
+}
+
+#define COPYRGB(dst, src)                                                      \
+    ({                                                                         \
+        dst = (v4f) {(float) src.r / 255, (float) src.g / 255,                 \
+                     (float) src.b / 255, 0};                                  \
+    })
+
+static void compile_lighting(SWShader* sh, SWFragConfig* cfg) {
+    u32 c0 = cfg->lconfig0;
+    u32 c1 = cfg->lconfig1;
+
+    int envluts = lightenvEnabledLuts[c0 >> 4 & 7];
+    sh->luts = envluts & ~(c1 >> 16 & 0xff);
+    for (int i = 0; i < 8; i++) {
+        sh->lutin[i].input = cfg->llutSel >> 4 * i & 7;
+        sh->lutin[i].abs = !(cfg->llutAbs & BIT(4 * i + 1));
+        sh->lutin[i].scale = ldexpf(1, (sbit(3)) (cfg->llutScale >> 4 * i));
+    }
+
+    sh->shadow = c0 & BIT(0);
+    sh->shadowinv = c0 & BIT(18);
+    sh->shadowtex = c0 >> 24 & 3;
+    sh->shadowprimary = c0 & BIT(16);
+    sh->shadowsecondary = c0 & BIT(17);
+    sh->shadowalpha = c0 & BIT(19);
+    sh->bumpmode = c0 >> 28 & 3;
+    sh->bumptex = c0 >> 22 & 3;
+    sh->bumprecalc = !(c0 & BIT(30));
+    sh->clamphighlights = c0 & BIT(27);
+
+    sh->numlights = cfg->numlights;
+    for (int i = 0; i < sh->numlights; i++) {
+        int num = cfg->lightPerm >> 4 * i & 7;
+        u32 lc = cfg->lightconfig[num];
+        auto l = &sh->light[i];
+        l->num = num;
+        l->directional = lc & BIT(0);
+        l->twosided = lc & BIT(1);
+        l->g0 = lc & BIT(2);
+        l->g1 = lc & BIT(3);
+        l->shadow = sh->shadow && !(c1 & BIT(num));
+        l->spot = envluts & BIT(LLUT_SP) && !(c1 >> 8 & BIT(num));
+        l->distattn = envluts & BIT(LLUT_DA) && !(c1 >> 24 & BIT(num));
+        if (l->spot) sh->luts |= BIT(LLUT_SP);
+    }
+
+    u8 refl = BIT(LLUT_RR) | BIT(LLUT_RG) | BIT(LLUT_RB);
+    sh->refl = envluts & BIT(LLUT_RR) && sh->luts & refl;
+    sh->reflsplat = !(envluts & BIT(LLUT_RG));
+    if (sh->luts & BIT(LLUT_FR)) {
+        sh->frprimary = c0 & BIT(2);
+        sh->frsecondary = c0 & BIT(3);
+    }
+
+    for (int i = 0; i < 8; i++) {
+        if (sh->luts & BIT(i) && sh->lutin[i].input == 5) sh->lutproj = true;
+    }
+
+    // the textures read by lighting are sampled like any other
+    if (sh->shadow && sh->shadowtex < 3 &&
+        cfg->texenable & BIT(sh->shadowtex)) {
+        sh->usetex[sh->shadowtex] = true;
+    }
+    if (sh->bumpmode && sh->bumptex < 3 && cfg->texenable & BIT(sh->bumptex)) {
+        sh->usetex[sh->bumptex] = true;
+    }
+}
+
+static void compile_shader(SWShader* sh, SWFragConfig* cfg) {
+    *sh = (SWShader) {};
+
+    u32 used = 0;
+    for (int i = 0; i < 6; i++) {
+        auto r = &cfg->tev[i];
+        auto s = &sh->steps[i];
+        s->stage = i;
+
+        u8 rgbsrc[3] = {r->source.rgb0, r->source.rgb1, r->source.rgb2};
+        u8 asrc[3] = {r->source.a0, r->source.a1, r->source.a2};
+        u8 rgbop[3] = {r->operand.rgb0, r->operand.rgb1, r->operand.rgb2};
+        u8 aop[3] = {r->operand.a0, r->operand.a1, r->operand.a2};
+        int rgbcomb = r->combiner.rgb < 10 ? r->combiner.rgb : 0;
+        int acomb = r->combiner.a < 10 ? r->combiner.a : 0;
+
+        s->combine = !(rgbcomb == 0 && rgbop[0] == 0 &&
+                       rgbsrc[0] == TEVSRC_PREVIOUS && acomb == 0 &&
+                       aop[0] == 0 && asrc[0] == TEVSRC_PREVIOUS);
+        if (s->combine) {
+            s->nrgb = tev_combiner_args[rgbcomb];
+            s->rgbcomb = tev_combiners_rgb[rgbcomb];
+            s->dot3rgba = rgbcomb == 7;
+            if (!s->dot3rgba) {
+                s->na = tev_combiner_args[acomb];
+                s->acomb = tev_combiners_a[acomb];
+            }
+            for (int k = 0; k < s->nrgb; k++) {
+                s->rgbsrc[k] = rgbsrc[k];
+                s->rgbop[k] = tev_operands_rgb[rgbop[k]];
+                used |= BIT(rgbsrc[k]);
+            }
+            for (int k = 0; k < s->na; k++) {
+                s->asrc[k] = asrc[k];
+                s->aop[k] = tev_operands_a[aop[k]];
+                used |= BIT(asrc[k]);
+            }
+        }
+
+        if (i > 0 && i < 5) {
+            s->bufrgb = cfg->bufupdate & BIT(i - 1);
+            s->bufa = cfg->bufupdate & BIT(4 + i - 1);
+        }
+
+        s->rgbscale = 1 << r->scale.rgb;
+        s->ascale = 1 << r->scale.a;
+    }
+
+    // drop the stages that have no effect
+    bool usebuf = used & BIT(TEVSRC_BUFFER);
+    for (int i = 0; i < 6; i++) {
+        auto s = &sh->steps[i];
+        if (!usebuf) s->bufrgb = s->bufa = false;
+        if (!s->combine && !s->bufrgb && !s->bufa && s->rgbscale == 1 &&
+            s->ascale == 1)
+            continue;
+        sh->steps[sh->nsteps++] = *s;
+    }
+
+    sh->tex0type = cfg->tex0type;
+    sh->tex2coord = cfg->tex2coord;
+    for (int i = 0; i < 3; i++) {
+        sh->usetex[i] =
+            cfg->texenable & BIT(i) && used & BIT(TEVSRC_TEX0 + i);
+    }
+
+    sh->lighting = cfg->lighting && used & (BIT(TEVSRC_LIGHT_PRIMARY) |
+                                            BIT(TEVSRC_LIGHT_SECONDARY));
+    if (sh->lighting) compile_lighting(sh, cfg);
+
+    // the normal, view and tangent are only needed for lighting
+    sh->nattr = sh->lighting ? SW_NATTR : ATTR_NORMAL;
+}
+
+static void load_shader(GPU* gpu, SWDrawState* st) {
+    SWFragConfig cfg = {};
+
+    TexEnvRegs* tev[6] = {&gpu->regs.tex.tev0, &gpu->regs.tex.tev1,
+                          &gpu->regs.tex.tev2, &gpu->regs.tex.tev3,
+                          &gpu->regs.tex.tev4, &gpu->regs.tex.tev5};
+    for (int i = 0; i < 6; i++) {
+        cfg.tev[i].source = tev[i]->source;
+        cfg.tev[i].operand = tev[i]->operand;
+        cfg.tev[i].combiner = tev[i]->combiner;
+        cfg.tev[i].scale = tev[i]->scale;
+    }
+    cfg.bufupdate = gpu->regs.tex.tev_buffer >> 8 & 0xff;
+    cfg.texenable = gpu->regs.tex.config.tex0enable |
+                    gpu->regs.tex.config.tex1enable << 1 |
+                    gpu->regs.tex.config.tex2enable << 2;
+    cfg.tex2coord = gpu->regs.tex.config.tex2coord;
+    if (gpu->regs.tex.config.tex0enable) {
+        cfg.tex0type = gpu->regs.tex.tex0.param.type;
+    }
+
+    cfg.lighting = !gpu->regs.lighting.disable;
+    if (cfg.lighting) {
+        cfg.numlights = gpu->regs.lighting.numlights + 1;
+        cfg.lightPerm = gpu->regs.lighting.permutation;
+        for (int i = 0; i < 8; i++) {
+            cfg.lightconfig[i] = gpu->regs.lighting.light[i].config;
+        }
+        cfg.lconfig0 = gpu->regs.lighting.config0;
+        cfg.lconfig1 = gpu->regs.lighting.config1;
+        cfg.llutAbs = gpu->regs.lighting.lutinputAbs;
+        cfg.llutSel = gpu->regs.lighting.lutinputSel;
+        cfg.llutScale = gpu->regs.lighting.lutinputScale;
+    }
+
+    u64 hash = gpu_hash_sw_fs(&cfg);
+    auto ent = LRU_load(gpu->sw.shaders, hash);
+    if (ent->hash != hash) {
+        ent->hash = hash;
+        compile_shader(&ent->sh, &cfg);
+        linfo("compiled new software fragment pipeline with hash %llx", hash);
+    }
+    st->sh = ent->sh;
+}
+
+static void setup_draw_state(GPU* gpu, SWDrawState* st) {
+    *st = (SWDrawState) {};
+
+    // textures
+    if (gpu->regs.tex.config.tex0enable) {
+        load_texture(gpu, &st->tex[0], &gpu->regs.tex.tex0,
+                     gpu->regs.tex.tex0_fmt);
+        int type = gpu->regs.tex.tex0.param.type;
+        if (type != 0 && type != 3) {
+            lwarnonce("texture type %d in software renderer", type);
+        }
+    }
+    if (gpu->regs.tex.config.tex1enable) {
+        load_texture(gpu, &st->tex[1], &gpu->regs.tex.tex1,
+                     gpu->regs.tex.tex1_fmt);
+    }
+    if (gpu->regs.tex.config.tex2enable) {
+        load_texture(gpu, &st->tex[2], &gpu->regs.tex.tex2,
+                     gpu->regs.tex.tex2_fmt);
+    }
+    if (gpu->regs.tex.config.tex3enable) {
+        lwarnonce("procedural textures in software renderer");
+    }
+
+    load_shader(gpu, st);
+
+    // texenvs
+    TexEnvRegs* tev[6] = {&gpu->regs.tex.tev0, &gpu->regs.tex.tev1,
+                          &gpu->regs.tex.tev2, &gpu->regs.tex.tev3,
+                          &gpu->regs.tex.tev4, &gpu->regs.tex.tev5};
+    for (int i = 0; i < 6; i++) {
+        auto c = tev[i]->color;
+        st->tevcolor[i] = unpack_rgba(RGBA(c.r, c.g, c.b, c.a));
+    }
+    auto bc = gpu->regs.tex.tev5.buffer_color;
+    st->bufcolor = unpack_rgba(RGBA(bc.r, bc.g, bc.b, bc.a));
+
+    // lighting
+    if (st->sh.lighting) {
+        for (int _i = 0; _i < st->sh.numlights; _i++) {
+            auto l = &gpu->regs.lighting.light[st->sh.light[_i].num];
+            auto dst = &st->light[_i];
+            COPYRGB(dst->specular0, l->specular0);
+            COPYRGB(dst->specular1, l->specular1);
+            COPYRGB(dst->diffuse, l->diffuse);
+            COPYRGB(dst->ambient, l->ambient);
+            dst->vec = (v4f) {cvtf16(l->vec.x), cvtf16(l->vec.y),
+                              cvtf16(l->vec.z), 0};
+            dst->spotdir =
+                normalize3((v4f) {(float) l->spotdir.x / BIT(11),
+                                  (float) l->spotdir.y / BIT(11),
+                                  (float) l->spotdir.z / BIT(11), 0});
+            dst->attn_bias = cvtf20(l->attn_bias);
+            dst->attn_scale = cvtf20(l->attn_scale);
+        }
+        COPYRGB(st->ambient, gpu->regs.lighting.ambient);
+        st->lightluts = gpu->lightLuts;
+    }
+
+    // alpha test
+    st->alphatest = gpu->regs.fb.alpha_test.enable;
+    st->alphafunc = gpu->regs.fb.alpha_test.func;
+    st->alpharef = gpu->regs.fb.alpha_test.ref;
+
+    // fog
+    st->fog = (gpu->regs.tex.tev_buffer & 7) == 5;
+    if (st->fog) {
+        st->fogzflip = gpu->regs.tex.tev_buffer & BIT(16);
+        COPYRGB(st->fogcolor, gpu->regs.tex.fogColor);
+        memcpy(st->foglut, gpu->fogLut, sizeof st->foglut);
+    }
+
+    // stencil test
+    st->stenciltest = gpu->regs.fb.stencil_test.enable;
+    st->stencilfunc = gpu->regs.fb.stencil_test.func;
+    st->stencilref = gpu->regs.fb.stencil_test.ref;
+    st->stencilmask = gpu->regs.fb.stencil_test.mask;
+    st->stencilwritemask = gpu->regs.fb.perms.depthbuf.write
+                               ? gpu->regs.fb.stencil_test.bufmask
+                               : 0;
+    st->stencilop[0] = gpu->regs.fb.stencil_op.fail;
+    st->stencilop[1] = gpu->regs.fb.stencil_op.zfail;
+    st->stencilop[2] = gpu->regs.fb.stencil_op.zpass;
+
+    // depth test, the depth buffer can be written even with the test off
+    st->depthfunc = gpu->regs.fb.color_mask.depthtest
+                        ? gpu->regs.fb.color_mask.depthfunc
+                        : 1;
+    st->depthwrite =
+        gpu->regs.fb.perms.depthbuf.write && gpu->regs.fb.color_mask.depth;
+
+    // color mask
+    if (gpu->regs.fb.perms.colorbuf.write) {
+        st->colormask = (gpu->regs.fb.color_mask.red ? 0xff : 0) |
+                        (gpu->regs.fb.color_mask.green ? 0xff00 : 0) |
+                        (gpu->regs.fb.color_mask.blue ? 0xff0000 : 0) |
+                        (gpu->regs.fb.color_mask.alpha ? 0xff000000 : 0);
+    }
+
+    // blending/logic ops
+    st->blend = gpu->regs.fb.color_op.blend_mode;
+    st->rgb_eq = gpu->regs.fb.blend_func.rgb_eq;
+    st->a_eq = gpu->regs.fb.blend_func.a_eq;
+    st->rgb_src = gpu->regs.fb.blend_func.rgb_src;
+    st->rgb_dst = gpu->regs.fb.blend_func.rgb_dst;
+    st->a_src = gpu->regs.fb.blend_func.a_src;
+    st->a_dst = gpu->regs.fb.blend_func.a_dst;
+    st->blendcolor =
+        unpack_rgba(RGBA(gpu->regs.fb.blend_color.r, gpu->regs.fb.blend_color.g,
+                         gpu->regs.fb.blend_color.b, gpu->regs.fb.blend_color.a));
+    st->logicop = gpu->regs.fb.logic_op;
+}
+
+static void setup_params(GPU* gpu, SetupParams* p, u32 state) {
+    p->vx = gpu->regs.raster.view_x;
+    p->vy = gpu->regs.raster.view_y;
+    p->vw = cvtf24(gpu->regs.raster.view_w);
+    p->vh = cvtf24(gpu->regs.raster.view_h);
+    p->dscale = cvtf24(gpu->regs.raster.depthmap_scale);
+    p->doffset = cvtf24(gpu->regs.raster.depthmap_offset);
+    p->wbuffer = !gpu->regs.raster.depthmap_enable;
+    p->cullmode = gpu->regs.raster.cullmode;
+    p->state = state;
+
+    // only pixels inside the framebuffer, viewport and scissor are drawn
+    p->xmin = p->vx > 0 ? p->vx : 0;
+    p->ymin = p->vy > 0 ? p->vy : 0;
+    p->xmax = ceilf(p->vx + 2 * p->vw) - 1;
+    p->ymax = ceilf(p->vy + 2 * p->vh) - 1;
+    if (p->xmax > (int) gpu->sw.fb.width - 1) p->xmax = gpu->sw.fb.width - 1;
+    if (p->ymax > (int) gpu->sw.fb.height - 1) p->ymax = gpu->sw.fb.height - 1;
+    if (gpu->regs.raster.scissortest.enable) {
+        auto sc = &gpu->regs.raster.scissortest;
+        if (sc->x1 > p->xmin) p->xmin = sc->x1;
+        if (sc->y1 > p->ymin) p->ymin = sc->y1;
+        if (sc->x2 < p->xmax) p->xmax = sc->x2;
+        if (sc->y2 < p->ymax) p->ymax = sc->y2;
+    }
+}
+
+static void load_clip_vertex(ClipVertex* dst, Vertex* v) {
+    memcpy(dst->pos, v->pos, sizeof(fvec4));
+    for (int i = 0; i < 4; i++) {
+        dst->attr[ATTR_COLOR + i] = clampf(v->color[i]);
+    }
+    dst->attr[ATTR_TC0] = v->texcoord0[0];
+    dst->attr[ATTR_TC0 + 1] = v->texcoord0[1];
+    dst->attr[ATTR_TC1] = v->texcoord1[0];
+    dst->attr[ATTR_TC1 + 1] = v->texcoord1[1];
+    dst->attr[ATTR_TC2] = v->texcoord2[0];
+    dst->attr[ATTR_TC2 + 1] = v->texcoord2[1];
+    dst->attr[ATTR_TCW] = v->texcoordw;
+
+    // rotate (0,0,1) by the normal quaternion
+    float qx = v->normquat[0];
+    float qy = v->normquat[1];
+    float qz = v->normquat[2];
+    float qw = v->normquat[3];
+    dst->attr[ATTR_NORMAL] = 2 * (qw * qy + qx * qz);
+    dst->attr[ATTR_NORMAL + 1] = 2 * (qy * qz - qw * qx);
+    dst->attr[ATTR_NORMAL + 2] = qw * qw - qx * qx - qy * qy + qz * qz;
+
+    dst->attr[ATTR_VIEW] = v->view[0];
+    dst->attr[ATTR_VIEW + 1] = v->view[1];
+    dst->attr[ATTR_VIEW + 2] = v->view[2];
+
+    // and (1,0,0) for the tangent
+    dst->attr[ATTR_TANGENT] = qw * qw + qx * qx - qy * qy - qz * qz;
+    dst->attr[ATTR_TANGENT + 1] = 2 * (qw * qz + qx * qy);
+    dst->attr[ATTR_TANGENT + 2] = 2 * (qx * qz - qw * qy);
+}
+
+static void lerp_clip_vertex(ClipVertex* dst, ClipVertex* a, ClipVertex* b,
+                             float t) {
+    for (int i = 0; i < 4; i++) {
+        dst->pos[i] = a->pos[i] + (b->pos[i] - a->pos[i]) * t;
+    }
+    for (int i = 0; i < SW_NATTR; i++) {
+        dst->attr[i] = a->attr[i] + (b->attr[i] - a->attr[i]) * t;
+    }
+}
+
+static void setup_triangle(SWState* sw, SetupParams* p, ClipVertex* a,
+                           ClipVertex* b, ClipVertex* c) {
+    SWTriangle t;
+    ClipVertex* v[3] = {a, b, c};
+    for (int i = 0; i < 3; i++) {
+        float iw = 1 / v[i]->pos[3];
+        t.x[i] = p->vx + (v[i]->pos[0] * iw + 1) * p->vw;
+        t.y[i] = p->vy + (v[i]->pos[1] * iw + 1) * p->vh;
+        t.z[i] = v[i]->pos[2] * p->dscale + v[i]->pos[3] * p->doffset;
+        if (!p->wbuffer) t.z[i] *= iw;
+        t.iw[i] = iw;
+    }
+
+    // counterclockwise is front facing
+    float area = (t.x[1] - t.x[0]) * (t.y[2] - t.y[0]) -
+                 (t.x[2] - t.x[0]) * (t.y[1] - t.y[0]);
+    if (area == 0 || isnan(area)) return;
+    switch (p->cullmode) {
+        case 1:
+            if (area > 0) return;
+            break;
+        case 2:
+            if (area < 0) return;
+            break;
+        case 3:
+            return;
+    }
+
+    // make the winding counterclockwise for the rasterizer
+    if (area < 0) {
+        SWAP(t.x[1], t.x[2]);
+        SWAP(t.y[1], t.y[2]);
+        SWAP(t.z[1], t.z[2]);
+        SWAP(t.iw[1], t.iw[2]);
+        SWAP(v[1], v[2]);
+    }
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < SW_NATTR; j++) {
+            t.attr[i][j] = v[i]->attr[j] * t.iw[i];
+        }
+    }
+
+    float minx = fminf(t.x[0], fminf(t.x[1], t.x[2]));
+    float maxx = fmaxf(t.x[0], fmaxf(t.x[1], t.x[2]));
+    float miny = fminf(t.y[0], fminf(t.y[1], t.y[2]));
+    float maxy = fmaxf(t.y[0], fmaxf(t.y[1], t.y[2]));
+    t.xmin = minx < p->xmin ? p->xmin : (int) minx;
+    t.ymin = miny < p->ymin ? p->ymin : (int) miny;
+    t.xmax = maxx > p->xmax ? p->xmax : (int) maxx;
+    t.ymax = maxy > p->ymax ? p->ymax : (int) maxy;
+    if (t.xmin > t.xmax || t.ymin > t.ymax) return;
+    t.state = p->state;
+
+    u32 idx = Vec_push(sw->tris, t);
+    for (int ty = t.ymin >> SW_TILE_SHIFT; ty <= t.ymax >> SW_TILE_SHIFT;
+         ty++) {
+        for (int tx = t.xmin >> SW_TILE_SHIFT; tx <= t.xmax >> SW_TILE_SHIFT;
+             tx++) {
+            Vec_push(sw->bins[ty * sw->fb.tilesx + tx], idx);
+        }
+    }
+}
+
+static void draw_triangle(SWState* sw, SetupParams* p, Vertex* a, Vertex* b,
+                          Vertex* c) {
+    ClipVertex in[3];
+    load_clip_vertex(&in[0], a);
+    load_clip_vertex(&in[1], b);
+    load_clip_vertex(&in[2], c);
+
+    if (in[0].pos[3] > CLIP_EPS && in[1].pos[3] > CLIP_EPS &&
+        in[2].pos[3] > CLIP_EPS) {
+        setup_triangle(sw, p, &in[0], &in[1], &in[2]);
+        return;
+    }
+
+    // clip against the w=eps plane, giving at most 4 vertices
+    ClipVertex out[4];
+    int n = 0;
+    for (int i = 0; i < 3; i++) {
+        ClipVertex* cur = &in[i];
+        ClipVertex* next = &in[(i + 1) % 3];
+        bool curin = cur->pos[3] > CLIP_EPS;
+        bool nextin = next->pos[3] > CLIP_EPS;
+        if (curin) out[n++] = *cur;
+        if (curin != nextin) {
+            float t = (CLIP_EPS - cur->pos[3]) / (next->pos[3] - cur->pos[3]);
+            lerp_clip_vertex(&out[n++], cur, next, t);
+        }
+    }
+    for (int i = 2; i < n; i++) {
+        setup_triangle(sw, p, &out[0], &out[i - 1], &out[i]);
+    }
+}
+
+void gpu_sw_draw(GPU* gpu, bool elements, bool immediate) {
+    auto sw = &gpu->sw;
+
+    int nattrs = gpu->regs.geom.vsh_num_attr + 1;
+    int nverts =
+        immediate ? gpu->immattrs.size / nattrs : gpu->regs.geom.nverts;
+    int primMode = gpu->regs.geom.prim_config.mode;
+
+    linfo("drawing %s %s nverts=%d, prim mode=%d",
+          elements ? "elements" : "arrays", immediate ? "immediate mode" : "",
+          nverts, primMode);
+
+    if (gpu->regs.fb.color_op.frag_mode == 3) {
+        lwarnonce("shadow map generation in software renderer");
+        Vec_free(gpu->immattrs);
+        return;
+    }
+
+    if (!update_cur_fb(gpu)) {
+        Vec_free(gpu->immattrs);
+        return;
+    }
+
+    // loading textures can flush the queue so the state is pushed after
+    SWDrawState st;
+    setup_draw_state(gpu, &st);
+    u32 stateidx = Vec_push(sw->states, st);
+
+    SetupParams params;
+    setup_params(gpu, &params, stateidx);
+
+    // starting  index
+    int basevert = immediate ? 0 : gpu->regs.geom.vtx_off;
+    // how many verts are sent to the VS (can be more than nverts for
+    // drawelements)
+    int nbufverts = nverts;
+
+    void* indexbuf = nullptr;
+    bool indexsize = gpu->regs.geom.indexfmt;
+    if (elements) {
+        u32 minind = 0xffff, maxind = 0;
+        indexbuf =
+            PTR(gpu->regs.geom.attr_base * 8 + gpu->regs.geom.indexbufoff);
+        for (int i = 0; i < gpu->regs.geom.nverts; i++) {
+            int idx;
+            if (indexsize) {
+                idx = ((u16*) indexbuf)[i];
+            } else {
+                idx = ((u8*) indexbuf)[i];
+            }
+            if (idx < minind) minind = idx;
+            if (idx > maxind) maxind = idx;
+        }
+        basevert = minind;
+        nbufverts = maxind + 1 - minind;
+    }
+
+    fvec4 vshout[nbufverts][16];
+    gpu_run_vsh(gpu, immediate, basevert, nbufverts, vshout);
+
+    fvec4(*fshin)[16] = vshout;
+
+    // geometry shader output is never indexed
+    bool outelements = elements;
+    ShaderUnit gsh;
+    gpu_init_gsh(gpu, &gsh);
+    if (gpu->regs.geom.config.use_gsh) {
+        gpu_run_gsh(gpu, &gsh, elements, basevert, nverts, vshout, indexsize,
+                    indexbuf);
+        fshin = gsh.gsh.outvtx.d;
+        basevert = 0;
+        nverts = gsh.gsh.outvtx.size;
+        nbufverts = nverts;
+        outelements = false;
+    }
+
+    if (sw->vtx.cap < nbufverts) Vec_resize(sw->vtx, nbufverts);
+    for (int i = 0; i < nbufverts; i++) {
+        gpu_write_outmap_vtx(gpu, &sw->vtx.d[i], fshin[i]);
+    }
+    Vec_free(gsh.gsh.outvtx);
+    Vec_free(gpu->immattrs);
+
+#define VTX(i)                                                                 \
+    (&sw->vtx.d[outelements ? (indexsize ? ((u16*) indexbuf)[i]                \
+                                         : ((u8*) indexbuf)[i]) -              \
+                                  basevert                                     \
+                            : (i)])
+
+    switch (primMode) {
+        case 1: // strip
+            for (int i = 0; i + 2 < nverts; i++) {
+                if (i & 1) {
+                    draw_triangle(sw, &params, VTX(i + 1), VTX(i), VTX(i + 2));
+                } else {
+                    draw_triangle(sw, &params, VTX(i), VTX(i + 1), VTX(i + 2));
+                }
+            }
+            break;
+        case 2: // fan
+            for (int i = 1; i + 1 < nverts; i++) {
+                draw_triangle(sw, &params, VTX(0), VTX(i), VTX(i + 1));
+            }
+            break;
+        default: // list and geometry primitives
+            for (int i = 0; i + 2 < nverts; i += 3) {
+                draw_triangle(sw, &params, VTX(i), VTX(i + 1), VTX(i + 2));
+            }
+            break;
+    }
+
+#undef VTX
+}
+
+// averages the pixels that are scaled down into one
+// coordinates are from the bottom left like gl
+static u32 read_fb_pixel(u8* base, FBInfo* fb, int x0, int y0, int sx,
+                         int sy) {
+    u32 sum[4] = {};
+    for (int y = y0; y < y0 + BIT(sy); y++) {
+        for (int x = x0; x < x0 + BIT(sx); x++) {
+            if (x >= fb->width || y < 0 || y >= fb->height) continue;
+            u32 c = read_color(
+                base + morton_swizzle(fb->width, x, fb->height - 1 - y) *
+                           fb->color_Bpp,
+                fb->color_fmt);
+            for (int k = 0; k < 4; k++) {
+                sum[k] += c >> 8 * k & 0xff;
+            }
+        }
+    }
+    int shift = sx + sy;
+    return RGBA(sum[0] >> shift, sum[1] >> shift, sum[2] >> shift,
+                sum[3] >> shift);
+}
+
+void gpu_sw_display_transfer(GPU* gpu, u32 paddr, int yoffdst, bool scalex,
+                             bool scaley, bool vflip, int screenid) {
+    FBInfo* fb = gpu_fbcache_find_within(gpu, paddr);
+    if (!fb) {
+        lwarnonce("could not find source fb at %08x", paddr);
+        return;
+    }
+    int yoffsrc = (paddr - fb->color_paddr) / (fb->color_Bpp * fb->width);
+
+    linfo("display transfer fb at %x to %s", paddr,
+          screenid == SCREEN_TOP ? "top" : "bot");
+
+    int yoff = yoffsrc + yoffdst;
+    int h = SCREEN_WIDTH(screenid);
+    int srcy0 = fb->height - (h << scaley) - yoff;
+
+    u8* base = PTR(fb->color_paddr);
+    u32* screen = gpu->sw.screens[screenid];
+    for (int y = 0; y < h; y++) {
+        int sy = srcy0 + ((vflip ? h - 1 - y : y) << scaley);
+        for (int x = 0; x < SCREEN_HEIGHT; x++) {
+            screen[y * SCREEN_HEIGHT + x] =
+                read_fb_pixel(base, fb, x << scalex, sy, scalex, scaley);
+        }
+    }
+
+    gpu_present_screen(gpu, screenid);
+}
+
+void gpu_sw_render_lcd_fb(GPU* gpu, u32 paddr, u32 fmt, int screenid) {
+    linfo("directly rendering lcd fb at %08x to screen %d", paddr, screenid);
+
+    u8* data = PTR(paddr);
+    int colorfmt = fmt & 7;
+    int Bpp = colorfmt_bpp[colorfmt];
+    if (colorfmt > 4) colorfmt = 0;
+
+    // the lcd framebuffer is linear with the top row first
+    int h = SCREEN_WIDTH(screenid);
+    u32* screen = gpu->sw.screens[screenid];
+    for (int y = 0; y < h; y++) {
+        for (int x = 0; x < SCREEN_HEIGHT; x++) {
+            screen[(h - 1 - y) * SCREEN_HEIGHT + x] =
+                read_color(data + (y * SCREEN_HEIGHT + x) * Bpp, colorfmt);
+        }
+    }
+
+    gpu_present_screen(gpu, screenid);
+}
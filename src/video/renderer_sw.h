@@ -0,0 +1,246 @@
+#ifndef RENDERER_SW_H
+#define RENDERER_SW_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "common.h"
+
+#include "gpuregs.h"
+
+#define MAX_RAST_THREADS 16
+
+// the framebuffer is split into tiles which are rasterized independently
+#define SW_TILE_SHIFT 5
+#define SW_TILE_SIZE BIT(SW_TILE_SHIFT)
+// framebuffers are at most 1024x1024
+#define SW_TILES_MAX (1024 >> SW_TILE_SHIFT)
+
+// color, texcoord0-2, texcoordw, normal, view, tangent
+#define SW_NATTR 20
+
+#define SW_SHADER_MAX 256
+
+typedef struct _GPU GPU;
+typedef union _Vertex Vertex;
+
+typedef float v4f __attribute__((vector_size(16)));
+typedef s32 v4i __attribute__((vector_size(16)));
+
+typedef struct {
+    u32* pixels; // rgba8, bottom row first
+    u16 width, height;
+    u8 wrap_s, wrap_t;
+    bool linear;
+    u32 border;
+} SWTexUnit;
+
+typedef v4f (*SWOperandRgb)(v4f s);
+typedef float (*SWOperandA)(v4f s);
+typedef v4f (*SWCombineRgb)(v4f a, v4f b, v4f c);
+typedef float (*SWCombineA)(float a, float b, float c);
+
+// the state the fragment pipeline of a draw is specialized for, this is
+// hashed to find the compiled pipeline like FragConfig is for gl
+typedef struct {
+    TexEnvRegs tev[6]; // without the colors
+    u32 bufupdate;
+    u32 texenable;
+    u32 tex2coord;
+    u32 tex0type;
+
+    u32 lighting;
+    u32 numlights;
+    u32 lightPerm;
+    u32 lightconfig[8];
+    u32 lconfig0;
+    u32 lconfig1;
+    u32 llutAbs;
+    u32 llutSel;
+    u32 llutScale;
+} SWFragConfig;
+
+// a tev stage with the operands and combiners it uses picked out
+typedef struct {
+    u8 stage;
+    bool combine; // false if the stage only passes the previous color on
+    bool bufrgb, bufa; // the buffer is updated with the input of the stage
+    bool dot3rgba;
+    u8 nrgb, na; // operands read by the combiners
+    u8 rgbsrc[3], asrc[3];
+    SWOperandRgb rgbop[3];
+    SWOperandA aop[3];
+    SWCombineRgb rgbcomb;
+    SWCombineA acomb;
+    float rgbscale, ascale;
+} SWTevStep;
+
+typedef struct {
+    u8 input;
+    bool abs;
+    float scale;
+} SWLutInput;
+
+// the fragment pipeline compiled from a SWFragConfig
+// stages that do nothing are dropped and only the inputs the stages read are
+// computed for each pixel
+typedef struct {
+    SWTevStep steps[6];
+    int nsteps;
+    int nattr; // attributes that need to be interpolated
+    bool usetex[3];
+    int tex0type;
+    bool tex2coord;
+
+    bool lighting;
+    int numlights;
+    struct {
+        u8 num; // index of the light for the luts and config bits
+        bool directional;
+        bool twosided;
+        bool g0, g1;
+        bool shadow;
+        bool spot;
+        bool distattn;
+    } light[8];
+    u8 luts; // LLUT_* that are read
+    SWLutInput lutin[8];
+    bool lutproj; // some lut reads dot(t, h_proj)
+    bool refl;
+    bool reflsplat; // only the red reflection lut is used for all channels
+    bool frprimary, frsecondary;
+    bool shadow;
+    bool shadowinv;
+    u8 shadowtex;
+    bool shadowprimary, shadowsecondary, shadowalpha;
+    u8 bumpmode;
+    u8 bumptex;
+    bool bumprecalc;
+    bool clamphighlights;
+} SWShader;
+
+typedef struct _SWShaderCacheEntry {
+    union {
+        u64 hash;
+        u64 key;
+    };
+    SWShader sh;
+
+    struct _SWShaderCacheEntry *next, *prev;
+} SWShaderCacheEntry;
+
+// everything about the pica state needed to shade and write the fragments
+// of a draw, this is captured when the draw is queued
+typedef struct {
+    SWTexUnit tex[3];
+    SWShader sh;
+
+    v4f tevcolor[6];
+    v4f bufcolor;
+
+    // in the order the lights are applied
+    struct {
+        v4f specular0;
+        v4f specular1;
+        v4f diffuse;
+        v4f ambient;
+        v4f vec;
+        v4f spotdir;
+        float attn_bias;
+        float attn_scale;
+    } light[8];
+    v4f ambient;
+    // the luts are read in place, draws are flushed before they are written
+    u16 (*lightluts)[256];
+
+    bool alphatest;
+    u8 alphafunc;
+    u8 alpharef;
+
+    bool fog;
+    bool fogzflip;
+    v4f fogcolor;
+    u16 foglut[129];
+
+    bool stenciltest;
+    u8 stencilfunc;
+    u8 stencilref;
+    u8 stencilmask;
+    u8 stencilwritemask;
+    u8 stencilop[3]; // fail, zfail, zpass
+
+    u8 depthfunc;
+    bool depthwrite;
+    u32 colormask;
+
+    bool blend;
+    u8 rgb_eq, a_eq;
+    u8 rgb_src, rgb_dst, a_src, a_dst;
+    v4f blendcolor;
+    u8 logicop;
+} SWDrawState;
+
+// a triangle after clipping and viewport transform
+// attributes are divided by w for perspective correct interpolation
+typedef struct {
+    float x[3], y[3];
+    float z[3];
+    float iw[3];
+    float attr[3][SW_NATTR];
+    int xmin, ymin, xmax, ymax;
+    u32 state;
+} SWTriangle;
+
+typedef struct {
+    // draws are queued and binned into tiles until the queue is flushed
+    Vec(SWDrawState) states;
+    Vec(SWTriangle) tris;
+    Vec(u32) bins[SW_TILES_MAX * SW_TILES_MAX];
+
+    // scratch space for the output vertices of a draw
+    Vec(Vertex) vtx;
+
+    LRUCache(SWShaderCacheEntry, SW_SHADER_MAX) shaders;
+
+    // framebuffer the queued triangles are drawn to
+    struct {
+        u32 color_paddr;
+        u32 depth_paddr;
+        u32 width, height;
+        u32 color_fmt;
+        u32 depth_fmt;
+        int tilesx, tilesy;
+
+        u8* color;
+        u8* depth;
+    } fb;
+
+    struct {
+        pthread_t threads[MAX_RAST_THREADS];
+        int nthreads;
+
+        pthread_mutex_t lock;
+        pthread_cond_t start;
+        pthread_cond_t done;
+        u32 gen;
+        int busy;
+        bool die;
+
+        volatile atomic_int nexttile;
+    } runner;
+
+    // rgba8 images of the screens, bottom row first
+    u32* screens[2];
+} SWState;
+
+void renderer_sw_init(SWState* state, GPU* gpu);
+void renderer_sw_destroy(SWState* state, GPU* gpu);
+
+void gpu_sw_display_transfer(GPU* gpu, u32 paddr, int yoff, bool scalex,
+                             bool scaley, bool vflip, int screenid);
+void gpu_sw_render_lcd_fb(GPU* gpu, u32 paddr, u32 fmt, int screenid);
+
+void gpu_sw_draw(GPU* gpu, bool elements, bool immediate);
+void gpu_sw_flush_draws(GPU* gpu);
+
+#endif
@@ -20,6 +20,7 @@ typedef struct {
     u32 curblockstart;
     u32 curblockend;
     int out_view; // for freecam
+    bool specialize; // bool and int uniforms are constants
 } DecCTX;
 
 void dec_block(DecCTX* ctx, u32 start, u32 num);
@@ -206,6 +207,15 @@ void decdestend(DecCTX* ctx, u8 mask) {
         }                                                                      \
     })
 
+void decbool(DecCTX* ctx, u32 c, bool inv) {
+    if (ctx->specialize) {
+        bool val = (ctx->shu.b & BIT(c)) != 0;
+        ds_printf(&ctx->s, "%s", val != inv ? "true" : "false");
+    } else {
+        ds_printf(&ctx->s, "%sb(%d)", inv ? "!" : "", c);
+    }
+}
+
 bool contains_jmp_out(DecCTX* ctx, u32 start, u32 end) {
     for (int pc = start; pc < end; pc++) {
         PICAInstr instr = ctx->shu.code[pc];
@@ -431,13 +441,20 @@ u32 dec_instr(DecCTX* ctx, u32 pc) {
         case PICA_CALL:
         case PICA_CALLC:
         case PICA_CALLU: {
+            if (instr.opcode == PICA_CALLU && ctx->specialize) {
+                if (!(ctx->shu.b & BIT(instr.fmt3.c))) {
+                    ds_printf(&ctx->s, "\n");
+                    break;
+                }
+                instr.opcode = PICA_CALL;
+            }
             if (instr.opcode != PICA_CALL) {
                 ds_printf(&ctx->s, "if (");
                 if (instr.opcode == PICA_CALLC) {
                     deccondop(ctx, instr.fmt2.op, instr.fmt2.refx,
                               instr.fmt2.refy);
                 } else {
-                    ds_printf(&ctx->s, "b(%d)", instr.fmt3.c);
+                    decbool(ctx, instr.fmt3.c, false);
                 }
                 ds_printf(&ctx->s, ") ");
             }
@@ -458,9 +475,22 @@ u32 dec_instr(DecCTX* ctx, u32 pc) {
         }
         case PICA_IFU:
         case PICA_IFC: {
+            if (instr.opcode == PICA_IFU && ctx->specialize) {
+                // only emit the side that is taken
+                ds_printf(&ctx->s, "{\n");
+                if (ctx->shu.b & BIT(instr.fmt3.c)) {
+                    dec_block(ctx, pc, instr.fmt2.dest - pc);
+                } else if (instr.fmt2.num) {
+                    dec_block(ctx, instr.fmt2.dest, instr.fmt2.num);
+                }
+                INDENT(ctx->depth);
+                ds_printf(&ctx->s, "}\n");
+                pc = instr.fmt2.dest + instr.fmt2.num;
+                break;
+            }
             ds_printf(&ctx->s, "if (");
             if (instr.opcode == PICA_IFU) {
-                ds_printf(&ctx->s, "b(%d)", instr.fmt3.c);
+                decbool(ctx, instr.fmt3.c, false);
             } else {
                 deccondop(ctx, instr.fmt2.op, instr.fmt2.refx, instr.fmt2.refy);
             }
@@ -477,6 +507,21 @@ u32 dec_instr(DecCTX* ctx, u32 pc) {
             break;
         }
         case PICA_LOOP: {
+            if (ctx->specialize) {
+                // constant bounds so the loop can be unrolled
+                u8* iu = ctx->shu.i[instr.fmt3.c & 3];
+                ds_printf(&ctx->s, "aL = %du;\n", iu[1]);
+                INDENT(ctx->depth);
+                ds_printf(&ctx->s,
+                          "for (uint l = 0u; l <= %du; l++, aL = (aL + %du) & "
+                          "0xffu) {\n",
+                          iu[0], iu[2]);
+                dec_block(ctx, pc, instr.fmt3.dest + 1 - pc);
+                INDENT(ctx->depth);
+                ds_printf(&ctx->s, "}\n");
+                pc = instr.fmt3.dest + 1;
+                break;
+            }
             ds_printf(&ctx->s, "aL = i[%d].y;\n", instr.fmt3.c);
             INDENT(ctx->depth);
             ds_printf(&ctx->s,
@@ -515,8 +560,7 @@ u32 dec_instr(DecCTX* ctx, u32 pc) {
                     deccondop(ctx, instr.fmt2.op, instr.fmt2.refx,
                               instr.fmt2.refy);
                 } else {
-                    ds_printf(&ctx->s, "%sb(%d)", instr.fmt3.num & 1 ? "!" : "",
-                              instr.fmt3.c);
+                    decbool(ctx, instr.fmt3.c, instr.fmt3.num & 1);
                 }
                 ds_printf(&ctx->s, ") {\n");
                 dec_block(ctx, dst, ctx->curfuncend - dst);
@@ -540,8 +584,7 @@ u32 dec_instr(DecCTX* ctx, u32 pc) {
                         deccondop(ctx, instr.fmt2.op, instr.fmt2.refx,
                                   instr.fmt2.refy);
                     } else {
-                        ds_printf(&ctx->s, "%sb(%d)",
-                                  instr.fmt3.num & 1 ? "!" : "", instr.fmt3.c);
+                        decbool(ctx, instr.fmt3.c, instr.fmt3.num & 1);
                     }
                     ds_printf(&ctx->s, ")) {\n");
                     dec_block(ctx, pc, dst - pc);
@@ -660,6 +703,9 @@ char* shader_dec_vs(GPU* gpu) {
     ctx.shu.code = (PICAInstr*) gpu->vsh.progdata;
     ctx.shu.opdescs = (OpDesc*) gpu->vsh.opdescs;
     ctx.shu.entrypoint = gpu->regs.vsh.entrypoint;
+    ctx.shu.i = gpu->regs.vsh.intuniform;
+    ctx.shu.b = gpu->regs.vsh.booluniform;
+    ctx.specialize = ctremu.specializeShaders;
 
     ctx.out_view = -1;
     for (int o = 0; o < 7; o++) {
@@ -196,6 +196,8 @@ typedef struct _FSHCacheEntry {
     struct _FSHCacheEntry *next, *prev;
 } FSHCacheEntry;
 
+extern const u8 lightenvEnabledLuts[8];
+
 char* shader_gen_fs(FragConfig* fcfg);
 
 #endif
@@ -1,23 +1,174 @@
 #include "shaderjit.h"
 
+#include "emulator.h"
+#include "perfmap.h"
 #include "video/gpu.h"
 #include "video/gpu_hash.h"
 
 #include "shaderjit_backend.h"
 
+static void free_variants(ShaderJitBlock* block) {
+    for (int i = 0; i < SHADERJIT_VARIANTS; i++) {
+        shaderjit_backend_free(block->variants.d[i].backend);
+    }
+    memset(&block->variants, 0, sizeof block->variants);
+    LRU_init(block->variants);
+}
+
 ShaderJitFunc shaderjit_get(GPU* gpu, ShaderUnit* shu) {
     u64 hash = gpu_hash_sw_shader(shu);
     auto block = LRU_load(gpu->vshaders_sw, hash);
     if (block->hash != hash) {
         block->hash = hash;
-        shaderjit_backend_free(block->backend);
-        block->backend = shaderjit_backend_init();
+        free_variants(block);
     }
-    return shaderjit_backend_get_code(block->backend, shu);
+    // specialized variants have the bool and int uniforms compiled in
+    // their keys are odd so they never match the generic variant
+    bool specialize = ctremu.specializeShaders;
+    u64 key = specialize ? gpu_hash_sw_shader_uniforms(shu) | 1 : 2;
+    auto variant = LRU_load(block->variants, key);
+    if (variant->key != key) {
+        variant->key = key;
+        shaderjit_backend_free(variant->backend);
+        variant->backend = shaderjit_backend_init(specialize);
+    }
+    return shaderjit_backend_get_code(variant->backend, shu);
 }
 
 void shaderjit_free_all(GPU* gpu) {
     for (int i = 0; i < VSH_MAX; i++) {
-        shaderjit_backend_free(gpu->vshaders_sw.d[i].backend);
+        free_variants(&gpu->vshaders_sw.d[i]);
     }
-}
\ No newline at end of file
+}
+
+// called by the backends whenever a shader is (re)compiled
+void shaderjit_add_perfmap(void* code, size_t size, ShaderUnit* shu) {
+    if (!g_perfmap) return;
+    perfmap_add_shader(code, size, gpu_hash_sw_shader(shu));
+}
+
+#define LOOP_WEIGHT_SHIFT 3
+#define MAX_WEIGHT_SHIFT 12
+
+static void count_src(u32* uses, u32 n, u32 weight) {
+    if (n >= 0x10 && n < 0x20) uses[n] += weight;
+}
+
+// adds up how often each output (0x00-0x0f) and temporary (0x10-0x1f)
+// register is accessed by the code reachable from entry, with accesses inside
+// loops weighted higher
+// this walks the code the same way the backends compile it, including every
+// function that gets called, so the backends can pick which registers to keep
+// in host registers for the whole shader
+void shaderjit_count_reg_uses(ShaderUnit* shu, u32 entry, u32* uses) {
+    struct {
+        u32 start, end, shift;
+    } funcs[SHADER_CODE_SIZE];
+    bool seen[SHADER_CODE_SIZE] = {};
+    int nfuncs = 0;
+
+    funcs[nfuncs++] = (typeof(funcs[0])) {entry, SHADER_CODE_SIZE, 0};
+    for (int f = 0; f < nfuncs; f++) {
+        u32 pc = funcs[f].start;
+        u32 end = funcs[f].end;
+        if (end > SHADER_CODE_SIZE) end = SHADER_CODE_SIZE;
+        u32 farthestjmp = 0;
+        // ends of the enclosing if and loop blocks, an end instruction inside
+        // one only leaves that block so we keep going
+        u32 blockend[SHADER_CODE_SIZE];
+        bool blockloop[SHADER_CODE_SIZE];
+        int depth = 0;
+        u32 loops = 0;
+        while (pc < end) {
+            while (depth && pc >= blockend[depth - 1]) {
+                if (blockloop[--depth]) loops--;
+            }
+            u32 shift = funcs[f].shift + loops * LOOP_WEIGHT_SHIFT;
+            if (shift > MAX_WEIGHT_SHIFT) shift = MAX_WEIGHT_SHIFT;
+            u32 weight = 1 << shift;
+
+            PICAInstr instr = shu->code[pc++];
+            switch (instr.opcode) {
+                case PICA_ADD ... PICA_MOV:
+                    count_src(uses, instr.fmt1.src1, weight);
+                    count_src(uses, instr.fmt1.src2, weight);
+                    if (instr.opcode != PICA_MOVA)
+                        uses[instr.fmt1.dest] += weight;
+                    break;
+                case PICA_DPHI ... PICA_SLTI:
+                    count_src(uses, instr.fmt1i.src1, weight);
+                    count_src(uses, instr.fmt1i.src2, weight);
+                    uses[instr.fmt1i.dest] += weight;
+                    break;
+                case PICA_CMP ... PICA_CMP + 1:
+                    count_src(uses, instr.fmt1c.src1, weight);
+                    count_src(uses, instr.fmt1c.src2, weight);
+                    break;
+                case PICA_MAD ... PICA_MAD + 0xf:
+                    count_src(uses, instr.fmt5.src1, weight);
+                    if (instr.fmt5.opcode & 1) {
+                        count_src(uses, instr.fmt5.src2, weight);
+                        count_src(uses, instr.fmt5.src3, weight);
+                    } else {
+                        count_src(uses, instr.fmt5i.src2, weight);
+                        count_src(uses, instr.fmt5i.src3, weight);
+                    }
+                    uses[instr.fmt5.dest] += weight;
+                    break;
+                case PICA_CALL:
+                case PICA_CALLC:
+                case PICA_CALLU:
+                    if (instr.fmt2.dest < SHADER_CODE_SIZE &&
+                        !seen[instr.fmt2.dest]) {
+                        seen[instr.fmt2.dest] = true;
+                        funcs[nfuncs++] = (typeof(funcs[0])) {
+                            instr.fmt2.dest, instr.fmt2.dest + instr.fmt2.num,
+                            shift};
+                    }
+                    break;
+                case PICA_IFU:
+                case PICA_IFC:
+                    blockloop[depth] = false;
+                    blockend[depth++] = instr.fmt2.dest + instr.fmt2.num;
+                    break;
+                case PICA_LOOP:
+                    blockloop[depth] = true;
+                    blockend[depth++] = instr.fmt3.dest + 1;
+                    loops++;
+                    break;
+                case PICA_JMPC:
+                case PICA_JMPU:
+                    if (instr.fmt3.dest > farthestjmp)
+                        farthestjmp = instr.fmt3.dest;
+                    break;
+                case PICA_END:
+                    if (!depth && farthestjmp < pc) pc = end;
+                    break;
+            }
+        }
+    }
+}
+
+// whether any jump in the program lands in [start, end)
+// blocks that are jumped into can't be dropped or duplicated
+bool shaderjit_jumps_into(ShaderUnit* shu, u32 start, u32 end) {
+    for (int pc = 0; pc < SHADER_CODE_SIZE; pc++) {
+        PICAInstr instr = shu->code[pc];
+        if (instr.opcode == PICA_JMPC || instr.opcode == PICA_JMPU) {
+            if (start <= instr.fmt3.dest && instr.fmt3.dest < end) return true;
+        }
+    }
+    return false;
+}
+
+// a loop with a known count can be unrolled if it is short and its body is
+// only arithmetic, so the copies need no labels of their own
+bool shaderjit_can_unroll(ShaderUnit* shu, u32 start, u32 len, u32 iters) {
+    if (iters * len > SHADERJIT_UNROLL_MAX) return false;
+    if (start + len > SHADER_CODE_SIZE) return false;
+    for (u32 pc = start; pc < start + len; pc++) {
+        u32 op = shu->code[pc].opcode;
+        if (op >= PICA_BREAK && op < PICA_CMP && op != PICA_NOP) return false;
+    }
+    return !shaderjit_jumps_into(shu, start, start + len);
+}
@@ -8,12 +8,24 @@ typedef struct _GPU GPU;
 
 typedef void (*ShaderJitFunc)(ShaderUnit* shu);
 
+// most loops this long or shorter are unrolled in specialized shaders
+#define SHADERJIT_UNROLL_MAX 64
+#define SHADERJIT_VARIANTS 8
+
+// a program compiled for one set of bool and int uniforms
+typedef struct _ShaderJitVariant {
+    u64 key;
+    void* backend;
+
+    struct _ShaderJitVariant *next, *prev;
+} ShaderJitVariant;
+
 typedef struct _ShaderJitBlock {
     union {
         u64 hash;
         u64 key;
     };
-    void* backend;
+    LRUCache(ShaderJitVariant, SHADERJIT_VARIANTS) variants;
 
     struct _ShaderJitBlock *next, *prev;
 } ShaderJitBlock;
@@ -21,4 +33,10 @@ typedef struct _ShaderJitBlock {
 ShaderJitFunc shaderjit_get(GPU* gpu, ShaderUnit* shu);
 void shaderjit_free_all(GPU* gpu);
 
+void shaderjit_add_perfmap(void* code, size_t size, ShaderUnit* shu);
+
+void shaderjit_count_reg_uses(ShaderUnit* shu, u32 entry, u32* uses);
+bool shaderjit_jumps_into(ShaderUnit* shu, u32 start, u32 end);
+bool shaderjit_can_unroll(ShaderUnit* shu, u32 start, u32 len, u32 iters);
+
 #endif
@@ -27,8 +27,11 @@
 // R11-R17 : temp
 // V0-V7 : temp
 
-ArmShaderJitBackend* shaderjit_arm_init() {
-    return calloc(1, sizeof(ArmShaderJitBackend));
+ArmShaderJitBackend* shaderjit_arm_init(bool specialize) {
+    ArmShaderJitBackend* this = calloc(1, sizeof(ArmShaderJitBackend));
+    this->specialize = specialize;
+    this->constal = -1;
+    return this;
     // the ras code is initialized each time we have to recompile
     // for a new entrypoint
 }
@@ -48,6 +51,8 @@ static rasA64VReg readsrc(ArmShaderJitBackend* this, rasA64VReg dst, u32 n, u8 i
         n -= 0x20;
         if (idx == 0) {
             LDRQ(src, (reg_c, 16 * n));
+        } else if (idx == 3 && this->constal >= 0) {
+            LDRQ(src, (reg_c, 16 * ((n + this->constal) & 0x7f)));
         } else {
             MOVW(R11, n);
             switch (idx) {
@@ -110,14 +115,23 @@ static rasA64VReg readsrc(ArmShaderJitBackend* this, rasA64VReg dst, u32 n, u8 i
     }
 }
 
+// pinned outputs are kept in the register of a temporary the shader never
+// uses, so they are written the same way as temporaries
+static int mapdest(ArmShaderJitBackend* this, int n) {
+    if (n < 0x10 && this->outregs[n] >= 0) return 0x10 + this->outregs[n];
+    return n;
+}
+
 // dest is either V0 or V16-V31
-static rasA64VReg getdest(int n, u8 mask) {
+static rasA64VReg getdest(ArmShaderJitBackend* this, int n, u8 mask) {
+    n = mapdest(this, n);
     if (n >= 0x10 && mask == 0b1111) return V(reg_r + n - 0x10);
     else return V0;
 }
 
 // the result will be in V0
 static void writedest(ArmShaderJitBackend* this, int n, u8 mask) {
+    n = mapdest(this, n);
     if (mask == 0b1111) {
         if (n < 0x10) {
             STRQ(V0, (reg_o, 16 * n));
@@ -248,9 +262,16 @@ static void setupMul(ArmShaderJitBackend* this, rasA64VReg src1, rasA64VReg src2
 #define SRC1(fmt) SRC(V0, 1, fmt)
 #define SRC2(fmt) SRC(V1, 2, fmt)
 #define SRC3(fmt) SRC(V2, 3, fmt)
-#define GETDST(_fmt) getdest(instr.fmt##_fmt.dest, desc.destmask)
+#define GETDST(_fmt) getdest(this, instr.fmt##_fmt.dest, desc.destmask)
 #define STRDST(_fmt) writedest(this, instr.fmt##_fmt.dest, desc.destmask)
 
+static void storeOutputs(ArmShaderJitBackend* this) {
+    for (int n = 0; n < 0x10; n++) {
+        if (this->outregs[n] >= 0)
+            STRQ(V(reg_r + this->outregs[n]), (reg_o, 16 * n));
+    }
+}
+
 static void compileBlock(ArmShaderJitBackend* this, ShaderUnit* shu, u32 start,
                          u32 len, bool isfunction) {
     u32 pc = start;
@@ -258,7 +279,7 @@ static void compileBlock(ArmShaderJitBackend* this, ShaderUnit* shu, u32 start,
     if (end > SHADER_CODE_SIZE) end = SHADER_CODE_SIZE;
     u32 farthestjmp = 0;
     while (pc < end) {
-        L(this->jmplabels.d[pc]);
+        if (!this->unrolled) L(this->jmplabels.d[pc]);
 
         if (pc == start && isfunction) {
             PUSH(LR, ZR);
@@ -476,6 +497,7 @@ static void compileBlock(ArmShaderJitBackend* this, ShaderUnit* shu, u32 start,
                 // if this is not the final end, we just jump to the end label
                 if (farthestjmp < pc) return;
                 else {
+                    if (!isfunction) storeOutputs(this);
                     POP(LR, ZR);
                     RET();
                     break;
@@ -483,6 +505,10 @@ static void compileBlock(ArmShaderJitBackend* this, ShaderUnit* shu, u32 start,
             case PICA_CALL:
             case PICA_CALLC:
             case PICA_CALLU: {
+                if (instr.opcode == PICA_CALLU && this->specialize) {
+                    if (!(shu->b & BIT(instr.fmt3.c))) break;
+                    instr.opcode = PICA_CALL;
+                }
                 LABEL(lelse);
                 if (instr.opcode == PICA_CALLU) {
                     TBZ(reg_b, instr.fmt3.c, lelse);
@@ -512,6 +538,28 @@ static void compileBlock(ArmShaderJitBackend* this, ShaderUnit* shu, u32 start,
             }
             case PICA_IFU:
             case PICA_IFC: {
+                if (instr.opcode == PICA_IFU && this->specialize) {
+                    // only compile the side that is taken, unless something
+                    // jumps into the other one
+                    u32 elseend = instr.fmt2.dest + instr.fmt2.num;
+                    if (shu->b & BIT(instr.fmt3.c)) {
+                        if (!shaderjit_jumps_into(shu, instr.fmt2.dest,
+                                                  elseend)) {
+                            compileBlock(this, shu, pc, instr.fmt2.dest - pc,
+                                         false);
+                            pc = elseend;
+                            break;
+                        }
+                    } else {
+                        if (!shaderjit_jumps_into(shu, pc, instr.fmt2.dest)) {
+                            compileBlock(this, shu, instr.fmt2.dest,
+                                         instr.fmt2.num, false);
+                            pc = elseend;
+                            break;
+                        }
+                    }
+                }
+
                 LABEL(lelse);
                 LABEL(lendif);
                 if (instr.opcode == PICA_IFU) {
@@ -540,6 +588,28 @@ static void compileBlock(ArmShaderJitBackend* this, ShaderUnit* shu, u32 start,
                 break;
             }
             case PICA_LOOP: {
+                if (this->specialize) {
+                    u8* iu = shu->i[instr.fmt3.c & 3];
+                    u32 len = instr.fmt3.dest + 1 - pc;
+                    u32 iters = iu[0] + 1;
+                    if (shaderjit_can_unroll(shu, pc, len, iters)) {
+                        // repeat the body with aL as a constant
+                        u8 al = iu[1];
+                        for (u32 i = 0; i < iters; i++) {
+                            this->constal = al;
+                            compileBlock(this, shu, pc, len, false);
+                            this->unrolled = true;
+                            al += iu[2];
+                        }
+                        this->constal = -1;
+                        this->unrolled = false;
+                        MOVW(reg_al, al);
+
+                        pc = instr.fmt3.dest + 1;
+                        break;
+                    }
+                }
+
                 LABEL(loop);
 
                 PUSH(loopcount, ZR);
@@ -564,7 +634,11 @@ static void compileBlock(ArmShaderJitBackend* this, ShaderUnit* shu, u32 start,
             case PICA_JMPC:
             case PICA_JMPU: {
                 auto jmplab = this->jmplabels.d[instr.fmt3.dest];
-                if (instr.opcode == PICA_JMPU) {
+                if (instr.opcode == PICA_JMPU && this->specialize) {
+                    if (!(shu->b & BIT(instr.fmt3.c)) == !(instr.fmt2.num & 1))
+                        break;
+                    B(jmplab);
+                } else if (instr.opcode == PICA_JMPU) {
                     TSTW(reg_b, BIT(instr.fmt3.c));
                     if (instr.fmt2.num & 1) {
                         TBZ(reg_b, instr.fmt3.c, jmplab);
@@ -768,6 +842,31 @@ static void compileLg2(ArmShaderJitBackend* this) {
     RET();
 }
 
+// temporaries always live in V16-V31, so the registers of any the shader does
+// not use can hold the most used outputs instead
+// the assignment is the same for every entrypoint and function so nothing
+// needs to be spilled around calls and loops
+// pinned outputs are loaded on entry and stored on exit so they need to be
+// written more than once to be worth it
+static void allocRegs(ArmShaderJitBackend* this, ShaderUnit* shu) {
+    u32 uses[0x20] = {};
+    Vec_foreach(e, this->entrypoints) {
+        shaderjit_count_reg_uses(shu, e->pc, uses);
+    }
+
+    memset(this->outregs, -1, sizeof this->outregs);
+    for (int t = 0; t < 0x10; t++) {
+        if (uses[0x10 + t]) continue;
+        int best = -1;
+        for (int n = 0; n < 0x10; n++) {
+            if (uses[n] > 1 && (best < 0 || uses[n] > uses[best])) best = n;
+        }
+        if (best < 0) break;
+        this->outregs[best] = t;
+        uses[best] = 0;
+    }
+}
+
 static rasLabel compileWithEntry(ArmShaderJitBackend* this, ShaderUnit* shu,
                                  u32 entry) {
     // this is so we only compile any functions that were not already compiled
@@ -783,9 +882,14 @@ static rasLabel compileWithEntry(ArmShaderJitBackend* this, ShaderUnit* shu,
     LDRX(reg_c, (R11, offsetof(ShaderUnit, c)));
     LDRX(reg_i, (R11, offsetof(ShaderUnit, i)));
     LDRH(reg_b, (R11, offsetof(ShaderUnit, b)));
+    for (int n = 0; n < 0x10; n++) {
+        if (this->outregs[n] >= 0)
+            LDRQ(V(reg_r + this->outregs[n]), (reg_o, 16 * n));
+    }
 
     compileBlock(this, shu, entry, SHADER_CODE_SIZE, false);
 
+    storeOutputs(this);
     POP(LR, ZR);
     RET();
 
@@ -821,6 +925,8 @@ ShaderJitFunc shaderjit_arm_get_code(ArmShaderJitBackend* this,
     this->lg2func = rasDeclareLabel(this->code);
     this->usinglg2 = false;
 
+    allocRegs(this, shu);
+
     Vec_foreach(e, this->entrypoints) {
         e->lab = compileWithEntry(this, shu, e->pc);
     }
@@ -833,6 +939,8 @@ ShaderJitFunc shaderjit_arm_get_code(ArmShaderJitBackend* this,
 
     rasReady(this->code);
 
+    shaderjit_add_perfmap(rasGetCode(this->code), rasGetSize(this->code), shu);
+
 #ifdef JIT_DISASM
     pica_shader_disasm(shu);
     shaderjit_arm_disassemble((void*) this);
@@ -22,9 +22,19 @@ typedef struct {
     rasLabel ex2func, lg2func;
     bool usingex2, usinglg2;
 
+    // temporary whose register each output is pinned to or -1
+    s8 outregs[0x10];
+
+    // bool and int uniforms are constants
+    bool specialize;
+    // value of aL in an unrolled loop or -1
+    int constal;
+    // compiling a repeated copy of a loop body
+    bool unrolled;
+
 } ArmShaderJitBackend;
 
-ArmShaderJitBackend* shaderjit_arm_init();
+ArmShaderJitBackend* shaderjit_arm_init(bool specialize);
 ShaderJitFunc shaderjit_arm_get_code(ArmShaderJitBackend* backend,
                                      ShaderUnit* shu);
 void shaderjit_arm_free(ArmShaderJitBackend* backend);
@@ -3,7 +3,8 @@
 
 #ifdef __x86_64__
 #include "shaderjit_x86.h"
-#define shaderjit_backend_init() shaderjit_x86_init()
+// specialized backends compile in the bool and int uniforms of the shu
+#define shaderjit_backend_init(specialize) shaderjit_x86_init(specialize)
 // gets the code for the current entrypoint of this shader (set in shu)
 #define shaderjit_backend_get_code(backend, shu)                               \
     shaderjit_x86_get_code(backend, shu)
@@ -12,7 +13,8 @@
     shaderjit_x86_disassemble(backend)
 #elifdef __aarch64__
 #include "shaderjit_arm.h"
-#define shaderjit_backend_init() shaderjit_arm_init()
+// specialized backends compile in the bool and int uniforms of the shu
+#define shaderjit_backend_init(specialize) shaderjit_arm_init(specialize)
 // gets the code for the current entrypoint of this shader (set in shu)
 #define shaderjit_backend_get_code(backend, shu)                               \
     shaderjit_arm_get_code(backend, shu)
@@ -28,23 +28,33 @@
 #define ones XMM5
 #define tmp XMM3
 #define loopcounter R12
-
-X86ShaderJitBackend* shaderjit_x86_init() {
-    return calloc(1, sizeof(X86ShaderJitBackend));
+// XMM8-XMM15 : pinned outputs/temporaries
+#define PINNED_BASE 8
+#define PINNED_MAX 8
+
+X86ShaderJitBackend* shaderjit_x86_init(bool specialize) {
+    X86ShaderJitBackend* this = calloc(1, sizeof(X86ShaderJitBackend));
+    this->specialize = specialize;
+    this->constal = -1;
+    return this;
 }
 
 static void readsrc(X86ShaderJitBackend* this, rasX64Xmm dst, u32 n, u8 idx,
                     u8 swizzle, bool neg) {
     rasX64Mem addr;
+    int hostreg = -1;
     if (n < 0x10) {
         addr = PTR(16 * n, reg_v);
     } else if (n < 0x20) {
+        hostreg = this->hostregs[n];
         n -= 0x10;
         addr = PTR(16 * n, reg_r);
     } else {
         n -= 0x20;
         if (idx == 0) {
             addr = PTR(16 * n, reg_c);
+        } else if (idx == 3 && this->constal >= 0) {
+            addr = PTR(16 * ((n + this->constal) & 0x7f), reg_c);
         } else {
             switch (idx) {
                 case 1:
@@ -68,9 +78,11 @@ static void readsrc(X86ShaderJitBackend* this, rasX64Xmm dst, u32 n, u8 idx,
         // pica swizzles are backwards
         swizzle = (swizzle & 0xcc) >> 2 | (swizzle & 0x33) << 2;
         swizzle = (swizzle & 0xf0) >> 4 | (swizzle & 0x0f) << 4;
-        PSHUFD(dst, addr, swizzle);
+        if (hostreg >= 0) PSHUFD(dst, XMM(hostreg), swizzle);
+        else PSHUFD(dst, addr, swizzle);
     } else {
-        MOVAPS(dst, addr);
+        if (hostreg >= 0) MOVAPS(dst, XMM(hostreg));
+        else MOVAPS(dst, addr);
     }
     if (neg) {
         XORPS(dst, negmask);
@@ -79,6 +91,18 @@ static void readsrc(X86ShaderJitBackend* this, rasX64Xmm dst, u32 n, u8 idx,
 
 static void writedest(X86ShaderJitBackend* this, rasX64Xmm src, int n,
                       u8 mask) {
+    int hostreg = this->hostregs[n];
+    if (hostreg >= 0) {
+        if (mask != 0b1111) {
+            mask = (mask & 0b1010) >> 1 | (mask & 0b0101) << 1;
+            mask = (mask & 0b1100) >> 2 | (mask & 0b0011) << 2;
+            BLENDPS(XMM(hostreg), src, mask);
+        } else {
+            MOVAPS(XMM(hostreg), src);
+        }
+        return;
+    }
+
     rasX64Mem addr;
     if (n < 0x10) {
         addr = PTR(16 * n, reg_o);
@@ -179,7 +203,7 @@ static void compileBlock(X86ShaderJitBackend* this, ShaderUnit* shu, u32 start,
     if (end > SHADER_CODE_SIZE) end = SHADER_CODE_SIZE;
     u32 farthestjmp = 0;
     while (pc < end) {
-        L(this->jmplabels.d[pc]);
+        if (!this->unrolled) L(this->jmplabels.d[pc]);
 
         PICAInstr instr = shu->code[pc++];
         OpDesc desc = shu->opdescs[instr.desc];
@@ -340,6 +364,10 @@ static void compileBlock(X86ShaderJitBackend* this, ShaderUnit* shu, u32 start,
             case PICA_CALL:
             case PICA_CALLC:
             case PICA_CALLU: {
+                if (instr.opcode == PICA_CALLU && this->specialize) {
+                    if (!(shu->b & BIT(instr.fmt3.c))) break;
+                    instr.opcode = PICA_CALL;
+                }
                 LABEL(lelse);
                 if (instr.opcode == PICA_CALLU) {
                     TESTW(reg_b, BIT(instr.fmt3.c));
@@ -366,6 +394,27 @@ static void compileBlock(X86ShaderJitBackend* this, ShaderUnit* shu, u32 start,
             }
             case PICA_IFU:
             case PICA_IFC: {
+                if (instr.opcode == PICA_IFU && this->specialize) {
+                    // only compile the side that is taken, unless something
+                    // jumps into the other one
+                    u32 elseend = instr.fmt2.dest + instr.fmt2.num;
+                    if (shu->b & BIT(instr.fmt3.c)) {
+                        if (!shaderjit_jumps_into(shu, instr.fmt2.dest,
+                                                  elseend)) {
+                            compileBlock(this, shu, pc, instr.fmt2.dest - pc);
+                            pc = elseend;
+                            break;
+                        }
+                    } else {
+                        if (!shaderjit_jumps_into(shu, pc, instr.fmt2.dest)) {
+                            compileBlock(this, shu, instr.fmt2.dest,
+                                         instr.fmt2.num);
+                            pc = elseend;
+                            break;
+                        }
+                    }
+                }
+
                 LABEL(lelse);
                 LABEL(lendif);
 
@@ -391,6 +440,28 @@ static void compileBlock(X86ShaderJitBackend* this, ShaderUnit* shu, u32 start,
                 break;
             }
             case PICA_LOOP: {
+                if (this->specialize) {
+                    u8* iu = shu->i[instr.fmt3.c & 3];
+                    u32 len = instr.fmt3.dest + 1 - pc;
+                    u32 iters = iu[0] + 1;
+                    if (shaderjit_can_unroll(shu, pc, len, iters)) {
+                        // repeat the body with aL as a constant
+                        u8 al = iu[1];
+                        for (u32 i = 0; i < iters; i++) {
+                            this->constal = al;
+                            compileBlock(this, shu, pc, len);
+                            this->unrolled = true;
+                            al += iu[2];
+                        }
+                        this->constal = -1;
+                        this->unrolled = false;
+                        MOVB(reg_al, al);
+
+                        pc = instr.fmt3.dest + 1;
+                        break;
+                    }
+                }
+
                 LABEL(lloop);
 
                 PUSH(loopcounter);
@@ -413,7 +484,11 @@ static void compileBlock(X86ShaderJitBackend* this, ShaderUnit* shu, u32 start,
             }
             case PICA_JMPC:
             case PICA_JMPU: {
-                if (instr.opcode == PICA_JMPU) {
+                if (instr.opcode == PICA_JMPU && this->specialize) {
+                    if (!(shu->b & BIT(instr.fmt3.c)) == !(instr.fmt3.num & 1))
+                        break;
+                    JMP(this->jmplabels.d[instr.fmt3.dest], NEAR);
+                } else if (instr.opcode == PICA_JMPU) {
                     TESTW(reg_b, BIT(instr.fmt3.c));
                     if (instr.fmt3.num & 1) {
                         JZ(this->jmplabels.d[instr.fmt3.dest], NEAR);
@@ -635,6 +710,40 @@ static void compileLg2(X86ShaderJitBackend* this) {
     RET();
 }
 
+// keep the most used outputs and temporaries in XMM8-XMM15
+// the assignment is the same for every entrypoint and function so nothing
+// needs to be spilled around calls and loops
+// pinned outputs are loaded on entry and stored on exit so they need to be
+// written more than once to be worth it
+static void allocRegs(X86ShaderJitBackend* this, ShaderUnit* shu) {
+    u32 uses[0x20] = {};
+    Vec_foreach(e, this->entrypoints) {
+        shaderjit_count_reg_uses(shu, e->pc, uses);
+    }
+    for (int n = 0; n < 0x10; n++) {
+        if (uses[n]) uses[n]--;
+    }
+
+    memset(this->hostregs, -1, sizeof this->hostregs);
+    this->npinned = 0;
+    while (this->npinned < PINNED_MAX) {
+        int best = -1;
+        for (int n = 0; n < 0x20; n++) {
+            if (uses[n] && (best < 0 || uses[n] > uses[best])) best = n;
+        }
+        if (best < 0) break;
+        this->hostregs[best] = PINNED_BASE + this->npinned++;
+        uses[best] = 0;
+    }
+}
+
+#ifdef _WIN32
+// xmm6-xmm15 are callee saved on windows
+#define FRAME_SIZE (16 * 16 + 16 * PINNED_MAX)
+#else
+#define FRAME_SIZE (16 * 16)
+#endif
+
 // returns the label of the function for the given entrypoint
 static rasLabel compileWithEntry(X86ShaderJitBackend* this, ShaderUnit* shu,
                                  u32 entry) {
@@ -659,8 +768,13 @@ static rasLabel compileWithEntry(X86ShaderJitBackend* this, ShaderUnit* shu,
     PUSH(RSI);
     PUSH(RDI);
 #endif
-    SUBQ(RSP, 16 * 16);
+    SUBQ(RSP, FRAME_SIZE);
     MOVQ(reg_r, RSP);
+#ifdef _WIN32
+    for (int i = 0; i < this->npinned; i++) {
+        MOVAPS(PTR(16 * 16 + 16 * i, RSP), XMM(PINNED_BASE + i));
+    }
+#endif
     LEAQ(reg_v, PTR(offsetof(ShaderUnit, v), arg));
     LEAQ(reg_o, PTR(offsetof(ShaderUnit, o), arg));
     MOVQ(reg_i, PTR(offsetof(ShaderUnit, i), arg));
@@ -672,11 +786,24 @@ static rasLabel compileWithEntry(X86ShaderJitBackend* this, ShaderUnit* shu,
     MOVD(RAX, 0x3f800000); // 1.0f
     MOVD(ones, RAX);
     SHUFPS(ones, ones, 0);
+    for (int n = 0; n < 0x10; n++) {
+        if (this->hostregs[n] >= 0)
+            MOVAPS(XMM(this->hostregs[n]), PTR(16 * n, reg_o));
+    }
 
     compileBlock(this, shu, entry, SHADER_CODE_SIZE);
 
     L(this->curEndLab);
-    ADDQ(RSP, 16 * 16);
+    for (int n = 0; n < 0x10; n++) {
+        if (this->hostregs[n] >= 0)
+            MOVAPS(PTR(16 * n, reg_o), XMM(this->hostregs[n]));
+    }
+#ifdef _WIN32
+    for (int i = 0; i < this->npinned; i++) {
+        MOVAPS(XMM(PINNED_BASE + i), PTR(16 * 16 + 16 * i, RSP));
+    }
+#endif
+    ADDQ(RSP, FRAME_SIZE);
 #ifdef _WIN32
     POP(RDI);
     POP(RSI);
@@ -719,6 +846,8 @@ ShaderJitFunc shaderjit_x86_get_code(X86ShaderJitBackend* this,
     this->lg2func = rasDeclareLabel(this->code);
     this->usingLg2 = false;
 
+    allocRegs(this, shu);
+
     Vec_foreach(e, this->entrypoints) {
         e->lab = compileWithEntry(this, shu, e->pc);
     }
@@ -731,6 +860,8 @@ ShaderJitFunc shaderjit_x86_get_code(X86ShaderJitBackend* this,
 
     rasReady(this->code);
 
+    shaderjit_add_perfmap(rasGetCode(this->code), rasGetSize(this->code), shu);
+
 #ifdef JIT_DISASM
     pica_shader_disasm(shu);
     shaderjit_arm_disassemble((void*) this);
@@ -22,9 +22,20 @@ typedef struct {
     bool usingEx2, usingLg2;
     rasLabel curEndLab;
 
+    // xmm register each output/temporary is pinned to or -1
+    s8 hostregs[0x20];
+    int npinned;
+
+    // bool and int uniforms are constants
+    bool specialize;
+    // value of aL in an unrolled loop or -1
+    int constal;
+    // compiling a repeated copy of a loop body
+    bool unrolled;
+
 } X86ShaderJitBackend;
 
-X86ShaderJitBackend* shaderjit_x86_init();
+X86ShaderJitBackend* shaderjit_x86_init(bool specialize);
 ShaderJitFunc shaderjit_x86_get_code(X86ShaderJitBackend* backend, ShaderUnit* shu);
 void shaderjit_x86_free(X86ShaderJitBackend* backend);
 void shaderjit_x86_disassemble(X86ShaderJitBackend* backend);
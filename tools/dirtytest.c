@@ -0,0 +1,123 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "common.h"
+
+// tools are built from a single file
+#include "kernel/memdirty.c"
+
+bool g_infologs = true;
+
+// checks that incremental collects report every written page even when the
+// kernel drops the ptes and their soft dirty bits
+// the memory is a memfd mapping like guest memory with fastmem, each round
+// writes some pages, pushes the whole mapping out with MADV_PAGEOUT and
+// collects, a written page that isn't reported right away has to be reported
+// by the forced full pass at the latest
+// without swap the shmem pages can't be written out, but reclaim still unmaps
+// them first, so the bits are lost the same way
+
+#ifndef MADV_PAGEOUT
+#define MADV_PAGEOUT 21
+#endif
+
+#define NPAGES 4096
+#define ROUNDS (3 * DIRTY_FULL_SCAN)
+#define WRITES 64
+
+#define PM_PRESENT BITL(63)
+
+static MemDirty dirty;
+static u8* mem;
+static int pagemap_fd;
+
+static void scan_mem(void*, u8* pages) {
+    memdirty_mark_range(&dirty, mem, NPAGES, 0, pages);
+}
+
+static u32 count_present() {
+    static u64 ents[NPAGES];
+    if (pread(pagemap_fd, ents, sizeof ents,
+              (uintptr_t) mem / PAGE_SIZE * sizeof ents[0]) != sizeof ents)
+        return NPAGES;
+    u32 n = 0;
+    for (int i = 0; i < NPAGES; i++) {
+        if (ents[i] & PM_PRESENT) n++;
+    }
+    return n;
+}
+
+int main() {
+    int fd = memfd_create("dirtytest", 0);
+    if (fd < 0 || ftruncate(fd, NPAGES * PAGE_SIZE) < 0) {
+        perror("memfd");
+        return 1;
+    }
+    mem = mmap(nullptr, NPAGES * PAGE_SIZE, PROT_READ | PROT_WRITE,
+               MAP_SHARED, fd, 0);
+    if (mem == MAP_FAILED) {
+        perror("mmap");
+        return 1;
+    }
+    pagemap_fd = open("/proc/self/pagemap", O_RDONLY);
+
+    memdirty_init(&dirty, NPAGES);
+    for (int i = 0; i < NPAGES; i++) {
+        mem[i * PAGE_SIZE] = 1;
+    }
+    static u32 pages[NPAGES];
+    memdirty_collect(&dirty, DIRTY_SAVESTATE, mem, true, pages, scan_mem,
+                     nullptr, nullptr);
+    if (dirty.pagemap < 0) {
+        printf("no soft dirty bits, every collect hashes all pages\n");
+    }
+
+    // collects since each page was written without being reported, 0 if it
+    // has been reported
+    static u32 owed[NPAGES];
+    u32 written = 0, late = 0, missed = 0, dropped = 0;
+    for (int r = 0; r < ROUNDS; r++) {
+        for (int i = 0; i < WRITES; i++) {
+            u32 pg = rand() % NPAGES;
+            mem[pg * PAGE_SIZE + rand() % PAGE_SIZE] += 1 + rand() % 255;
+            if (!owed[pg]) written++;
+            owed[pg] = 1;
+        }
+
+        u32 before = count_present();
+        if (madvise(mem, NPAGES * PAGE_SIZE, MADV_PAGEOUT) < 0) {
+            perror("madvise");
+            return 1;
+        }
+        dropped += before - count_present();
+
+        u32 n = memdirty_collect(&dirty, DIRTY_SAVESTATE, mem, false, pages,
+                                 scan_mem, nullptr, nullptr);
+        for (u32 i = 0; i < n; i++) {
+            if (owed[pages[i]] > 1) late++;
+            owed[pages[i]] = 0;
+        }
+        for (int i = 0; i < NPAGES; i++) {
+            if (!owed[i]) continue;
+            if (owed[i]++ >= DIRTY_FULL_SCAN) {
+                printf("page %d written %d collects ago is still missing\n",
+                       i, owed[i] - 1);
+                missed++;
+                owed[i] = 0;
+            }
+        }
+    }
+
+    printf("%d rounds, %d pages written, %d ptes dropped by pageout\n", ROUNDS,
+           written, dropped);
+    printf("%d reported late by the full pass, %d missed\n", late, missed);
+    if (!dropped) {
+        printf("pageout dropped nothing, the lost bit case was not tested\n");
+    }
+
+    memdirty_destroy(&dirty);
+    return missed ? 1 : 0;
+}
@@ -0,0 +1,274 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+// tools are built from a single file
+#include "audio/dspmix.c"
+
+// benchmark for the dsp channel pipeline, mixing all 24 channels with a mix
+// of adpcm, pcm16 and pcm8 sources at different rates and interpolation modes
+// "scalar" is the old per sample pipeline, "simd" is dsp_adpcm_decode and
+// dsp_resample_mix as used by dsp_process_chn now
+// the block adpcm decoder is checked against the old one first
+
+#define FRAMES 20000
+#define SRC_SAMPLES BIT(16)
+
+typedef struct {
+    int codec;
+    bool stereo;
+    float rate;
+    int interp;
+    float gain[2];
+    u32 pos;
+    ADPCMData adpcm;
+    DSPResampler rs;
+} Chn;
+
+static Chn chns[DSP_CHANNELS];
+static s16 coeffs[8][2];
+static u8 adpcmsrc[SRC_SAMPLES / 14 * 8 + 8];
+static s16 pcm16src[SRC_SAMPLES][2];
+static s8 pcm8src[SRC_SAMPLES][2];
+
+// old pipeline
+
+static void old_adpcm(ADPCMData* st, u32 pos, u32 count, s16* l, s16* r) {
+    u8* src = adpcmsrc;
+    src += (pos / 14) * 8;
+    if (pos % 14 > 0) {
+        src += 1 + (pos % 14) / 2;
+    }
+    for (int s = 0; s < count; s++) {
+        if (pos % 14 == 0) {
+            st->indexScale = *src++;
+        }
+        int diff = (sbit(4)) ((pos++ & 1) ? *src++ : *src >> 4);
+        diff <<= st->scale;
+        int sample = coeffs[st->index][0] * st->history[0] +
+                     coeffs[st->index][1] * st->history[1];
+        sample += BIT(10);
+        sample >>= 11;
+        sample += diff;
+        if (sample > INT16_MAX) sample = INT16_MAX;
+        if (sample < INT16_MIN) sample = INT16_MIN;
+        st->history[1] = st->history[0];
+        st->history[0] = sample;
+        l[s] = sample;
+        r[s] = sample;
+    }
+}
+
+static void old_chn(Chn* c, s32 (*mixer)[2]) {
+    u32 nSamples = FRAME_SAMPLES * c->rate;
+    s16 lsamples[nSamples];
+    s16 rsamples[nSamples];
+    s32 lframe[FRAME_SAMPLES];
+    s32 rframe[FRAME_SAMPLES];
+
+    switch (c->codec) {
+        case DSPFMT_ADPCM:
+            old_adpcm(&c->adpcm, c->pos, nSamples, lsamples, rsamples);
+            break;
+        case DSPFMT_PCM16:
+            for (int s = 0; s < nSamples; s++) {
+                lsamples[s] = pcm16src[c->pos + s][0];
+                rsamples[s] = pcm16src[c->pos + s][c->stereo];
+            }
+            break;
+        case DSPFMT_PCM8:
+            for (int s = 0; s < nSamples; s++) {
+                lsamples[s] = pcm8src[c->pos + s][0];
+                rsamples[s] = pcm8src[c->pos + s][c->stereo];
+            }
+            break;
+    }
+    c->pos = (c->pos + nSamples) % (SRC_SAMPLES - RESAMPLE_MAX_LEN);
+
+    for (int s = 0; s < FRAME_SAMPLES; s++) {
+        float pos = (float) s * nSamples / FRAME_SAMPLES;
+        if (pos >= nSamples) pos = nSamples - 1;
+        if (c->interp == DSPINTRP_NEAREST) {
+            lframe[s] = lsamples[(int) pos];
+            rframe[s] = rsamples[(int) pos];
+        } else {
+            float frac = pos - (int) pos;
+            int pos0 = (int) pos;
+            int pos1 = (int) pos + 1;
+            if (pos1 >= nSamples) pos1 = nSamples - 1;
+            lframe[s] = lsamples[pos0] * (1 - frac) + lsamples[pos1] * frac;
+            rframe[s] = rsamples[pos0] * (1 - frac) + rsamples[pos1] * frac;
+        }
+    }
+    for (int s = 0; s < FRAME_SAMPLES; s++) {
+        lframe[s] *= c->gain[0];
+        rframe[s] *= c->gain[1];
+    }
+    for (int s = 0; s < FRAME_SAMPLES; s++) {
+        mixer[s][0] += lframe[s];
+        mixer[s][1] += rframe[s];
+    }
+}
+
+// new pipeline
+
+static void new_chn(Chn* c, s32 (*mixer)[FRAME_SAMPLES]) {
+    u32 step = dsp_resample_step(c->rate);
+    u32 nSamples = dsp_resample_len(&c->rs, step);
+    alignas(16) s16 lsamples[RESAMPLE_TAPS + RESAMPLE_MAX_LEN];
+    alignas(16) s16 rsamples[RESAMPLE_TAPS + RESAMPLE_MAX_LEN];
+    s16* ldst = &lsamples[RESAMPLE_TAPS];
+    s16* rdst = &rsamples[RESAMPLE_TAPS];
+    alignas(16) s32 frame[2][FRAME_SAMPLES];
+
+    switch (c->codec) {
+        case DSPFMT_ADPCM:
+            dsp_adpcm_decode(&c->adpcm, coeffs, adpcmsrc, c->pos, nSamples,
+                             ldst);
+            break;
+        case DSPFMT_PCM16:
+            if (c->stereo) {
+                for (int s = 0; s < nSamples; s++) {
+                    ldst[s] = pcm16src[c->pos + s][0];
+                    rdst[s] = pcm16src[c->pos + s][1];
+                }
+            } else {
+                for (int s = 0; s < nSamples; s++) {
+                    ldst[s] = pcm16src[c->pos + s][0];
+                }
+            }
+            break;
+        case DSPFMT_PCM8:
+            if (c->stereo) {
+                for (int s = 0; s < nSamples; s++) {
+                    ldst[s] = pcm8src[c->pos + s][0];
+                    rdst[s] = pcm8src[c->pos + s][1];
+                }
+            } else {
+                for (int s = 0; s < nSamples; s++) {
+                    ldst[s] = pcm8src[c->pos + s][0];
+                }
+            }
+            break;
+    }
+    c->pos = (c->pos + nSamples) % (SRC_SAMPLES - RESAMPLE_MAX_LEN);
+
+    dsp_resample_mix(&c->rs, c->interp, step, (s16*[]) {lsamples, rsamples},
+                     c->stereo, c->gain, mixer, frame);
+}
+
+static void init_chns() {
+    static const float rates[] = {1.0f, 0.5f, 1.3458f, 0.6729f, 1.5f, 2.0f};
+    for (int i = 0; i < DSP_CHANNELS; i++) {
+        chns[i] = (Chn) {
+            .codec = i % 3 == 0   ? DSPFMT_PCM16
+                     : i % 3 == 1 ? DSPFMT_ADPCM
+                                  : DSPFMT_PCM8,
+            .rate = rates[i % countof(rates)],
+            .interp = i % 3 == 2 ? DSPINTRP_NEAREST
+                      : i % 2    ? DSPINTRP_LINEAR
+                                 : DSPINTRP_POLYPHASE,
+            .gain = {0.5f, 0.25f},
+        };
+        chns[i].stereo = chns[i].codec != DSPFMT_ADPCM && (i & 4);
+    }
+}
+
+static bool check() {
+    // block decoding has to be bit exact, including resuming in the middle of
+    // an adpcm frame
+    for (int i = 0; i < 1000; i++) {
+        u32 pos = rand() % 1000;
+        ADPCMData a = {.indexScale = adpcmsrc[pos / 14 * 8]};
+        ADPCMData b = a;
+        s16 l[2000], r[2000], out[2000];
+        u32 done = 0;
+        while (done < 2000) {
+            u32 n = 1 + rand() % 400;
+            if (n > 2000 - done) n = 2000 - done;
+            old_adpcm(&a, pos + done, n, l + done, r + done);
+            dsp_adpcm_decode(&b, coeffs, adpcmsrc, pos + done, n, out + done);
+            done += n;
+        }
+        if (memcmp(l, out, sizeof out)) {
+            printf("adpcm mismatch at %d\n", pos);
+            return false;
+        }
+    }
+
+    // a constant signal has to come through every mode at unity gain once
+    // the history is full
+    for (int mode = 0; mode < 3; mode++) {
+        DSPResampler rs = {};
+        u32 step = dsp_resample_step(1.3458f);
+        alignas(16) s16 buf[RESAMPLE_TAPS + RESAMPLE_MAX_LEN];
+        alignas(16) s32 frame[2][FRAME_SAMPLES];
+        for (int f = 0; f < 4; f++) {
+            u32 len = dsp_resample_len(&rs, step);
+            for (int s = 0; s < len; s++) {
+                buf[RESAMPLE_TAPS + s] = 10000;
+            }
+            dsp_resample_mix(&rs, mode, step, (s16*[]) {buf, buf}, false,
+                             (float[]) {1, 1}, nullptr, frame);
+        }
+        for (int s = 0; s < FRAME_SAMPLES; s++) {
+            if (abs(frame[0][s] - 10000) > 1) {
+                printf("mode %d dc gain wrong: %d\n", mode, frame[0][s]);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+static volatile s32 sink;
+
+int main() {
+    for (int i = 0; i < sizeof adpcmsrc; i++) {
+        adpcmsrc[i] = rand();
+        // keep the predictor index in range
+        if (i % 8 == 0) adpcmsrc[i] &= 0x7f;
+    }
+    for (int i = 0; i < 8; i++) {
+        coeffs[i][0] = 1000 + rand() % 3000;
+        coeffs[i][1] = -(rand() % 2000);
+    }
+    for (int i = 0; i < SRC_SAMPLES; i++) {
+        pcm16src[i][0] = rand();
+        pcm16src[i][1] = rand();
+        pcm8src[i][0] = rand();
+        pcm8src[i][1] = rand();
+    }
+
+    if (!check()) return 1;
+    printf("block adpcm decode matches the old decoder\n\n");
+
+    init_chns();
+    u64 start = time_now_ns();
+    for (int f = 0; f < FRAMES; f++) {
+        s32 mixer[FRAME_SAMPLES][2] = {};
+        for (int i = 0; i < DSP_CHANNELS; i++) {
+            old_chn(&chns[i], mixer);
+        }
+        sink = mixer[f % FRAME_SAMPLES][0];
+    }
+    double scalar = (double) (time_now_ns() - start) / FRAMES;
+
+    init_chns();
+    start = time_now_ns();
+    for (int f = 0; f < FRAMES; f++) {
+        alignas(16) s32 mixer[2][FRAME_SAMPLES] = {};
+        for (int i = 0; i < DSP_CHANNELS; i++) {
+            new_chn(&chns[i], mixer);
+        }
+        sink = mixer[0][f % FRAME_SAMPLES];
+    }
+    double simd = (double) (time_now_ns() - start) / FRAMES;
+
+    printf("%-8s %14s\n", "", "ns per frame");
+    printf("%-8s %14.0f\n", "scalar", scalar);
+    printf("%-8s %14.0f\n", "simd", simd);
+    printf("\n%.1fx faster, a frame is %.0f ns of audio\n", scalar / simd,
+           1e9 * FRAME_SAMPLES / SAMPLE_RATE);
+
+    return 0;
+}
@@ -0,0 +1,544 @@
+#define NOJIT
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+
+// tools are built from a single file
+#include "arm/jit/backend/backend_interp.c"
+#include "arm/jit/ir.c"
+#include "arm/media.c"
+#include "arm/vfp.c"
+
+bool g_infologs = false;
+JITStats g_jit_stats;
+
+void cpu_update_mode(ArmCore*, CpuMode) {}
+void cpu_undefined_fail(ArmCore*, u32) {}
+JITBlock* get_jitblock(ArmCore*, u32, u32) {
+    return nullptr;
+}
+
+// differential test of the cached interpreter against ir_interpret
+// random ir blocks shaped like what the translator and optimizer emit are run
+// through both on copies of the same state, the registers, flags, vfp
+// registers, memory, cycles and profiling counters must come out the same
+// accesses go to a small window where only some pages are in the tlb, so both
+// the tlb and the callback paths are used
+// not covered: the fastmem handlers (this is built without JIT_FASTMEM),
+// block linking and the vfp/cp15/exception callbacks
+// usage: irdiff [blocks] [seed]
+
+#define MEMBASE 0x10000
+#define MEMSIZE BIT(16)
+
+#define MAXDEPTH 2
+
+typedef struct {
+    ArmCore cpu;
+    u8 mem[MEMSIZE];
+    IRBlockCounters counters;
+} Core;
+
+// ref runs ir_interpret, test the cached interpreter
+static Core ref, test;
+static u8 initmem[MEMSIZE];
+static SWTLBEntry tlb[SWTLB_SIZE];
+
+#define MEMPTR(cpu, addr) (&((Core*) (cpu))->mem[((addr) - MEMBASE) % MEMSIZE])
+
+static u32 read8(ArmCore* cpu, u32 addr, bool sx) {
+    u8 b = *MEMPTR(cpu, addr);
+    return sx ? (s8) b : b;
+}
+
+static u32 read16(ArmCore* cpu, u32 addr, bool sx) {
+    u16 h;
+    memcpy(&h, MEMPTR(cpu, addr), sizeof h);
+    return sx ? (s16) h : h;
+}
+
+static u32 read32(ArmCore* cpu, u32 addr) {
+    u32 w;
+    memcpy(&w, MEMPTR(cpu, addr), sizeof w);
+    return w;
+}
+
+static void write8(ArmCore* cpu, u32 addr, u8 b) {
+    *MEMPTR(cpu, addr) = b;
+}
+
+static void write16(ArmCore* cpu, u32 addr, u16 h) {
+    memcpy(MEMPTR(cpu, addr), &h, sizeof h);
+}
+
+static void write32(ArmCore* cpu, u32 addr, u32 w) {
+    memcpy(MEMPTR(cpu, addr), &w, sizeof w);
+}
+
+static u32 rand32() {
+    return (u32) rand() << 16 ^ rand();
+}
+
+static u32 rand_imm() {
+    static const u32 special[] = {
+        0, 1, 2, 31, 32, 0xff, 0x8000, BIT(31), MASK(31), ~0u, 0x3f800000,
+    };
+    return rand() % 2 ? special[rand() % countof(special)] : rand32();
+}
+
+// generator
+
+typedef struct {
+    bool imm;
+    u32 v;
+} Arg;
+
+#define IMM(x) ((Arg) {true, (x)})
+#define VAL(x) ((Arg) {false, (x)})
+
+static IRBlock blk;
+// values that can be used at the current point
+static Vec(u32) vals;
+// the float values among them, float ops only take these so any nan is the
+// host default nan, with two different nans which one comes out depends on
+// the operand order the compiler picked
+static Vec(u32) fvals;
+// whether the host carry/overflow were set in every path to here, they are
+// left over from the last iteration in the cached interpreter and reset in
+// ir_interpret
+static bool cfvalid, vfvalid;
+
+static u32 emit(IROpcode opc, Arg a, Arg b) {
+    u32 i = irblock_write(&blk, (IRInstr) {.opcode = opc,
+                                           .imm1 = a.imm,
+                                           .imm2 = b.imm,
+                                           .op1 = a.v,
+                                           .op2 = b.v});
+    if (iropc_hasresult(opc)) Vec_push(vals, i);
+    switch (opc) {
+        case IR_LOAD_VFP:
+        case IR_FADD:
+        case IR_FSUB:
+        case IR_FMUL:
+        case IR_FDIV:
+        case IR_FSQRT:
+            Vec_push(fvals, i);
+            break;
+        default:
+            break;
+    }
+    return i;
+}
+
+static Arg var() {
+    return VAL(vals.d[rand() % vals.size]);
+}
+
+static Arg arg() {
+    return rand() % 4 ? var() : IMM(rand_imm());
+}
+
+static float rand_float() {
+    return (float) (rand() % 2000 - 1000) / 16;
+}
+
+static Arg farg() {
+    if (fvals.size && rand() % 4) return VAL(fvals.d[rand() % fvals.size]);
+    return IMM(F2I(rand_float()));
+}
+
+static void gen_alu() {
+    static const IROpcode binops[] = {
+        IR_AND,            IR_OR,             IR_XOR,
+        IR_ADD,            IR_SUB,            IR_MUL,
+        IR_SMULH,          IR_UMULH,          IR_SMULW,
+        IR_MEDIA_UADD8,    IR_MEDIA_USUB8,    IR_MEDIA_UQADD8,
+        IR_MEDIA_UQSUB8,   IR_MEDIA_UHADD8,   IR_MEDIA_QSUB8,
+        IR_MEDIA_GE_UADD8, IR_MEDIA_GE_USUB8, IR_MEDIA_GE_SSUB8,
+    };
+    static const IROpcode unops[] = {
+        IR_MOV, IR_NOT, IR_CLZ, IR_REV, IR_REV16, IR_FNEG, IR_FABS,
+    };
+    switch (rand() % 10) {
+        case 0:
+        case 1:
+        case 2:
+            emit(binops[rand() % countof(binops)], arg(), arg());
+            break;
+        case 3:
+        case 4:
+            emit(unops[rand() % countof(unops)], IMM(0), arg());
+            break;
+        case 5:
+            emit(IR_LSL + rand() % 3, arg(),
+                 rand() % 2 ? IMM(rand() % 40) : arg());
+            break;
+        case 6:
+            emit(IR_ROR, arg(), IMM(1 + rand() % 31));
+            break;
+        case 7:
+            switch (rand() % 3) {
+                case 0:
+                    emit(IR_USAT, IMM(rand() % 32), arg());
+                    break;
+                case 1:
+                    emit(IR_SSAT, IMM(rand() % 32), arg());
+                    break;
+                case 2:
+                    emit(IR_PCMASK, var(), IMM(0));
+                    break;
+            }
+            break;
+        case 8:
+            emit(IR_FADD + rand() % 4, farg(), farg());
+            break;
+        case 9:
+            emit(IR_FSQRT, IMM(0), farg());
+            break;
+    }
+}
+
+// an add/sub followed by its flag group like the translator emits, the
+// optimizer turns unused parts of the group into nops
+static void gen_arith() {
+    if (rand() % 8 == 0) {
+        // the low half of a 64 bit add, the adc makes the add set the carry
+        emit(IR_ADD, arg(), arg());
+        emit(IR_ADC, arg(), arg());
+        cfvalid = vfvalid = true;
+        return;
+    }
+    IROpcode opc = IR_ADD + rand() % 4;
+    if (opc >= IR_ADC && (!cfvalid || rand() % 2)) {
+        emit(IR_SETC, IMM(0), arg());
+        cfvalid = true;
+    }
+    u32 res = emit(opc, arg(), arg());
+    static const int flags[] = {CF, VF, NF, ZF};
+    static const IROpcode gets[] = {IR_GETC, IR_GETV, IR_GETN, IR_GETZ};
+    bool cv = false;
+    for (int k = 0; k < 4; k++) {
+        switch (rand() % 4) {
+            case 0:
+                emit(IR_NOP, IMM(0), IMM(0));
+                emit(IR_NOP, IMM(0), IMM(0));
+                break;
+            case 1:
+                emit(gets[k], IMM(0), VAL(res));
+                emit(IR_NOP, IMM(0), IMM(0));
+                cv |= k < 2;
+                break;
+            default: {
+                u32 f = emit(gets[k], IMM(0), VAL(res));
+                emit(IR_STORE_FLAG, IMM(flags[k]), VAL(f));
+                cv |= k < 2;
+                break;
+            }
+        }
+    }
+    if (cv) cfvalid = vfvalid = true;
+}
+
+static Arg gen_addr(u32 size) {
+    u32 a = emit(IR_AND, arg(), IMM((MEMSIZE - 1) & -size));
+    return VAL(emit(IR_OR, VAL(a), IMM(MEMBASE)));
+}
+
+static void gen_mem() {
+    static const IROpcode loads[] = {
+        IR_LOAD_MEM8, IR_LOAD_MEMS8, IR_LOAD_MEM16, IR_LOAD_MEMS16,
+        IR_LOAD_MEM32,
+    };
+    static const u32 loadsize[] = {1, 1, 2, 2, 4};
+    if (rand() % 2) {
+        int k = rand() % countof(loads);
+        emit(loads[k], gen_addr(loadsize[k]), IMM(0));
+    } else {
+        int k = rand() % 3;
+        emit(IR_STORE_MEM8 + k, gen_addr(BIT(k)), arg());
+    }
+}
+
+static void gen_load() {
+    switch (rand() % 8) {
+        case 0:
+            emit(IR_LOAD_REG, IMM(rand() % 15), IMM(0));
+            break;
+        case 1:
+            emit(IR_LOAD_FLAG, IMM(rand() % 5), IMM(0));
+            break;
+        case 2:
+            emit(IR_LOAD_REG_USR, IMM(8 + rand() % 7), IMM(0));
+            break;
+        case 3:
+            emit(IR_LOAD_CPSR, IMM(0), IMM(0));
+            break;
+        case 4:
+            emit(IR_LOAD_SPSR, IMM(0), IMM(0));
+            break;
+        case 5:
+            emit(IR_LOAD_THUMB, IMM(0), IMM(0));
+            break;
+        case 6:
+            emit(IR_LOAD_GE, IMM(0), IMM(0));
+            break;
+        case 7:
+            emit(IR_LOAD_VFP, IMM(rand() % 32), IMM(0));
+            break;
+    }
+}
+
+static void gen_store() {
+    switch (rand() % 8) {
+        case 0:
+            emit(IR_STORE_REG, IMM(rand() % 15), arg());
+            break;
+        case 1:
+            emit(IR_STORE_FLAG, IMM(rand() % 5), arg());
+            break;
+        case 2:
+            emit(IR_STORE_REG_USR, IMM(8 + rand() % 7), arg());
+            break;
+        case 3:
+            emit(IR_STORE_CPSR, IMM(0), arg());
+            break;
+        case 4:
+            emit(IR_STORE_SPSR, IMM(0), arg());
+            break;
+        case 5:
+            emit(IR_STORE_THUMB, IMM(0), arg());
+            break;
+        case 6:
+            emit(IR_STORE_GE, IMM(0), arg());
+            break;
+        case 7:
+            emit(IR_STORE_VFP, IMM(rand() % 32), farg());
+            break;
+    }
+}
+
+static void gen_carry() {
+    switch (rand() % 5) {
+        case 0:
+            emit(IR_ADC, arg(), arg());
+            break;
+        case 1:
+            emit(IR_SBC, arg(), arg());
+            break;
+        case 2:
+            emit(IR_RRC, arg(), IMM(0));
+            break;
+        case 3:
+            emit(IR_GETCIFZ, arg(), arg());
+            break;
+        case 4:
+            emit(IR_GETC, IMM(0), arg());
+            break;
+    }
+}
+
+static void gen_ops(int n, int depth);
+
+// a conditional region like a conditional instruction, sometimes with an else
+// part like the optimizer makes out of two opposite conditions
+static void gen_cond(int depth) {
+    Arg c;
+    switch (rand() % 3) {
+        case 0:
+            // fused with the jump
+            c = VAL(emit(IR_LOAD_FLAG, IMM(rand() % 4), IMM(0)));
+            break;
+        case 1: {
+            u32 a = emit(IR_LOAD_FLAG, IMM(rand() % 4), IMM(0));
+            u32 b = emit(IR_LOAD_FLAG, IMM(rand() % 4), IMM(0));
+            c = VAL(emit(IR_XOR, VAL(a), VAL(b)));
+            break;
+        }
+        default:
+            c = var();
+            break;
+    }
+    u32 jmp = emit(rand() % 2 ? IR_JZ : IR_JNZ, c, IMM(0));
+
+    size_t nvals = vals.size, nfvals = fvals.size;
+    bool cf = cfvalid, vf = vfvalid;
+    // nothing in the first part may change the last jump taken
+    bool haselse = rand() % 3 == 0;
+    gen_ops(1 + rand() % 6, haselse ? MAXDEPTH : depth + 1);
+    vals.size = nvals;
+    fvals.size = nfvals;
+    cfvalid = cf;
+    vfvalid = vf;
+
+    if (haselse) {
+        u32 jelse = emit(IR_JELSE, IMM(0), IMM(0));
+        blk.code.d[jmp].op2 = jelse;
+        gen_ops(1 + rand() % 6, MAXDEPTH);
+        vals.size = nvals;
+        fvals.size = nfvals;
+        cfvalid = cf;
+        vfvalid = vf;
+        jmp = jelse;
+    }
+    blk.code.d[jmp].op2 = blk.code.size;
+}
+
+static void gen_ops(int n, int depth) {
+    for (int i = 0; i < n; i++) {
+        int r = rand() % 100;
+        if (r < 8 && depth < MAXDEPTH) gen_cond(depth);
+        else if (r < 22) gen_arith();
+        else if (r < 32) gen_load();
+        else if (r < 40) gen_store();
+        else if (r < 50) gen_mem();
+        else if (r < 54 && cfvalid) gen_carry();
+        else if (r < 56 && vfvalid) emit(IR_GETV, IMM(0), arg());
+        else if (r < 57) emit(IR_IDLE, IMM(0), IMM(0));
+        else gen_alu();
+    }
+}
+
+static void gen_block() {
+    blk.code.size = 0;
+    vals.size = 0;
+    fvals.size = 0;
+    cfvalid = vfvalid = false;
+    blk.loop = rand() % 3 == 0;
+
+    emit(IR_BEGIN, IMM(0), IMM(0));
+    for (int i = 0; i < 3; i++) {
+        emit(IR_LOAD_REG, IMM(rand() % 15), IMM(0));
+    }
+    gen_ops(4 + rand() % 60, 0);
+    // ir_interpret looks up to 3 instructions ahead of an add/sub
+    for (int i = 0; i < 3; i++) {
+        emit(IR_NOP, IMM(0), IMM(0));
+    }
+    u32 end = emit(blk.loop ? IR_END_LOOP : IR_END_RET, IMM(0), IMM(0));
+    blk.code.d[end].cycles = 1 + rand() % 4;
+}
+
+// running
+
+static void init_state() {
+    memset(&ref, 0, sizeof ref);
+    ArmCore* cpu = &ref.cpu;
+    for (int i = 0; i < 16; i++) {
+        cpu->r[i] = rand_imm();
+    }
+    cpu->cpsr.w = rand32();
+    cpu->spsr = rand32();
+    for (int i = 0; i < 5; i++) {
+        cpu->banked_r8_12[0][i] = rand32();
+    }
+    cpu->banked_sp[0] = rand32();
+    cpu->banked_lr[0] = rand32();
+    for (int i = 0; i < 32; i++) {
+        cpu->s[i] = rand_float();
+    }
+    memcpy(ref.mem, initmem, MEMSIZE);
+    cpu->read8 = read8;
+    cpu->read16 = read16;
+    cpu->read32 = read32;
+    cpu->write8 = write8;
+    cpu->write16 = write16;
+    cpu->write32 = write32;
+    cpu->cycles = blk.loop ? 1 + rand() % 64 : 16;
+
+    test = ref;
+    test.cpu.tlb = tlb;
+    memset(tlb, 0, sizeof tlb);
+    for (u32 pg = MEMBASE; pg < MEMBASE + MEMSIZE; pg += BIT(12)) {
+        if (rand() % 2) continue;
+        auto e = &tlb[(pg >> 12) % SWTLB_SIZE];
+        e->tag = pg >> 12;
+        e->base = (uintptr_t) &test.mem[pg - MEMBASE] - pg;
+    }
+}
+
+static bool check(const char* name, int i, u64 a, u64 b) {
+    if (a == b) return true;
+    printf("%s", name);
+    if (i >= 0) printf("%d", i);
+    printf(": ir 0x%llx cached 0x%llx\n", (unsigned long long) a,
+           (unsigned long long) b);
+    return false;
+}
+
+static bool compare() {
+    ArmCore* a = &ref.cpu;
+    ArmCore* b = &test.cpu;
+    bool ok = true;
+    for (int i = 0; i < 16; i++) {
+        ok &= check("r", i, a->r[i], b->r[i]);
+    }
+    ok &= check("cpsr", -1, a->cpsr.w, b->cpsr.w);
+    ok &= check("spsr", -1, a->spsr, b->spsr);
+    for (int i = 0; i < 5; i++) {
+        ok &= check("usr r", 8 + i, a->banked_r8_12[0][i],
+                    b->banked_r8_12[0][i]);
+    }
+    ok &= check("usr sp", -1, a->banked_sp[0], b->banked_sp[0]);
+    ok &= check("usr lr", -1, a->banked_lr[0], b->banked_lr[0]);
+    for (int i = 0; i < 32; i++) {
+        ok &= check("s", i, F2I(a->s[i]), F2I(b->s[i]));
+    }
+    ok &= check("cycles", -1, a->cycles, b->cycles);
+    ok &= check("execs", -1, ref.counters.execs, test.counters.execs);
+    ok &= check("counted cycles", -1, ref.counters.cycles,
+                test.counters.cycles);
+    for (int i = 0; i < MEMSIZE; i++) {
+        if (ref.mem[i] != test.mem[i]) {
+            printf("mem 0x%x: ir 0x%x cached 0x%x\n", MEMBASE + i, ref.mem[i],
+                   test.mem[i]);
+            ok = false;
+            break;
+        }
+    }
+    return ok;
+}
+
+int main(int argc, char** argv) {
+    int nblocks = argc > 1 ? atoi(argv[1]) : 20000;
+    int seed = argc > 2 ? atoi(argv[2]) : 0;
+    srand(seed);
+
+    for (int i = 0; i < MEMSIZE; i++) {
+        initmem[i] = rand();
+    }
+    irblock_init(&blk);
+    int loops = 0;
+    for (int n = 0; n < nblocks; n++) {
+        gen_block();
+        init_state();
+        if (blk.loop) loops++;
+
+        bool counters = rand() % 2;
+        blk.counters = counters ? &test.counters : nullptr;
+        auto code = backend_interp_generate_code(&blk, nullptr, &test.cpu);
+        backend_interp_exec(code);
+
+        blk.counters = counters ? &ref.counters : nullptr;
+        do {
+            ir_interpret(&blk, &ref.cpu);
+        } while (blk.loop && ref.cpu.cycles > 0);
+
+        if (!compare()) {
+            printf("block %d with seed %d differs\n", n, seed);
+            ir_disassemble(&blk);
+            backend_interp_disassemble(code);
+            return 1;
+        }
+        backend_interp_free(code);
+    }
+
+    printf("%d blocks (%d looping) matched with seed %d\n", nblocks, loops,
+           seed);
+    irblock_free(&blk);
+    Vec_free(vals);
+    Vec_free(fvals);
+    return 0;
+}
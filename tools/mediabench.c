@@ -0,0 +1,277 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifdef __x86_64__
+#include <emmintrin.h>
+#else
+#include <arm_neon.h>
+#endif
+
+// tools are built from a single file
+#include "arm/media.c"
+
+// micro benchmark for the jit lowering of the armv6 media instructions
+// "callback" is the old lowering which called c code that also wrote the
+// GE flags, "simd" is the same sequence the backends emit now (including
+// computing the GE flags) written with intrinsics
+// the intrinsic versions are checked against the interpreter helpers first,
+// this checks the choice of instructions but not the code the jit emits
+
+#define N 4096
+#define ITERS 4000
+
+static ArmCore cpu;
+static u32 in_a[N], in_b[N];
+
+// old callbacks
+
+static u32 cb_uadd8(ArmCore* cpu, u32 a, u32 b) {
+    u32 res = 0;
+    for (int i = 0; i < 4; i++) {
+        u32 sum = (a & 0xff) + (b & 0xff);
+        if (sum >= 0x100) cpu->cpsr.ge |= BIT(i);
+        else cpu->cpsr.ge &= ~BIT(i);
+        sum &= 0xff;
+        res |= sum << 8 * i;
+        a >>= 8;
+        b >>= 8;
+    }
+    return res;
+}
+
+static u32 cb_usub8(ArmCore* cpu, u32 a, u32 b) {
+    u32 res = 0;
+    for (int i = 0; i < 4; i++) {
+        u32 diff = (a & 0xff) - (b & 0xff);
+        if (diff < 0x100) cpu->cpsr.ge |= BIT(i);
+        else cpu->cpsr.ge &= ~BIT(i);
+        diff &= 0xff;
+        res |= diff << 8 * i;
+        a >>= 8;
+        b >>= 8;
+    }
+    return res;
+}
+
+static u32 cb_ssub8(ArmCore* cpu, u32 a, u32 b) {
+    u32 res = 0;
+    for (int i = 0; i < 4; i++) {
+        s32 diff = (s32) (s8) (a & 0xff) - (s32) (s8) (b & 0xff);
+        if (diff >= 0) cpu->cpsr.ge |= BIT(i);
+        else cpu->cpsr.ge &= ~BIT(i);
+        diff &= 0xff;
+        res |= diff << 8 * i;
+        a >>= 8;
+        b >>= 8;
+    }
+    return res;
+}
+
+static u32 cb_uhadd8(ArmCore* cpu, u32 a, u32 b) {
+    return media_uhadd8(a, b);
+}
+
+static u32 cb_uqadd8(ArmCore* cpu, u32 a, u32 b) {
+    return media_uqadd8(a, b);
+}
+
+static u32 cb_uqsub8(ArmCore* cpu, u32 a, u32 b) {
+    return media_uqsub8(a, b);
+}
+
+static u32 cb_qsub8(ArmCore* cpu, u32 a, u32 b) {
+    return media_qsub8(a, b);
+}
+
+static u32 cb_sel(ArmCore* cpu, u32 a, u32 b) {
+    u32 mask = 0;
+    for (int i = 0; i < 4; i++) {
+        if (cpu->cpsr.ge & BIT(i)) mask |= 0xff << 8 * i;
+    }
+    return (a & mask) | (b & ~mask);
+}
+
+// the jit called these through a register so they can't be inlined
+static u32 (*volatile callbacks[])(ArmCore*, u32, u32) = {
+    cb_uadd8, cb_usub8,  cb_ssub8, cb_uqadd8,
+    cb_uqsub8, cb_uhadd8, cb_qsub8, cb_sel,
+};
+
+// new lowering
+
+#ifdef __x86_64__
+
+#define V(a) _mm_cvtsi32_si128(a)
+#define U(v) ((u32) _mm_cvtsi128_si32(v))
+
+static inline u32 simd_uadd8(u32 a, u32 b) {
+    return U(_mm_add_epi8(V(a), V(b)));
+}
+static inline u32 simd_usub8(u32 a, u32 b) {
+    return U(_mm_sub_epi8(V(a), V(b)));
+}
+static inline u32 simd_uqadd8(u32 a, u32 b) {
+    return U(_mm_adds_epu8(V(a), V(b)));
+}
+static inline u32 simd_uqsub8(u32 a, u32 b) {
+    return U(_mm_subs_epu8(V(a), V(b)));
+}
+static inline u32 simd_uhadd8(u32 a, u32 b) {
+    __m128i x = V(a), y = V(b);
+    __m128i round = _mm_and_si128(_mm_xor_si128(x, y), V(0x01010101));
+    return U(_mm_sub_epi8(_mm_avg_epu8(x, y), round));
+}
+static inline u32 simd_qsub8(u32 a, u32 b) {
+    return U(_mm_subs_epi8(V(a), V(b)));
+}
+static inline u32 simd_ge_uadd8(u32 a, u32 b) {
+    __m128i x = V(a), y = V(b);
+    __m128i nocarry = _mm_cmpeq_epi8(_mm_add_epi8(x, y), _mm_adds_epu8(x, y));
+    return (_mm_movemask_epi8(nocarry) & 0xf) ^ 0xf;
+}
+static inline u32 simd_ge_usub8(u32 a, u32 b) {
+    __m128i x = V(a), y = V(b);
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_max_epu8(x, y), x)) & 0xf;
+}
+static inline u32 simd_ge_ssub8(u32 a, u32 b) {
+    return (_mm_movemask_epi8(_mm_cmpgt_epi8(V(b), V(a))) & 0xf) ^ 0xf;
+}
+
+#else
+
+#define V(a) vreinterpret_u8_u32(vdup_n_u32(a))
+#define U(v) vget_lane_u32(vreinterpret_u32_u8(v), 0)
+#define GATHER(m) (((U(m) & 0x08040201) * 0x01010101) >> 24)
+
+static inline u32 simd_uadd8(u32 a, u32 b) {
+    return U(vadd_u8(V(a), V(b)));
+}
+static inline u32 simd_usub8(u32 a, u32 b) {
+    return U(vsub_u8(V(a), V(b)));
+}
+static inline u32 simd_uqadd8(u32 a, u32 b) {
+    return U(vqadd_u8(V(a), V(b)));
+}
+static inline u32 simd_uqsub8(u32 a, u32 b) {
+    return U(vqsub_u8(V(a), V(b)));
+}
+static inline u32 simd_uhadd8(u32 a, u32 b) {
+    return U(vhadd_u8(V(a), V(b)));
+}
+static inline u32 simd_qsub8(u32 a, u32 b) {
+    return U(vreinterpret_u8_s8(
+        vqsub_s8(vreinterpret_s8_u8(V(a)), vreinterpret_s8_u8(V(b)))));
+}
+static inline u32 simd_ge_uadd8(u32 a, u32 b) {
+    return GATHER(vcgt_u8(V(a), vadd_u8(V(a), V(b))));
+}
+static inline u32 simd_ge_usub8(u32 a, u32 b) {
+    return GATHER(vcge_u8(V(a), V(b)));
+}
+static inline u32 simd_ge_ssub8(u32 a, u32 b) {
+    return GATHER(vcge_s8(vreinterpret_s8_u8(V(a)), vreinterpret_s8_u8(V(b))));
+}
+
+#endif
+
+// sel is lowered to plain alu instructions
+static inline u32 simd_sel(u32 ge, u32 a, u32 b) {
+    u32 mask = ((ge * 0x00204081) & 0x01010101) * 0xff;
+    return (a & mask) | (b & ~mask);
+}
+
+static u32 rand32() {
+    return (u32) rand() << 16 ^ (u32) rand();
+}
+
+static bool check() {
+    bool ok = true;
+    for (int i = 0; i < 1'000'000; i++) {
+        u32 a = rand32(), b = rand32();
+        // make sure the edge cases of each byte get hit
+        if (i & 1) a = (a & 0x7f80ff00) | 0x00007f01;
+        if (i & 2) b = (b & 0x80ff7f00) | 0x0000ff80;
+        u32 ge = rand32() & 0xf;
+
+#define CHECK(name, got, expected)                                             \
+    if ((got) != (expected)) {                                                 \
+        printf("%s mismatch: %08x %08x got %08x expected %08x\n", name, a, b,  \
+               got, expected);                                                 \
+        ok = false;                                                            \
+    }
+
+        CHECK("uadd8", simd_uadd8(a, b), media_uadd8(a, b));
+        CHECK("usub8", simd_usub8(a, b), media_usub8(a, b));
+        CHECK("uqadd8", simd_uqadd8(a, b), media_uqadd8(a, b));
+        CHECK("uqsub8", simd_uqsub8(a, b), media_uqsub8(a, b));
+        CHECK("uhadd8", simd_uhadd8(a, b), media_uhadd8(a, b));
+        CHECK("qsub8", simd_qsub8(a, b), media_qsub8(a, b));
+        CHECK("ge_uadd8", simd_ge_uadd8(a, b), media_ge_uadd8(a, b));
+        CHECK("ge_usub8", simd_ge_usub8(a, b), media_ge_usub8(a, b));
+        CHECK("ge_ssub8", simd_ge_ssub8(a, b), media_ge_ssub8(a, b));
+        cpu.cpsr.ge = ge;
+        CHECK("sel", simd_sel(ge, a, b), cb_sel(&cpu, a, b));
+
+#undef CHECK
+
+        if (!ok) break;
+    }
+    return ok;
+}
+
+static volatile u32 sink;
+
+// each result feeds into the next operation so the loop is latency bound
+// like a real dependency chain in game code
+#define BENCH(expr)                                                            \
+    ({                                                                         \
+        u32 x = 0;                                                             \
+        u64 start = time_now_ns();                                             \
+        for (int it = 0; it < ITERS; it++) {                                   \
+            for (int i = 0; i < N; i++) {                                      \
+                u32 a = in_a[i] ^ x;                                           \
+                u32 b = in_b[i];                                               \
+                x = (expr);                                                    \
+            }                                                                  \
+        }                                                                      \
+        sink = x;                                                              \
+        (double) (time_now_ns() - start) / ((u64) ITERS * N);                  \
+    })
+
+int main() {
+    if (!check()) return 1;
+    printf("simd sequences match the interpreter\n\n");
+
+    for (int i = 0; i < N; i++) {
+        in_a[i] = rand32();
+        in_b[i] = rand32();
+    }
+
+    static const char* names[] = {"uadd8",  "usub8",  "ssub8", "uqadd8",
+                                  "uqsub8", "uhadd8", "qsub8", "sel"};
+    double cb[countof(names)], simd[countof(names)];
+
+    for (int op = 0; op < countof(names); op++) {
+        auto f = callbacks[op];
+        cb[op] = BENCH(f(&cpu, a, b));
+    }
+
+    simd[0] = BENCH(simd_uadd8(a, b) ^ simd_ge_uadd8(a, b));
+    simd[1] = BENCH(simd_usub8(a, b) ^ simd_ge_usub8(a, b));
+    simd[2] = BENCH(simd_usub8(a, b) ^ simd_ge_ssub8(a, b));
+    simd[3] = BENCH(simd_uqadd8(a, b));
+    simd[4] = BENCH(simd_uqsub8(a, b));
+    simd[5] = BENCH(simd_uhadd8(a, b));
+    simd[6] = BENCH(simd_qsub8(a, b));
+    simd[7] = BENCH(simd_sel(b & 0xf, a, b));
+
+    printf("%-8s %12s %12s %8s\n", "op", "callback ns", "simd ns", "speedup");
+    for (int op = 0; op < countof(names); op++) {
+        printf("%-8s %12.2f %12.2f %7.1fx\n", names[op], cb[op], simd[op],
+               cb[op] / simd[op]);
+    }
+    printf("\nuqadd8, uqsub8 and qsub8 were already lowered to simd on x86, "
+           "uhadd8 was on arm64\n");
+
+    return 0;
+}
@@ -0,0 +1,187 @@
+#define _GNU_SOURCE
+#include <linux/perf_event.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "common.h"
+
+// benchmark for the backing of guest memory, mapped the same way as
+// memory_init does with fastmem: a memfd viewed through a fixed window in a
+// reserved 4gb region
+// each mode runs the same access patterns, texture hashing (sequential reads
+// of whole textures at random places), dma (memcpy between random places) and
+// vertex loading (random small reads), and counts dTLB load misses
+// huge pages for a memfd need shmem thp set to advise or always in
+// /sys/kernel/mm/transparent_hugepage/shmem_enabled, "pmd mapped" shows how
+// much of the window actually ended up mapped with huge pages
+// dTLB misses need perf_event_paranoid <= 2
+
+#define MEM_SIZE (128 * BIT(20))
+#define WINDOW_BASE 0x2000'0000
+#define TEX_SIZE (256 * BIT(10))
+#define DMA_SIZE (64 * BIT(10))
+#define ITERS 2000
+#define VTX_LOADS BIT(22)
+
+typedef struct {
+    const char* name;
+    bool huge;
+    bool prefault;
+} Mode;
+
+static const Mode modes[] = {
+    {"4k", false, false},
+    {"4k+pf", false, true},
+    {"thp", true, false},
+    {"thp+pf", true, true},
+};
+
+static int perf_fd = -1;
+
+static void perf_open() {
+    struct perf_event_attr attr = {
+        .type = PERF_TYPE_HW_CACHE,
+        .size = sizeof attr,
+        .config = PERF_COUNT_HW_CACHE_DTLB |
+                  PERF_COUNT_HW_CACHE_OP_READ << 8 |
+                  PERF_COUNT_HW_CACHE_RESULT_MISS << 16,
+        .disabled = 1,
+        .exclude_kernel = 1,
+        .exclude_hv = 1,
+    };
+    perf_fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static void perf_start() {
+    if (perf_fd < 0) return;
+    ioctl(perf_fd, PERF_EVENT_IOC_RESET, 0);
+    ioctl(perf_fd, PERF_EVENT_IOC_ENABLE, 0);
+}
+
+static s64 perf_stop() {
+    if (perf_fd < 0) return -1;
+    ioctl(perf_fd, PERF_EVENT_IOC_DISABLE, 0);
+    s64 count;
+    if (read(perf_fd, &count, sizeof count) != sizeof count) return -1;
+    return count;
+}
+
+// kb of shmem in this process mapped with pmds
+static long shmem_pmd_kb() {
+    FILE* fp = fopen("/proc/self/smaps_rollup", "r");
+    if (!fp) return -1;
+    char line[256];
+    long kb = -1;
+    while (fgets(line, sizeof line, fp)) {
+        if (sscanf(line, "ShmemPmdMapped: %ld kB", &kb) == 1) break;
+    }
+    fclose(fp);
+    return kb;
+}
+
+static u32 rng = 1;
+
+static u32 rand32() {
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    return rng;
+}
+
+static volatile u64 sink;
+
+static u64 run_textures(u8* mem) {
+    u64 hash = 0;
+    for (int i = 0; i < ITERS; i++) {
+        u64* tex = (u64*) &mem[(rand32() % (MEM_SIZE / TEX_SIZE)) * TEX_SIZE];
+        for (int j = 0; j < TEX_SIZE / 8; j++) {
+            hash = (hash ^ tex[j]) * 0x100'0000'01b3;
+        }
+    }
+    return hash;
+}
+
+static u64 run_dma(u8* mem) {
+    for (int i = 0; i < ITERS * 4; i++) {
+        u32 src = rand32() % (MEM_SIZE - DMA_SIZE) & ~15;
+        u32 dst = rand32() % (MEM_SIZE - DMA_SIZE) & ~15;
+        memmove(&mem[dst], &mem[src], DMA_SIZE);
+    }
+    return mem[0];
+}
+
+static u64 run_vertices(u8* mem) {
+    u64 sum = 0;
+    for (int i = 0; i < VTX_LOADS; i++) {
+        u32 addr = rand32() % (MEM_SIZE - 16) & ~3;
+        sum += *(u32*) &mem[addr] + *(u32*) &mem[addr + 12];
+    }
+    return sum;
+}
+
+static void bench(const char* name, u64 (*f)(u8*), u8* mem) {
+    rng = 1;
+    perf_start();
+    u64 start = time_now_ns();
+    sink = f(mem);
+    u64 ns = time_now_ns() - start;
+    s64 misses = perf_stop();
+    printf("  %-10s %10.2f ms ", name, ns / 1e6);
+    if (misses < 0) printf("%14s\n", "n/a");
+    else printf("%14lld\n", (long long) misses);
+}
+
+int main() {
+    perf_open();
+    if (perf_fd < 0) printf("dTLB miss counter not available\n\n");
+
+    for (int m = 0; m < countof(modes); m++) {
+        const Mode* mode = &modes[m];
+
+        u64 start = time_now_ns();
+        int fd = memfd_create("membench", 0);
+        if (fd < 0 || ftruncate(fd, MEM_SIZE) < 0) {
+            perror("memfd_create");
+            return 1;
+        }
+        u8* region = mmap(nullptr, BITL(32), PROT_NONE,
+                          MAP_PRIVATE | MAP_ANON | MAP_NORESERVE, -1, 0);
+        u8* mem = mmap(&region[WINDOW_BASE], MEM_SIZE, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_FIXED, fd, 0);
+        if (region == MAP_FAILED || mem == MAP_FAILED) {
+            perror("mmap");
+            return 1;
+        }
+        if (mode->huge && madvise(mem, MEM_SIZE, MADV_HUGEPAGE) < 0) {
+            perror("madvise");
+        }
+        if (mode->prefault) {
+            for (u32 i = 0; i < MEM_SIZE; i += BIT(12)) {
+                ((volatile u8*) mem)[i] = 0;
+            }
+        }
+        double setup = (time_now_ns() - start) / 1e6;
+
+        // fill with something so hashing is not all zeros
+        for (u32 i = 0; i < MEM_SIZE / 4; i += 1024) {
+            ((u32*) mem)[i] = i;
+        }
+
+        printf("%s: setup %.2f ms, pmd mapped %ld kb\n", mode->name, setup,
+               shmem_pmd_kb());
+        printf("  %-10s %13s %14s\n", "", "time", "dTLB misses");
+        bench("texture", run_textures, mem);
+        bench("dma", run_dma, mem);
+        bench("vertex", run_vertices, mem);
+        printf("\n");
+
+        munmap(region, BITL(32));
+        close(fd);
+    }
+
+    return 0;
+}
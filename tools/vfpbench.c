@@ -0,0 +1,127 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "common.h"
+
+// micro benchmark for how the jit backends run single precision vfp ops
+// float values used to live in general purpose registers like every other ir
+// value, so each op moved its operands into simd registers and the result
+// back ("gpr"), now values only used by float ops stay in simd registers
+// across the block ("simd")
+// these are c versions of both sequences, not code emitted by the jit
+
+#define N 4096
+#define ITERS 4000
+
+#ifdef __x86_64__
+#define IN_SIMD "+x"
+#else
+#define IN_SIMD "+w"
+#endif
+
+// the empty asm pins a value to a register class so the compiler can't skip
+// the moves or vectorize the loop
+#define GPR(x) asm volatile("" : "+r"(x))
+#define SIMD(x) asm volatile("" : IN_SIMD(x))
+
+static float in_a[N], in_b[N];
+
+// one op of the gpr lowering, operands and result live in gprs
+#define GPR_OP(op, x, y)                                                       \
+    ({                                                                         \
+        u32 _x = (x), _y = (y);                                                \
+        GPR(_x);                                                               \
+        GPR(_y);                                                               \
+        u32 _r = F2I(I2F(_x) op I2F(_y));                                      \
+        GPR(_r);                                                               \
+        _r;                                                                    \
+    })
+
+static volatile float sink;
+
+// vmla, each accumulate depends on the last so this is latency bound
+static double bench_mla_gpr() {
+    u32 acc = 0;
+    u64 start = time_now_ns();
+    for (int it = 0; it < ITERS; it++) {
+        for (int i = 0; i < N; i++) {
+            u32 p = GPR_OP(*, F2I(in_a[i]), F2I(in_b[i]));
+            acc = GPR_OP(+, acc, p);
+        }
+    }
+    sink = I2F(acc);
+    return (double) (time_now_ns() - start) / ((u64) ITERS * N);
+}
+
+static double bench_mla_simd() {
+    float acc = 0;
+    u64 start = time_now_ns();
+    for (int it = 0; it < ITERS; it++) {
+        for (int i = 0; i < N; i++) {
+            float p = in_a[i] * in_b[i];
+            SIMD(p);
+            acc += p;
+            SIMD(acc);
+        }
+    }
+    sink = acc;
+    return (double) (time_now_ns() - start) / ((u64) ITERS * N);
+}
+
+// a row of a vertex transform, the 4 multiplies are independent so this is
+// more throughput bound
+static double bench_dot_gpr() {
+    u32 sum = 0;
+    u64 start = time_now_ns();
+    for (int it = 0; it < ITERS; it++) {
+        for (int i = 0; i < N; i += 4) {
+            u32 r = GPR_OP(*, F2I(in_a[i]), F2I(in_b[i]));
+            for (int j = 1; j < 4; j++) {
+                u32 p = GPR_OP(*, F2I(in_a[i + j]), F2I(in_b[i + j]));
+                r = GPR_OP(+, r, p);
+            }
+            sum ^= r;
+        }
+    }
+    sink = I2F(sum);
+    return (double) (time_now_ns() - start) / ((u64) ITERS * (N / 4));
+}
+
+static double bench_dot_simd() {
+    u32 sum = 0;
+    u64 start = time_now_ns();
+    for (int it = 0; it < ITERS; it++) {
+        for (int i = 0; i < N; i += 4) {
+            float r = in_a[i] * in_b[i];
+            SIMD(r);
+            for (int j = 1; j < 4; j++) {
+                float p = in_a[i + j] * in_b[i + j];
+                SIMD(p);
+                r += p;
+                SIMD(r);
+            }
+            sum ^= F2I(r);
+        }
+    }
+    sink = I2F(sum);
+    return (double) (time_now_ns() - start) / ((u64) ITERS * (N / 4));
+}
+
+int main() {
+    for (int i = 0; i < N; i++) {
+        in_a[i] = (float) rand() / RAND_MAX;
+        in_b[i] = (float) rand() / RAND_MAX;
+    }
+
+    static const char* names[] = {"vmla", "dot4"};
+    double gpr[] = {bench_mla_gpr(), bench_dot_gpr()};
+    double simd[] = {bench_mla_simd(), bench_dot_simd()};
+
+    printf("%-8s %12s %12s %8s\n", "op", "gpr ns", "simd ns", "speedup");
+    for (int op = 0; op < countof(names); op++) {
+        printf("%-8s %12.2f %12.2f %7.2fx\n", names[op], gpr[op], simd[op],
+               gpr[op] / simd[op]);
+    }
+
+    return 0;
+}